@@ -21,6 +21,7 @@ class C_AI_BaseNPC : public C_BaseCombatCharacter
 
 public:
 	DECLARE_CLIENTCLASS();
+	ALLOW_PARALLEL_BONE_SETUP( C_AI_BaseNPC );
 
 	C_AI_BaseNPC();
 	virtual unsigned int	PhysicsSolidMaskForEntity( void ) const { return MASK_NPCSOLID; }
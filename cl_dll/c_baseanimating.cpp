@@ -28,6 +28,8 @@
 #include <KeyValues.h>
 #include "c_rope.h"
 #include "isaverestore.h"
+#include "cliententitylist.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -102,6 +104,7 @@ C_BaseAnimating::C_BaseAnimating()
 	m_lastPhysicsBone = 0;
 	m_iMostRecentModelBoneCounter = 0xFFFFFFFF;
 	m_CachedBoneFlags = 0;
+	m_pBoneSetupStudioHdr = NULL;
 
 	m_vecPreRagdollMins = vec3_origin;
 	m_vecPreRagdollMaxs = vec3_origin;
@@ -234,6 +237,9 @@ studiohdr_t *C_BaseAnimating::OnNewModel()
 
 studiohdr_t* C_BaseAnimating::GetModelPtr()
 { 
+	if ( m_pBoneSetupStudioHdr )
+		return m_pBoneSetupStudioHdr;
+
 	if ( !GetModel() )
 		return NULL;
 
@@ -966,15 +972,8 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 		return false;
 	}
 
-	if( m_iMostRecentModelBoneCounter != g_iModelBoneCounter )
-	{
-		// Clear out which bones we've touched this frame if this is 
-		// the first time we've seen this object this frame.
-		m_CachedBoneFlags = 0;
-	}
-
 	// Have we cached off all bones meeting the flag set?
-	if( ( m_CachedBoneFlags & boneMask ) != boneMask )
+	if( NeedsBoneSetup( boneMask ) )
 	{
 		MEASURE_TIMED_STAT( CS_BONE_SETUP_TIME );
 
@@ -989,21 +988,15 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 		}
 		else
 		{
-			if (!m_pIk)
-				m_pIk = new CIKContext;
-
 			Vector		pos[MAXSTUDIOBONES];
 			Quaternion	q[MAXSTUDIOBONES];
 
-			m_pIk->Init( hdr, GetRenderAngles(), GetRenderOrigin(), currentTime );
+			BeginBoneSetup( hdr, currentTime );
 
 			int bonesMaskNeedRecalc = boneMask & ~m_CachedBoneFlags;
 			StandardBlendingRules( pos, q, currentTime, bonesMaskNeedRecalc );
 
-			CalculateIKLocks( currentTime );
-			m_pIk->SolveDependencies( pos, q );
-
-			BuildTransformations( pos, q, parentTransform );
+			FinishBoneSetup( pos, q, currentTime, parentTransform );
 		}
 		if( !( m_CachedBoneFlags & BONE_USED_BY_ATTACHMENT ) && ( boneMask & BONE_USED_BY_ATTACHMENT ) )
 		{
@@ -1036,6 +1029,238 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if any of the bones in the mask still have to be set up this frame
+//-----------------------------------------------------------------------------
+bool C_BaseAnimating::NeedsBoneSetup( int boneMask )
+{
+	if( m_iMostRecentModelBoneCounter != g_iModelBoneCounter )
+	{
+		// Clear out which bones we've touched this frame if this is 
+		// the first time we've seen this object this frame.
+		m_CachedBoneFlags = 0;
+	}
+
+	return ( m_CachedBoneFlags & boneMask ) != boneMask;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Bone setup is split around StandardBlendingRules, which only poses the
+//			bones and may run on a worker thread.  The IK traces and the bone to
+//			world transforms before and after it always run on the main thread.
+//-----------------------------------------------------------------------------
+void C_BaseAnimating::BeginBoneSetup( studiohdr_t *hdr, float currentTime )
+{
+	if (!m_pIk)
+		m_pIk = new CIKContext;
+
+	m_pIk->Init( hdr, GetRenderAngles(), GetRenderOrigin(), currentTime );
+}
+
+void C_BaseAnimating::FinishBoneSetup( Vector pos[], Quaternion q[], float currentTime, const matrix3x4_t &parentTransform )
+{
+	CalculateIKLocks( currentTime );
+	m_pIk->SolveDependencies( pos, q );
+
+	BuildTransformations( pos, q, parentTransform );
+}
+
+struct ParallelBoneSetup_t
+{
+	C_BaseAnimating	*m_pEntity;
+	int				m_nBoneMask;
+	float			m_flCurrentTime;
+	Vector			m_Pos[MAXSTUDIOBONES];
+	Quaternion		m_Q[MAXSTUDIOBONES];
+};
+
+static CUtlVector< ParallelBoneSetup_t > g_ParallelBoneSetup;
+
+void C_BaseAnimating::ProcessParallelBoneSetup( void *pContext, int iItem )
+{
+	ParallelBoneSetup_t *pSetup = (ParallelBoneSetup_t *)pContext + iItem;
+	pSetup->m_pEntity->StandardBlendingRules( pSetup->m_Pos, pSetup->m_Q, pSetup->m_flCurrentTime, pSetup->m_nBoneMask );
+}
+
+// (static function)
+void C_BaseAnimating::SetupBonesInParallel( C_BaseAnimating **ppEntities, int nEntities, float currentTime, bool bThreaded )
+{
+	VPROF_BUDGET( "C_BaseAnimating::SetupBonesInParallel", VPROF_BUDGETGROUP_OTHER_ANIMATION );
+
+	int boneMask = BONE_USED_BY_ANYTHING;
+	g_ParallelBoneSetup.RemoveAll();
+
+	int i;
+	for ( i = 0; i < nEntities; i++ )
+	{
+		C_BaseAnimating *pEntity = ppEntities[i];
+		if ( !pEntity->IsBoneAccessAllowed() || !pEntity->CanSetupBonesInParallel() )
+			continue;
+
+		studiohdr_t *hdr = pEntity->GetModelPtr();
+		if ( !hdr || ( hdr->flags & STUDIOHDR_FLAGS_STATIC_PROP ) )
+			continue;
+
+		if ( !pEntity->NeedsBoneSetup( boneMask ) )
+			continue;
+
+		// Anything that goes through the engine happens here, before the workers start
+		Studio_LoadSharedAnimations( hdr );
+		pEntity->BeginBoneSetup( hdr, currentTime );
+		pEntity->m_pBoneSetupStudioHdr = hdr;
+
+		int j = g_ParallelBoneSetup.AddToTail();
+		g_ParallelBoneSetup[j].m_pEntity = pEntity;
+		g_ParallelBoneSetup[j].m_nBoneMask = boneMask & ~pEntity->m_CachedBoneFlags;
+		g_ParallelBoneSetup[j].m_flCurrentTime = currentTime;
+	}
+
+	int nSetup = g_ParallelBoneSetup.Count();
+	if ( bThreaded )
+	{
+		Plat_ParallelProcess( ProcessParallelBoneSetup, g_ParallelBoneSetup.Base(), nSetup );
+	}
+	else
+	{
+		for ( i = 0; i < nSetup; i++ )
+		{
+			ProcessParallelBoneSetup( g_ParallelBoneSetup.Base(), i );
+		}
+	}
+
+	for ( i = 0; i < nSetup; i++ )
+	{
+		g_ParallelBoneSetup[i].m_pEntity->m_pBoneSetupStudioHdr = NULL;
+	}
+
+	for ( i = 0; i < nSetup; i++ )
+	{
+		ParallelBoneSetup_t *pSetup = &g_ParallelBoneSetup[i];
+		C_BaseAnimating *pEntity = pSetup->m_pEntity;
+
+		// Following an entity sets it up first, which may already have happened through SetupBones
+		if ( !pEntity->NeedsBoneSetup( boneMask ) )
+			continue;
+
+		matrix3x4_t parentTransform;
+		AngleMatrix( pEntity->GetRenderAngles(), pEntity->GetRenderOrigin(), parentTransform );
+		pEntity->FinishBoneSetup( pSetup->m_Pos, pSetup->m_Q, currentTime, parentTransform );
+
+		if( !( pEntity->m_CachedBoneFlags & BONE_USED_BY_ATTACHMENT ) && ( boneMask & BONE_USED_BY_ATTACHMENT ) )
+		{
+			pEntity->SetupBones_AttachmentHelper();
+		}
+
+		pEntity->m_iMostRecentModelBoneCounter = g_iModelBoneCounter;
+		pEntity->m_CachedBoneFlags |= boneMask;
+	}
+}
+
+static float MaxBoneDifference( const matrix3x4_t &bone1, const matrix3x4_t &bone2 )
+{
+	float flMaxDiff = 0.0f;
+	for ( int i = 0; i < 3; i++ )
+	{
+		for ( int j = 0; j < 4; j++ )
+		{
+			flMaxDiff = max( flMaxDiff, fabs( bone1[i][j] - bone2[i][j] ) );
+		}
+	}
+	return flMaxDiff;
+}
+
+static int CachedBoneCount( C_BaseAnimating *pAnimating )
+{
+	studiohdr_t *hdr = pAnimating->GetModelPtr();
+	return hdr ? hdr->numbones : 0;
+}
+
+CON_COMMAND( cl_bone_setup_benchmark, "Times setting up the bones of every animating entity serially and on worker threads: cl_bone_setup_benchmark [iterations]" )
+{
+	int nIterations = 100;
+	if ( engine->Cmd_Argc() > 1 )
+	{
+		nIterations = max( atoi( engine->Cmd_Argv( 1 ) ), 1 );
+	}
+
+	CUtlVector< C_BaseAnimating * > entities;
+	for ( C_BaseEntity *pEnt = ClientEntityList().FirstBaseEntity(); pEnt; pEnt = ClientEntityList().NextBaseEntity( pEnt ) )
+	{
+		if ( pEnt->IsDormant() )
+			continue;
+
+		C_BaseAnimating *pAnimating = dynamic_cast< C_BaseAnimating * >( pEnt );
+		if ( pAnimating && pAnimating->CanSetupBonesInParallel() )
+		{
+			entities.AddToTail( pAnimating );
+		}
+	}
+
+	if ( entities.Count() == 0 )
+	{
+		Msg( "cl_bone_setup_benchmark: no animating entities\n" );
+		return;
+	}
+
+	C_BaseAnimating::PushAllowBoneAccess( true, false );
+
+	// The first pass settles sequence transitions, so both timed runs start from the same state
+	C_BaseAnimating::InvalidateBoneCaches();
+	C_BaseAnimating::SetupBonesInParallel( entities.Base(), entities.Count(), gpGlobals->curtime, false );
+
+	double flSerial = 0.0f;
+	double flThreaded = 0.0f;
+	CUtlVector< matrix3x4_t > serialBones;
+
+	for ( int bThreaded = 0; bThreaded < 2; bThreaded++ )
+	{
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nIterations; i++ )
+		{
+			C_BaseAnimating::InvalidateBoneCaches();
+			C_BaseAnimating::SetupBonesInParallel( entities.Base(), entities.Count(), gpGlobals->curtime, bThreaded != 0 );
+		}
+		double flElapsed = Plat_FloatTime() - flStart;
+
+		if ( !bThreaded )
+		{
+			flSerial = flElapsed;
+			for ( int j = 0; j < entities.Count(); j++ )
+			{
+				for ( int k = 0; k < CachedBoneCount( entities[j] ); k++ )
+				{
+					entities[j]->GetCachedBoneMatrix( k, serialBones[ serialBones.AddToTail() ] );
+				}
+			}
+		}
+		else
+		{
+			flThreaded = flElapsed;
+		}
+	}
+
+	float flMaxDiff = 0.0f;
+	int iBone = 0;
+	for ( int j = 0; j < entities.Count(); j++ )
+	{
+		for ( int k = 0; k < CachedBoneCount( entities[j] ); k++ )
+		{
+			matrix3x4_t bone;
+			entities[j]->GetCachedBoneMatrix( k, bone );
+			flMaxDiff = max( flMaxDiff, MaxBoneDifference( serialBones[iBone++], bone ) );
+		}
+	}
+
+	C_BaseAnimating::PopBoneAccess();
+	C_BaseAnimating::InvalidateBoneCaches();
+
+	float flSerialMs = flSerial * 1000.0f / nIterations;
+	float flThreadedMs = flThreaded * 1000.0f / nIterations;
+	Msg( "%d entities on %d threads: serial %.3f ms, threaded %.3f ms per frame (%.2fx), max bone difference %f\n",
+		entities.Count(), Plat_GetParallelThreadCount(), flSerialMs, flThreadedMs, 
+		flThreadedMs > 0.0f ? flSerialMs / flThreadedMs : 0.0f, flMaxDiff );
+}
+
 
 C_BaseAnimating* C_BaseAnimating::FindFollowedEntity()
 {
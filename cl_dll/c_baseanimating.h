@@ -24,8 +24,16 @@
 // Shared activities
 #include "ai_activity.h"
 #include "animationlayer.h"
+#include <typeinfo>
 
 #define LIPSYNC_POSEPARAM_NAME "mouth"
+
+// Lets SetupBonesInParallel run StandardBlendingRules for this class on a worker
+// thread.  Only use it once StandardBlendingRules, and everything it calls, has been
+// checked to touch nothing but the entity and its model.  It covers exactly this
+// class, subclasses have to be checked and opted in on their own.
+#define ALLOW_PARALLEL_BONE_SETUP( className ) \
+	virtual bool CanSetupBonesInParallel() { return typeid( *this ) == typeid( className ); }
 /*
 class C_BaseClientShader
 {
@@ -252,6 +260,14 @@ public:
 	// Invalidate bone caches so all SetupBones() calls force bone transforms to be regenerated.
 	static void						InvalidateBoneCaches();
 
+	// Sets up the bones of a batch of entities ahead of drawing.  Their poses are evaluated
+	// on worker threads if bThreaded, the rest of the setup stays on this thread.  Entities
+	// that are already set up this frame, or can't be set up this way, are left to SetupBones.
+	static void						SetupBonesInParallel( C_BaseAnimating **ppEntities, int nEntities, float currentTime, bool bThreaded );
+
+	// True if StandardBlendingRules can run on a worker thread, see ALLOW_PARALLEL_BONE_SETUP
+	ALLOW_PARALLEL_BONE_SETUP( C_BaseAnimating );
+
 	// Purpose: My physics object has been updated, react or extract data
 	virtual void					VPhysicsUpdate( IPhysicsObject *pPhysics );
 
@@ -361,6 +377,15 @@ private:
 	float							m_flOldCycle;
 	void							SetupBones_AttachmentHelper();
 
+	bool							NeedsBoneSetup( int boneMask );
+	void							BeginBoneSetup( studiohdr_t *hdr, float currentTime );
+	void							FinishBoneSetup( Vector pos[], Quaternion q[], float currentTime, const matrix3x4_t &parentTransform );
+	static void						ProcessParallelBoneSetup( void *pContext, int iItem );
+
+	// Returned by GetModelPtr while the pose is evaluated on a worker thread, which
+	// can't go through the model cache
+	studiohdr_t						*m_pBoneSetupStudioHdr;
+
 // For prediction
 public:
 	int								SelectWeightedSequence ( int activity );
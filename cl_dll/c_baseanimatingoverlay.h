@@ -17,6 +17,7 @@ public:
 
 	// model specific
 	virtual	void	StandardBlendingRules( Vector pos[], Quaternion q[], float currentTime, int boneMask );
+	ALLOW_PARALLEL_BONE_SETUP( C_BaseAnimatingOverlay );
 
 	enum
 	{
@@ -24,6 +24,7 @@ class C_BaseCombatCharacter : public C_BaseFlex
 public:
 	DECLARE_CLIENTCLASS();
 	DECLARE_PREDICTABLE();
+	ALLOW_PARALLEL_BONE_SETUP( C_BaseCombatCharacter );
 
 					C_BaseCombatCharacter( void );
 	virtual			~C_BaseCombatCharacter( void );
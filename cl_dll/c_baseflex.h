@@ -39,6 +39,7 @@ public:
 	DECLARE_CLIENTCLASS();
 	DECLARE_PREDICTABLE();
 	DECLARE_INTERPOLATION();
+	ALLOW_PARALLEL_BONE_SETUP( C_BaseFlex );
 
 					C_BaseFlex();
 	virtual			~C_BaseFlex();
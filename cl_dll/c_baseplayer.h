@@ -49,6 +49,7 @@ public:
 	DECLARE_CLIENTCLASS();
 	DECLARE_PREDICTABLE();
 	DECLARE_INTERPOLATION();
+	ALLOW_PARALLEL_BONE_SETUP( C_BasePlayer );
 
 	C_BasePlayer();
 	virtual			~C_BasePlayer();
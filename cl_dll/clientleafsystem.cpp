@@ -22,10 +22,22 @@
 #include "tier0/vprof.h"
 #include "DetailObjectSystem.h"
 #include "engine/IStaticPropMgr.h"
+#include <xmmintrin.h>
 
 
 static ConVar cl_drawleaf("cl_drawleaf", "-1");
 static ConVar r_PortalTestEnts( "r_PortalTestEnts", "0", 0, "Clip entities against portal frustums." );
+static ConVar r_StaticPropLists( "r_StaticPropLists", "1", 0, "Collate static props from per-leaf arrays, culling them against the view frustum." );
+
+
+//-----------------------------------------------------------------------------
+// World space bounds of 4 static props, laid out for the SSE frustum test
+//-----------------------------------------------------------------------------
+struct StaticPropBounds_t
+{
+	float	m_Mins[3][4];
+	float	m_Maxs[3][4];
+};
 		    
 //-----------------------------------------------------------------------------
 // The client leaf system
@@ -117,6 +129,16 @@ private:
 	void InsertIntoTree( ClientRenderHandle_t handle );
 	void RemoveFromTree( ClientRenderHandle_t handle );
 
+	// Computes a world-aligned box around the renderable
+	void ComputeAbsBounds( IClientRenderable *pRenderable, Vector &absMins, Vector &absMaxs );
+
+	// Rebuilds the per-leaf static prop arrays
+	void BuildStaticPropLists();
+	void MarkStaticPropListsDirty( ClientRenderHandle_t handle );
+
+	// Adds the static props in a leaf to the render list
+	void CollateStaticPropsInLeaf( int leaf, int worldListLeafIndex, SetupRenderInfo_t &info );
+
 	// Insert translucent renderables into list of translucent objects
 	void InsertTranslucentRenderable( IClientRenderable* pRenderable,
 		int& count, IClientRenderable** pList, float* pDist );
@@ -204,6 +226,11 @@ private:
 		unsigned short	m_FirstDetailProp;
 		unsigned short	m_DetailPropCount;
 		int				m_DetailPropRenderFrame;
+
+		// Static props never move, so they also get a flat array
+		// in m_StaticPropsInLeaves, starting on a multiple of 4
+		int				m_FirstStaticProp;
+		unsigned short	m_StaticPropCount;
 	};
 
 	// Shadow information
@@ -223,6 +250,10 @@ private:
 		Vector					m_Maxs;
 	};
 
+	// Adds a single renderable that passed the early outs to the render list
+	void CollateRenderable( RenderableInfo_t &renderable, ClientRenderHandle_t handle,
+		const Vector &mins, const Vector &maxs, int leaf, int worldListLeafIndex, SetupRenderInfo_t &info );
+
 	// Stores data associated with each leaf.
 	CUtlVector< ClientLeaf_t >	m_Leaf;
 
@@ -244,6 +275,12 @@ private:
 	// Cached rendering info
 	CUtlLinkedList< CCachedRenderInfo, unsigned short >		m_CachedRenderInfos;
 
+	// The static props of every leaf, plus their bounds for each 4 of them.
+	// Rebuilt whenever a static prop is inserted into or removed from the tree
+	CUtlVector< ClientRenderHandle_t >	m_StaticPropsInLeaves;
+	CUtlVector< StaticPropBounds_t >	m_StaticPropBounds;
+	bool m_bStaticPropListsDirty;
+
 	// Should I draw static props?
 	bool m_DrawStaticProps;
 	bool m_DrawSmallObjects;
@@ -264,7 +301,7 @@ EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CClientLeafSystem, IClientLeafSystem, CLIENTL
 //-----------------------------------------------------------------------------
 // constructor, destructor
 //-----------------------------------------------------------------------------
-CClientLeafSystem::CClientLeafSystem() : m_DrawStaticProps(true), m_DrawSmallObjects(true)
+CClientLeafSystem::CClientLeafSystem() : m_DrawStaticProps(true), m_DrawSmallObjects(true), m_bStaticPropListsDirty(true)
 {
 	// Set up the bi-directional lists...
 	m_RenderablesInLeaf.Init( FirstRenderableInLeaf, FirstLeafInRenderable );
@@ -310,6 +347,8 @@ void CClientLeafSystem::LevelInitPreEntity()
 	newLeaf.m_FirstDetailProp = 0;
 	newLeaf.m_DetailPropCount = 0;
 	newLeaf.m_DetailPropRenderFrame = -1;
+	newLeaf.m_FirstStaticProp = 0;
+	newLeaf.m_StaticPropCount = 0;
 	while ( --leafCount >= 0 )
 	{
 		m_Leaf.AddToTail( newLeaf );
@@ -328,6 +367,9 @@ void CClientLeafSystem::LevelShutdownPostEntity()
 	m_Leaf.Purge();
 	m_ShadowsInLeaf.Purge();
 	m_ShadowsOnRenderable.Purge();
+	m_StaticPropsInLeaves.Purge();
+	m_StaticPropBounds.Purge();
+	m_bStaticPropListsDirty = true;
 }
 
 
@@ -713,6 +755,8 @@ void CClientLeafSystem::AddRenderableToLeaves( ClientRenderHandle_t handle, int
 		AddRenderableToLeaf( pLeaves[j], handle ); 
 	}
 	m_Renderables[handle].m_Area = GetRenderableArea( handle );
+
+	MarkStaticPropListsDirty( handle );
 }
 
 
@@ -726,22 +770,16 @@ bool CClientLeafSystem::EnumerateLeaf( int leaf, int context )
 	return true;
 }
 
-void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t handle )
+void CClientLeafSystem::ComputeAbsBounds( IClientRenderable *pRenderable, Vector &absMins, Vector &absMaxs )
 {
-	// When we insert into the tree, increase the shadow enumerator
-	// to make sure each shadow is added exactly once to each renderable
-	++m_ShadowEnum;
-
 	Vector mins, maxs;
 
 	// NOTE: The render bounds here are relative to the renderable's coordinate system
-	IClientRenderable* pRenderable = m_Renderables[handle].m_pRenderable;
 	pRenderable->GetRenderBounds( mins, maxs );
 
 	// FIXME: Should I just use a sphere here?
 	// Another option is to pass the OBB down the tree; makes for a better fit
 	// Generate a world-aligned AABB
-	Vector absMins, absMaxs;
 	const QAngle& angles = pRenderable->GetRenderAngles();
 	if (angles == vec3_angle)
 	{
@@ -755,12 +793,24 @@ void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t handle )
 		TransformAABB( boxToWorld, mins, maxs, absMins, absMaxs );
 	}
 	Assert( absMins.IsValid() && absMaxs.IsValid() );
+}
+
+void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t handle )
+{
+	// When we insert into the tree, increase the shadow enumerator
+	// to make sure each shadow is added exactly once to each renderable
+	++m_ShadowEnum;
+
+	Vector absMins, absMaxs;
+	ComputeAbsBounds( m_Renderables[handle].m_pRenderable, absMins, absMaxs );
 
 	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
 	pQuery->EnumerateLeavesInBox( absMins, absMaxs, this, handle );
 
 	// Cache off the area it's sitting in.
 	m_Renderables[handle].m_Area = GetRenderableArea( handle );
+
+	MarkStaticPropListsDirty( handle );
 }
 
 //-----------------------------------------------------------------------------
@@ -769,6 +819,7 @@ void CClientLeafSystem::InsertIntoTree( ClientRenderHandle_t handle )
 void CClientLeafSystem::RemoveFromTree( ClientRenderHandle_t handle )
 {
 	m_RenderablesInLeaf.RemoveElement( handle );
+	MarkStaticPropListsDirty( handle );
 
 	// Remove all shadows cast onto the object
 	m_ShadowsOnRenderable.RemoveBucket( handle );
@@ -994,8 +1045,244 @@ void CClientLeafSystem::CollateRenderablesInViewModelRenderGroup( CUtlVector< IC
 	}
 }
 
+void CClientLeafSystem::CollateRenderable( RenderableInfo_t &renderable, ClientRenderHandle_t handle,
+	const Vector &mins, const Vector &maxs, int leaf, int worldListLeafIndex, SetupRenderInfo_t &info )
+{
+	// If the renderable is inside an area, cull it using the frustum for that area.
+	if ( r_PortalTestEnts.GetInt() )
+	{
+		if ( renderable.m_Area != -1 )
+		{
+			if ( !engine->DoesBoxTouchAreaFrustum( mins, maxs, renderable.m_Area ) )
+				return;
+		}
+	}
+
+#ifdef TF2_CLIENT_DLL
+	if (info.m_flRenderDistSq != 0.0f)
+	{
+		if ((maxs.z - mins.z) < 100)
+		{
+			Vector vCenter;
+			VectorLerp( mins, maxs, 0.5f, vCenter );
+
+			float flDistSq = info.m_vecRenderOrigin.DistToSqr( vCenter );
+			if (info.m_flRenderDistSq <= flDistSq)
+				return;
+		}
+	}
+#endif
+
+	if( renderable.m_RenderGroup == RENDER_GROUP_TRANSLUCENT_ENTITY )
+	{
+		// Translucent entities already have had ComputeTranslucentRenderLeaf called on them
+		// so m_RenderLeaf should be set to the nearest leaf, so that's what we want here.
+		if( renderable.m_RenderLeaf == leaf )
+		{
+			if( renderable.m_pRenderable->LODTest() )
+			{
+				bool twoPass = (renderable.m_Flags & RENDER_FLAGS_TWOPASS) != 0; 
+				AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+					worldListLeafIndex, (RenderGroup_t)renderable.m_RenderGroup, handle, twoPass );
+
+				// Add to both lists if it's a two-pass model... 
+				if (twoPass)
+				{
+					AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+						worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, handle, twoPass );
+				}
+			}
+		}
+	}
+	else
+	{
+		// Don't hit the same ent in multiple leaves twice.
+		if( renderable.m_pRenderable->LODTest() )
+		{
+			AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
+				worldListLeafIndex, (RenderGroup_t)renderable.m_RenderGroup, handle);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Static prop lists
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::MarkStaticPropListsDirty( ClientRenderHandle_t handle )
+{
+	if (m_Renderables[handle].m_Flags & RENDER_FLAGS_STATIC_PROP)
+	{
+		m_bStaticPropListsDirty = true;
+	}
+}
+
+void CClientLeafSystem::BuildStaticPropLists()
+{
+	m_StaticPropsInLeaves.RemoveAll();
+	m_StaticPropBounds.RemoveAll();
+
+	for ( int leaf = 0; leaf < m_Leaf.Count(); ++leaf )
+	{
+		ClientLeaf_t &leafInfo = m_Leaf[leaf];
+		leafInfo.m_FirstStaticProp = m_StaticPropsInLeaves.Count();
+
+		unsigned short idx = m_RenderablesInLeaf.FirstElement(leaf);
+		for ( ;idx != m_RenderablesInLeaf.InvalidIndex(); idx = m_RenderablesInLeaf.NextElement(idx) )
+		{
+			ClientRenderHandle_t handle = m_RenderablesInLeaf.Element(idx);
+			RenderableInfo_t& renderable = m_Renderables[handle];
+			if ( !(renderable.m_Flags & RENDER_FLAGS_STATIC_PROP) )
+				continue;
+
+			int i = m_StaticPropsInLeaves.AddToTail( handle );
+			if ( (i & 3) == 0 )
+			{
+				int j = m_StaticPropBounds.AddToTail();
+				memset( &m_StaticPropBounds[j], 0, sizeof(StaticPropBounds_t) );
+			}
+
+			Vector absMins, absMaxs;
+			ComputeAbsBounds( renderable.m_pRenderable, absMins, absMaxs );
+
+			StaticPropBounds_t &bounds = m_StaticPropBounds[i >> 2];
+			for ( int k = 0; k < 3; ++k )
+			{
+				bounds.m_Mins[k][i & 3] = absMins[k];
+				bounds.m_Maxs[k][i & 3] = absMaxs[k];
+			}
+		}
+
+		leafInfo.m_StaticPropCount = m_StaticPropsInLeaves.Count() - leafInfo.m_FirstStaticProp;
+
+		// Pad out so the next leaf starts on its own set of bounds
+		while ( m_StaticPropsInLeaves.Count() & 3 )
+		{
+			m_StaticPropsInLeaves.AddToTail( m_Renderables.InvalidIndex() );
+		}
+	}
+
+	m_bStaticPropListsDirty = false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns a bit for each of the 4 boxes that isn't entirely behind a frustum plane
+//-----------------------------------------------------------------------------
+static int BoxesInFrustum( const StaticPropBounds_t &bounds, const VPlane *pFrustum )
+{
+	if ( MathLib_SSEEnabled() )
+	{
+		__m128 minX = _mm_loadu_ps( bounds.m_Mins[0] );
+		__m128 minY = _mm_loadu_ps( bounds.m_Mins[1] );
+		__m128 minZ = _mm_loadu_ps( bounds.m_Mins[2] );
+		__m128 maxX = _mm_loadu_ps( bounds.m_Maxs[0] );
+		__m128 maxY = _mm_loadu_ps( bounds.m_Maxs[1] );
+		__m128 maxZ = _mm_loadu_ps( bounds.m_Maxs[2] );
+
+		int nOutside = 0;
+		for ( int i = 0; i < FRUSTUM_NUMPLANES; ++i )
+		{
+			// Test the corner furthest along the plane normal
+			const Vector &normal = pFrustum[i].m_Normal;
+			__m128 x = _mm_mul_ps( _mm_set1_ps( normal.x ), normal.x >= 0.0f ? maxX : minX );
+			__m128 y = _mm_mul_ps( _mm_set1_ps( normal.y ), normal.y >= 0.0f ? maxY : minY );
+			__m128 z = _mm_mul_ps( _mm_set1_ps( normal.z ), normal.z >= 0.0f ? maxZ : minZ );
+			__m128 dist = _mm_add_ps( _mm_add_ps( x, y ), z );
+			nOutside |= _mm_movemask_ps( _mm_cmplt_ps( dist, _mm_set1_ps( pFrustum[i].m_Dist ) ) );
+		}
+		return ~nOutside & 0xF;
+	}
+
+	int nInside = 0;
+	for ( int k = 0; k < 4; ++k )
+	{
+		int i;
+		for ( i = 0; i < FRUSTUM_NUMPLANES; ++i )
+		{
+			const Vector &normal = pFrustum[i].m_Normal;
+			Vector corner( normal.x >= 0.0f ? bounds.m_Maxs[0][k] : bounds.m_Mins[0][k],
+				normal.y >= 0.0f ? bounds.m_Maxs[1][k] : bounds.m_Mins[1][k],
+				normal.z >= 0.0f ? bounds.m_Maxs[2][k] : bounds.m_Mins[2][k] );
+			if ( DotProduct( normal, corner ) < pFrustum[i].m_Dist )
+				break;
+		}
+
+		if ( i == FRUSTUM_NUMPLANES )
+		{
+			nInside |= ( 1 << k );
+		}
+	}
+	return nInside;
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds the static props in a leaf to the render list
+//-----------------------------------------------------------------------------
+void CClientLeafSystem::CollateStaticPropsInLeaf( int leaf, int worldListLeafIndex, SetupRenderInfo_t &info )
+{
+	if ( !m_DrawStaticProps )
+		return;
+
+	const ClientLeaf_t &leafInfo = m_Leaf[leaf];
+	int nFirst = leafInfo.m_FirstStaticProp;
+	int nCount = leafInfo.m_StaticPropCount;
+	for ( int i = 0; i < nCount; i += 4 )
+	{
+		const StaticPropBounds_t &bounds = m_StaticPropBounds[ (nFirst + i) >> 2 ];
+		int nVisible = info.m_pFrustum ? BoxesInFrustum( bounds, info.m_pFrustum ) : 0xF;
+		if ( !nVisible )
+			continue;
+
+		int nInGroup = min( 4, nCount - i );
+		for ( int k = 0; k < nInGroup; ++k )
+		{
+			if ( !(nVisible & (1 << k)) )
+				continue;
+
+			ClientRenderHandle_t handle = m_StaticPropsInLeaves[nFirst + i + k];
+			RenderableInfo_t& renderable = m_Renderables[handle];
+
+			Vector mins( bounds.m_Mins[0][k], bounds.m_Mins[1][k], bounds.m_Mins[2][k] );
+			Vector maxs( bounds.m_Maxs[0][k], bounds.m_Maxs[1][k], bounds.m_Maxs[2][k] );
+
+			// Early out if we're told to not draw small objects (top view only,
+			// that's why we don't check the z component).
+			if (!m_DrawSmallObjects)
+			{
+				if ((maxs.x - mins.x < 50.f) && (maxs.y - mins.y < 50.f))
+					continue;
+			}
+
+			// Don't hit the same prop in multiple leaves twice.
+			if ( renderable.m_RenderGroup != RENDER_GROUP_TRANSLUCENT_ENTITY )
+			{
+				if( renderable.m_RenderFrame2 == info.m_nRenderFrame )
+					continue;
+
+				renderable.m_RenderFrame2 = info.m_nRenderFrame;
+			}
+
+			CollateRenderable( renderable, handle, mins, maxs, leaf, worldListLeafIndex, info );
+		}
+	}
+}
+
+
 void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafIndex,	SetupRenderInfo_t &info )
 {
+	bool bStaticPropLists = r_StaticPropLists.GetBool();
+	if ( bStaticPropLists )
+	{
+		if ( m_bStaticPropListsDirty )
+		{
+			BuildStaticPropLists();
+		}
+
+		CollateStaticPropsInLeaf( leaf, worldListLeafIndex, info );
+	}
+
 	// Collate everything.
 	unsigned short idx = m_RenderablesInLeaf.FirstElement(leaf);
 	for ( ;idx != m_RenderablesInLeaf.InvalidIndex(); idx = m_RenderablesInLeaf.NextElement(idx) )
@@ -1003,6 +1290,10 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 		ClientRenderHandle_t handle = m_RenderablesInLeaf.Element(idx);
 		RenderableInfo_t& renderable = m_Renderables[handle];
 
+		// Static props were already added from the leaf's array
+		if (bStaticPropLists && (renderable.m_Flags & RENDER_FLAGS_STATIC_PROP))
+			continue;
+
 		// Early out on static props if we don't want to render them
 		if ((!m_DrawStaticProps) && (renderable.m_Flags & RENDER_FLAGS_STATIC_PROP))
 			continue;
@@ -1035,61 +1326,7 @@ void CClientLeafSystem::CollateRenderablesInLeaf( int leaf, int worldListLeafInd
 		mins += vOrigin;
 		maxs += vOrigin;
 
-		// If the renderable is inside an area, cull it using the frustum for that area.
-		if ( r_PortalTestEnts.GetInt() )
-		{
-			if ( renderable.m_Area != -1 )
-			{
-				if ( !engine->DoesBoxTouchAreaFrustum( mins, maxs, renderable.m_Area ) )
-					continue;
-			}
-		}
-
-#ifdef TF2_CLIENT_DLL
-		if (info.m_flRenderDistSq != 0.0f)
-		{
-			if ((maxs.z - mins.z) < 100)
-			{
-				Vector vCenter;
-				VectorLerp( mins, maxs, 0.5f, vCenter );
-
-				float flDistSq = info.m_vecRenderOrigin.DistToSqr( vCenter );
-				if (info.m_flRenderDistSq <= flDistSq)
-					continue;
-			}
-		}
-#endif
-
-		if( renderable.m_RenderGroup == RENDER_GROUP_TRANSLUCENT_ENTITY )
-		{
-			// Translucent entities already have had ComputeTranslucentRenderLeaf called on them
-			// so m_RenderLeaf should be set to the nearest leaf, so that's what we want here.
-			if( renderable.m_RenderLeaf == leaf )
-			{
-				if( renderable.m_pRenderable->LODTest() )
-				{
-					bool twoPass = (renderable.m_Flags & RENDER_FLAGS_TWOPASS) != 0; 
-					AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
-						worldListLeafIndex, (RenderGroup_t)renderable.m_RenderGroup, handle, twoPass );
-
-					// Add to both lists if it's a two-pass model... 
-					if (twoPass)
-					{
-						AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
-							worldListLeafIndex, RENDER_GROUP_OPAQUE_ENTITY, handle, twoPass );
-					}
-				}
-			}
-		}
-		else
-		{
-			// Don't hit the same ent in multiple leaves twice.
-			if( renderable.m_pRenderable->LODTest() )
-			{
-				AddRenderableToRenderList( *info.m_pRenderList, renderable.m_pRenderable, 
-					worldListLeafIndex, (RenderGroup_t)renderable.m_RenderGroup, handle);
-			}
-		}
+		CollateRenderable( renderable, handle, mins, maxs, leaf, worldListLeafIndex, info );
 	}
 
 	// Do detail objects.
@@ -36,6 +36,7 @@ typedef CGameTrace trace_t;
 struct Ray_t;
 class Vector2D;
 class CStaticProp;
+class VPlane;
 
 
 //-----------------------------------------------------------------------------
@@ -79,6 +80,7 @@ struct SetupRenderInfo_t
 	int m_nRenderFrame;
 	float m_flRenderDistSq;
 	bool m_bDrawDetailObjects;
+	const VPlane *m_pFrustum;	// static props outside it are skipped; NULL skips the test
 };
 
 
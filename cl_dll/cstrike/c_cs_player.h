@@ -21,6 +21,7 @@ class C_CSPlayer : public C_BasePlayer
 public:
 	DECLARE_CLASS( C_CSPlayer, C_BasePlayer );
 	DECLARE_CLIENTCLASS();
+	ALLOW_PARALLEL_BONE_SETUP( C_CSPlayer );
 
 	C_CSPlayer();
 
@@ -22,6 +22,7 @@
 #include "tier0/vprof.h"
 #include "engine/ivmodelinfo.h"
 #include "materialsystem/IMesh.h"
+#include <xmmintrin.h>
 
 
 //-----------------------------------------------------------------------------
@@ -46,17 +47,14 @@ public:
 	bool Init( int index, const Vector& org, const QAngle& angles, model_t* pModel, 
 		colorRGBExp32 lighting, int lightstyle, unsigned char lightstylecount, int orientation );
 
-	bool InitSprite( int index, const Vector& org, const QAngle& angles, unsigned short nSpriteIndex, 
-		colorRGBExp32 lighting, int lightstyle, unsigned char lightstylecount, int orientation, float flScale );
+	// Sprites are drawn from CDetailObjectSystem's sprite arrays, this just reserves the slot
+	bool InitSprite( int index, const Vector& org, const QAngle& angles );
 
 	void GetColorModulation( float* color );
 
 	// Computes the render angles for screen alignment
 	void ComputeAngles( void );
 
-	// Renders the sprite
-	void DrawSprite( CMeshBuilder &meshBuilder );
-
 	int GetType() const { return m_Type; }
 	unsigned char GetAlpha() const { return m_Alpha; }
 
@@ -73,10 +71,6 @@ protected:
 	unsigned char	m_Type;
 	colorRGBExp32	m_Color;
 	unsigned int	m_LightStyle;
-
-	// FIXME: Would be nice to not have to store these (or use a union or something)
-	unsigned short	m_nSpriteIndex;
-	float			m_flScale;
 };
 
 
@@ -141,6 +135,13 @@ public:
 	DetailPropLightstylesLump_t& DetailLighting( int i ) { return m_DetailLighting[i]; }
 	DetailPropSpriteDict_t& DetailSpriteDict( int i ) { return m_DetailSpriteDict[i]; }
 
+	// Fills an empty system with a grid of leaves of random sprites around 
+	// the origin, so the sprite code can be timed without a map
+	void BuildSyntheticDetailSprites( int nLeavesPerSide, int nSpritesPerLeaf );
+
+	// Times building the sprite vertices of every leaf with and without SSE
+	void RunSpriteBenchmark( const Vector &viewOrigin, int nIterations );
+
 private:
 	struct DetailModelDict_t
 	{
@@ -161,12 +162,48 @@ private:
 		float m_flDistance;
 	};
 
+	struct DetailLeaf_t
+	{
+		int m_nFirstDetailObject;
+		int m_nDetailObjectCount;
+	};
+
+	struct DetailSpriteLighting_t
+	{
+		float			m_Color[3];		// linear, scaled by lightstyle 0 when drawn
+		unsigned int	m_LightStyle;
+		unsigned char	m_LightStyleCount;
+	};
+
+	struct DetailSpriteVertex_t
+	{
+		Vector		m_Position;
+		Vector2D	m_TexCoord;
+	};
+
 	// Unserialization
 	void UnserializeModelDict( CUtlBuffer& buf );
 	void UnserializeDetailSprites( CUtlBuffer& buf );
 	void UnserializeModels( CUtlBuffer& buf );
 	void UnserializeModelLighting( CUtlBuffer& buf );
 
+	// Sprite data, kept parallel to m_DetailObjects
+	void AddSpriteData( int nIndex, const DetailObjectLump_t &lump );
+	void ClearSpriteData();
+
+	// Fade factors for the current view
+	void ComputeEnumContext( EnumContext_t &ctx );
+
+	// Computes the fade alpha of a range of detail objects
+	void ComputeSpriteFade( int nFirst, int nCount, const Vector &viewOrigin, const EnumContext_t &ctx, bool bUseSSE );
+
+	// Builds 4 vertices per detail object in a range, turning sprites towards the view
+	void BuildSpriteVertices( int nFirst, int nCount, const Vector &viewOrigin, DetailSpriteVertex_t *pVerts, bool bUseSSE );
+	void BuildSpriteVertex( int nSprite, const Vector &viewOrigin, DetailSpriteVertex_t *pVerts );
+
+	// Computes the color of a single sprite
+	void ComputeSpriteColor( int nSprite, float flLightStyle0, unsigned char *pColor );
+
 	// Count the number of detail sprites in the leaf list
 	int CountSpritesInLeafList( int nLeafCount, int *pLeafList );
 
@@ -181,6 +218,25 @@ private:
 	CUtlVector<CDetailModel>				m_DetailObjects;
 	CUtlVector<DetailPropSpriteDict_t>		m_DetailSpriteDict;
 	CUtlVector<DetailPropLightstylesLump_t>	m_DetailLighting;
+	CUtlVector<DetailLeaf_t>				m_DetailLeaves;
+	int										m_nDetailModelCount;
+
+	// Detail sprites as flat arrays indexed like m_DetailObjects, so a leaf's
+	// sprites are in the same range as its detail objects. Models get
+	// entries that never become visible.
+	CUtlVector<float>			m_SpriteOrigin[3];
+	CUtlVector<float>			m_SpriteRight[3];		// for sprites that don't turn
+	CUtlVector<float>			m_SpriteUp[3];
+	CUtlVector<float>			m_SpriteFaceView;		// 1 if the sprite turns towards the view
+	CUtlVector<float>			m_SpriteFaceViewZ;		// 0 if it only turns around z
+	CUtlVector<float>			m_SpriteCorner[4];		// scaled ul.x, ul.y, lr.x, lr.y
+	CUtlVector<float>			m_SpriteTexCoord[4];	// ul.x, ul.y, lr.x, lr.y, already flipped
+	CUtlVector<float>			m_SpriteVisible;		// 1 for sprites, 0 for models
+	CUtlVector<float>			m_SpriteAlpha;			// 0-255, from the last EnumerateLeaf
+	CUtlVector<DetailSpriteLighting_t>	m_SpriteLighting;
+
+	// Vertices of the leaf being drawn
+	CUtlVector<DetailSpriteVertex_t>	m_SpriteVerts;
 
 	// Necessary to get sprites to batch correctly
 	CMaterialReference m_DetailSpriteMaterial;
@@ -420,19 +476,10 @@ bool CDetailModel::Init( int index, const Vector& org, const QAngle& angles,
 	return CBaseStaticModel::Init( index, org, angles, pModel );
 }
 
-bool CDetailModel::InitSprite( int index, const Vector& org, const QAngle& angles, unsigned short nSpriteIndex, 
-	colorRGBExp32 lighting, int lightstyle, unsigned char lightstylecount, int orientation, float flScale )
+bool CDetailModel::InitSprite( int index, const Vector& org, const QAngle& angles )
 {
-	m_Color = lighting;
-	m_LightStyleCount = lightstylecount;
-	m_LightStyle = lightstyle; 
-	m_Orientation = orientation;
-	m_nSpriteIndex = nSpriteIndex;
 	m_Type = DETAIL_PROP_TYPE_SPRITE;
-	m_flScale = flScale;
-
-	// HACK: Use m_pModel here to indicate flipped-ness horizontally!
-	return CBaseStaticModel::Init( index, org, angles, (model_t*)(index & 0x1) );
+	return CBaseStaticModel::Init( index, org, angles, NULL );
 }
 
 
@@ -517,77 +564,12 @@ void CDetailModel::ComputeAngles( void )
 }
 
 
-//-----------------------------------------------------------------------------
-// Renders the sprite
-//-----------------------------------------------------------------------------
-void CDetailModel::DrawSprite( CMeshBuilder &meshBuilder )
-{
-	Assert( m_Type == DETAIL_PROP_TYPE_SPRITE );
-
-	Vector vecColor;
-	GetColorModulation( vecColor.Base() );
-
-	unsigned char color[4];
-	color[0] = (unsigned char)(vecColor[0] * 255.0f);
-	color[1] = (unsigned char)(vecColor[1] * 255.0f);
-	color[2] = (unsigned char)(vecColor[2] * 255.0f);
-	color[3] = m_Alpha;
-
-	DetailPropSpriteDict_t &dict = s_DetailObjectSystem.DetailSpriteDict( m_nSpriteIndex );
-
-	Vector vecOrigin, dx, dy;
-	AngleVectors( m_Angles, NULL, &dx, &dy );
-
-	Vector2D ul, lr;
-	Vector2DMultiply( dict.m_UL, m_flScale, ul );
-	Vector2DMultiply( dict.m_LR, m_flScale, lr );
-
-	VectorMA( m_Origin, ul.x, dx, vecOrigin );
-	VectorMA( vecOrigin, ul.y, dy, vecOrigin );
-	dx *= (lr.x - ul.x);
-	dy *= (lr.y - ul.y);
-
-	Vector2D texul, texlr;
-	texul = dict.m_TexUL;
-	texlr = dict.m_TexLR;
-
-	// What a shameless re-use of bits (m_pModel == 0 when it should be flipped horizontally)
-	if ( !m_pModel )
-	{
-		texul.x = dict.m_TexLR.x;
-		texlr.x = dict.m_TexUL.x;
-	}
-
-	meshBuilder.Position3fv( vecOrigin.Base() );
-	meshBuilder.TexCoord2fv( 0, texul.Base() );
-	meshBuilder.Color4ubv( color );
-	meshBuilder.AdvanceVertex();
-
-	vecOrigin += dy;
-	meshBuilder.Position3fv( vecOrigin.Base() );
-	meshBuilder.TexCoord2f( 0, texul.x, texlr.y );
-	meshBuilder.Color4ubv( color );
-	meshBuilder.AdvanceVertex();
-
-	vecOrigin += dx;
-	meshBuilder.Position3fv( vecOrigin.Base() );
-	meshBuilder.TexCoord2fv( 0, texlr.Base() );
-	meshBuilder.Color4ubv( color );
-	meshBuilder.AdvanceVertex();
-
-	vecOrigin -= dy;
-	meshBuilder.Position3fv( vecOrigin.Base() );
-	meshBuilder.TexCoord2f( 0, texlr.x, texul.y );
-	meshBuilder.Color4ubv( color );
-	meshBuilder.AdvanceVertex();
-}
-
-
 //-----------------------------------------------------------------------------
 // constructor, destructor
 //-----------------------------------------------------------------------------
 CDetailObjectSystem::CDetailObjectSystem() : m_DetailObjects( 0, 1024 ), m_DetailSpriteDict( 0, 32 ), m_DetailObjectDict( 0, 32 )
 {
+	m_nDetailModelCount = 0;
 	BuildExponentTable();
 }
 
@@ -649,6 +631,9 @@ void CDetailObjectSystem::LevelShutdownPreEntity()
 	m_DetailObjects.RemoveAll();
 	m_DetailObjectDict.RemoveAll();
 	m_DetailLighting.RemoveAll();
+	m_DetailLeaves.RemoveAll();
+	m_nDetailModelCount = 0;
+	ClearSpriteData();
 }
 
 void CDetailObjectSystem::LevelShutdownPostEntity()
@@ -742,6 +727,10 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 			{
 				ClientLeafSystem()->SetDetailObjectsInLeaf( detailObjectLeaf, 
 					firstDetailObject, detailObjectCount );
+
+				int i = m_DetailLeaves.AddToTail();
+				m_DetailLeaves[i].m_nFirstDetailObject = firstDetailObject;
+				m_DetailLeaves[i].m_nDetailObjectCount = detailObjectCount;
 			}
 
 			detailObjectLeaf = lump.m_Leaf;
@@ -755,14 +744,14 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 			m_DetailObjects[newObj].Init( newObj, lump.m_Origin, lump.m_Angles, 
 				m_DetailObjectDict[lump.m_DetailModel].m_pModel, lump.m_Lighting,
 				lump.m_LightStyles, lump.m_LightStyleCount, lump.m_Orientation );
+			++m_nDetailModelCount;
 		}
 		else
 		{
-			m_DetailObjects[newObj].InitSprite( newObj, lump.m_Origin, lump.m_Angles, 
-				lump.m_DetailModel, lump.m_Lighting,
-				lump.m_LightStyles, lump.m_LightStyleCount, lump.m_Orientation, lump.m_flScale );
+			m_DetailObjects[newObj].InitSprite( newObj, lump.m_Origin, lump.m_Angles );
 		}
 
+		AddSpriteData( newObj, lump );
 		++detailObjectCount;
 	}
 
@@ -770,10 +759,389 @@ void CDetailObjectSystem::UnserializeModels( CUtlBuffer& buf )
 	{
 		ClientLeafSystem()->SetDetailObjectsInLeaf( detailObjectLeaf, 
 			firstDetailObject, detailObjectCount );
+
+		int i = m_DetailLeaves.AddToTail();
+		m_DetailLeaves[i].m_nFirstDetailObject = firstDetailObject;
+		m_DetailLeaves[i].m_nDetailObjectCount = detailObjectCount;
 	}
 }
 
 
+//-----------------------------------------------------------------------------
+// Sprite data, kept parallel to m_DetailObjects
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::AddSpriteData( int nIndex, const DetailObjectLump_t &lump )
+{
+	Assert( m_SpriteVisible.Count() == nIndex );
+
+	int j;
+	for ( j = 0; j < 3; ++j )
+	{
+		m_SpriteOrigin[j].AddToTail( lump.m_Origin[j] );
+	}
+
+	int i = m_SpriteLighting.AddToTail();
+	DetailSpriteLighting_t &lighting = m_SpriteLighting[i];
+	lighting.m_Color[0] = TexLightToLinear( lump.m_Lighting.r, lump.m_Lighting.exponent );
+	lighting.m_Color[1] = TexLightToLinear( lump.m_Lighting.g, lump.m_Lighting.exponent );
+	lighting.m_Color[2] = TexLightToLinear( lump.m_Lighting.b, lump.m_Lighting.exponent );
+	lighting.m_LightStyle = lump.m_LightStyles;
+	lighting.m_LightStyleCount = lump.m_LightStyleCount;
+
+	m_SpriteAlpha.AddToTail( 0.0f );
+
+	if ( lump.m_Type != DETAIL_PROP_TYPE_SPRITE )
+	{
+		m_SpriteVisible.AddToTail( 0.0f );
+		m_SpriteFaceView.AddToTail( 0.0f );
+		m_SpriteFaceViewZ.AddToTail( 0.0f );
+		for ( j = 0; j < 3; ++j )
+		{
+			m_SpriteRight[j].AddToTail( 0.0f );
+			m_SpriteUp[j].AddToTail( 0.0f );
+		}
+		for ( j = 0; j < 4; ++j )
+		{
+			m_SpriteCorner[j].AddToTail( 0.0f );
+			m_SpriteTexCoord[j].AddToTail( 0.0f );
+		}
+		return;
+	}
+
+	m_SpriteVisible.AddToTail( 1.0f );
+	m_SpriteFaceView.AddToTail( (lump.m_Orientation != 0) ? 1.0f : 0.0f );
+	m_SpriteFaceViewZ.AddToTail( (lump.m_Orientation == 2) ? 0.0f : 1.0f );
+
+	Vector vecRight, vecUp;
+	AngleVectors( lump.m_Angles, NULL, &vecRight, &vecUp );
+	for ( j = 0; j < 3; ++j )
+	{
+		m_SpriteRight[j].AddToTail( vecRight[j] );
+		m_SpriteUp[j].AddToTail( vecUp[j] );
+	}
+
+	DetailPropSpriteDict_t &dict = m_DetailSpriteDict[lump.m_DetailModel];
+	m_SpriteCorner[0].AddToTail( dict.m_UL.x * lump.m_flScale );
+	m_SpriteCorner[1].AddToTail( dict.m_UL.y * lump.m_flScale );
+	m_SpriteCorner[2].AddToTail( dict.m_LR.x * lump.m_flScale );
+	m_SpriteCorner[3].AddToTail( dict.m_LR.y * lump.m_flScale );
+
+	// Every other sprite is flipped horizontally
+	bool bFlip = (nIndex & 0x1) == 0;
+	m_SpriteTexCoord[0].AddToTail( bFlip ? dict.m_TexLR.x : dict.m_TexUL.x );
+	m_SpriteTexCoord[1].AddToTail( dict.m_TexUL.y );
+	m_SpriteTexCoord[2].AddToTail( bFlip ? dict.m_TexUL.x : dict.m_TexLR.x );
+	m_SpriteTexCoord[3].AddToTail( dict.m_TexLR.y );
+}
+
+void CDetailObjectSystem::ClearSpriteData()
+{
+	int j;
+	for ( j = 0; j < 3; ++j )
+	{
+		m_SpriteOrigin[j].Purge();
+		m_SpriteRight[j].Purge();
+		m_SpriteUp[j].Purge();
+	}
+	for ( j = 0; j < 4; ++j )
+	{
+		m_SpriteCorner[j].Purge();
+		m_SpriteTexCoord[j].Purge();
+	}
+	m_SpriteFaceView.Purge();
+	m_SpriteFaceViewZ.Purge();
+	m_SpriteVisible.Purge();
+	m_SpriteAlpha.Purge();
+	m_SpriteLighting.Purge();
+	m_SpriteVerts.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Computes the fade alpha of a range of detail objects
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::ComputeSpriteFade( int nFirst, int nCount, const Vector &viewOrigin, const EnumContext_t &ctx, bool bUseSSE )
+{
+	const float *pOriginX = m_SpriteOrigin[0].Base() + nFirst;
+	const float *pOriginY = m_SpriteOrigin[1].Base() + nFirst;
+	const float *pOriginZ = m_SpriteOrigin[2].Base() + nFirst;
+	const float *pVisible = m_SpriteVisible.Base() + nFirst;
+	float *pAlpha = m_SpriteAlpha.Base() + nFirst;
+
+	int i = 0;
+	if ( bUseSSE )
+	{
+		__m128 viewX = _mm_set1_ps( viewOrigin.x );
+		__m128 viewY = _mm_set1_ps( viewOrigin.y );
+		__m128 viewZ = _mm_set1_ps( viewOrigin.z );
+		__m128 maxSqDist = _mm_set1_ps( ctx.m_MaxSqDist );
+		__m128 falloff = _mm_set1_ps( ctx.m_FalloffFactor );
+		__m128 opaque = _mm_set1_ps( 255.0f );
+		__m128 zero = _mm_setzero_ps();
+		bool bFade = ( ctx.m_FadeSqDist > 0 );
+
+		for ( ; i + 4 <= nCount; i += 4 )
+		{
+			__m128 dx = _mm_sub_ps( _mm_loadu_ps( pOriginX + i ), viewX );
+			__m128 dy = _mm_sub_ps( _mm_loadu_ps( pOriginY + i ), viewY );
+			__m128 dz = _mm_sub_ps( _mm_loadu_ps( pOriginZ + i ), viewZ );
+			__m128 sqDist = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+
+			// Inside the fade distance the falloff is >= 255, so clamping it covers both cases
+			__m128 alpha;
+			if ( bFade )
+			{
+				alpha = _mm_mul_ps( falloff, _mm_sub_ps( maxSqDist, sqDist ) );
+				alpha = _mm_max_ps( _mm_min_ps( alpha, opaque ), zero );
+			}
+			else
+			{
+				alpha = _mm_and_ps( _mm_cmplt_ps( sqDist, maxSqDist ), opaque );
+			}
+
+			_mm_storeu_ps( pAlpha + i, _mm_mul_ps( alpha, _mm_loadu_ps( pVisible + i ) ) );
+		}
+	}
+
+	for ( ; i < nCount; ++i )
+	{
+		Vector v( pOriginX[i] - viewOrigin.x, pOriginY[i] - viewOrigin.y, pOriginZ[i] - viewOrigin.z );
+		float sqDist = v.LengthSqr();
+
+		float flAlpha = 0.0f;
+		if ( sqDist < ctx.m_MaxSqDist )
+		{
+			flAlpha = 255.0f;
+			if ( (ctx.m_FadeSqDist > 0) && (sqDist > ctx.m_FadeSqDist) )
+			{
+				flAlpha = min( ctx.m_FalloffFactor * (ctx.m_MaxSqDist - sqDist), 255.0f );
+			}
+		}
+		pAlpha[i] = flAlpha * pVisible[i];
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds the quad of a single sprite, the way the sprite's render angles would
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::BuildSpriteVertex( int i, const Vector &viewOrigin, DetailSpriteVertex_t *pVerts )
+{
+	Vector vecOrigin( m_SpriteOrigin[0][i], m_SpriteOrigin[1][i], m_SpriteOrigin[2][i] );
+
+	Vector dx, dy;
+	if ( m_SpriteFaceView[i] != 0.0f )
+	{
+		Vector vecDir;
+		QAngle angles;
+		VectorSubtract( viewOrigin, vecOrigin, vecDir );
+		vecDir.z *= m_SpriteFaceViewZ[i];
+		VectorAngles( vecDir, angles );
+		AngleVectors( angles, NULL, &dx, &dy );
+	}
+	else
+	{
+		dx.Init( m_SpriteRight[0][i], m_SpriteRight[1][i], m_SpriteRight[2][i] );
+		dy.Init( m_SpriteUp[0][i], m_SpriteUp[1][i], m_SpriteUp[2][i] );
+	}
+
+	VectorMA( vecOrigin, m_SpriteCorner[0][i], dx, vecOrigin );
+	VectorMA( vecOrigin, m_SpriteCorner[1][i], dy, vecOrigin );
+	dx *= m_SpriteCorner[2][i] - m_SpriteCorner[0][i];
+	dy *= m_SpriteCorner[3][i] - m_SpriteCorner[1][i];
+
+	float flTexULX = m_SpriteTexCoord[0][i];
+	float flTexULY = m_SpriteTexCoord[1][i];
+	float flTexLRX = m_SpriteTexCoord[2][i];
+	float flTexLRY = m_SpriteTexCoord[3][i];
+
+	pVerts[0].m_Position = vecOrigin;
+	pVerts[0].m_TexCoord.Init( flTexULX, flTexULY );
+	vecOrigin += dy;
+	pVerts[1].m_Position = vecOrigin;
+	pVerts[1].m_TexCoord.Init( flTexULX, flTexLRY );
+	vecOrigin += dx;
+	pVerts[2].m_Position = vecOrigin;
+	pVerts[2].m_TexCoord.Init( flTexLRX, flTexLRY );
+	vecOrigin -= dy;
+	pVerts[3].m_Position = vecOrigin;
+	pVerts[3].m_TexCoord.Init( flTexLRX, flTexULY );
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds 4 vertices per detail object in a range. The SSE path builds the 
+// right + up vectors VectorAngles + AngleVectors would produce directly
+// from the direction to the view, 4 sprites at a time.
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::BuildSpriteVertices( int nFirst, int nCount, const Vector &viewOrigin, DetailSpriteVertex_t *pVerts, bool bUseSSE )
+{
+	VPROF_BUDGET( "CDetailObjectSystem::BuildSpriteVertices", VPROF_BUDGETGROUP_DETAILPROP_RENDERING );
+
+	int i = 0;
+	if ( bUseSSE )
+	{
+		__m128 viewX = _mm_set1_ps( viewOrigin.x );
+		__m128 viewY = _mm_set1_ps( viewOrigin.y );
+		__m128 viewZ = _mm_set1_ps( viewOrigin.z );
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps( 1.0f );
+		__m128 epsilon = _mm_set1_ps( 1e-6f );
+
+		for ( ; i + 4 <= nCount; i += 4 )
+		{
+			int n = nFirst + i;
+
+			__m128 originX = _mm_loadu_ps( m_SpriteOrigin[0].Base() + n );
+			__m128 originY = _mm_loadu_ps( m_SpriteOrigin[1].Base() + n );
+			__m128 originZ = _mm_loadu_ps( m_SpriteOrigin[2].Base() + n );
+
+			// Direction to the view
+			__m128 fx = _mm_sub_ps( viewX, originX );
+			__m128 fy = _mm_sub_ps( viewY, originY );
+			__m128 fz = _mm_mul_ps( _mm_sub_ps( viewZ, originZ ), _mm_loadu_ps( m_SpriteFaceViewZ.Base() + n ) );
+
+			__m128 len2DSqr = _mm_add_ps( _mm_mul_ps( fx, fx ), _mm_mul_ps( fy, fy ) );
+			__m128 len2D = _mm_sqrt_ps( len2DSqr );
+			__m128 len = _mm_sqrt_ps( _mm_add_ps( len2DSqr, _mm_mul_ps( fz, fz ) ) );
+			__m128 ooLen2D = _mm_div_ps( one, _mm_max_ps( len2D, epsilon ) );
+			__m128 ooLen = _mm_div_ps( one, _mm_max_ps( len, epsilon ) );
+
+			// Straight up or down has a yaw of 0
+			__m128 vertical = _mm_cmple_ps( len2DSqr, epsilon );
+			__m128 cy = _mm_or_ps( _mm_and_ps( vertical, one ), _mm_andnot_ps( vertical, _mm_mul_ps( fx, ooLen2D ) ) );
+			__m128 sy = _mm_andnot_ps( vertical, _mm_mul_ps( fy, ooLen2D ) );
+			__m128 sp = _mm_sub_ps( zero, _mm_mul_ps( fz, ooLen ) );
+			__m128 cp = _mm_mul_ps( len2D, ooLen );
+
+			// right = ( sy, -cy, 0 ), up = ( sp * cy, sp * sy, cp ), blended with the fixed vectors
+			__m128 faceView = _mm_loadu_ps( m_SpriteFaceView.Base() + n );
+			__m128 rightX = _mm_loadu_ps( m_SpriteRight[0].Base() + n );
+			__m128 rightY = _mm_loadu_ps( m_SpriteRight[1].Base() + n );
+			__m128 rightZ = _mm_loadu_ps( m_SpriteRight[2].Base() + n );
+			__m128 upX = _mm_loadu_ps( m_SpriteUp[0].Base() + n );
+			__m128 upY = _mm_loadu_ps( m_SpriteUp[1].Base() + n );
+			__m128 upZ = _mm_loadu_ps( m_SpriteUp[2].Base() + n );
+			rightX = _mm_add_ps( rightX, _mm_mul_ps( faceView, _mm_sub_ps( sy, rightX ) ) );
+			rightY = _mm_add_ps( rightY, _mm_mul_ps( faceView, _mm_sub_ps( _mm_sub_ps( zero, cy ), rightY ) ) );
+			rightZ = _mm_sub_ps( rightZ, _mm_mul_ps( faceView, rightZ ) );
+			upX = _mm_add_ps( upX, _mm_mul_ps( faceView, _mm_sub_ps( _mm_mul_ps( sp, cy ), upX ) ) );
+			upY = _mm_add_ps( upY, _mm_mul_ps( faceView, _mm_sub_ps( _mm_mul_ps( sp, sy ), upY ) ) );
+			upZ = _mm_add_ps( upZ, _mm_mul_ps( faceView, _mm_sub_ps( cp, upZ ) ) );
+
+			__m128 ulX = _mm_loadu_ps( m_SpriteCorner[0].Base() + n );
+			__m128 ulY = _mm_loadu_ps( m_SpriteCorner[1].Base() + n );
+			__m128 width = _mm_sub_ps( _mm_loadu_ps( m_SpriteCorner[2].Base() + n ), ulX );
+			__m128 height = _mm_sub_ps( _mm_loadu_ps( m_SpriteCorner[3].Base() + n ), ulY );
+
+			// Corners go upper left, lower left, lower right, upper right
+			float flPos[4][3][4];
+			__m128 posX = _mm_add_ps( originX, _mm_add_ps( _mm_mul_ps( ulX, rightX ), _mm_mul_ps( ulY, upX ) ) );
+			__m128 posY = _mm_add_ps( originY, _mm_add_ps( _mm_mul_ps( ulX, rightY ), _mm_mul_ps( ulY, upY ) ) );
+			__m128 posZ = _mm_add_ps( originZ, _mm_add_ps( _mm_mul_ps( ulX, rightZ ), _mm_mul_ps( ulY, upZ ) ) );
+			__m128 dxX = _mm_mul_ps( width, rightX );
+			__m128 dxY = _mm_mul_ps( width, rightY );
+			__m128 dxZ = _mm_mul_ps( width, rightZ );
+			__m128 dyX = _mm_mul_ps( height, upX );
+			__m128 dyY = _mm_mul_ps( height, upY );
+			__m128 dyZ = _mm_mul_ps( height, upZ );
+
+			_mm_storeu_ps( flPos[0][0], posX );
+			_mm_storeu_ps( flPos[0][1], posY );
+			_mm_storeu_ps( flPos[0][2], posZ );
+			posX = _mm_add_ps( posX, dyX );
+			posY = _mm_add_ps( posY, dyY );
+			posZ = _mm_add_ps( posZ, dyZ );
+			_mm_storeu_ps( flPos[1][0], posX );
+			_mm_storeu_ps( flPos[1][1], posY );
+			_mm_storeu_ps( flPos[1][2], posZ );
+			posX = _mm_add_ps( posX, dxX );
+			posY = _mm_add_ps( posY, dxY );
+			posZ = _mm_add_ps( posZ, dxZ );
+			_mm_storeu_ps( flPos[2][0], posX );
+			_mm_storeu_ps( flPos[2][1], posY );
+			_mm_storeu_ps( flPos[2][2], posZ );
+			posX = _mm_sub_ps( posX, dyX );
+			posY = _mm_sub_ps( posY, dyY );
+			posZ = _mm_sub_ps( posZ, dyZ );
+			_mm_storeu_ps( flPos[3][0], posX );
+			_mm_storeu_ps( flPos[3][1], posY );
+			_mm_storeu_ps( flPos[3][2], posZ );
+
+			DetailSpriteVertex_t *pVert = pVerts + i * 4;
+			for ( int j = 0; j < 4; ++j )
+			{
+				float flTexULX = m_SpriteTexCoord[0][n + j];
+				float flTexULY = m_SpriteTexCoord[1][n + j];
+				float flTexLRX = m_SpriteTexCoord[2][n + j];
+				float flTexLRY = m_SpriteTexCoord[3][n + j];
+
+				for ( int k = 0; k < 4; ++k )
+				{
+					pVert[k].m_Position.Init( flPos[k][0][j], flPos[k][1][j], flPos[k][2][j] );
+				}
+				pVert[0].m_TexCoord.Init( flTexULX, flTexULY );
+				pVert[1].m_TexCoord.Init( flTexULX, flTexLRY );
+				pVert[2].m_TexCoord.Init( flTexLRX, flTexLRY );
+				pVert[3].m_TexCoord.Init( flTexLRX, flTexULY );
+				pVert += 4;
+			}
+		}
+	}
+
+	for ( ; i < nCount; ++i )
+	{
+		BuildSpriteVertex( nFirst + i, viewOrigin, pVerts + i * 4 );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Computes the color of a single sprite
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::ComputeSpriteColor( int nSprite, float flLightStyle0, unsigned char *pColor )
+{
+	pColor[3] = (unsigned char)m_SpriteAlpha[nSprite];
+
+	if (mat_fullbright.GetInt() == 1)
+	{
+		pColor[0] = pColor[1] = pColor[2] = 255;
+		return;
+	}
+
+	Vector tmp;
+	Vector normal( 1, 0, 0);
+	Vector vecOrigin( m_SpriteOrigin[0][nSprite], m_SpriteOrigin[1][nSprite], m_SpriteOrigin[2][nSprite] );
+	engine->ComputeDynamicLighting( vecOrigin, &normal, tmp );
+
+	const DetailSpriteLighting_t &spriteLighting = m_SpriteLighting[nSprite];
+	float color[3];
+	color[0] = tmp[0] + flLightStyle0 * spriteLighting.m_Color[0];
+	color[1] = tmp[1] + flLightStyle0 * spriteLighting.m_Color[1];
+	color[2] = tmp[2] + flLightStyle0 * spriteLighting.m_Color[2];
+
+	// Add in the lightstyles
+	for (int i = 0; i < spriteLighting.m_LightStyleCount; ++i)
+	{
+		DetailPropLightstylesLump_t& lighting = m_DetailLighting[ spriteLighting.m_LightStyle + i ];
+		float val = engine->LightStyleValue( lighting.m_Style );
+		if (val != 0)
+		{
+			color[0] += val * TexLightToLinear( lighting.m_Lighting.r, lighting.m_Lighting.exponent ); 
+			color[1] += val * TexLightToLinear( lighting.m_Lighting.g, lighting.m_Lighting.exponent ); 
+			color[2] += val * TexLightToLinear( lighting.m_Lighting.b, lighting.m_Lighting.exponent ); 
+		}
+	}
+
+	// Gamma correct....
+	engine->LinearToGamma( color, color );
+
+	pColor[0] = (unsigned char)(color[0] * 255.0f);
+	pColor[1] = (unsigned char)(color[1] * 255.0f);
+	pColor[2] = (unsigned char)(color[2] * 255.0f);
+}
+
+
 
 //-----------------------------------------------------------------------------
 // Renders all opaque detail objects in a particular set of leaves
@@ -825,20 +1193,18 @@ int CDetailObjectSystem::SortSpritesBackToFront( int nLeaf, const Vector &viewOr
 	int nFirstDetailObject, nDetailObjectCount;
 	ClientLeafSystem()->GetDetailObjectsInLeaf( nLeaf, nFirstDetailObject, nDetailObjectCount );
 
-	Vector vecDelta;
+	// Models never have any sprite alpha
 	int nCount = 0;
-	for ( int j = 0; j < nDetailObjectCount; ++j )
+	for ( int j = nFirstDetailObject; j < nFirstDetailObject + nDetailObjectCount; ++j )
 	{
-		CDetailModel &model = m_DetailObjects[nFirstDetailObject + j];
-
-		if ( (model.GetType() == DETAIL_PROP_TYPE_MODEL) || (model.GetAlpha() == 0) )
+		if ( m_SpriteAlpha[j] < 1.0f )
 			continue;
 
-		pSortInfo[nCount].m_nIndex = nFirstDetailObject + j;
+		pSortInfo[nCount].m_nIndex = j;
 
 		// Compute distance from the camera to each object
-		VectorSubtract( model.GetRenderOrigin(), viewOrigin, vecDelta );
-		pSortInfo[nCount].m_flDistance = DotProduct( viewForward, vecDelta );
+		pSortInfo[nCount].m_flDistance = viewForward.x * (m_SpriteOrigin[0][j] - viewOrigin.x) + 
+			viewForward.y * (m_SpriteOrigin[1][j] - viewOrigin.y) + viewForward.z * (m_SpriteOrigin[2][j] - viewOrigin.z);
 		++nCount;
 	}
 
@@ -886,6 +1252,10 @@ void CDetailObjectSystem::RenderTranslucentDetailObjects( const Vector &viewOrig
 	IMesh *pMesh = materials->GetDynamicMesh( true, NULL, NULL, pMaterial );
 	meshBuilder.Begin( pMesh, MATERIAL_QUADS, nCountToDraw );
 
+	bool bUseSSE = MathLib_SSEEnabled();
+	float flLightStyle0 = engine->LightStyleValue( 0 );
+	unsigned char color[4];
+
 	int nTotalDrawn = 0;
 	int nCountDrawn = 0;
 	for ( int i = 0; i < nLeafCount; ++i )
@@ -898,11 +1268,26 @@ void CDetailObjectSystem::RenderTranslucentDetailObjects( const Vector &viewOrig
 		// Sort detail sprites in each leaf independently; then render them
 		SortInfo_t *pSortInfo = (SortInfo_t *)stackalloc( nDetailObjectCount * sizeof(SortInfo_t) );
 		int nCount = SortSpritesBackToFront( nLeaf, viewOrigin, viewForward, pSortInfo );
+		if ( nCount == 0 )
+			continue;
+
+		// Build the whole leaf in one pass, then copy out in sorted order
+		m_SpriteVerts.EnsureCount( nDetailObjectCount * 4 );
+		BuildSpriteVertices( nFirstDetailObject, nDetailObjectCount, viewOrigin, m_SpriteVerts.Base(), bUseSSE );
 
 		for ( int j = 0; j < nCount; ++j )
 		{
-			CDetailModel &model = m_DetailObjects[pSortInfo[j].m_nIndex];
-			model.DrawSprite( meshBuilder );
+			int nSprite = pSortInfo[j].m_nIndex;
+			ComputeSpriteColor( nSprite, flLightStyle0, color );
+
+			const DetailSpriteVertex_t *pVert = &m_SpriteVerts[ (nSprite - nFirstDetailObject) * 4 ];
+			for ( int k = 0; k < 4; ++k )
+			{
+				meshBuilder.Position3fv( pVert[k].m_Position.Base() );
+				meshBuilder.TexCoord2fv( 0, pVert[k].m_TexCoord.Base() );
+				meshBuilder.Color4ubv( color );
+				meshBuilder.AdvanceVertex();
+			}
 
 			++nTotalDrawn;
 
@@ -943,12 +1328,20 @@ bool CDetailObjectSystem::EnumerateLeaf( int leaf, int context )
 	ClientLeafSystem()->DrawDetailObjectsInLeaf( leaf, pCtx->m_BuildWorldListNumber, 
 		firstDetailObject, detailObjectCount );
 
+	// Sprites fade all at once; they face the view when their vertices are built
+	ComputeSpriteFade( firstDetailObject, detailObjectCount, CurrentViewOrigin(), *pCtx, MathLib_SSEEnabled() );
+	if ( m_nDetailModelCount == 0 )
+		return true;
+
 	// Compute the translucency. Need to do it now cause we need to
 	// know that when we're rendering (opaque stuff is rendered first)
 	for ( i = 0; i < detailObjectCount; ++i)
 	{
 		// Calculate distance (badly)
 		CDetailModel& model = m_DetailObjects[firstDetailObject+i];
+		if ( model.GetType() != DETAIL_PROP_TYPE_MODEL )
+			continue;
+
 		VectorSubtract( model.GetRenderOrigin(), CurrentViewOrigin(), v );
 
 		float sqDist = v.LengthSqr();
@@ -1001,8 +1394,20 @@ void CDetailObjectSystem::BuildDetailObjectRenderLists( )
 //	static ConVar	cl_detaildist( "cl_detaildist", "1200", 0, "Distance at which detail props are no longer visible" );
 //	static ConVar	cl_detailfade( "cl_detailfade", "400", 0, "Distance across which detail props fade in" );
 
-	// Compute factors to optimize rendering of the detail models
 	EnumContext_t ctx;
+	ComputeEnumContext( ctx );
+
+	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
+	pQuery->EnumerateLeavesInSphere( CurrentViewOrigin(), 
+		cl_detaildist.GetFloat(), this, (int)&ctx );
+}
+
+
+//-----------------------------------------------------------------------------
+// Compute factors to optimize rendering of the detail models
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::ComputeEnumContext( EnumContext_t &ctx )
+{
 	ctx.m_MaxSqDist = cl_detaildist.GetFloat() * cl_detaildist.GetFloat();
 	ctx.m_FadeSqDist = cl_detaildist.GetFloat() - cl_detailfade.GetFloat();
 	if (ctx.m_FadeSqDist > 0)
@@ -1011,8 +1416,144 @@ void CDetailObjectSystem::BuildDetailObjectRenderLists( )
 		ctx.m_FadeSqDist = 0;
 	ctx.m_FalloffFactor = 255.0f / (ctx.m_MaxSqDist - ctx.m_FadeSqDist);
 	ctx.m_BuildWorldListNumber = view->BuildWorldListsNumber();
+}
 
-	ISpatialQuery* pQuery = engine->GetBSPTreeQuery();
-	pQuery->EnumerateLeavesInSphere( CurrentViewOrigin(), 
-		cl_detaildist.GetFloat(), this, (int)&ctx );
+
+//-----------------------------------------------------------------------------
+// Fills an empty system with a grid of leaves of random sprites around the
+// origin. The grid reaches past cl_detaildist so part of it fades out, and
+// the sprites cycle through every orientation. Nothing is registered with
+// the leaf system.
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::BuildSyntheticDetailSprites( int nLeavesPerSide, int nSpritesPerLeaf )
+{
+	Assert( m_DetailObjects.Count() == 0 );
+
+	int i = m_DetailSpriteDict.AddToTail();
+	m_DetailSpriteDict[i].m_UL.Init( -16.0f, 32.0f );
+	m_DetailSpriteDict[i].m_LR.Init( 16.0f, 0.0f );
+	m_DetailSpriteDict[i].m_TexUL.Init( 0.0f, 0.0f );
+	m_DetailSpriteDict[i].m_TexLR.Init( 1.0f, 1.0f );
+
+	CUniformRandomStream randomStream;
+	randomStream.SetSeed( 1 );
+
+	float flLeafSize = 2.5f * cl_detaildist.GetFloat() / nLeavesPerSide;
+	float flGridMin = -0.5f * flLeafSize * nLeavesPerSide;
+
+	DetailObjectLump_t lump;
+	memset( &lump, 0, sizeof(lump) );
+	lump.m_Type = DETAIL_PROP_TYPE_SPRITE;
+	lump.m_Lighting.r = lump.m_Lighting.g = lump.m_Lighting.b = 128;
+
+	for ( int y = 0; y < nLeavesPerSide; ++y )
+	{
+		for ( int x = 0; x < nLeavesPerSide; ++x )
+		{
+			int nLeaf = m_DetailLeaves.AddToTail();
+			m_DetailLeaves[nLeaf].m_nFirstDetailObject = m_DetailObjects.Count();
+			m_DetailLeaves[nLeaf].m_nDetailObjectCount = nSpritesPerLeaf;
+
+			for ( int j = 0; j < nSpritesPerLeaf; ++j )
+			{
+				lump.m_Origin.x = flGridMin + flLeafSize * ( x + randomStream.RandomFloat( 0.0f, 1.0f ) );
+				lump.m_Origin.y = flGridMin + flLeafSize * ( y + randomStream.RandomFloat( 0.0f, 1.0f ) );
+				lump.m_Origin.z = randomStream.RandomFloat( -64.0f, 0.0f );
+				lump.m_Angles.Init( 0.0f, randomStream.RandomFloat( 0.0f, 360.0f ), 0.0f );
+				lump.m_Orientation = j % 3;
+				lump.m_flScale = randomStream.RandomFloat( 0.5f, 1.5f );
+
+				int nNewObj = m_DetailObjects.AddToTail();
+				m_DetailObjects[nNewObj].InitSprite( nNewObj, lump.m_Origin, lump.m_Angles );
+				AddSpriteData( nNewObj, lump );
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Builds the sprites of every leaf from a view, once with the per sprite
+// angles and once 4 at a time with SSE, and compares the two
+//-----------------------------------------------------------------------------
+void CDetailObjectSystem::RunSpriteBenchmark( const Vector &viewOrigin, int nIterations )
+{
+	int nObjectCount = m_DetailObjects.Count();
+	if ( nObjectCount == 0 )
+	{
+		Msg( "cl_detail_sprite_benchmark: no detail objects\n" );
+		return;
+	}
+
+	EnumContext_t ctx;
+	ComputeEnumContext( ctx );
+
+	CUtlVector< DetailSpriteVertex_t > verts[2];
+	double flTime[2];
+	for ( int bUseSSE = 0; bUseSSE < 2; ++bUseSSE )
+	{
+		verts[bUseSSE].EnsureCount( nObjectCount * 4 );
+		double flStart = Plat_FloatTime();
+		for ( int i = 0; i < nIterations; ++i )
+		{
+			for ( int j = 0; j < m_DetailLeaves.Count(); ++j )
+			{
+				const DetailLeaf_t &leaf = m_DetailLeaves[j];
+				ComputeSpriteFade( leaf.m_nFirstDetailObject, leaf.m_nDetailObjectCount, viewOrigin, ctx, bUseSSE != 0 );
+				BuildSpriteVertices( leaf.m_nFirstDetailObject, leaf.m_nDetailObjectCount, viewOrigin, 
+					verts[bUseSSE].Base() + leaf.m_nFirstDetailObject * 4, bUseSSE != 0 );
+			}
+		}
+		flTime[bUseSSE] = Plat_FloatTime() - flStart;
+	}
+
+	int nSpriteCount = 0;
+	int nVisibleCount = 0;
+	float flMaxError = 0.0f;
+	for ( int i = 0; i < nObjectCount; ++i )
+	{
+		if ( m_SpriteVisible[i] == 0.0f )
+			continue;
+
+		++nSpriteCount;
+		if ( m_SpriteAlpha[i] >= 1.0f )
+		{
+			++nVisibleCount;
+		}
+
+		for ( int k = 0; k < 4; ++k )
+		{
+			Vector vecDelta;
+			VectorSubtract( verts[0][i * 4 + k].m_Position, verts[1][i * 4 + k].m_Position, vecDelta );
+			flMaxError = max( flMaxError, vecDelta.Length() );
+		}
+	}
+
+	Msg( "%d detail sprites in %d leaves, %d within cl_detaildist\n", nSpriteCount, m_DetailLeaves.Count(), nVisibleCount );
+	Msg( "  per sprite angles: %.3f ms, SSE: %.3f ms per build, max vertex difference %.4f\n", 
+		flTime[0] * 1000.0f / nIterations, flTime[1] * 1000.0f / nIterations, flMaxError );
+}
+
+//-----------------------------------------------------------------------------
+// Runs on a synthetic detail set in a scratch system, so it needs no map and
+// leaves the fade state of a loaded level alone
+//-----------------------------------------------------------------------------
+CON_COMMAND( cl_detail_sprite_benchmark, "Times building the detail sprite vertices of a synthetic 32x32 leaf detail set: cl_detail_sprite_benchmark [iterations] [sprites per leaf]" )
+{
+	int nIterations = 100;
+	if ( engine->Cmd_Argc() > 1 )
+	{
+		nIterations = max( atoi( engine->Cmd_Argv( 1 ) ), 1 );
+	}
+
+	int nSpritesPerLeaf = 32;
+	if ( engine->Cmd_Argc() > 2 )
+	{
+		nSpritesPerLeaf = max( atoi( engine->Cmd_Argv( 2 ) ), 1 );
+	}
+
+	CDetailObjectSystem *pSystem = new CDetailObjectSystem;
+	pSystem->BuildSyntheticDetailSprites( 32, nSpritesPerLeaf );
+	pSystem->RunSpriteBenchmark( vec3_origin, nIterations );
+	delete pSystem;
 }
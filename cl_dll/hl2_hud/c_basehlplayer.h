@@ -27,6 +27,7 @@ class C_BaseHLPlayer : public C_BasePlayer
 public:
 	DECLARE_CLASS( C_BaseHLPlayer, C_BasePlayer );
 	DECLARE_CLIENTCLASS();
+	ALLOW_PARALLEL_BONE_SETUP( C_BaseHLPlayer );
 
 						C_BaseHLPlayer();
 
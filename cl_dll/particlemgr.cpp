@@ -18,6 +18,9 @@
 #include "mempool.h"
 #include "IClientMode.h"
 #include "view_scene.h"
+#include "view.h"
+#include "particle_util.h"
+#include "vstdlib/random.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -28,13 +31,31 @@ CCycleCount	g_ParticleTimer;
 
 static ConVar r_DrawParticles("r_DrawParticles", "1", 0, "Enable/disable particle rendering");
 static ConVar particle_simulateoverflow( "particle_simulateoverflow", "0", 0, "Used for stress-testing particle systems. Randomly denies creation of particles." );
+static ConVar particle_radix_sort( "particle_radix_sort", "1", 0, "Sort particles with an exact radix sort on depth instead of 32 depth buckets." );
 
 
 #define NUM_PARTICLES_PER_BATCH 200
 #define NUM_VERTS_PER_BATCH		(NUM_PARTICLES_PER_BATCH * 4)
 
 #define BUCKET_SORT_EVERY_N		8			// It does a bucket sort for each material approximately every N times.
-#define MAX_TOTAL_PARTICLES		(16*1024)	// Max particles in the bucket sort.
+
+#define SORT_KEY_BITS			16			// Depth is quantized to this many bits for the radix sort.
+#define SORT_RADIX_BITS			8			// Bits sorted by each counting pass.
+#define SORT_RADIX_SIZE			(1 << SORT_RADIX_BITS)
+
+
+// A particle and the depth it sorts by. The sorts work on a contiguous array of these
+// rather than chasing the particle list, which is scattered all over the particle pool.
+struct ParticleSortKey_t
+{
+	float			m_flZ;
+	unsigned int	m_nKey;
+	Particle		*m_pParticle;
+};
+
+// Only one material is ever being sorted at a time, so they all share these.
+static CUtlVector<ParticleSortKey_t> s_SortKeys;
+static CUtlVector<ParticleSortKey_t> s_SortScratch;
 
 
 //-----------------------------------------------------------------------------
@@ -48,6 +69,10 @@ static ConVar particle_simulateoverflow( "particle_simulateoverflow", "0", 0, "U
 CParticleMgr g_ParticleMgr;
 bool g_bParticleMgrConstructed = false; // makes sure it isn't used from constructors.
 
+// Set by particle_sort_benchmark, run at the end of the next view.
+static int s_nSortBenchmarkParticles = 0;
+static int s_nSortBenchmarkIterations = 0;
+
 
 
 
@@ -92,6 +117,7 @@ inline void SwapParticles( Particle *pPrev, Particle *pCur )
 CEffectMaterial::CEffectMaterial()
 {
 	m_Particles.m_pNext = m_Particles.m_pPrev = &m_Particles;
+	m_nArrayParticles = 0;
 }
 
 					
@@ -116,6 +142,7 @@ CParticleEffectBinding::CParticleEffectBinding()
 	m_Max.Init( 50, 50, 50 );
 
 	m_nActiveParticles = 0;
+	m_nArrayParticles = 0;
 
 	m_hRender = INVALID_CLIENT_RENDER_HANDLE;
 	m_FrameCode = 0;
@@ -285,7 +312,7 @@ int CParticleEffectBinding::DrawModel( int flags )
 	
 	
 	// Don't do anything if there are no particles.
-	if( !m_nActiveParticles )
+	if( !m_nActiveParticles && !m_nArrayParticles )
 		return 1;
 
 	
@@ -455,7 +482,16 @@ void CParticleEffectBinding::EnlargeBBoxToContain( const Vector &pt )
 
 int CParticleEffectBinding::GetNumActiveParticles()
 {
-	return m_nActiveParticles;
+	return m_nActiveParticles + m_nArrayParticles;
+}
+
+
+void CParticleEffectBinding::SetNumArrayParticles( IMaterial *pMaterial, int nParticles )
+{
+	CEffectMaterial *pEffectMat = GetEffectMaterial( pMaterial );
+	m_nArrayParticles += nParticles - pEffectMat->m_nArrayParticles;
+	pEffectMat->m_nArrayParticles = nParticles;
+	Assert( m_nArrayParticles >= 0 );
 }
 
 
@@ -476,8 +512,11 @@ int CParticleEffectBinding::DrawMaterialParticles(
 	IMesh *pMesh = NULL;
 	StartDrawMaterialParticles( bOnlySimulate, pMaterial, flTimeDelta, pMesh, builder, particleDraw, bWireframe );
 
-	float zCoords[MAX_TOTAL_PARTICLES];
-	int nZCoords = 0;
+	if( bBucketSort )
+	{
+		s_SortKeys.RemoveAll();
+	}
+
 	float minZ = 1e24, maxZ = -1e24;
 	int nParticlesInCurrentBatch = 0;
 	int nParticlesDrawn = 0;
@@ -503,11 +542,10 @@ int CParticleEffectBinding::DrawMaterialParticles(
 			{
 				if( curZ < minZ ) minZ = curZ;
 				if( curZ > maxZ ) maxZ = curZ;
-				if( nZCoords < MAX_TOTAL_PARTICLES )
-				{
-					zCoords[nZCoords] = curZ;
-					++nZCoords;
-				}
+
+				ParticleSortKey_t &key = s_SortKeys[ s_SortKeys.AddToTail() ];
+				key.m_flZ = curZ;
+				key.m_pParticle = pCur;
 
 				// Update bounding box 
 				// FIXME: Move simulation to Update()?
@@ -551,9 +589,34 @@ int CParticleEffectBinding::DrawMaterialParticles(
 		TestFlushBatch( bOnlySimulate, pMesh, builder, nParticlesInCurrentBatch );
 	}
 
+	// Now the particles the effect keeps in its own arrays. They sort themselves.
+	// Like SimulateAndRender, each one is drawn before it's moved and aged, so
+	// a particle that dies this frame still gets drawn once.
+	if( pMaterial->m_nArrayParticles )
+	{
+		for( int iArrayParticle=0; iArrayParticle < pMaterial->m_nArrayParticles; iArrayParticle++ )
+		{
+			if( !bOnlySimulate )
+			{
+				m_pSim->RenderArrayParticle( pMaterial->m_pMaterial, iArrayParticle, &particleDraw );
+				TestFlushBatch( bOnlySimulate, pMesh, builder, nParticlesInCurrentBatch );
+			}
+
+			++g_nParticlesDrawn;
+			++nParticlesDrawn;
+		}
+
+		m_pSim->SimulateArray( pMaterial->m_pMaterial, flTimeDelta, bbMin, bbMax );
+		if( pMaterial->m_nArrayParticles )
+			bboxSet = true;
+	}
+
 	if( bBucketSort )
 	{
-		DoBucketSort( pMaterial, zCoords, nZCoords, minZ, maxZ );
+		if( particle_radix_sort.GetInt() )
+			DoRadixSort( pMaterial, s_SortKeys.Base(), s_SortKeys.Count(), minZ, maxZ );
+		else
+			DoBucketSort( pMaterial, s_SortKeys.Base(), s_SortKeys.Count(), minZ, maxZ );
 	}
 
 	// Flush out any remaining particles.
@@ -611,7 +674,7 @@ void CParticleEffectBinding::RenderEnd( VMatrix &tempModel, VMatrix &tempView )
 }
 
 
-void CParticleEffectBinding::DoBucketSort( CEffectMaterial *pMaterial, float *zCoords, int nZCoords, float minZ, float maxZ )
+void CParticleEffectBinding::DoBucketSort( CEffectMaterial *pMaterial, ParticleSortKey_t *pKeys, int nKeys, float minZ, float maxZ )
 {
 	// Do an O(N) bucket sort. This helps the sort when there are lots of particles.
 	#define NUM_BUCKETS	32
@@ -622,41 +685,95 @@ void CParticleEffectBinding::DoBucketSort( CEffectMaterial *pMaterial, float *zC
 	}
 	
 	// Sort into buckets.
-	int iCurParticle = 0;
-	Particle *pNext, *pCur;
-	for( pCur=pMaterial->m_Particles.m_pNext; pCur != &pMaterial->m_Particles; pCur=pNext )
+	for( int iCurParticle=0; iCurParticle < nKeys; iCurParticle++ )
 	{
-		pNext = pCur->m_pNext;
-		if( iCurParticle >= nZCoords )
-			break;
+		Particle *pCur = pKeys[iCurParticle].m_pParticle;
 
 		// Remove it..
 		UnlinkParticle( pCur );
 
 		// Add it to the appropriate bucket.
-		float flPercent = (zCoords[iCurParticle] - minZ) / (maxZ - minZ);
+		float flPercent = (maxZ > minZ) ? (pKeys[iCurParticle].m_flZ - minZ) / (maxZ - minZ) : 0;
 		int iAddBucket = (int)( flPercent * (NUM_BUCKETS - 0.0001f) );
-		iAddBucket = NUM_BUCKETS - iAddBucket - 1;
 		Assert( iAddBucket >= 0 && iAddBucket < NUM_BUCKETS );
 
-		InsertParticleAfter( pCur, &buckets[iAddBucket] );
-
-		++iCurParticle;
+		InsertParticleBefore( pCur, &buckets[iAddBucket] );
 	}
 
 	// Put the buckets back into the main list.
 	for( int iReAddBucket=0; iReAddBucket < NUM_BUCKETS; iReAddBucket++ )
 	{
 		Particle *pListHead = &buckets[iReAddBucket];
-		for( pCur=pListHead->m_pNext; pCur != pListHead; pCur=pNext )
+		Particle *pNext;
+		for( Particle *pCur=pListHead->m_pNext; pCur != pListHead; pCur=pNext )
 		{
 			pNext = pCur->m_pNext;
-			InsertParticleAfter( pCur, &pMaterial->m_Particles );
-			--iCurParticle;
+			InsertParticleBefore( pCur, &pMaterial->m_Particles );
+		}
+	}
+}
+
+
+void CParticleEffectBinding::DoRadixSort( CEffectMaterial *pMaterial, ParticleSortKey_t *pKeys, int nKeys, float minZ, float maxZ )
+{
+	if( nKeys == 0 )
+		return;
+
+	// Quantize the depths over the range they covered this frame.
+	const unsigned int nMaxKey = (1 << SORT_KEY_BITS) - 1;
+	float flScale = (maxZ > minZ) ? nMaxKey / (maxZ - minZ) : 0;
+	for( int i=0; i < nKeys; i++ )
+	{
+		unsigned int nKey = (unsigned int)( (pKeys[i].m_flZ - minZ) * flScale );
+		pKeys[i].m_nKey = min( nKey, nMaxKey );
+	}
+
+	// LSD radix sort: a stable counting sort on each digit, least significant first.
+	// That's O(N) and, unlike the buckets, exact down to the quantized key.
+	s_SortScratch.EnsureCount( nKeys );
+	ParticleSortKey_t *pSrc = pKeys;
+	ParticleSortKey_t *pDest = s_SortScratch.Base();
+	
+	for( int iShift=0; iShift < SORT_KEY_BITS; iShift += SORT_RADIX_BITS )
+	{
+		int counts[SORT_RADIX_SIZE];
+		memset( counts, 0, sizeof( counts ) );
+		for( int i=0; i < nKeys; i++ )
+		{
+			++counts[ (pSrc[i].m_nKey >> iShift) & (SORT_RADIX_SIZE-1) ];
+		}
+
+		// Skip the pass if every key has the same digit (usually the top one, when the
+		// effect spans little of the depth range).
+		if( counts[ (pSrc[0].m_nKey >> iShift) & (SORT_RADIX_SIZE-1) ] == nKeys )
+			continue;
+
+		// Turn the counts into where each digit starts.
+		int nTotal = 0;
+		for( int iDigit=0; iDigit < SORT_RADIX_SIZE; iDigit++ )
+		{
+			int nCount = counts[iDigit];
+			counts[iDigit] = nTotal;
+			nTotal += nCount;
+		}
+
+		for( int i=0; i < nKeys; i++ )
+		{
+			pDest[ counts[ (pSrc[i].m_nKey >> iShift) & (SORT_RADIX_SIZE-1) ]++ ] = pSrc[i];
 		}
+
+		ParticleSortKey_t *pTemp = pSrc;
+		pSrc = pDest;
+		pDest = pTemp;
 	}
 
-	Assert(iCurParticle==0);
+	// Relink the particles in sorted order.
+	for( int i=0; i < nKeys; i++ )
+	{
+		Particle *pCur = pSrc[i].m_pParticle;
+		UnlinkParticle( pCur );
+		InsertParticleBefore( pCur, &pMaterial->m_Particles );
+	}
 }
 
 
@@ -693,6 +810,7 @@ void CParticleEffectBinding::Term()
 		delete pMaterial;
 	}	
 	m_Materials.Purge();
+	m_nArrayParticles = 0;
 
 	memset( m_EffectMaterialHash, 0, sizeof( m_EffectMaterialHash ) );
 }
@@ -732,15 +850,23 @@ void CParticleEffectBinding::TestFlushBatch( bool bOnlySimulate, IMesh *pMesh, C
 
 bool CParticleEffectBinding::RecalculateBoundingBox()
 {
+	// Array particles push the bbox out themselves as they're added and
+	// simulated, so keep what they've done to it.
 	if( m_nActiveParticles == 0 )
 	{
+		if( m_nArrayParticles )
+			return true;
+
 		m_pSim->GetSortOrigin( m_Min );
 		m_Max = m_Min;
 		return false;
 	}
 
-	m_Min.Init(  1e28,  1e28,  1e28 );
-	m_Max.Init( -1e28, -1e28, -1e28 );
+	if( !m_nArrayParticles )
+	{
+		m_Min.Init(  1e28,  1e28,  1e28 );
+		m_Max.Init( -1e28, -1e28, -1e28 );
+	}
 
 	FOR_EACH_LL( m_Materials, iMaterial )
 	{
@@ -982,6 +1108,12 @@ void CParticleMgr::SimulateUndrawnEffects()
 			pEffect->DrawModel( 0 );
 		}
 	}
+
+	if( s_nSortBenchmarkIterations )
+	{
+		RunSortBenchmark( s_nSortBenchmarkParticles, s_nSortBenchmarkIterations );
+		s_nSortBenchmarkIterations = 0;
+	}
 }
 
 
@@ -1081,6 +1213,137 @@ IMaterial* CParticleMgr::GetPMaterial( const char *pMaterialName )
 }
 
 
+//-----------------------------------------------------------------------------
+// Sort benchmark
+//-----------------------------------------------------------------------------
+
+// Particles drifting around in front of the camera so their order keeps changing.
+class CSortBenchmarkEffect : public IParticleEffect
+{
+public:
+	virtual bool SimulateAndRender( Particle *pInParticle, ParticleDraw *pDraw, float &sortKey )
+	{
+		StandardParticle_t *pParticle = (StandardParticle_t*)pInParticle;
+		pParticle->m_Pos += pParticle->m_Velocity * pDraw->GetTimeDelta();
+
+		Vector tPos;
+		TransformParticle( g_ParticleMgr.GetModelView(), pParticle->m_Pos, tPos );
+		sortKey = tPos.z;
+
+		// Next to invisible, but the vertices get built all the same.
+		RenderParticle_Color255Size( pDraw, tPos, Vector( 255, 255, 255 ), 1, 4 );
+		return true;
+	}
+
+	virtual void GetSortOrigin( Vector &vSortOrigin )
+	{
+		vSortOrigin = CurrentViewOrigin();
+	}
+};
+
+
+void CParticleMgr::RunSortBenchmark( int nParticles, int nIterations )
+{
+	// The particles come out of a pool of their own so the benchmark doesn't
+	// starve the real effects (or get starved by them).
+	CMemoryPool *pSavedBucket = m_pParticleBucket;
+	m_pParticleBucket = new CMemoryPool( PARTICLE_SIZE, nParticles, CMemoryPool::GROW_NONE );
+
+	int nSavedRadixSort = particle_radix_sort.GetInt();
+
+	CSortBenchmarkEffect sim;
+	double flTimes[2];
+	int nOutOfOrder[2];
+	int nAdded = 0;
+
+	for( int iRadix=0; iRadix < 2; iRadix++ )
+	{
+		particle_radix_sort.SetValue( iRadix );
+
+		CParticleEffectBinding binding;
+		binding.Init( this, &sim );
+		IMaterial *pMaterial = binding.FindOrAddMaterial( "particle/particle_smokegrenade" );
+
+		// Both sorts start from the same particles.
+		CUniformRandomStream stream;
+		stream.SetSeed( 1 );
+		for( nAdded=0; nAdded < nParticles; nAdded++ )
+		{
+			StandardParticle_t *pParticle = (StandardParticle_t*)binding.AddParticle( sizeof( StandardParticle_t ), pMaterial );
+			if( !pParticle )
+				break;
+
+			pParticle->m_Pos = CurrentViewOrigin() + CurrentViewForward() * stream.RandomFloat( 64, 1024 );
+			pParticle->m_Pos.x += stream.RandomFloat( -256, 256 );
+			pParticle->m_Pos.y += stream.RandomFloat( -256, 256 );
+			pParticle->m_Pos.z += stream.RandomFloat( -256, 256 );
+			pParticle->m_Velocity.Init( stream.RandomFloat( -64, 64 ), stream.RandomFloat( -64, 64 ), stream.RandomFloat( -64, 64 ) );
+		}
+
+		CEffectMaterial *pEffectMat = binding.GetEffectMaterial( pMaterial );
+
+		VMatrix mTempModel, mTempView;
+		binding.RenderStart( mTempModel, mTempView );
+
+		double flStart = Plat_FloatTime();
+		for( int i=0; i < nIterations; i++ )
+		{
+			Vector bbMin( FLT_MAX, FLT_MAX, FLT_MAX ), bbMax( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+			bool bboxSet = false;
+			binding.DrawMaterialParticles( true, false, pEffectMat, 1.0f / 60.0f, bbMin, bbMax, bboxSet, false );
+		}
+		flTimes[iRadix] = Plat_FloatTime() - flStart;
+
+		// Count the neighbors that ended up the wrong way around.
+		nOutOfOrder[iRadix] = 0;
+		float prevZ = -FLT_MAX;
+		for( Particle *pCur=pEffectMat->m_Particles.m_pNext; pCur != &pEffectMat->m_Particles; pCur=pCur->m_pNext )
+		{
+			Vector tPos;
+			TransformParticle( m_mModelView, pCur->m_Pos, tPos );
+			if( tPos.z < prevZ )
+				++nOutOfOrder[iRadix];
+			prevZ = tPos.z;
+		}
+
+		binding.RenderEnd( mTempModel, mTempView );
+
+		// It was never added to the effect list, so don't let it remove itself.
+		binding.Term();
+		binding.m_pParticleMgr = NULL;
+	}
+
+	particle_radix_sort.SetValue( nSavedRadixSort );
+
+	delete m_pParticleBucket;
+	m_pParticleBucket = pSavedBucket;
+
+	Msg( "%d particles, %d iterations of simulate + sort + mesh build:\n", nAdded, nIterations );
+	Msg( "  bucket sort: %.3f ms per iteration, %d particles out of order\n", flTimes[0] * 1000.0f / nIterations, nOutOfOrder[0] );
+	Msg( "  radix sort:  %.3f ms per iteration, %d particles out of order\n", flTimes[1] * 1000.0f / nIterations, nOutOfOrder[1] );
+}
+
+
+CON_COMMAND( particle_sort_benchmark, "Times simulating, sorting and drawing a synthetic effect with both particle sorts: particle_sort_benchmark [particles] [iterations]" )
+{
+	int nParticles = 10000;
+	int nIterations = 100;
+	if( engine->Cmd_Argc() > 1 )
+	{
+		nParticles = max( atoi( engine->Cmd_Argv( 1 ) ), 1 );
+	}
+	if( engine->Cmd_Argc() > 2 )
+	{
+		nIterations = max( atoi( engine->Cmd_Argv( 2 ) ), 1 );
+	}
+
+	// It needs to draw, so it has to wait for the view to render.
+	s_nSortBenchmarkParticles = nParticles;
+	s_nSortBenchmarkIterations = nIterations;
+	Msg( "particle_sort_benchmark: runs at the end of the next rendered view\n" );
+}
+
+
 // ------------------------------------------------------------------------------------ //
 // ------------------------------------------------------------------------------------ //
 float Helper_GetTime()
@@ -132,6 +132,7 @@ class ParticleDraw;
 class CMeshBuilder;
 class CMemoryPool;
 class CEffectMaterial;
+struct ParticleSortKey_t;
 
 
 #define INVALID_MATERIAL_HANDLE	NULL
@@ -173,6 +174,9 @@ public:
 	IMaterial *m_pMaterial;
 	Particle m_Particles;
 	CEffectMaterial *m_pHashedNext;
+
+	// How many particles the effect keeps in its own arrays with this material.
+	int m_nArrayParticles;
 };
 
 
@@ -227,6 +231,14 @@ public:
 
 	// Fill in the origin used to sort this entity.
 	virtual void	GetParticlePosition( Particle *pParticle, Vector& worldpos ) { worldpos = pParticle->m_Pos; }
+
+	// Effects can keep particles in arrays of their own rather than in the particle manager's
+	// lists (see CSimpleArrayEmitter), and tell the binding how many each material has with
+	// CParticleEffectBinding::SetNumArrayParticles. Each time a material is drawn, RenderArrayParticle
+	// is called for each of its array particles, then SimulateArray is called to move and age them
+	// all (pushing bbMin/bbMax out to contain the ones that are left).
+	virtual void	SimulateArray( IMaterial *pMaterial, float flTimeDelta, Vector &bbMin, Vector &bbMax ) {}
+	virtual void	RenderArrayParticle( IMaterial *pMaterial, int iParticle, ParticleDraw *pParticleDraw ) {}
 };
 
 
@@ -316,6 +328,10 @@ public:
 	// Get the current number of particles in the effect.
 	int				GetNumActiveParticles();
 
+	// Effects that keep particles in their own arrays call this whenever the number
+	// using a material changes. See IParticleEffect::SimulateArray.
+	void			SetNumArrayParticles( IMaterial *pMaterial, int nParticles );
+
 
 private:
 
@@ -362,10 +378,20 @@ private:
 	void			BBoxCalcStart( bool bBucketSort, Vector &bbMin, Vector &bbMax );
 	void			BBoxCalcEnd( bool bBucketSort, bool bboxSet, Vector &bbMin, Vector &bbMax );
 	
+	// Both sorts leave the particles in pKeys ordered by ascending sort key at the
+	// end of the material's list. The radix sort is exact to 1/65536th of the
+	// depth range, the bucket sort only to 1/32nd.
 	void			DoBucketSort( 
 		CEffectMaterial *CEffectMaterial, 
-		float *zCoords, 
-		int nZCoords,
+		ParticleSortKey_t *pKeys, 
+		int nKeys,
+		float minZ,
+		float maxZ );
+
+	void			DoRadixSort( 
+		CEffectMaterial *CEffectMaterial, 
+		ParticleSortKey_t *pKeys, 
+		int nKeys,
 		float minZ,
 		float maxZ );
 
@@ -434,6 +460,9 @@ private:
 	// Number of active particles.
 	unsigned short					m_nActiveParticles;
 
+	// Number of particles the effect keeps in its own arrays.
+	int								m_nArrayParticles;
+
 	// See CParticleMgr::m_FrameCode.
 	unsigned short					m_FrameCode;
 
@@ -537,6 +566,10 @@ private:
 	// Initialize the array of point-sourced lights.
 	void			InitializePointSourceLights();
 
+	// Times simulating, sorting and building the mesh of a synthetic effect.
+	// Has to run while the view is rendering so it can draw.
+	void			RunSortBenchmark( int nParticles, int nIterations );
+
 
 public:
 
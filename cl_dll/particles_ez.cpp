@@ -10,7 +10,7 @@
 
 
 // Singletons for each type of particle system.
-static CSmartPtr<CSimpleEmitter> g_pSimpleSingleton;
+static CSmartPtr<CSimpleArrayEmitter> g_pSimpleSingleton;
 static CSmartPtr<CEmberEffect> g_pEmberSingleton;
 static CSmartPtr<CFireSmokeEffect> g_pFireSmokeSingleton;
 static CSmartPtr<CFireParticle> g_pFireSingleton;
@@ -35,7 +35,7 @@ public:
 
 	virtual void LevelInitPreEntity()
 	{
-		g_pSimpleSingleton = InitSingleton( CSimpleEmitter::Create( "Simple Particle Singleton" ) );
+		g_pSimpleSingleton = InitSingleton( CSimpleArrayEmitter::Create( "Simple Particle Singleton" ) );
 		g_pEmberSingleton = InitSingleton( CEmberEffect::Create( "Ember Particle Singleton" ) );
 		g_pFireSmokeSingleton = InitSingleton( CFireSmokeEffect::Create( "Fire Smoke Particle Singleton" ) );
 		g_pFireSingleton = InitSingleton( CFireParticle::Create( "Fire Particle Singleton" ) );
@@ -78,8 +78,7 @@ void AddSimpleParticle( const SimpleParticle *pParticle, PMaterialHandle hMateri
 {
 	if ( g_pSimpleSingleton.IsValid() )
 	{
-		SimpleParticle *pNew = g_pSimpleSingleton->AddSimpleParticle( hMaterial, pParticle->m_Pos );
-		CopyParticle( pParticle, pNew );
+		g_pSimpleSingleton->AddSimpleParticle( pParticle, hMaterial );
 	}
 }
 
@@ -7,6 +7,7 @@
 #include "cbase.h"
 #include "particles_simple.h"
 #include "env_wind_shared.h"
+#include <xmmintrin.h>
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -357,6 +358,474 @@ bool CSimpleEmitter::SimulateAndRender( Particle *pInParticle, ParticleDraw *pDr
 	return true;
 }
 
+//==================================================
+// CSimpleParticleArray
+//==================================================
+
+#define SIMPLE_ARRAY_MIN_CAPACITY	64
+#define SIMPLE_ARRAY_MAX_CAPACITY	8192
+#define SIMPLE_ARRAY_FREE_BLOCKS	32		// Most blocks of the minimum capacity kept around for reuse.
+
+static int SimpleArrayBlockSize( int nCapacity )
+{
+	// Extra 15 bytes to align the streams on.
+	return nCapacity * ( NUM_SIMPLE_STREAMS * sizeof( float ) + sizeof( SimpleParticleLook_t ) ) + 15;
+}
+
+// Effects come and go all the time and most never need more than the minimum
+// capacity, so blocks of that size are kept for the next effect to use.
+class CSimpleArrayBlockPool
+{
+public:
+	~CSimpleArrayBlockPool()
+	{
+		for ( int i = 0; i < m_FreeBlocks.Count(); i++ )
+		{
+			free( m_FreeBlocks[i] );
+		}
+	}
+
+	void *Alloc( int nCapacity )
+	{
+		if ( nCapacity == SIMPLE_ARRAY_MIN_CAPACITY && m_FreeBlocks.Count() )
+		{
+			int iLast = m_FreeBlocks.Count() - 1;
+			void *pBlock = m_FreeBlocks[iLast];
+			m_FreeBlocks.Remove( iLast );
+			return pBlock;
+		}
+
+		return malloc( SimpleArrayBlockSize( nCapacity ) );
+	}
+
+	void Free( void *pBlock, int nCapacity )
+	{
+		if ( nCapacity == SIMPLE_ARRAY_MIN_CAPACITY && m_FreeBlocks.Count() < SIMPLE_ARRAY_FREE_BLOCKS )
+		{
+			m_FreeBlocks.AddToTail( pBlock );
+		}
+		else
+		{
+			free( pBlock );
+		}
+	}
+
+private:
+	CUtlVector<void*>	m_FreeBlocks;
+};
+
+static CSimpleArrayBlockPool s_SimpleArrayBlocks;
+
+
+CSimpleParticleArray::CSimpleParticleArray( IMaterial *pMaterial )
+{
+	m_pMaterial = pMaterial;
+	m_nCount = 0;
+	m_nCapacity = 0;
+	m_pBlock = NULL;
+	memset( m_pStreams, 0, sizeof( m_pStreams ) );
+	m_pLook = NULL;
+}
+
+
+CSimpleParticleArray::~CSimpleParticleArray()
+{
+	if ( m_pBlock )
+	{
+		s_SimpleArrayBlocks.Free( m_pBlock, m_nCapacity );
+	}
+}
+
+
+void CSimpleParticleArray::SetCapacity( int nCapacity )
+{
+	Assert( nCapacity >= m_nCount && ( nCapacity & 3 ) == 0 );
+
+	void *pBlock = s_SimpleArrayBlocks.Alloc( nCapacity );
+	float *pStreams = (float*)( ( (unsigned long)pBlock + 15 ) & ~15 );
+
+	for ( int i = 0; i < NUM_SIMPLE_STREAMS; i++ )
+	{
+		float *pStream = pStreams + i * nCapacity;
+		if ( m_nCount )
+		{
+			memcpy( pStream, m_pStreams[i], m_nCount * sizeof( float ) );
+		}
+		m_pStreams[i] = pStream;
+	}
+
+	SimpleParticleLook_t *pLook = (SimpleParticleLook_t*)( pStreams + NUM_SIMPLE_STREAMS * nCapacity );
+	if ( m_nCount )
+	{
+		memcpy( pLook, m_pLook, m_nCount * sizeof( SimpleParticleLook_t ) );
+	}
+	m_pLook = pLook;
+
+	if ( m_pBlock )
+	{
+		s_SimpleArrayBlocks.Free( m_pBlock, m_nCapacity );
+	}
+
+	m_pBlock = pBlock;
+	m_nCapacity = nCapacity;
+}
+
+
+bool CSimpleParticleArray::AddParticle( const SimpleParticle &particle )
+{
+	if ( m_nCount == m_nCapacity )
+	{
+		if ( m_nCapacity >= SIMPLE_ARRAY_MAX_CAPACITY )
+			return false;
+
+		SetCapacity( m_nCapacity ? m_nCapacity * 2 : SIMPLE_ARRAY_MIN_CAPACITY );
+	}
+
+	int i = m_nCount++;
+	m_pStreams[SIMPLE_STREAM_POS_X][i] = particle.m_Pos.x;
+	m_pStreams[SIMPLE_STREAM_POS_Y][i] = particle.m_Pos.y;
+	m_pStreams[SIMPLE_STREAM_POS_Z][i] = particle.m_Pos.z;
+	m_pStreams[SIMPLE_STREAM_VEL_X][i] = particle.m_vecVelocity.x;
+	m_pStreams[SIMPLE_STREAM_VEL_Y][i] = particle.m_vecVelocity.y;
+	m_pStreams[SIMPLE_STREAM_VEL_Z][i] = particle.m_vecVelocity.z;
+	m_pStreams[SIMPLE_STREAM_LIFETIME][i] = particle.m_flLifetime;
+	m_pStreams[SIMPLE_STREAM_DIETIME][i] = particle.m_flDieTime;
+	m_pStreams[SIMPLE_STREAM_ROLL][i] = particle.m_flRoll;
+	m_pStreams[SIMPLE_STREAM_ROLLDELTA][i] = particle.m_flRollDelta;
+	m_pStreams[SIMPLE_STREAM_DEPTH][i] = 0;
+
+	SimpleParticleLook_t &look = m_pLook[i];
+	look.m_uchColor[0] = particle.m_uchColor[0];
+	look.m_uchColor[1] = particle.m_uchColor[1];
+	look.m_uchColor[2] = particle.m_uchColor[2];
+	look.m_uchStartAlpha = particle.m_uchStartAlpha;
+	look.m_uchEndAlpha = particle.m_uchEndAlpha;
+	look.m_uchStartSize = particle.m_uchStartSize;
+	look.m_uchEndSize = particle.m_uchEndSize;
+	look.m_iFlags = particle.m_iFlags;
+	return true;
+}
+
+
+void CSimpleParticleArray::CopyParticle( int iDest, int iSrc )
+{
+	for ( int i = 0; i < NUM_SIMPLE_STREAMS; i++ )
+	{
+		m_pStreams[i][iDest] = m_pStreams[i][iSrc];
+	}
+	m_pLook[iDest] = m_pLook[iSrc];
+}
+
+
+void CSimpleParticleArray::SwapParticles( int iParticle, int iOther )
+{
+	for ( int i = 0; i < NUM_SIMPLE_STREAMS; i++ )
+	{
+		float flTemp = m_pStreams[i][iParticle];
+		m_pStreams[i][iParticle] = m_pStreams[i][iOther];
+		m_pStreams[i][iOther] = flTemp;
+	}
+
+	SimpleParticleLook_t temp = m_pLook[iParticle];
+	m_pLook[iParticle] = m_pLook[iOther];
+	m_pLook[iOther] = temp;
+}
+
+
+void CSimpleParticleArray::RemoveParticle( int iParticle )
+{
+	Assert( iParticle >= 0 && iParticle < m_nCount );
+
+	--m_nCount;
+	if ( iParticle != m_nCount )
+	{
+		CopyParticle( iParticle, m_nCount );
+	}
+}
+
+
+bool CSimpleParticleArray::SimulateScalar( int iFirst, int nParticles, float flTimeDelta, const Vector &vAccelDelta, float flDragScale, const VMatrix &mView )
+{
+	bool bDied = false;
+	for ( int i = iFirst; i < nParticles; i++ )
+	{
+		float vx = ( m_pStreams[SIMPLE_STREAM_VEL_X][i] + vAccelDelta.x ) * flDragScale;
+		float vy = ( m_pStreams[SIMPLE_STREAM_VEL_Y][i] + vAccelDelta.y ) * flDragScale;
+		float vz = ( m_pStreams[SIMPLE_STREAM_VEL_Z][i] + vAccelDelta.z ) * flDragScale;
+		m_pStreams[SIMPLE_STREAM_VEL_X][i] = vx;
+		m_pStreams[SIMPLE_STREAM_VEL_Y][i] = vy;
+		m_pStreams[SIMPLE_STREAM_VEL_Z][i] = vz;
+
+		float x = m_pStreams[SIMPLE_STREAM_POS_X][i] + vx * flTimeDelta;
+		float y = m_pStreams[SIMPLE_STREAM_POS_Y][i] + vy * flTimeDelta;
+		float z = m_pStreams[SIMPLE_STREAM_POS_Z][i] + vz * flTimeDelta;
+		m_pStreams[SIMPLE_STREAM_POS_X][i] = x;
+		m_pStreams[SIMPLE_STREAM_POS_Y][i] = y;
+		m_pStreams[SIMPLE_STREAM_POS_Z][i] = z;
+
+		m_pStreams[SIMPLE_STREAM_DEPTH][i] = mView.m[2][0] * x + mView.m[2][1] * y + mView.m[2][2] * z + mView.m[2][3];
+		m_pStreams[SIMPLE_STREAM_ROLL][i] += m_pStreams[SIMPLE_STREAM_ROLLDELTA][i] * flTimeDelta;
+
+		m_pStreams[SIMPLE_STREAM_LIFETIME][i] += flTimeDelta;
+		if ( m_pStreams[SIMPLE_STREAM_LIFETIME][i] >= m_pStreams[SIMPLE_STREAM_DIETIME][i] )
+		{
+			bDied = true;
+		}
+	}
+
+	return bDied;
+}
+
+
+bool CSimpleParticleArray::SimulateSSE( int nParticles, float flTimeDelta, const Vector &vAccelDelta, float flDragScale, const VMatrix &mView )
+{
+	Assert( ( nParticles & 3 ) == 0 );
+
+	__m128 dt = _mm_set1_ps( flTimeDelta );
+	__m128 drag = _mm_set1_ps( flDragScale );
+	__m128 ax = _mm_set1_ps( vAccelDelta.x );
+	__m128 ay = _mm_set1_ps( vAccelDelta.y );
+	__m128 az = _mm_set1_ps( vAccelDelta.z );
+	__m128 m0 = _mm_set1_ps( mView.m[2][0] );
+	__m128 m1 = _mm_set1_ps( mView.m[2][1] );
+	__m128 m2 = _mm_set1_ps( mView.m[2][2] );
+	__m128 m3 = _mm_set1_ps( mView.m[2][3] );
+
+	float *pPosX = m_pStreams[SIMPLE_STREAM_POS_X];
+	float *pPosY = m_pStreams[SIMPLE_STREAM_POS_Y];
+	float *pPosZ = m_pStreams[SIMPLE_STREAM_POS_Z];
+	float *pVelX = m_pStreams[SIMPLE_STREAM_VEL_X];
+	float *pVelY = m_pStreams[SIMPLE_STREAM_VEL_Y];
+	float *pVelZ = m_pStreams[SIMPLE_STREAM_VEL_Z];
+	float *pLifetime = m_pStreams[SIMPLE_STREAM_LIFETIME];
+	float *pDieTime = m_pStreams[SIMPLE_STREAM_DIETIME];
+	float *pRoll = m_pStreams[SIMPLE_STREAM_ROLL];
+	float *pRollDelta = m_pStreams[SIMPLE_STREAM_ROLLDELTA];
+	float *pDepth = m_pStreams[SIMPLE_STREAM_DEPTH];
+
+	int nDied = 0;
+	for ( int i = 0; i < nParticles; i += 4 )
+	{
+		__m128 vx = _mm_mul_ps( _mm_add_ps( _mm_load_ps( pVelX + i ), ax ), drag );
+		__m128 vy = _mm_mul_ps( _mm_add_ps( _mm_load_ps( pVelY + i ), ay ), drag );
+		__m128 vz = _mm_mul_ps( _mm_add_ps( _mm_load_ps( pVelZ + i ), az ), drag );
+		_mm_store_ps( pVelX + i, vx );
+		_mm_store_ps( pVelY + i, vy );
+		_mm_store_ps( pVelZ + i, vz );
+
+		__m128 x = _mm_add_ps( _mm_load_ps( pPosX + i ), _mm_mul_ps( vx, dt ) );
+		__m128 y = _mm_add_ps( _mm_load_ps( pPosY + i ), _mm_mul_ps( vy, dt ) );
+		__m128 z = _mm_add_ps( _mm_load_ps( pPosZ + i ), _mm_mul_ps( vz, dt ) );
+		_mm_store_ps( pPosX + i, x );
+		_mm_store_ps( pPosY + i, y );
+		_mm_store_ps( pPosZ + i, z );
+
+		__m128 depth = _mm_add_ps( _mm_add_ps( _mm_mul_ps( m0, x ), _mm_mul_ps( m1, y ) ), _mm_add_ps( _mm_mul_ps( m2, z ), m3 ) );
+		_mm_store_ps( pDepth + i, depth );
+
+		_mm_store_ps( pRoll + i, _mm_add_ps( _mm_load_ps( pRoll + i ), _mm_mul_ps( _mm_load_ps( pRollDelta + i ), dt ) ) );
+
+		__m128 lifetime = _mm_add_ps( _mm_load_ps( pLifetime + i ), dt );
+		_mm_store_ps( pLifetime + i, lifetime );
+		nDied |= _mm_movemask_ps( _mm_cmpge_ps( lifetime, _mm_load_ps( pDieTime + i ) ) );
+	}
+
+	return nDied != 0;
+}
+
+
+void CSimpleParticleArray::Simulate( float flTimeDelta, const Vector &vAccel, float flDrag, const VMatrix &mView, Vector &bbMin, Vector &bbMax )
+{
+	Vector vAccelDelta = vAccel * flTimeDelta;
+	float flDragScale = max( 0.0f, 1.0f - flDrag * flTimeDelta );
+
+	// Everything but the last few goes four at a time.
+	int nSSE = 0;
+	bool bDied = false;
+	if ( MathLib_SSEEnabled() )
+	{
+		nSSE = m_nCount & ~3;
+		bDied = SimulateSSE( nSSE, flTimeDelta, vAccelDelta, flDragScale, mView );
+	}
+	if ( SimulateScalar( nSSE, m_nCount, flTimeDelta, vAccelDelta, flDragScale, mView ) )
+	{
+		bDied = true;
+	}
+
+	if ( bDied )
+	{
+		for ( int i = 0; i < m_nCount; )
+		{
+			if ( m_pStreams[SIMPLE_STREAM_LIFETIME][i] >= m_pStreams[SIMPLE_STREAM_DIETIME][i] )
+			{
+				RemoveParticle( i );
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	// One pass of the same incremental sort CParticleEffectBinding does on its lists,
+	// which grows the bbox as it goes.
+	float *pDepth = m_pStreams[SIMPLE_STREAM_DEPTH];
+	for ( int i = 0; i < m_nCount; i++ )
+	{
+		Vector vPos( m_pStreams[SIMPLE_STREAM_POS_X][i], m_pStreams[SIMPLE_STREAM_POS_Y][i], m_pStreams[SIMPLE_STREAM_POS_Z][i] );
+		VectorMin( bbMin, vPos, bbMin );
+		VectorMax( bbMax, vPos, bbMax );
+
+		if ( i > 0 && pDepth[i-1] > pDepth[i] )
+		{
+			SwapParticles( i-1, i );
+		}
+	}
+}
+
+
+//==================================================
+// CSimpleArrayEmitter
+//==================================================
+
+CSimpleArrayEmitter::CSimpleArrayEmitter( const char *pDebugName ) : CParticleEffect( pDebugName )
+{
+	m_pLastArray = NULL;
+
+	m_flNearClipMin	= 16.0f;
+	m_flNearClipMax	= 64.0f;
+	m_vAccel.Init();
+	m_flDrag = 0.0f;
+}
+
+
+CSimpleArrayEmitter::~CSimpleArrayEmitter()
+{
+	m_Arrays.PurgeAndDeleteElements();
+}
+
+
+CSmartPtr<CSimpleArrayEmitter> CSimpleArrayEmitter::Create( const char *pDebugName )
+{
+	CSimpleArrayEmitter *pRet = new CSimpleArrayEmitter( pDebugName );
+	pRet->SetDynamicallyAllocated( true );
+	return pRet;
+}
+
+
+void CSimpleArrayEmitter::SetNearClip( float nearClipMin, float nearClipMax )
+{
+	m_flNearClipMin = nearClipMin;
+	m_flNearClipMax = nearClipMax;
+}
+
+
+void CSimpleArrayEmitter::SetAcceleration( const Vector &vAccel )
+{
+	m_vAccel = vAccel;
+}
+
+
+void CSimpleArrayEmitter::SetDrag( float flDrag )
+{
+	m_flDrag = flDrag;
+}
+
+
+CSimpleParticleArray* CSimpleArrayEmitter::FindArray( IMaterial *pMaterial )
+{
+	if ( m_pLastArray && m_pLastArray->GetMaterial() == pMaterial )
+		return m_pLastArray;
+
+	for ( int i = 0; i < m_Arrays.Count(); i++ )
+	{
+		if ( m_Arrays[i]->GetMaterial() == pMaterial )
+		{
+			m_pLastArray = m_Arrays[i];
+			return m_pLastArray;
+		}
+	}
+
+	return NULL;
+}
+
+
+bool CSimpleArrayEmitter::AddSimpleParticle( const SimpleParticle *pParticle, PMaterialHandle hMaterial )
+{
+	if ( !hMaterial )
+		return false;
+
+	CSimpleParticleArray *pArray = FindArray( hMaterial );
+	if ( !pArray )
+	{
+		pArray = new CSimpleParticleArray( hMaterial );
+		m_Arrays.AddToTail( pArray );
+	}
+
+	if ( !pArray->AddParticle( *pParticle ) )
+		return false;
+
+	m_ParticleEffect.SetNumArrayParticles( hMaterial, pArray->Count() );
+	m_ParticleEffect.EnlargeBBoxToContain( pParticle->m_Pos );
+	return true;
+}
+
+
+bool CSimpleArrayEmitter::SimulateAndRender( Particle *pParticle, ParticleDraw *pDraw, float &sortKey )
+{
+	// All the particles are in the arrays.
+	Assert( false );
+	return false;
+}
+
+
+void CSimpleArrayEmitter::SimulateArray( IMaterial *pMaterial, float flTimeDelta, Vector &bbMin, Vector &bbMax )
+{
+	CSimpleParticleArray *pArray = FindArray( pMaterial );
+	if ( !pArray )
+		return;
+
+	pArray->Simulate( flTimeDelta, m_vAccel, m_flDrag, g_ParticleMgr.GetModelView(), bbMin, bbMax );
+	m_ParticleEffect.SetNumArrayParticles( pMaterial, pArray->Count() );
+
+	// Go away if we're released and that was the last of the particles.
+	if ( m_ParticleEffect.GetNumActiveParticles() == 0 && IsReleased() )
+	{
+		m_ParticleEffect.SetRemoveFlag();
+	}
+}
+
+
+void CSimpleArrayEmitter::RenderArrayParticle( IMaterial *pMaterial, int iParticle, ParticleDraw *pDraw )
+{
+	CSimpleParticleArray *pArray = FindArray( pMaterial );
+	Assert( pArray && iParticle < pArray->Count() );
+
+	Vector vPos( 
+		pArray->GetStream( SIMPLE_STREAM_POS_X )[iParticle],
+		pArray->GetStream( SIMPLE_STREAM_POS_Y )[iParticle],
+		pArray->GetStream( SIMPLE_STREAM_POS_Z )[iParticle] );
+
+	Vector tPos;
+	TransformParticle( g_ParticleMgr.GetModelView(), vPos, tPos );
+
+	const SimpleParticleLook_t &look = pArray->GetLook( iParticle );
+	float t = pArray->GetStream( SIMPLE_STREAM_LIFETIME )[iParticle] / pArray->GetStream( SIMPLE_STREAM_DIETIME )[iParticle];
+
+	Vector vColor( look.m_uchColor[0] / 255.0f, look.m_uchColor[1] / 255.0f, look.m_uchColor[2] / 255.0f );
+	float flAlpha = ( look.m_uchStartAlpha + ( look.m_uchEndAlpha - look.m_uchStartAlpha ) * t ) / 255.0f;
+	float flSize = look.m_uchStartSize + ( look.m_uchEndSize - look.m_uchStartSize ) * t;
+
+	RenderParticle_ColorSizeAngle(
+		pDraw,
+		tPos,
+		vColor,
+		flAlpha * GetAlphaDistanceFade( tPos, m_flNearClipMin, m_flNearClipMax ),
+		flSize,
+		pArray->GetStream( SIMPLE_STREAM_ROLL )[iParticle] );
+}
+
+
 //==================================================
 // Particle Library
 //==================================================
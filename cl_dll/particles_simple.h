@@ -14,6 +14,7 @@
 #include "particlemgr.h"
 #include "ParticleSphereRenderer.h"
 #include "smartptr.h"
+#include "utlvector.h"
 
 
 // ------------------------------------------------------------------------------------------------ //
@@ -164,6 +165,132 @@ private:
 	CSimpleEmitter( const CSimpleEmitter & ); // not defined, not accessible
 };
 
+//-----------------------------------------------------------------------------
+// CSimpleParticleArray holds SimpleParticles as one array per field (structure
+// of arrays), so they can be simulated four at a time. Removing a particle moves
+// the last one into its slot, so particle indices only hold until the next
+// Simulate or RemoveParticle.
+//-----------------------------------------------------------------------------
+enum SimpleParticleStream_t
+{
+	SIMPLE_STREAM_POS_X = 0,
+	SIMPLE_STREAM_POS_Y,
+	SIMPLE_STREAM_POS_Z,
+	SIMPLE_STREAM_VEL_X,
+	SIMPLE_STREAM_VEL_Y,
+	SIMPLE_STREAM_VEL_Z,
+	SIMPLE_STREAM_LIFETIME,
+	SIMPLE_STREAM_DIETIME,
+	SIMPLE_STREAM_ROLL,
+	SIMPLE_STREAM_ROLLDELTA,
+	SIMPLE_STREAM_DEPTH,		// Along the view's z axis, filled in by Simulate.
+
+	NUM_SIMPLE_STREAMS
+};
+
+// The fields that are only read when rendering.
+struct SimpleParticleLook_t
+{
+	unsigned char	m_uchColor[3];
+	unsigned char	m_uchStartAlpha;
+	unsigned char	m_uchEndAlpha;
+	unsigned char	m_uchStartSize;
+	unsigned char	m_uchEndSize;
+	unsigned char	m_iFlags;
+};
+
+class CSimpleParticleArray
+{
+public:
+					CSimpleParticleArray( IMaterial *pMaterial );
+					~CSimpleParticleArray();
+
+	IMaterial*		GetMaterial() const							{ return m_pMaterial; }
+	int				Count() const								{ return m_nCount; }
+
+	// Returns false if the array is full.
+	bool			AddParticle( const SimpleParticle &particle );
+	void			RemoveParticle( int iParticle );
+
+	// Applies the acceleration and drag, moves and ages all the particles and removes
+	// the ones that have reached their die time. Also fills in their depth along
+	// mView's z axis, does one pass of an incremental sort on it (far to near), and
+	// pushes bbMin/bbMax out to contain them.
+	void			Simulate( float flTimeDelta, const Vector &vAccel, float flDrag, const VMatrix &mView, Vector &bbMin, Vector &bbMax );
+
+	const float*	GetStream( int iStream ) const				{ return m_pStreams[iStream]; }
+	const SimpleParticleLook_t& GetLook( int iParticle ) const	{ return m_pLook[iParticle]; }
+
+private:
+	void			SetCapacity( int nCapacity );
+	void			CopyParticle( int iDest, int iSrc );
+	void			SwapParticles( int iParticle, int iOther );
+
+	// These return true if any of the particles died.
+	bool			SimulateSSE( int nParticles, float flTimeDelta, const Vector &vAccelDelta, float flDragScale, const VMatrix &mView );
+	bool			SimulateScalar( int iFirst, int nParticles, float flTimeDelta, const Vector &vAccelDelta, float flDragScale, const VMatrix &mView );
+
+	IMaterial				*m_pMaterial;
+	int						m_nCount;
+	int						m_nCapacity;		// Always a multiple of 4.
+
+	// All the arrays come out of one block.
+	void					*m_pBlock;
+	float					*m_pStreams[NUM_SIMPLE_STREAMS];
+	SimpleParticleLook_t	*m_pLook;
+
+	CSimpleParticleArray( const CSimpleParticleArray & ); // not defined, not accessible
+};
+
+
+// CSimpleArrayEmitter simulates the same particles as CSimpleEmitter, but keeps them
+// in a CSimpleParticleArray per material instead of allocating each one from the
+// particle manager. It's for fire-and-forget effects: once added, a particle can't
+// be got at again because it moves around in the arrays as others die.
+//
+// Every particle gets the same acceleration and drag. SIMPLE_PARTICLE_FLAG_WINDBLOWN
+// isn't supported.
+class CSimpleArrayEmitter : public CParticleEffect
+{
+public:
+
+	DECLARE_CLASS( CSimpleArrayEmitter, CParticleEffect );
+
+	static CSmartPtr<CSimpleArrayEmitter>	Create( const char *pDebugName );
+
+	void			SetNearClip( float nearClipMin, float nearClipMax );
+	void			SetAcceleration( const Vector &vAccel );
+	void			SetDrag( float flDrag );
+
+	// Copies the particle into the array for hMaterial. Returns false if it's full.
+	bool			AddSimpleParticle( const SimpleParticle *pParticle, PMaterialHandle hMaterial );
+
+// IParticleEffect overrides.
+public:
+
+	virtual bool	SimulateAndRender( Particle *pParticle, ParticleDraw *pDraw, float &sortKey );
+	virtual void	SimulateArray( IMaterial *pMaterial, float flTimeDelta, Vector &bbMin, Vector &bbMax );
+	virtual void	RenderArrayParticle( IMaterial *pMaterial, int iParticle, ParticleDraw *pDraw );
+
+protected:
+					CSimpleArrayEmitter( const char *pDebugName );
+	virtual			~CSimpleArrayEmitter();
+
+	CSimpleParticleArray*	FindArray( IMaterial *pMaterial );
+
+	CUtlVector<CSimpleParticleArray*>	m_Arrays;
+	CSimpleParticleArray				*m_pLastArray;	// Last one FindArray found.
+
+	float			m_flNearClipMin;
+	float			m_flNearClipMax;
+	Vector			m_vAccel;
+	float			m_flDrag;
+
+private:
+	CSimpleArrayEmitter( const CSimpleArrayEmitter & ); // not defined, not accessible
+};
+
+
 //==================================================
 // EmberEffect
 //==================================================
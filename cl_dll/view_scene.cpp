@@ -32,6 +32,7 @@
 #include "view_scene.h"
 #include "particles_ez.h"
 #include "engine/IStaticPropMgr.h"
+#include "c_baseanimating.h"
 
 // VXP
 #include "materialsystem/IMaterialSystemHardwareConfig.h"
@@ -393,6 +394,7 @@ void CViewRender::SetupRenderList( const CViewSetup *pView, WorldListInfo_t& inf
 	setupInfo.m_nRenderFrame = m_BuildWorldListsNumber;
 	setupInfo.m_pRenderList = &renderList;
 	setupInfo.m_bDrawDetailObjects = g_pClientMode->ShouldDrawDetailObjects() && r_DrawDetailProps.GetInt();
+	setupInfo.m_pFrustum = m_Frustum;
 
 	if (pView)
 	{
@@ -579,6 +581,49 @@ static void OverlayFrameBufferTexture( void )
 	}
 }
 
+static ConVar cl_threaded_bone_setup( "cl_threaded_bone_setup", "1", 0, "Set up the bones of visible animating entities on worker threads before drawing, 0 sets them up as they're drawn" );
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets up the bones of the animating entities in the render list before
+//			any of them are drawn, so their poses can be evaluated in parallel.
+//			Whatever this misses is still set up when it's first drawn.
+//-----------------------------------------------------------------------------
+static void SetupRenderListBones( CRenderList &renderList )
+{
+	if ( !cl_threaded_bone_setup.GetBool() )
+		return;
+
+	VPROF_BUDGET( "SetupRenderListBones", VPROF_BUDGETGROUP_OTHER_ANIMATION );
+
+	static CUtlVector< C_BaseAnimating * > s_Animating;
+	s_Animating.RemoveAll();
+
+	static const int s_EntityGroups[] = { RENDER_GROUP_OPAQUE_ENTITY, RENDER_GROUP_TRANSLUCENT_ENTITY };
+	for ( int i = 0; i < ARRAYSIZE( s_EntityGroups ); i++ )
+	{
+		CRenderList::CEntry *pEntries = renderList.m_RenderGroups[ s_EntityGroups[i] ];
+		int nEntries = renderList.m_RenderGroupCounts[ s_EntityGroups[i] ];
+		for ( int j = 0; j < nEntries; j++ )
+		{
+			IClientRenderable *pRenderable = pEntries[j].m_pRenderable;
+			const model_t *pModel = pRenderable->GetModel();
+			if ( !pModel || modelinfo->GetModelType( pModel ) != mod_studio )
+				continue;
+
+			C_BaseEntity *pEntity = pRenderable->GetIClientUnknown()->GetBaseEntity();
+			C_BaseAnimating *pAnimating = pEntity ? dynamic_cast< C_BaseAnimating * >( pEntity ) : NULL;
+			if ( pAnimating )
+			{
+				s_Animating.AddToTail( pAnimating );
+			}
+		}
+	}
+
+	// VPROF isn't thread safe, while it's recording the poses are evaluated here
+	bool bThreaded = !g_VProfCurrentProfile.IsEnabled() && g_VProfCurrentProfile.AtRoot();
+	C_BaseAnimating::SetupBonesInParallel( s_Animating.Base(), s_Animating.Count(), gpGlobals->curtime, bThreaded );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Draws the world
 //-----------------------------------------------------------------------------
@@ -619,6 +664,11 @@ void CViewRender::BuildWorldRenderLists(
 		SetupRenderList( pView, info, renderList );
 	}
 
+	if( ShouldDrawEntities() )
+	{
+		SetupRenderListBones( renderList );
+	}
+
 	// Iterate through any bmodels that aren't rotated/translated ( they use the identity matrix )
 	//  and therefore are rendered with the world as an optimization
 	{
@@ -5,7 +5,7 @@
 #endif
 
 // The current network protocol version.  Changing this makes clients and servers incompatible
-#define PROTOCOL_VERSION    2
+#define PROTOCOL_VERSION    3
 
 // The client listens for incoming messages from the server and responds on this port
 #define PORT_CLIENT "27005"
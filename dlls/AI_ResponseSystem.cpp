@@ -12,6 +12,7 @@
 #include "filesystem.h"
 #include "utldict.h"
 #include "ai_speech.h"
+#include "tier0/fasttimer.h"
 #include <ctype.h>
 
 static ConVar sv_debugresponses( "sv_debugresponses", "0", 0, "Show verbose matching output (1 for simple, 2 for rule scoring)" );
@@ -42,6 +43,9 @@ public:
 
 	virtual void Release() = 0;
 
+	// Times indexed vs. exhaustive rule matching and verifies they agree
+	void		BenchmarkRuleIndex( int iterations );
+
 protected:
 
 	virtual const char *GetScriptFile( void ) = 0;
@@ -399,6 +403,40 @@ private:
 		float		value;
 	};
 
+	// Rules which share a required "criterion == token" test
+	struct RuleBucket
+	{
+		RuleBucket()
+		{
+		}
+
+		RuleBucket( const RuleBucket& src )
+		{
+			int c = src.m_Rules.Count();
+			for ( int i = 0; i < c; i++ )
+			{
+				m_Rules.AddToTail( src.m_Rules[ i ] );
+			}
+		}
+
+		RuleBucket& operator=( const RuleBucket& src )
+		{
+			if ( this == &src )
+				return *this;
+
+			m_Rules.RemoveAll();
+			int c = src.m_Rules.Count();
+			for ( int i = 0; i < c; i++ )
+			{
+				m_Rules.AddToTail( src.m_Rules[ i ] );
+			}
+			return *this;
+		}
+
+		// Indices into m_Rules, ascending
+		CUtlVector< int >	m_Rules;
+	};
+
 	struct ResponseSearchResult
 	{
 		ResponseSearchResult()
@@ -477,6 +515,11 @@ private:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	void		CollectBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool useIndex, CUtlVector< int >& bestrules );
+
+	bool		IsIndexableCriterion( int icriterion );
+	void		BuildRuleIndex();
+	void		GatherCandidateRules( const AI_CriteriaSet& set, CUtlVector< int >& candidates );
 
 	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
 	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
@@ -504,6 +547,12 @@ private:
 	CUtlDict< Rule, int >	m_Rules;
 	CUtlDict< Enumeration, int > m_Enumerations;
 
+	// Decision index built after loading:  each rule is filed under one of its required
+	//  "name == token" criteria, keyed as "name=token", or is left unindexed and always scored
+	CUtlDict< int, int >		m_IndexedCriteriaNames;
+	CUtlDict< RuleBucket, int >	m_RuleBuckets;
+	CUtlVector< int >			m_UnindexedRules;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -575,6 +624,10 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+
+	m_IndexedCriteriaNames.RemoveAll();
+	m_RuleBuckets.RemoveAll();
+	m_UnindexedRules.RemoveAll();
 }
 
 //-----------------------------------------------------------------------------
@@ -1168,22 +1221,164 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 	return bret;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: A criterion can be indexed when it's a required, plain "name == token"
+//  string test, since then no rule containing it can score unless the set
+//  holds exactly that (case insensitive) value.
+// Input  : icriterion - 
+// Output : Returns true on success, false on failure.
+//-----------------------------------------------------------------------------
+bool CResponseSystem::IsIndexableCriterion( int icriterion )
+{
+	Criteria *c = &m_Criteria[ icriterion ];
+	if ( !c->required || c->IsSubCriteriaType() || !c->name )
+		return false;
+
+	Matcher& m = c->matcher;
+	if ( !m.valid || m.isnumeric || m.notequal || m.usemin || m.usemax )
+		return false;
+
+	return m.token[ 0 ] ? true : false;
+}
+
+static int __cdecl RuleIndexCompare( const void *a, const void *b )
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Files every rule into a bucket keyed by one of its required criteria,
+//  preferring "concept" since that's what nearly every query varies on
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_IndexedCriteriaNames.RemoveAll();
+	m_RuleBuckets.RemoveAll();
+	m_UnindexedRules.RemoveAll();
+
+	char key[ 256 ];
+
+	int c = m_Rules.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		Rule *rule = &m_Rules[ i ];
+
+		int best = -1;
+		int count = rule->m_Criteria.Count();
+		for ( int j = 0; j < count; j++ )
+		{
+			int icriterion = rule->m_Criteria[ j ];
+			if ( !IsIndexableCriterion( icriterion ) )
+				continue;
+
+			if ( best == -1 || !Q_stricmp( m_Criteria[ icriterion ].name, "concept" ) )
+			{
+				best = icriterion;
+			}
+		}
+
+		if ( best == -1 )
+		{
+			m_UnindexedRules.AddToTail( i );
+			continue;
+		}
+
+		Criteria *crit = &m_Criteria[ best ];
+		if ( m_IndexedCriteriaNames.Find( crit->name ) == m_IndexedCriteriaNames.InvalidIndex() )
+		{
+			m_IndexedCriteriaNames.Insert( crit->name, 0 );
+		}
+
+		// Tokens can never contain '=' (it's parsed as an operator), so the key is unambiguous
+		Q_snprintf( key, sizeof( key ), "%s=%s", crit->name, crit->matcher.token );
+
+		int bucket = m_RuleBuckets.Find( key );
+		if ( bucket == m_RuleBuckets.InvalidIndex() )
+		{
+			bucket = m_RuleBuckets.Insert( key );
+		}
+
+		// Rules are visited in order, so each bucket stays sorted
+		m_RuleBuckets[ bucket ].m_Rules.AddToTail( i );
+	}
+
+	DevMsg( 2, "CResponseSystem:  indexed %i rules into %i buckets, %i unindexed\n",
+		c - m_UnindexedRules.Count(), m_RuleBuckets.Count(), m_UnindexedRules.Count() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns, in ascending rule order, every rule that could possibly score
+//  against the set.  Rules left out would have been excluded by a required criterion.
+// Input  : set - 
+//			candidates - 
+//-----------------------------------------------------------------------------
+void CResponseSystem::GatherCandidateRules( const AI_CriteriaSet& set, CUtlVector< int >& candidates )
+{
+	char key[ 256 ];
+
+	for ( int i = m_IndexedCriteriaNames.First(); i != m_IndexedCriteriaNames.InvalidIndex(); i = m_IndexedCriteriaNames.Next( i ) )
+	{
+		const char *name = m_IndexedCriteriaNames.GetElementName( i );
+
+		int found = set.FindCriterionIndex( name );
+		if ( found == -1 )
+			continue;
+
+		const char *value = set.GetValue( found );
+		if ( !value || !value[ 0 ] )
+			continue;
+
+		Q_snprintf( key, sizeof( key ), "%s=%s", name, value );
+
+		int bucket = m_RuleBuckets.Find( key );
+		if ( bucket == m_RuleBuckets.InvalidIndex() )
+			continue;
+
+		CUtlVector< int >& rules = m_RuleBuckets[ bucket ].m_Rules;
+		int c = rules.Count();
+		for ( int j = 0; j < c; j++ )
+		{
+			candidates.AddToTail( rules[ j ] );
+		}
+	}
+
+	int c = m_UnindexedRules.Count();
+	for ( int j = 0; j < c; j++ )
+	{
+		candidates.AddToTail( m_UnindexedRules[ j ] );
+	}
+
+	// Ties are broken by position, so keep the exhaustive scan's ordering
+	if ( candidates.Count() > 1 )
+	{
+		qsort( candidates.Base(), candidates.Count(), sizeof( int ), RuleIndexCompare );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : set - 
 //			verbose - 
-// Output : int
+//			useIndex - only score rules the decision index says can match
+//			bestrules - all rules tied for the best score
 //-----------------------------------------------------------------------------
-int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+void CResponseSystem::CollectBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool useIndex, CUtlVector< int >& bestrules )
 {
-	CUtlVector< int >	bestrules;
 	float bestscore = 0.001f;
 
-	int c = m_Rules.Count();
+	CUtlVector< int > candidates;
+	if ( useIndex )
+	{
+		GatherCandidateRules( set, candidates );
+	}
+
+	int c = useIndex ? candidates.Count() : m_Rules.Count();
 	int i;
 	for ( i = 0; i < c; i++ )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
+		int irule = useIndex ? candidates[ i ] : i;
+
+		float score = ScoreCriteriaAgainstRule( set, irule, verbose );
 		// Check equals so that we keep track of all matching rules
 		if ( score >= bestscore )
 		{
@@ -1195,9 +1390,23 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 			}
 
 			// Add to bucket
-			bestrules.AddToTail( i );
+			bestrules.AddToTail( irule );
 		}
 	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : set - 
+//			verbose - 
+// Output : int
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+{
+	CUtlVector< int >	bestrules;
+
+	// When dumping rule scoring, score everything so the output shows why rules failed
+	CollectBestMatchingRules( set, verbose, !verbose, bestrules );
 
 	int bestCount = bestrules.Count();
 	if ( bestCount <= 0 )
@@ -1215,6 +1424,78 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 	return bestrules[ idx ];
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Runs a query per indexed bucket (plus an empty one) through both the
+//  indexed and exhaustive paths, checks that they pick the same rules, and reports timing
+// Input  : iterations - 
+//-----------------------------------------------------------------------------
+void CResponseSystem::BenchmarkRuleIndex( int iterations )
+{
+	CUtlVector< AI_CriteriaSet * > sets;
+	sets.AddToTail( new AI_CriteriaSet );
+
+	char name[ 256 ];
+	for ( int b = m_RuleBuckets.First(); b != m_RuleBuckets.InvalidIndex(); b = m_RuleBuckets.Next( b ) )
+	{
+		Q_strncpy( name, m_RuleBuckets.GetElementName( b ), sizeof( name ) );
+		char *value = Q_strrchr( name, '=' );
+		if ( !value )
+			continue;
+		*value++ = 0;
+
+		AI_CriteriaSet *set = new AI_CriteriaSet;
+		set->AppendCriteria( name, value );
+		sets.AddToTail( set );
+	}
+
+	int mismatches = 0;
+	int i, j;
+
+	CUtlVector< int > indexed;
+	CUtlVector< int > exhaustive;
+	for ( i = 0; i < sets.Count(); i++ )
+	{
+		indexed.RemoveAll();
+		exhaustive.RemoveAll();
+		CollectBestMatchingRules( *sets[ i ], false, true, indexed );
+		CollectBestMatchingRules( *sets[ i ], false, false, exhaustive );
+
+		bool same = ( indexed.Count() == exhaustive.Count() );
+		for ( j = 0; same && j < indexed.Count(); j++ )
+		{
+			same = ( indexed[ j ] == exhaustive[ j ] );
+		}
+
+		if ( !same )
+		{
+			++mismatches;
+		}
+	}
+
+	CFastTimer timer;
+	double flTime[ 2 ];
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		timer.Start();
+		for ( int k = 0; k < iterations; k++ )
+		{
+			for ( i = 0; i < sets.Count(); i++ )
+			{
+				indexed.RemoveAll();
+				CollectBestMatchingRules( *sets[ i ], false, pass == 0, indexed );
+			}
+		}
+		timer.End();
+		flTime[ pass ] = timer.GetDuration().GetMillisecondsF();
+	}
+
+	Msg( "%s:  %i rules, %i buckets, %i unindexed, %i queries x %i\n",
+		GetScriptFile(), m_Rules.Count(), m_RuleBuckets.Count(), m_UnindexedRules.Count(), sets.Count(), iterations );
+	Msg( "  indexed %.3f msec, exhaustive %.3f msec, %i mismatches\n", flTime[ 0 ], flTime[ 1 ], mismatches );
+
+	sets.PurgeAndDeleteElements();
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : set - 
@@ -1360,6 +1641,8 @@ void CResponseSystem::LoadRuleSet( const char *basescript )
 	LoadFromBuffer( basescript, (const char *)buffer );
 
 	Assert( m_ScriptStack.Count() == 0 );
+
+	BuildRuleIndex();
 }
 
 static AI_Response::RESPONSETYPE ComputeResponseType( const char *s )
@@ -2009,3 +2292,18 @@ IResponseSystem *InstancedResponseSystemCreate( const char *scriptfile )
 
 	return ( IResponseSystem * )newSys;
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void CC_BenchmarkResponseRules( void )
+{
+	int iterations = 100;
+	if ( engine->Cmd_Argc() > 1 )
+	{
+		iterations = max( 1, atoi( engine->Cmd_Argv( 1 ) ) );
+	}
+
+	defaultresponsesytem.BenchmarkRuleIndex( iterations );
+}
+static ConCommand sv_benchmarkresponses( "sv_benchmarkresponses", CC_BenchmarkResponseRules, "Times indexed vs. exhaustive response rule matching over the loaded rules:  sv_benchmarkresponses <iterations>", FCVAR_CHEAT );
@@ -3,6 +3,7 @@
 #include "animation.h"
 #include "studio.h"
 #include "bone_setup.h"
+#include "posecache.h"
 #include "ai_basenpc.h"
 #include "npcevent.h"
 
@@ -384,10 +385,23 @@ void CBaseAnimatingOverlay::GetSkeleton( Vector pos[], Quaternion q[], int boneM
 		return;
 	}
 
-	CalcPose( pStudioHdr, m_pIk, pos, q, GetSequence(), m_flCycle, GetPoseParameterArray(), boneMask );
+	COMPILE_TIME_ASSERT( MAX_POSE_CACHE_LAYERS >= 1 + MAX_OVERLAYS );
 
-	// layers
+	CPoseCacheKey key( pStudioHdr, boneMask, GetPoseParameterArray(), m_pIk == NULL );
+	key.AddLayer( GetSequence(), m_flCycle, 1.0f );
+	for (int i = 0; i < MAX_OVERLAYS; i++)
+	{
+		if (m_AnimOverlay[i].m_flWeight > 0)
+		{
+			key.AddLayer( m_AnimOverlay[i].m_nSequence, m_AnimOverlay[i].m_flCycle, m_AnimOverlay[i].m_flWeight );
+		}
+	}
+
+	if ( !g_PoseCache.Lookup( key, pos, q ) )
 	{
+		CalcPose( pStudioHdr, m_pIk, pos, q, GetSequence(), m_flCycle, GetPoseParameterArray(), boneMask );
+
+		// layers
 		for (int i = 0; i < MAX_OVERLAYS; i++)
 		{
 			if (m_AnimOverlay[i].m_flWeight > 0)
@@ -396,6 +410,8 @@ void CBaseAnimatingOverlay::GetSkeleton( Vector pos[], Quaternion q[], int boneM
 				AccumulatePose( pStudioHdr, m_pIk, pos, q, m_AnimOverlay[i].m_nSequence, m_AnimOverlay[i].m_flCycle, GetPoseParameterArray(), boneMask, m_AnimOverlay[i].m_flWeight );
 			}
 		}
+
+		g_PoseCache.Store( key, pos, q );
 	}
 
 	if ( m_pIk )
@@ -10,6 +10,7 @@
 #include "activitylist.h"
 #include "studio.h"
 #include "bone_setup.h"
+#include "posecache.h"
 #include "mathlib.h"
 #include "model_types.h"
 #include "physics.h"
@@ -1685,7 +1686,14 @@ void CBaseAnimating::GetSkeleton( Vector pos[], Quaternion q[], int boneMask )
 		return;
 	}
 
-	CalcPose( pStudioHdr, m_pIk, pos, q, m_nSequence, m_flCycle, GetPoseParameterArray(), boneMask );
+	CPoseCacheKey key( pStudioHdr, boneMask, GetPoseParameterArray(), m_pIk == NULL );
+	key.AddLayer( m_nSequence, m_flCycle, 1.0f );
+
+	if ( !g_PoseCache.Lookup( key, pos, q ) )
+	{
+		CalcPose( pStudioHdr, m_pIk, pos, q, m_nSequence, m_flCycle, GetPoseParameterArray(), boneMask );
+		g_PoseCache.Store( key, pos, q );
+	}
 
 	if ( m_pIk )
 	{
@@ -2112,3 +2120,85 @@ BEGIN_PREDICTION_DATA_NO_BASE( CBaseAnimating )
 	DEFINE_FIELD( CBaseAnimating, m_bClientSideFrameReset, FIELD_BOOLEAN ),
 
 END_PREDICTION_DATA()
+
+//-----------------------------------------------------------------------------
+// Purpose: Times pose setup for every sequence of each player model in play, with
+//			and without the animation seek cache
+//-----------------------------------------------------------------------------
+CON_COMMAND( anim_cache_benchmark, "Times pose setup of the player models in play with and without the animation cache: anim_cache_benchmark [steps per sequence]" )
+{
+	int nSteps = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 10;
+
+	CUtlVector< studiohdr_t * > models;
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		studiohdr_t *pStudioHdr = pPlayer ? pPlayer->GetModelPtr() : NULL;
+		if ( pStudioHdr && models.Find( pStudioHdr ) == -1 )
+		{
+			models.AddToTail( pStudioHdr );
+		}
+	}
+
+	if ( !models.Count() )
+	{
+		Msg( "anim_cache_benchmark: no player models in play\n" );
+		return;
+	}
+
+	float flTotalUncached = 0.0f, flTotalCached = 0.0f;
+	for ( int i = 0; i < models.Count(); i++ )
+	{
+		float flUncached, flCached;
+		bool bMatch = Studio_BenchmarkAnimCache( models[i], nSteps, flUncached, flCached );
+		Msg( "%s: %d sequences, %.2f ms uncached, %.2f ms cached%s\n", models[i]->name, models[i]->numseq,
+			flUncached, flCached, bMatch ? "" : " (POSES DIFFER)" );
+
+		flTotalUncached += flUncached;
+		flTotalCached += flCached;
+	}
+
+	int nAnims, nBytes;
+	Studio_GetAnimCacheStats( nAnims, nBytes );
+	Msg( "total %.2f ms uncached, %.2f ms cached; %d animations cached in %d KB\n",
+		flTotalUncached, flTotalCached, nAnims, nBytes / 1024 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compares and times the SSE and scalar bone blends over every sequence
+//			of each player model in play
+//-----------------------------------------------------------------------------
+CON_COMMAND( bone_blend_benchmark, "Compares the SSE and scalar bone blends over the player models in play: bone_blend_benchmark [steps per sequence]" )
+{
+	int nSteps = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 10;
+
+	CUtlVector< studiohdr_t * > models;
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		studiohdr_t *pStudioHdr = pPlayer ? pPlayer->GetModelPtr() : NULL;
+		if ( pStudioHdr && models.Find( pStudioHdr ) == -1 )
+		{
+			models.AddToTail( pStudioHdr );
+		}
+	}
+
+	if ( !models.Count() )
+	{
+		Msg( "bone_blend_benchmark: no player models in play\n" );
+		return;
+	}
+
+	bool bPassed = true;
+	for ( int i = 0; i < models.Count(); i++ )
+	{
+		float flMaxError, flScalar, flSSE;
+		bool bMatch = Studio_BenchmarkBoneBlend( models[i], nSteps, flMaxError, flScalar, flSSE );
+		Msg( "%s: %d sequences, %.2f ms scalar, %.2f ms SSE, max error %g%s\n", models[i]->name, models[i]->numseq,
+			flScalar, flSSE, flMaxError, bMatch ? "" : " (FAILED)" );
+
+		bPassed = bPassed && bMatch;
+	}
+
+	Msg( "bone_blend_benchmark: %s\n", bPassed ? "passed" : "FAILED" );
+}
@@ -29742,6 +29742,14 @@ SOURCE=.\PointTeleport.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\posecache.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\posecache.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\game_shared\precache_register.cpp
 # End Source File
 # Begin Source File
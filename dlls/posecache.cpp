@@ -0,0 +1,240 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Local space poses shared between entities.
+//
+//=============================================================================
+
+#include "cbase.h"
+#include "posecache.h"
+#include "checksum_crc.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CPoseCache g_PoseCache;
+
+static void PoseCacheBudgetChanged( ConVar *var, const char *pOldString )
+{
+	g_PoseCache.SetBudget( var->GetInt() * 1024 );
+}
+
+static ConVar pose_cache_budget( "pose_cache_budget", "2048", 0, "KB of local space poses shared between entities, 0 turns the pose cache off", PoseCacheBudgetChanged );
+static ConVar pose_cache_cycle_steps( "pose_cache_cycle_steps", "1000", 0, "Cycles that round to the same of this many steps of a sequence share a cached pose, 0 only shares identical cycles" );
+
+//-----------------------------------------------------------------------------
+// CPoseCacheKey
+//-----------------------------------------------------------------------------
+CPoseCacheKey::CPoseCacheKey( const studiohdr_t *pStudioHdr, int boneMask, const float poseParameter[], bool bCacheable )
+{
+	m_bCacheable = bCacheable && g_PoseCache.IsEnabled();
+	m_pStudioHdr = pStudioHdr;
+	m_nChecksum = pStudioHdr->checksum;
+	m_nBoneMask = boneMask;
+	m_nLayers = 0;
+
+	memset( m_PoseParameter, 0, sizeof( m_PoseParameter ) );
+	memcpy( m_PoseParameter, poseParameter, pStudioHdr->numposeparameters * sizeof( float ) );
+}
+
+void CPoseCacheKey::AddLayer( int sequence, float cycle, float weight )
+{
+	Assert( m_nLayers < MAX_POSE_CACHE_LAYERS );
+	if ( m_nLayers >= MAX_POSE_CACHE_LAYERS )
+		return;
+
+	// only the key is quantized, the caller poses a miss at the exact cycle
+	int nSteps = pose_cache_cycle_steps.GetInt();
+	if ( m_bCacheable && nSteps > 0 )
+	{
+		cycle = floor( cycle * nSteps + 0.5f ) / nSteps;
+	}
+
+	m_Layers[m_nLayers].sequence = sequence;
+	m_Layers[m_nLayers].cycle = cycle;
+	m_Layers[m_nLayers].weight = weight;
+	m_nLayers++;
+}
+
+//-----------------------------------------------------------------------------
+// CPoseCache
+//-----------------------------------------------------------------------------
+CPoseCache::CPoseCache() : m_Poses( 0, 0, PoseLessFunc )
+{
+	m_nBudget = 2048 * 1024;
+	m_nBytes = 0;
+	ResetStats();
+}
+
+CPoseCache::~CPoseCache()
+{
+	Flush();
+}
+
+bool CPoseCache::IsEnabled() const
+{
+	return m_nBudget > 0;
+}
+
+unsigned long CPoseCache::HashKey( const CPoseCacheKey &key )
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, (void *)&key.m_pStudioHdr, sizeof( key.m_pStudioHdr ) );
+	CRC32_ProcessBuffer( &crc, (void *)&key.m_nBoneMask, sizeof( key.m_nBoneMask ) );
+	CRC32_ProcessBuffer( &crc, (void *)key.m_Layers, key.m_nLayers * sizeof( key.m_Layers[0] ) );
+	CRC32_ProcessBuffer( &crc, (void *)key.m_PoseParameter, sizeof( key.m_PoseParameter ) );
+	CRC32_Final( &crc );
+	return crc;
+}
+
+bool CPoseCache::PoseLessFunc( pose_t * const &lhs, pose_t * const &rhs )
+{
+	if ( lhs->m_nHash != rhs->m_nHash )
+		return lhs->m_nHash < rhs->m_nHash;
+
+	const CPoseCacheKey &a = lhs->m_Key;
+	const CPoseCacheKey &b = rhs->m_Key;
+	if ( a.m_pStudioHdr != b.m_pStudioHdr )
+		return a.m_pStudioHdr < b.m_pStudioHdr;
+	if ( a.m_nChecksum != b.m_nChecksum )
+		return a.m_nChecksum < b.m_nChecksum;
+	if ( a.m_nBoneMask != b.m_nBoneMask )
+		return a.m_nBoneMask < b.m_nBoneMask;
+	if ( a.m_nLayers != b.m_nLayers )
+		return a.m_nLayers < b.m_nLayers;
+
+	int cmp = memcmp( a.m_Layers, b.m_Layers, a.m_nLayers * sizeof( a.m_Layers[0] ) );
+	if ( cmp )
+		return cmp < 0;
+	return memcmp( a.m_PoseParameter, b.m_PoseParameter, sizeof( a.m_PoseParameter ) ) < 0;
+}
+
+bool CPoseCache::Lookup( const CPoseCacheKey &key, Vector pos[], Quaternion q[] )
+{
+	if ( !key.IsCacheable() )
+	{
+		if ( IsEnabled() )
+		{
+			m_nUncacheable++;
+		}
+		return false;
+	}
+
+	pose_t search( key );
+	search.m_nHash = HashKey( key );
+
+	int i = m_Poses.Find( &search );
+	if ( i == m_Poses.InvalidIndex() )
+	{
+		m_nMisses++;
+		return false;
+	}
+
+	pose_t *pPose = m_Poses[i];
+	int nBones = key.m_pStudioHdr->numbones;
+	memcpy( pos, pPose->m_pPos, nBones * sizeof( Vector ) );
+	memcpy( q, pPose->m_pQ, nBones * sizeof( Quaternion ) );
+
+	// most recently used goes to the tail
+	m_LRU.Unlink( pPose->m_LRU );
+	m_LRU.LinkToTail( pPose->m_LRU );
+
+	m_nHits++;
+	return true;
+}
+
+void CPoseCache::Store( const CPoseCacheKey &key, const Vector pos[], const Quaternion q[] )
+{
+	if ( !key.IsCacheable() || !IsEnabled() )
+		return;
+
+	int nBones = key.m_pStudioHdr->numbones;
+	int nBytes = sizeof( pose_t ) + nBones * ( sizeof( Vector ) + sizeof( Quaternion ) );
+	if ( nBytes > m_nBudget )
+		return;
+
+	pose_t *pPose = new pose_t( key );
+	pPose->m_nHash = HashKey( key );
+	if ( m_Poses.Find( pPose ) != m_Poses.InvalidIndex() )
+	{
+		delete pPose;
+		return;
+	}
+
+	while ( m_nBytes + nBytes > m_nBudget )
+	{
+		FreePose( m_LRU[ m_LRU.Head() ] );
+		m_nEvictions++;
+	}
+
+	pPose->m_nBytes = nBytes;
+	pPose->m_pPos = new Vector[ nBones ];
+	pPose->m_pQ = new Quaternion[ nBones ];
+	memcpy( pPose->m_pPos, pos, nBones * sizeof( Vector ) );
+	memcpy( pPose->m_pQ, q, nBones * sizeof( Quaternion ) );
+
+	m_Poses.Insert( pPose );
+	pPose->m_LRU = m_LRU.AddToTail( pPose );
+	m_nBytes += nBytes;
+}
+
+void CPoseCache::SetBudget( int nBytes )
+{
+	m_nBudget = max( nBytes, 0 );
+
+	while ( m_nBytes > m_nBudget )
+	{
+		FreePose( m_LRU[ m_LRU.Head() ] );
+	}
+}
+
+void CPoseCache::Flush()
+{
+	while ( m_LRU.Count() )
+	{
+		FreePose( m_LRU[ m_LRU.Head() ] );
+	}
+}
+
+void CPoseCache::FreePose( pose_t *pPose )
+{
+	m_Poses.Remove( pPose );
+	m_LRU.Remove( pPose->m_LRU );
+	m_nBytes -= pPose->m_nBytes;
+
+	delete[] pPose->m_pPos;
+	delete[] pPose->m_pQ;
+	delete pPose;
+}
+
+void CPoseCache::ResetStats()
+{
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_nUncacheable = 0;
+	m_nEvictions = 0;
+}
+
+void CPoseCache::PrintStats()
+{
+	int nLookups = m_nHits + m_nMisses;
+	Msg( "pose cache: %d poses in %d of %d KB\n", m_LRU.Count(), m_nBytes / 1024, m_nBudget / 1024 );
+	Msg( "  %d hits, %d misses (%.1f%% hit rate), %d evictions, %d uncacheable poses\n",
+		m_nHits, m_nMisses, nLookups ? 100.0f * m_nHits / nLookups : 0.0f, m_nEvictions, m_nUncacheable );
+}
+
+void CPoseCache::LevelShutdownPostEntity()
+{
+	// the poses point at models that may go away with the level
+	Flush();
+}
+
+CON_COMMAND( pose_cache_stats, "Prints pose cache usage and hit rate: pose_cache_stats [reset]" )
+{
+	g_PoseCache.PrintStats();
+
+	if ( engine->Cmd_Argc() > 1 && !Q_stricmp( engine->Cmd_Argv( 1 ), "reset" ) )
+	{
+		g_PoseCache.ResetStats();
+	}
+}
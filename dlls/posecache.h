@@ -0,0 +1,115 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Local space poses shared between entities.  Entities without IK that
+//			play the same sequences, at cycles that quantize the same, with the
+//			same pose parameters and bone mask, get the same pose back; only the
+//			bone to world transforms built from it are per entity.
+//
+//=============================================================================
+
+#ifndef POSECACHE_H
+#define POSECACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "studio.h"
+#include "igamesystem.h"
+#include "utlrbtree.h"
+#include "utllinkedlist.h"
+
+// base sequence plus the overlays of CBaseAnimatingOverlay
+#define MAX_POSE_CACHE_LAYERS	9
+
+//-----------------------------------------------------------------------------
+// Purpose: Everything a cached pose depends on.  Add the base sequence first,
+//			then any layers accumulated on top.  Cycles are only quantized for
+//			the lookup; a miss is posed at the entity's exact cycles, and that
+//			pose is shared with the entities whose cycles quantize the same.
+//			Poses fed to an IK context depend on the entity, so aren't cacheable.
+//-----------------------------------------------------------------------------
+class CPoseCacheKey
+{
+public:
+	CPoseCacheKey( const studiohdr_t *pStudioHdr, int boneMask, const float poseParameter[], bool bCacheable );
+
+	void	AddLayer( int sequence, float cycle, float weight );
+
+	bool	IsCacheable() const { return m_bCacheable; }
+
+private:
+	friend class CPoseCache;
+
+	struct poselayer_t
+	{
+		int		sequence;
+		float	cycle;
+		float	weight;
+	};
+
+	bool				m_bCacheable;
+	const studiohdr_t	*m_pStudioHdr;
+	long				m_nChecksum;
+	int					m_nBoneMask;
+	int					m_nLayers;
+	poselayer_t			m_Layers[MAX_POSE_CACHE_LAYERS];
+	float				m_PoseParameter[MAXSTUDIOPOSEPARAM];
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: The least recently used poses are thrown out to stay under the
+//			pose_cache_budget, and all of them at level shutdown
+//-----------------------------------------------------------------------------
+class CPoseCache : public CAutoGameSystem
+{
+public:
+	CPoseCache();
+	virtual ~CPoseCache();
+
+	bool	IsEnabled() const;
+
+	// returns false if the pose has to be calculated
+	bool	Lookup( const CPoseCacheKey &key, Vector pos[], Quaternion q[] );
+	void	Store( const CPoseCacheKey &key, const Vector pos[], const Quaternion q[] );
+
+	void	SetBudget( int nBytes );
+	void	Flush();
+
+	void	PrintStats();
+	void	ResetStats();
+
+	// IGameSystem
+	virtual void LevelShutdownPostEntity();
+
+private:
+	struct pose_t
+	{
+		CPoseCacheKey	m_Key;
+		unsigned long	m_nHash;
+		int				m_nBytes;
+		unsigned short	m_LRU;
+		Vector			*m_pPos;
+		Quaternion		*m_pQ;
+
+		pose_t( const CPoseCacheKey &key ) : m_Key( key ) {}
+	};
+
+	static bool PoseLessFunc( pose_t * const &lhs, pose_t * const &rhs );
+	static unsigned long HashKey( const CPoseCacheKey &key );
+
+	void	FreePose( pose_t *pPose );
+
+	CUtlRBTree< pose_t *, int >	m_Poses;
+	CUtlLinkedList< pose_t *, unsigned short >	m_LRU;	// head is the least recently used
+	int		m_nBudget;
+	int		m_nBytes;
+
+	int		m_nHits;
+	int		m_nMisses;
+	int		m_nUncacheable;
+	int		m_nEvictions;
+};
+
+extern CPoseCache g_PoseCache;
+
+#endif // POSECACHE_H
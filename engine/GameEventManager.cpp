@@ -62,6 +62,8 @@ void CGameEventManager::Reset()
 
 	m_GameEvents.RemoveAll();
 
+	memset( m_EventsById, 0, sizeof(m_EventsById) );
+
 	m_FileCRC = 0;
 
 	Assert( m_GameEvents.Count() == 0 );
@@ -72,7 +74,7 @@ bool CGameEventManager::FireEvent( KeyValues * event, IRecipientFilter * filter)
 	if ( event == NULL || m_FileCRC == 0 )
 		return false;
 
-	GameEvent_t * eventtype = GetEventType( event->GetName() );
+	GameEvent_t * eventtype = GetEventType( event );
 
 	if ( eventtype == NULL )
 	{
@@ -116,7 +118,7 @@ bool CGameEventManager::FireRemoteEvent( KeyValues * event )
 	if ( event == NULL )
 		return false;
 
-	GameEvent_t * et = GetEventType( event->GetName() );
+	GameEvent_t * et = GetEventType( event );
 
 	if ( et == NULL )
 	{
@@ -204,7 +206,7 @@ void CGameEventManager::SendGameEventToClients(KeyValues * event, GameEvent_t *
 			return;
 		}
 
-		pBuffer->WriteBytes( buffer.m_pData, buffer.GetNumBytesWritten() );
+		pBuffer->WriteBits( buffer.m_pData, buffer.GetNumBitsWritten() );
 	}
 	else
 	{
@@ -255,7 +257,7 @@ void CGameEventManager::SendGameEventToClients(KeyValues * event, GameEvent_t *
 				continue;
 			}
 			
-			pBuffer->WriteBytes( buffer.m_pData, buffer.GetNumBytesWritten() );
+			pBuffer->WriteBits( buffer.m_pData, buffer.GetNumBitsWritten() );
 		}
 	}
 }
@@ -282,7 +284,7 @@ bool CGameEventManager::SerializeKeyValues( KeyValues* event, bf_write* buf, Gam
 {
 	if ( eventtype == NULL )
 	{
-		eventtype = GetEventType( event->GetName() );
+		eventtype = GetEventType( event );
 
 		if ( eventtype == NULL )
 		{
@@ -294,36 +296,23 @@ bool CGameEventManager::SerializeKeyValues( KeyValues* event, bf_write* buf, Gam
 	buf->WriteByte( svc_gameevent );	// hey, here comes an game event
 	buf->WriteByte( eventtype->eventid ); // and it's me
 
-	// now iterate trough all fields descripted in gameevents.res and put them in the buffer
+	// now write all fields described in gameevents.res, bit packed in descriptor order
 
-	KeyValues * key = eventtype->keys->GetFirstSubKey(); 
-	
-	while ( key )
+	for ( int i = 0; i < eventtype->descriptors.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
+		const GameEventKey_t &descriptor = eventtype->descriptors[i];
 
-		if ( Q_strcmp(keyName,"eventid") == 0 ||
-			 Q_strcmp(keyName,"priority") == 0 ||
-			 Q_strcmp(keyName,"time") == 0 )
-		{
-			key = key->GetNextKey();	// ignore standard keys
-			continue;
-		}
+		KeyValues * key = event->FindKey( descriptor.keySymbol );
 
-		int type = key->GetInt();
-
-		switch ( type )
+		switch ( descriptor.type )
 		{
-			case 0 : buf->WriteString( event->GetString( keyName, "") ); break;
-			case 1 : buf->WriteFloat( event->GetFloat( keyName, 0.0f) ); break;
-			case 2 : buf->WriteLong( event->GetInt( keyName, 0) ); break;
-			case 3 : buf->WriteShort( event->GetInt( keyName, 0) ); break;
-			case 4 : buf->WriteByte( event->GetInt( keyName, 0) ); break;
-			case 5 : buf->WriteByte( event->GetInt( keyName, 0) ); break;
-			default: DevMsg(1, "CGameEventManager:: unkown type %i in key '%s'.\n", type, key->GetName() ); break;
+			case TYPE_STRING : buf->WriteString( key ? key->GetString() : "" ); break;
+			case TYPE_FLOAT  : buf->WriteFloat( key ? key->GetFloat() : 0.0f ); break;
+			case TYPE_LONG   : buf->WriteLong( key ? key->GetInt() : 0 ); break;
+			case TYPE_SHORT  : buf->WriteShort( key ? key->GetInt() : 0 ); break;
+			case TYPE_BYTE   : buf->WriteByte( key ? key->GetInt() : 0 ); break;
+			case TYPE_BOOL   : buf->WriteOneBit( ( key && key->GetInt() ) ? 1 : 0 ); break;
 		}
-
-		key = key->GetNextKey();
 	}
 
 	return true;
@@ -347,37 +336,21 @@ KeyValues * CGameEventManager::UnserializeKeyValue(bf_read * buf)
 
 	KeyValues * event = new KeyValues( eventtype->name );
 
-	KeyValues * key = eventtype->keys->GetFirstSubKey(); 
-
-	while ( key )
+	for ( int i = 0; i < eventtype->descriptors.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
+		const GameEventKey_t &descriptor = eventtype->descriptors[i];
 
-		if ( Q_strcmp(keyName,"eventid") == 0 ||
-			 Q_strcmp(keyName,"priority") == 0 ||
-			 Q_strcmp(keyName,"time") == 0 )
+		switch ( descriptor.type )
 		{
-			key = key->GetNextKey();	// ignore standard keys
-			continue;
-		}
-
-		int type = key->GetInt();
-
-		switch ( type )
-		{
-			case 0 : if ( buf->ReadString( stringbuf, 1024) )
-						event->SetString( keyName, stringbuf );
-					 break;
-			case 1 : event->SetFloat( keyName, buf->ReadFloat() ); break;
-			case 2 : event->SetInt( keyName, buf->ReadLong() ); break;
-			case 3 : event->SetInt( keyName, buf->ReadShort() ); break;
-			case 4 : event->SetInt( keyName, buf->ReadByte() ); break;
-			case 5 : event->SetInt( keyName, buf->ReadByte() ); break;
-			default: DevMsg(1, "CGameEventManager:: unkown type %i in key '%s'.\n", type, key->GetName() ); break;
-
+			case TYPE_STRING : if ( buf->ReadString( stringbuf, sizeof(stringbuf) ) )
+								event->SetString( descriptor.name, stringbuf );
+							   break;
+			case TYPE_FLOAT  : event->SetFloat( descriptor.name, buf->ReadFloat() ); break;
+			case TYPE_LONG   : event->SetInt( descriptor.name, buf->ReadLong() ); break;
+			case TYPE_SHORT  : event->SetInt( descriptor.name, buf->ReadShort() ); break;
+			case TYPE_BYTE   : event->SetInt( descriptor.name, buf->ReadByte() ); break;
+			case TYPE_BOOL   : event->SetInt( descriptor.name, buf->ReadOneBit() ); break;
 		}
-
-		key = key->GetNextKey();
 	}
 
 	return event;
@@ -538,6 +511,8 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 	
 	et->keys =event->MakeCopy(); // create local copy
 
+	et->nameSymbol = et->keys->GetNameSymbol();
+
 	KeyValues * subkey = et->keys->GetFirstSubKey();
 
 	// translate types strings to integers
@@ -568,9 +543,20 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 
 		if ( i == MAX_DATA_TYPES )
 		{
-			et->keys->SetInt( keyName, 0 );	// string type
+			i = TYPE_STRING;
+			et->keys->SetInt( keyName, i );
 			DevMsg(1, "CGameEventManager:: unkown type '%s' in key '%s'.\n", type, subkey->GetName() );
 		}
+
+		// resolve the key once, serialization just walks these
+
+		GameEventKey_t descriptor;
+
+		descriptor.name = keyName;
+		descriptor.keySymbol = subkey->GetNameSymbol();
+		descriptor.type = i;
+
+		et->descriptors.AddToTail( descriptor );
 		
 		subkey = subkey->GetNextKey();
 	}
@@ -579,6 +565,11 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 	
 	m_GameEvents.AddToTail( et );
 
+	if ( et->eventid >= 0 && et->eventid < MAX_EVENT_NUMBER && m_EventsById[et->eventid] == NULL )
+	{
+		m_EventsById[et->eventid] = et;
+	}
+
 	return true;
 }
 
@@ -589,6 +580,9 @@ int  CGameEventManager::GetEventNumber()
 
 CGameEventManager::GameEvent_t * CGameEventManager::GetEventType(int eventid) // returns event name or NULL
 {
+	if ( eventid >= 0 && eventid < MAX_EVENT_NUMBER )
+		return m_EventsById[eventid];
+
 	for (int i=0; i < m_GameEvents.Count(); i++ )
 	{
 		GameEvent_t * e = m_GameEvents.Element( i );
@@ -613,6 +607,22 @@ CGameEventManager::GameEvent_t * CGameEventManager::GetEventType(const char * na
 	return NULL;
 }
 
+CGameEventManager::GameEvent_t * CGameEventManager::GetEventType(KeyValues * event)
+{
+	// compare symbols first, they're case insensitive so the name still has to match
+	int nameSymbol = event->GetNameSymbol();
+
+	for (int i=0; i < m_GameEvents.Count(); i++ )
+	{
+		GameEvent_t * e = m_GameEvents.Element( i );
+
+		if ( e->nameSymbol == nameSymbol && Q_strcmp(e->name, event->GetName() ) == 0 )
+			return e;
+	}
+
+	return NULL;
+}
+
 KeyValues * CGameEventManager::GetEvent(const char * name)
 {
 	GameEvent_t * et = GetEventType( name );
@@ -622,3 +632,140 @@ KeyValues * CGameEventManager::GetEvent(const char * name)
 
 	return NULL;
 }
+
+void CGameEventManager::RunSerializationTest( int iterations )
+{
+	if ( m_GameEvents.Count() == 0 )
+	{
+		Msg( "CGameEventManager: no game events loaded.\n" );
+		return;
+	}
+
+	// build one sample of every event type, with a different value in each key
+
+	CUtlVector<KeyValues*> samples;
+	int i, j;
+
+	for ( i = 0; i < m_GameEvents.Count(); i++ )
+	{
+		GameEvent_t * et = m_GameEvents.Element( i );
+		KeyValues * event = new KeyValues( et->name );
+
+		for ( j = 0; j < et->descriptors.Count(); j++ )
+		{
+			const GameEventKey_t &descriptor = et->descriptors[j];
+
+			switch ( descriptor.type )
+			{
+				case TYPE_STRING : event->SetString( descriptor.name, descriptor.name ); break;
+				case TYPE_FLOAT  : event->SetFloat( descriptor.name, j + 0.5f ); break;
+				case TYPE_LONG   : event->SetInt( descriptor.name, 0x12345678 + j ); break;
+				case TYPE_SHORT  : event->SetInt( descriptor.name, 0x1234 + j ); break;
+				case TYPE_BYTE   : event->SetInt( descriptor.name, ( 0x40 + j ) & 0xFF ); break;
+				case TYPE_BOOL   : event->SetInt( descriptor.name, j & 1 ); break;
+			}
+		}
+
+		samples.AddToTail( event );
+	}
+
+	char	 buffer_data[256];
+	int		 failed = 0;
+	int		 totalBits = 0;
+
+	// round trip each one and check every key made it
+
+	for ( i = 0; i < samples.Count(); i++ )
+	{
+		GameEvent_t * et = m_GameEvents.Element( i );
+
+		bf_write buffer;
+		buffer.StartWriting( buffer_data, sizeof(buffer_data) );
+		SerializeKeyValues( samples[i], &buffer, et );
+
+		if ( buffer.IsOverflowed() )
+		{
+			Msg( "  %s: serialization overflowed\n", et->name );
+			failed++;
+			continue;
+		}
+
+		totalBits += buffer.GetNumBitsWritten();
+
+		bf_read msg( buffer_data, buffer.GetNumBytesWritten() );
+		msg.ReadByte();	// svc_gameevent
+
+		KeyValues * copy = UnserializeKeyValue( &msg );
+		bool ok = ( copy != NULL ) && ( Q_strcmp( copy->GetName(), et->name ) == 0 );
+
+		for ( j = 0; ok && j < et->descriptors.Count(); j++ )
+		{
+			const GameEventKey_t &descriptor = et->descriptors[j];
+
+			switch ( descriptor.type )
+			{
+				case TYPE_STRING : ok = Q_strcmp( samples[i]->GetString( descriptor.name ), copy->GetString( descriptor.name ) ) == 0; break;
+				case TYPE_FLOAT  : ok = samples[i]->GetFloat( descriptor.name ) == copy->GetFloat( descriptor.name ); break;
+				default			 : ok = samples[i]->GetInt( descriptor.name ) == copy->GetInt( descriptor.name ); break;
+			}
+
+			if ( !ok )
+			{
+				Msg( "  %s: key '%s' didn't survive the round trip\n", et->name, descriptor.name );
+			}
+		}
+
+		if ( !ok )
+		{
+			failed++;
+		}
+
+		if ( copy )
+		{
+			copy->deleteThis();
+		}
+	}
+
+	// now time it
+
+	double start = Plat_FloatTime();
+
+	for ( int n = 0; n < iterations; n++ )
+	{
+		for ( i = 0; i < samples.Count(); i++ )
+		{
+			bf_write buffer;
+			buffer.StartWriting( buffer_data, sizeof(buffer_data) );
+			SerializeKeyValues( samples[i], &buffer, m_GameEvents.Element( i ) );
+
+			bf_read msg( buffer_data, buffer.GetNumBytesWritten() );
+			msg.ReadByte();
+
+			KeyValues * copy = UnserializeKeyValue( &msg );
+			if ( copy )
+			{
+				copy->deleteThis();
+			}
+		}
+	}
+
+	float elapsed = Plat_FloatTime() - start;
+	int count = iterations * samples.Count();
+
+	Msg( "%i of %i event types round tripped, %.1f bits per event on average\n", 
+		samples.Count() - failed, samples.Count(), (float)totalBits / samples.Count() );
+	Msg( "%i events written and read back in %.2f ms (%.0f events/sec)\n", 
+		count, elapsed * 1000.0f, elapsed > 0 ? count / elapsed : 0.0f );
+
+	for ( i = 0; i < samples.Count(); i++ )
+	{
+		samples[i]->deleteThis();
+	}
+}
+
+CON_COMMAND( gameevent_test, "Round trips every game event type through the network serializer: gameevent_test [iterations]" )
+{
+	int iterations = ( Cmd_Argc() > 1 ) ? atoi( Cmd_Argv( 1 ) ) : 1000;
+
+	g_pGameEventManager->RunSerializationTest( max( iterations, 1 ) );
+}
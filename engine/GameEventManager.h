@@ -28,10 +28,29 @@ class CGameEventManager  : public IGameEventManager
 {
 private :
 
+	// data types, in the order of s_GameEnventTypeMap
+	enum
+	{
+		TYPE_STRING = 0,
+		TYPE_FLOAT,
+		TYPE_LONG,
+		TYPE_SHORT,
+		TYPE_BYTE,
+		TYPE_BOOL,
+	};
+
+	typedef struct {
+		const char	*name;		// key name, owned by the KeyValues symbol table
+		int			keySymbol;	// KeyValues symbol of the name
+		int			type;		// TYPE_*
+	} GameEventKey_t;
+
 	typedef struct {
 		char		name[MAX_EVENT_NAME_LENGTH];	// name of this event
+		int			nameSymbol;	// KeyValues symbol of the name
 		int			eventid;	// internal index number
 		KeyValues * keys;		// KeyValue describing data types, if NULL only name 
+		CUtlVector<GameEventKey_t>	descriptors;	// keys sent over the net, resolved once at registration
 		CUtlVector<IGameEventListener*>	listeners;	// registered listeners
 	} GameEvent_t;
 
@@ -70,12 +89,17 @@ public:
 	void Shutdown();
 	void UpdateListeners();
 
+	// serializes sample events of every type and reads them back, checking and timing the round trip
+	void RunSerializationTest( int iterations );
+
 private:
 
 	GameEvent_t * GetEventType(const char * name);
+	GameEvent_t * GetEventType(KeyValues * event);
 	GameEvent_t * GetEventType(int eventid);
 
 	CUtlVector<GameEvent_t*>		m_GameEvents;	// list of events
+	GameEvent_t *					m_EventsById[MAX_EVENT_NUMBER];	// events by eventid, if it's in range
 	CUtlVector<IGameEventListener*>	m_Listerners;	// list of all known isteners
 	CRC32_t							m_FileCRC;	// CRC of current used game events
 };
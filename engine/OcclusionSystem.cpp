@@ -22,6 +22,7 @@
 #include "glquake.h"
 #include "materialsystem/imesh.h"
 #include "tier0/vprof.h"
+#include <xmmintrin.h>
 
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -40,6 +41,8 @@ static ConVar r_occludermincount( "r_occludermincount", "6", 0, "At least this m
 static ConVar r_occlusionspew( "r_occlusionspew", "0", 0, "Activate/deactivates spew about what the occlusion system is doing." );
 static ConVar r_occluderminarea( "r_occluderminarea", "5", 0, "Prevents this occluder from being used if it takes up less than X% of the screen." );
 static ConVar r_occludeemaxarea( "r_occludeemaxarea", "5", 0, "Prevents occlusion testing for entities that take up more than X% of the screen." );
+static ConVar r_occlusiondepthbuffer( "r_occlusiondepthbuffer", "0", 0, "Test occludees against a low resolution depth buffer of the occluders instead of the edge list." );
+static ConVar r_occlusioncompare( "r_occlusioncompare", "0", 0, "Run both occlusion tests on every occludee and spew how often they disagree." );
 
 
 #ifdef DEBUG_OCCLUSION_SYSTEM
@@ -544,34 +547,35 @@ bool CWingedEdgeList::IsOccludingActiveEdgeList( CWingedEdgeList &testList, floa
 {
 	WingedEdge_t *pTestEdge = testList.FirstActiveEdge();
 	pTestEdge = AdvanceActiveEdgeListToX( pTestEdge, -1.0f );
-	float flNextTestX = pTestEdge->m_flX;
+	float flCurrentX = pTestEdge->m_flX;
 
 	// If the occludee is off screen, it's occluded
-	if ( flNextTestX >= 1.0f )
+	if ( flCurrentX >= 1.0f )
 		return true;
 
 	WingedEdge_t *pOccluderEdge = FirstActiveEdge();
-	pOccluderEdge = AdvanceActiveEdgeListToX( pOccluderEdge, flNextTestX );
+	pOccluderEdge = AdvanceActiveEdgeListToX( pOccluderEdge, flCurrentX );
 
+	// The test surface is the one entered at the current test edge; it lasts until the next one
 	Surface_t *pTestSurf = (pTestEdge->m_nEnterSurfID >= 0) ? &testList.m_Surfaces[pTestEdge->m_nEnterSurfID] : &m_BackSurface;
+	float flNextTestX = pTestEdge->m_pNextActiveEdge->m_flX;
 
 	// Use the leave surface because we know the occluder has been advanced *beyond* the test surf X.
 	Surface_t *pOccluderSurf = (pOccluderEdge->m_nLeaveSurfID >= 0) ? &m_Surfaces[pOccluderEdge->m_nLeaveSurfID] : &m_BackSurface;
-
-	float flCurrentX = flNextTestX;
 	float flNextOccluderX = pOccluderEdge->m_flX;
-	flNextTestX = pTestEdge->m_flX;
 
 	while ( true )
 	{
 		// Is the occludee in front of the occluder? No dice!
-		float flTestOOz = ComputeZValue( pTestSurf, flCurrentX, y );
-		float flOccluderOOz = ComputeZValue( pOccluderSurf, flCurrentX, y );
-		if ( flTestOOz < flOccluderOOz )
+		// Both are planes, so testing both ends of the span covers all of it
+		float flEndX = min( min( flNextTestX, flNextOccluderX ), 1.0f );
+		if ( ComputeZValue( pTestSurf, flCurrentX, y ) < ComputeZValue( pOccluderSurf, flCurrentX, y ) )
+			return false;
+		if ( ComputeZValue( pTestSurf, flEndX, y ) < ComputeZValue( pOccluderSurf, flEndX, y ) )
 			return false;
 
-		// We're done if there's no more occludees
-		if ( flNextTestX == FLT_MAX )
+		// We're done if there's no more occludees, or the rest of them are off screen
+		if ( ( flNextTestX == FLT_MAX ) || ( flEndX >= 1.0f ) )
 			return true;
 
 		// We're done if there's no more occluders
@@ -583,7 +587,7 @@ bool CWingedEdgeList::IsOccludingActiveEdgeList( CWingedEdgeList &testList, floa
 			flCurrentX = flNextTestX;
 			pTestEdge = pTestEdge->m_pNextActiveEdge;
 			pTestSurf = (pTestEdge->m_nEnterSurfID >= 0) ? &testList.m_Surfaces[pTestEdge->m_nEnterSurfID] : &m_BackSurface;
-			flNextTestX = pTestEdge->m_flX;
+			flNextTestX = pTestEdge->m_pNextActiveEdge->m_flX;
 		}
 		else
 		{
@@ -763,6 +767,9 @@ public:
 	// Removal of small occluders
 	void CullSmallOccluders();
 
+	// Did the surface survive CullSmallOccluders?
+	bool IsSurfaceUsed( int nSurfID ) const;
+
 private:
 	struct Surface_t
 	{
@@ -871,6 +878,7 @@ private:
 	// Surfaces
 	CUtlVector< Surface_t > m_Surfaces;
 	CUtlVector< int > m_SurfaceSort;
+	CUtlVector< bool > m_SurfaceUsed;
 	Surface_t m_StartSurfTerminal;
 	Surface_t m_EndSurfTerminal;
 
@@ -1188,7 +1196,9 @@ void CEdgeList::CullSmallOccluders()
 
 	// The *2 here is because surf areas are 2x bigger than actual
 	float flMinScreenArea = r_occluderminarea.GetFloat() * 0.02f;
-	bool *bUseSurface = (bool*)stackalloc( nSurfCount * sizeof(bool) );
+	m_SurfaceUsed.RemoveAll();
+	m_SurfaceUsed.EnsureCount( nSurfCount );
+	bool *bUseSurface = m_SurfaceUsed.Base();
 	memset( bUseSurface, 0, nSurfCount * sizeof(bool) );
 	
 	int i;
@@ -1214,6 +1224,12 @@ void CEdgeList::CullSmallOccluders()
 }
 
 
+inline bool CEdgeList::IsSurfaceUsed( int nSurfID ) const
+{
+	return m_SurfaceUsed[nSurfID];
+}
+
+
 //-----------------------------------------------------------------------------
 // Removal
 //-----------------------------------------------------------------------------
@@ -1224,6 +1240,7 @@ void CEdgeList::RemoveAll()
 	m_OrigSortIndices.RemoveAll();
 	m_Surfaces.RemoveAll();
 	m_SurfaceSort.RemoveAll();
+	m_SurfaceUsed.RemoveAll();
 }
 
 
@@ -1892,6 +1909,352 @@ void CEdgeList::Visualize( unsigned char *pColor )
 
 
 
+//-----------------------------------------------------------------------------
+//
+// Low resolution depth buffer of the occluders. Triangles are binned into
+// screen tiles and rasterized a tile at a time, 4 pixels at once with SSE.
+// Occludees are tested as the screen rectangle of their box at its nearest depth.
+//
+//-----------------------------------------------------------------------------
+#define OCCLUSION_BUFFER_WIDTH		256
+#define OCCLUSION_BUFFER_HEIGHT		128
+#define OCCLUSION_TILE_SIZE			32
+#define OCCLUSION_TILES_X			( OCCLUSION_BUFFER_WIDTH / OCCLUSION_TILE_SIZE )
+#define OCCLUSION_TILES_Y			( OCCLUSION_BUFFER_HEIGHT / OCCLUSION_TILE_SIZE )
+
+class COcclusionDepthBuffer
+{
+public:
+	COcclusionDepthBuffer();
+
+	// Occluders are added as projection space polygons, already clipped to the screen
+	void RemoveAll();
+	void AddPolygon( Vector **ppVertices, int nCount, int nSurfID );
+
+	// Rasterizes the polygons of the surfaces the edge list didn't cull
+	void Rasterize( const CEdgeList &edgeList );
+
+	bool HasOccluders() const;
+
+	// Tests the 8 projected verts of a box
+	bool IsOccluded( const Vector *pProjectedVerts ) const;
+
+private:
+	struct Triangle_t
+	{
+		// Edge functions a * x + b * y + c, all >= 0 inside the triangle
+		float	m_flEdgeA[3];
+		float	m_flEdgeB[3];
+		float	m_flEdgeC[3];
+
+		// Depth plane z = a * x + b * y + c, biased to the farthest depth in a pixel
+		float	m_flDepthA;
+		float	m_flDepthB;
+		float	m_flDepthC;
+
+		// Inclusive pixel bounds
+		int		m_nMinX;
+		int		m_nMinY;
+		int		m_nMaxX;
+		int		m_nMaxY;
+
+		int		m_nSurfID;
+	};
+
+	void AddTriangle( const Vector &v0, const Vector &v1, const Vector &v2, int nSurfID );
+	void RasterizeTriangle( const Triangle_t &tri, int nMinX, int nMinY, int nMaxX, int nMaxY );
+
+	CUtlVector< Triangle_t > m_Triangles;
+	CUtlVector< int > m_TileBins[OCCLUSION_TILES_Y][OCCLUSION_TILES_X];
+	int m_nRasterizedTriangles;
+
+	// Lower z is closer
+	float m_flDepth[OCCLUSION_BUFFER_HEIGHT][OCCLUSION_BUFFER_WIDTH];
+};
+
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+COcclusionDepthBuffer::COcclusionDepthBuffer() : m_Triangles( 0, 64 )
+{
+	m_nRasterizedTriangles = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Occluder polygons
+//-----------------------------------------------------------------------------
+void COcclusionDepthBuffer::RemoveAll()
+{
+	m_Triangles.RemoveAll();
+	m_nRasterizedTriangles = 0;
+}
+
+void COcclusionDepthBuffer::AddPolygon( Vector **ppVertices, int nCount, int nSurfID )
+{
+	// Move into pixel space, keeping projection space z
+	Vector *pPixelVerts = (Vector*)stackalloc( nCount * sizeof(Vector) );
+	for ( int i = 0; i < nCount; ++i )
+	{
+		pPixelVerts[i].x = ( ppVertices[i]->x + 1.0f ) * ( 0.5f * OCCLUSION_BUFFER_WIDTH );
+		pPixelVerts[i].y = ( ppVertices[i]->y + 1.0f ) * ( 0.5f * OCCLUSION_BUFFER_HEIGHT );
+		pPixelVerts[i].z = ppVertices[i]->z;
+	}
+
+	// The polygons are convex, so fan them out
+	for ( int k = 1; k < nCount - 1; ++k )
+	{
+		AddTriangle( pPixelVerts[0], pPixelVerts[k], pPixelVerts[k+1], nSurfID );
+	}
+}
+
+void COcclusionDepthBuffer::AddTriangle( const Vector &v0, const Vector &v1, const Vector &v2, int nSurfID )
+{
+	Vector vecEdge1, vecEdge2, vecNormal;
+	VectorSubtract( v1, v0, vecEdge1 );
+	VectorSubtract( v2, v0, vecEdge2 );
+	CrossProduct( vecEdge1, vecEdge2, vecNormal );
+
+	// Degenerate in screen space?
+	if ( fabs( vecNormal.z ) < 1e-4 )
+		return;
+
+	int i = m_Triangles.AddToTail();
+	Triangle_t &tri = m_Triangles[i];
+	tri.m_nSurfID = nSurfID;
+
+	const Vector *ppVerts[3] = { &v0, &v1, &v2 };
+	for ( int j = 0; j < 3; ++j )
+	{
+		const Vector &a = *ppVerts[j];
+		const Vector &b = *ppVerts[ (j + 1) % 3 ];
+		const Vector &c = *ppVerts[ (j + 2) % 3 ];
+		float flA = b.y - a.y;
+		float flB = a.x - b.x;
+		float flC = -( flA * a.x + flB * a.y );
+
+		// Face the edge function towards the opposite vertex
+		if ( flA * c.x + flB * c.y + flC < 0.0f )
+		{
+			flA = -flA;
+			flB = -flB;
+			flC = -flC;
+		}
+
+		tri.m_flEdgeA[j] = flA;
+		tri.m_flEdgeB[j] = flB;
+		tri.m_flEdgeC[j] = flC;
+	}
+
+	tri.m_flDepthA = -vecNormal.x / vecNormal.z;
+	tri.m_flDepthB = -vecNormal.y / vecNormal.z;
+	tri.m_flDepthC = v0.z - tri.m_flDepthA * v0.x - tri.m_flDepthB * v0.y;
+
+	// The occluder can't be further away than this anywhere in the pixel
+	tri.m_flDepthC += 0.5f * ( fabs( tri.m_flDepthA ) + fabs( tri.m_flDepthB ) );
+
+	float flMinX = min( v0.x, min( v1.x, v2.x ) );
+	float flMinY = min( v0.y, min( v1.y, v2.y ) );
+	float flMaxX = max( v0.x, max( v1.x, v2.x ) );
+	float flMaxY = max( v0.y, max( v1.y, v2.y ) );
+	tri.m_nMinX = clamp( (int)floor( flMinX ), 0, OCCLUSION_BUFFER_WIDTH - 1 );
+	tri.m_nMinY = clamp( (int)floor( flMinY ), 0, OCCLUSION_BUFFER_HEIGHT - 1 );
+	tri.m_nMaxX = clamp( (int)floor( flMaxX ), 0, OCCLUSION_BUFFER_WIDTH - 1 );
+	tri.m_nMaxY = clamp( (int)floor( flMaxY ), 0, OCCLUSION_BUFFER_HEIGHT - 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Bins the triangles into tiles, then rasterizes tile by tile
+//-----------------------------------------------------------------------------
+void COcclusionDepthBuffer::Rasterize( const CEdgeList &edgeList )
+{
+	int nTileX, nTileY;
+	for ( nTileY = 0; nTileY < OCCLUSION_TILES_Y; ++nTileY )
+	{
+		for ( nTileX = 0; nTileX < OCCLUSION_TILES_X; ++nTileX )
+		{
+			m_TileBins[nTileY][nTileX].RemoveAll();
+		}
+	}
+
+	m_nRasterizedTriangles = 0;
+	int i;
+	for ( i = 0; i < m_Triangles.Count(); ++i )
+	{
+		const Triangle_t &tri = m_Triangles[i];
+		if ( !edgeList.IsSurfaceUsed( tri.m_nSurfID ) )
+			continue;
+
+		++m_nRasterizedTriangles;
+		for ( nTileY = tri.m_nMinY / OCCLUSION_TILE_SIZE; nTileY <= tri.m_nMaxY / OCCLUSION_TILE_SIZE; ++nTileY )
+		{
+			for ( nTileX = tri.m_nMinX / OCCLUSION_TILE_SIZE; nTileX <= tri.m_nMaxX / OCCLUSION_TILE_SIZE; ++nTileX )
+			{
+				m_TileBins[nTileY][nTileX].AddToTail( i );
+			}
+		}
+	}
+
+	for ( nTileY = 0; nTileY < OCCLUSION_TILES_Y; ++nTileY )
+	{
+		int nTileMinY = nTileY * OCCLUSION_TILE_SIZE;
+		int nTileMaxY = nTileMinY + OCCLUSION_TILE_SIZE - 1;
+		for ( nTileX = 0; nTileX < OCCLUSION_TILES_X; ++nTileX )
+		{
+			int nTileMinX = nTileX * OCCLUSION_TILE_SIZE;
+			int nTileMaxX = nTileMinX + OCCLUSION_TILE_SIZE - 1;
+
+			// Nothing drawn is infinitely far away
+			for ( int y = nTileMinY; y <= nTileMaxY; ++y )
+			{
+				for ( int x = nTileMinX; x <= nTileMaxX; ++x )
+				{
+					m_flDepth[y][x] = FLT_MAX;
+				}
+			}
+
+			const CUtlVector< int > &bin = m_TileBins[nTileY][nTileX];
+			for ( i = 0; i < bin.Count(); ++i )
+			{
+				const Triangle_t &tri = m_Triangles[ bin[i] ];
+				RasterizeTriangle( tri, max( tri.m_nMinX, nTileMinX ), max( tri.m_nMinY, nTileMinY ),
+					min( tri.m_nMaxX, nTileMaxX ), min( tri.m_nMaxY, nTileMaxY ) );
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Rasterizes part of a triangle, sampling at pixel centers
+//-----------------------------------------------------------------------------
+void COcclusionDepthBuffer::RasterizeTriangle( const Triangle_t &tri, int nMinX, int nMinY, int nMaxX, int nMaxY )
+{
+	if ( MathLib_SSEEnabled() )
+	{
+		// Tiles are a multiple of 4 wide, so rounding down stays in the tile
+		nMinX &= ~3;
+
+		__m128 vecStepX = _mm_setr_ps( 0.5f, 1.5f, 2.5f, 3.5f );
+		__m128 vecZero = _mm_setzero_ps();
+		for ( int y = nMinY; y <= nMaxY; ++y )
+		{
+			float flY = y + 0.5f;
+			for ( int x = nMinX; x <= nMaxX; x += 4 )
+			{
+				__m128 vecX = _mm_add_ps( _mm_set1_ps( (float)x ), vecStepX );
+
+				__m128 vecInside = _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( vecX, _mm_set1_ps( tri.m_flEdgeA[0] ) ), 
+					_mm_set1_ps( tri.m_flEdgeB[0] * flY + tri.m_flEdgeC[0] ) ), vecZero );
+				vecInside = _mm_and_ps( vecInside, _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( vecX, _mm_set1_ps( tri.m_flEdgeA[1] ) ), 
+					_mm_set1_ps( tri.m_flEdgeB[1] * flY + tri.m_flEdgeC[1] ) ), vecZero ) );
+				vecInside = _mm_and_ps( vecInside, _mm_cmpge_ps( _mm_add_ps( _mm_mul_ps( vecX, _mm_set1_ps( tri.m_flEdgeA[2] ) ), 
+					_mm_set1_ps( tri.m_flEdgeB[2] * flY + tri.m_flEdgeC[2] ) ), vecZero ) );
+				if ( !_mm_movemask_ps( vecInside ) )
+					continue;
+
+				__m128 vecZ = _mm_add_ps( _mm_mul_ps( vecX, _mm_set1_ps( tri.m_flDepthA ) ), 
+					_mm_set1_ps( tri.m_flDepthB * flY + tri.m_flDepthC ) );
+
+				float *pDepth = &m_flDepth[y][x];
+				__m128 vecDepth = _mm_loadu_ps( pDepth );
+				__m128 vecNewDepth = _mm_min_ps( vecDepth, vecZ );
+				vecDepth = _mm_or_ps( _mm_and_ps( vecInside, vecNewDepth ), _mm_andnot_ps( vecInside, vecDepth ) );
+				_mm_storeu_ps( pDepth, vecDepth );
+			}
+		}
+		return;
+	}
+
+	for ( int y = nMinY; y <= nMaxY; ++y )
+	{
+		float flY = y + 0.5f;
+		for ( int x = nMinX; x <= nMaxX; ++x )
+		{
+			float flX = x + 0.5f;
+			int j;
+			for ( j = 0; j < 3; ++j )
+			{
+				if ( tri.m_flEdgeA[j] * flX + tri.m_flEdgeB[j] * flY + tri.m_flEdgeC[j] < 0.0f )
+					break;
+			}
+			if ( j < 3 )
+				continue;
+
+			float flZ = tri.m_flDepthA * flX + tri.m_flDepthB * flY + tri.m_flDepthC;
+			if ( flZ < m_flDepth[y][x] )
+			{
+				m_flDepth[y][x] = flZ;
+			}
+		}
+	}
+}
+
+
+bool COcclusionDepthBuffer::HasOccluders() const
+{
+	return m_nRasterizedTriangles > 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// The box is occluded if the depth buffer is at least as close as the 
+// nearest point of the box everywhere within its screen rectangle
+//-----------------------------------------------------------------------------
+bool COcclusionDepthBuffer::IsOccluded( const Vector *pProjectedVerts ) const
+{
+	Vector vecMins = pProjectedVerts[0];
+	Vector vecMaxs = pProjectedVerts[0];
+	for ( int i = 1; i < 8; ++i )
+	{
+		VectorMin( vecMins, pProjectedVerts[i], vecMins );
+		VectorMax( vecMaxs, pProjectedVerts[i], vecMaxs );
+	}
+
+	// Off screen counts as occluded, like the edge list does
+	if ( vecMaxs.x < -1.0f || vecMins.x >= 1.0f || vecMaxs.y < -1.0f || vecMins.y >= 1.0f )
+		return true;
+
+	// Grow the rectangle by a pixel so partially covered pixels are tested too
+	int nMinX = (int)floor( ( vecMins.x + 1.0f ) * ( 0.5f * OCCLUSION_BUFFER_WIDTH ) ) - 1;
+	int nMinY = (int)floor( ( vecMins.y + 1.0f ) * ( 0.5f * OCCLUSION_BUFFER_HEIGHT ) ) - 1;
+	int nMaxX = (int)floor( ( vecMaxs.x + 1.0f ) * ( 0.5f * OCCLUSION_BUFFER_WIDTH ) ) + 1;
+	int nMaxY = (int)floor( ( vecMaxs.y + 1.0f ) * ( 0.5f * OCCLUSION_BUFFER_HEIGHT ) ) + 1;
+	nMinX = clamp( nMinX, 0, OCCLUSION_BUFFER_WIDTH - 1 );
+	nMinY = clamp( nMinY, 0, OCCLUSION_BUFFER_HEIGHT - 1 );
+	nMaxX = clamp( nMaxX, 0, OCCLUSION_BUFFER_WIDTH - 1 );
+	nMaxY = clamp( nMaxY, 0, OCCLUSION_BUFFER_HEIGHT - 1 );
+
+	float flNearestZ = vecMins.z;
+	bool bUseSSE = MathLib_SSEEnabled();
+	__m128 vecNearestZ = _mm_set1_ps( flNearestZ );
+	for ( int y = nMinY; y <= nMaxY; ++y )
+	{
+		const float *pDepth = m_flDepth[y];
+		int x = nMinX;
+		if ( bUseSSE )
+		{
+			for ( ; x + 3 <= nMaxX; x += 4 )
+			{
+				if ( _mm_movemask_ps( _mm_cmpgt_ps( _mm_loadu_ps( pDepth + x ), vecNearestZ ) ) )
+					return false;
+			}
+		}
+
+		for ( ; x <= nMaxX; ++x )
+		{
+			if ( pDepth[x] > flNearestZ )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+
 //-----------------------------------------------------------------------------
 // Implementation of IOcclusionSystem
 //-----------------------------------------------------------------------------
@@ -1942,6 +2305,20 @@ private:
 	// Stitches up clipped vertices
 	void StitchClippedVertices( Vector *pVertices, int nCount );
 
+	// Projects the 8 box verts, returns false if the box shouldn't be occlusion tested
+	bool ProjectBox( const Vector &vecAbsMins, const Vector &vecAbsMaxs, Vector *pVecProjectedVertex );
+
+	// Tests the projected box against the winged edge list
+	bool IsOccludedByEdgeList( const Vector &vecAbsMins, const Vector &vecAbsMaxs, const Vector *pVecProjectedVertex );
+
+	// Which of the two tests are needed this frame
+	enum
+	{
+		OCCLUSION_TEST_EDGE_LIST = 0x1,
+		OCCLUSION_TEST_DEPTH_BUFFER = 0x2,
+	};
+	int ComputeOcclusionTests() const;
+
 private:
 	// Per-frame information
 	bool m_bEdgeListDirty;
@@ -1957,11 +2334,15 @@ private:
 	float m_flFOVFactor;
 	CEdgeList m_EdgeList;
 	CWingedEdgeList m_WingedEdgeList;
+	COcclusionDepthBuffer m_DepthBuffer;
+	int m_nOcclusionTests;			// which tests the occluder lists were built for
 	CUtlVector< Vector > m_ClippedVerts;
 
 	// Stats
 	int m_nTests;
 	int m_nOccluded;
+	int m_nDepthOnlyOccluded;		// r_occlusioncompare disagreements
+	int m_nEdgeOnlyOccluded;
 };
 
 static COcclusionSystem g_OcclusionSystem;
@@ -1983,8 +2364,11 @@ IOcclusionSystem *OcclusionSystem()
 COcclusionSystem::COcclusionSystem() : m_ClippedVerts( 0, 64 )
 {
 	m_bEdgeListDirty = false;
+	m_nOcclusionTests = 0;
 	m_nTests = 0;
 	m_nOccluded = 0;
+	m_nDepthOnlyOccluded = 0;
+	m_nEdgeOnlyOccluded = 0;
 }
 
 COcclusionSystem::~COcclusionSystem()
@@ -2256,6 +2640,11 @@ void COcclusionSystem::AddPolygonToEdgeList( CEdgeList &edgeList, Vector **ppPol
 	}
 	edgeList.SetSurfaceArea( nSurfID, flScreenArea );
 
+	if ( m_nOcclusionTests & OCCLUSION_TEST_DEPTH_BUFFER )
+	{
+		m_DepthBuffer.AddPolygon( ppClipVertex, nClipCount, nSurfID );
+	}
+
 	// If there's a clipped vertex, attempt to seam up with other edges...
 	if ( bClipped )
 	{
@@ -2279,14 +2668,25 @@ void COcclusionSystem::AddPolygonToEdgeList( CEdgeList &edgeList, Vector **ppPol
 //-----------------------------------------------------------------------------
 // Recomputes the occluder edge list
 //-----------------------------------------------------------------------------
+int COcclusionSystem::ComputeOcclusionTests() const
+{
+	if ( r_occlusioncompare.GetInt() )
+		return OCCLUSION_TEST_EDGE_LIST | OCCLUSION_TEST_DEPTH_BUFFER;
+
+	return r_occlusiondepthbuffer.GetInt() ? OCCLUSION_TEST_DEPTH_BUFFER : OCCLUSION_TEST_EDGE_LIST;
+}
+
 void COcclusionSystem::RecomputeOccluderEdgeList()
 {
-	if ( !m_bEdgeListDirty )
+	int nOcclusionTests = ComputeOcclusionTests();
+	if ( !m_bEdgeListDirty && ( nOcclusionTests == m_nOcclusionTests ) )
 		return;
 
 	m_bEdgeListDirty = false;
+	m_nOcclusionTests = nOcclusionTests;
 	m_EdgeList.RemoveAll();
 	m_WingedEdgeList.Clear();
+	m_DepthBuffer.RemoveAll();
 	m_ClippedVerts.RemoveAll();
 
 	mvertex_t *pVertices = host_state.worldmodel->brush.vertexes;
@@ -2340,7 +2740,16 @@ void COcclusionSystem::RecomputeOccluderEdgeList()
 	}
 
 	m_EdgeList.CullSmallOccluders();
-	m_EdgeList.ReduceActiveList( m_WingedEdgeList ); 
+
+	// The depth buffer doesn't need the reduced edge list
+	if ( m_nOcclusionTests & OCCLUSION_TEST_DEPTH_BUFFER )
+	{
+		m_DepthBuffer.Rasterize( m_EdgeList );
+	}
+	if ( m_nOcclusionTests & OCCLUSION_TEST_EDGE_LIST )
+	{
+		m_EdgeList.ReduceActiveList( m_WingedEdgeList ); 
+	}
 //	Msg("Edge count %d -> %d\n", m_EdgeList.EdgeCount(), m_WingedEdgeList.EdgeCount() );
 
 	unsigned char color[4] = { 255, 255, 255, 255 };
@@ -2397,8 +2806,14 @@ void COcclusionSystem::SetView( const Vector &vecCameraPos, float flFOV, const V
 		{
 			float flPercent = 100.0f * ((float)m_nOccluded / (float)m_nTests);
 			Msg("Occl %.2f (%d/%d)\n", flPercent, m_nOccluded, m_nTests );
+			if ( r_occlusioncompare.GetInt() )
+			{
+				Msg("  only depth buffer occluded %d, only edge list occluded %d\n", m_nDepthOnlyOccluded, m_nEdgeOnlyOccluded );
+			}
 			m_nTests = 0;
 			m_nOccluded = 0;
+			m_nDepthOnlyOccluded = 0;
+			m_nEdgeOnlyOccluded = 0;
 		}
 	}
 }
@@ -2506,19 +2921,8 @@ static bool WingedEdgeLessFunc( const int& src1, const int& src2, void *pCtx )
 	return dEdge1.x * dEdge2.y <= dEdge1.y * dEdge2.x;
 }
 
-bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAbsMaxs )
+bool COcclusionSystem::ProjectBox( const Vector &vecAbsMins, const Vector &vecAbsMaxs, Vector *pVecProjectedVertex )
 {
-	if ( r_occlusion.GetInt() == 0 )
-		return false;
-
-	VPROF_BUDGET( "COcclusionSystem::IsOccluded", "Occlusion" );
-
-	RecomputeOccluderEdgeList();
-
-	// No occluders? Then the edge list isn't occluded
-	if ( m_WingedEdgeList.EdgeCount() == 0 )
-		return false;
-
 	// Don't occlude things that have large screen area
 	// Use a super cheap but inaccurate screen area computation
 	Vector vecCenter;
@@ -2541,23 +2945,14 @@ bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAb
 	if (flScreenArea >= flMaxSize)
 		return false;
 
-	++m_nTests;
-
-	// Clear out its state
-	s_WingedTestEdgeList.Clear();
-
 	// NOTE: This assumes that frustum culling has already occurred on this object
 	// If that were not the case, we'd need to add a little extra into this 
 	// (probably a single plane test, which tests if the box is wholly behind the camera )
 
-	// Convert the bbox into a max of 3 quads...
-	const Vector *pCornerVert[2] = { &vecAbsMins, &vecAbsMaxs };
-
 	// Compute the 8 box verts, and transform them into projective space...
 	// NOTE: We'd want to project them *after* the plane test if there were
 	// no frustum culling.
 	int i;
-	Vector pVecProjectedVertex[8];
 
 	// NOTE: The code immediately below is an optimized version of this loop
 	// The optimization takes advantage of the fact that the verts are all
@@ -2602,6 +2997,26 @@ bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAb
 			return false;
 	}
 
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Tests the projected box against the winged edge list
+//-----------------------------------------------------------------------------
+static int s_nEdgeListTestCount = 0;
+
+bool COcclusionSystem::IsOccludedByEdgeList( const Vector &vecAbsMins, const Vector &vecAbsMaxs, const Vector *pVecProjectedVertex )
+{
+	// Marks the box edges used by this test
+	++s_nEdgeListTestCount;
+
+	// Clear out its state
+	s_WingedTestEdgeList.Clear();
+
+	// Convert the bbox into a max of 3 quads...
+	const Vector *pCornerVert[2] = { &vecAbsMins, &vecAbsMaxs };
+
 	// Precompute stuff needed by the loop over faces below
 	float pSign[2] = { -1, 1 };
 	Vector vecDelta[2];
@@ -2609,6 +3024,7 @@ bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAb
 	VectorSubtract( m_vecCameraPosition, *pCornerVert[1], vecDelta[1] );
 
 	// Determine which faces + edges are visible...
+	int i;
 	int pSurfInd[6];
 	for ( i = 0; i < 6; ++i )
 	{
@@ -2632,10 +3048,10 @@ bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAb
 
 		// Mark edges as being used...
 		int *pFaceEdges = s_pFaceEdges[i];
-		s_pEdges[ *pFaceEdges++ ].m_nTestCount = m_nTests;
-		s_pEdges[ *pFaceEdges++ ].m_nTestCount = m_nTests;
-		s_pEdges[ *pFaceEdges++ ].m_nTestCount = m_nTests;
-		s_pEdges[ *pFaceEdges ].m_nTestCount = m_nTests;
+		s_pEdges[ *pFaceEdges++ ].m_nTestCount = s_nEdgeListTestCount;
+		s_pEdges[ *pFaceEdges++ ].m_nTestCount = s_nEdgeListTestCount;
+		s_pEdges[ *pFaceEdges++ ].m_nTestCount = s_nEdgeListTestCount;
+		s_pEdges[ *pFaceEdges ].m_nTestCount = s_nEdgeListTestCount;
 	}
 
 	// Sort edges by minimum Y + dx/dy...
@@ -2646,7 +3062,7 @@ bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAb
 	{
 		// Skip non-visible edges
 		EdgeInfo_t *pEdge = &s_pEdges[i];
-		if ( pEdge->m_nTestCount != m_nTests )
+		if ( pEdge->m_nTestCount != s_nEdgeListTestCount )
 			continue;
 
 		pEdge->m_nMinVert = ( pVecProjectedVertex[ pEdge->m_nVert[0] ].y >= pVecProjectedVertex[ pEdge->m_nVert[1] ].y );
@@ -2676,11 +3092,64 @@ bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAb
 
 	// Now let's see if this edge list is occluded or not..
 	bool bOccluded = m_WingedEdgeList.IsOccludingEdgeList( s_WingedTestEdgeList );
-	if (bOccluded)
-		++m_nOccluded;
 
 	s_WingedTestEdgeList.Visualize( s_VisualizationColor[bOccluded] );
 
 	return bOccluded;
 }
 
+
+//-----------------------------------------------------------------------------
+// Occlusion test
+//-----------------------------------------------------------------------------
+bool COcclusionSystem::IsOccluded( const Vector &vecAbsMins, const Vector &vecAbsMaxs )
+{
+	if ( r_occlusion.GetInt() == 0 )
+		return false;
+
+	VPROF_BUDGET( "COcclusionSystem::IsOccluded", "Occlusion" );
+
+	RecomputeOccluderEdgeList();
+
+	// No occluders? Then the edge list isn't occluded
+	bool bUseDepthBuffer = ( m_nOcclusionTests == OCCLUSION_TEST_DEPTH_BUFFER ) || 
+		( ( m_nOcclusionTests & OCCLUSION_TEST_DEPTH_BUFFER ) && r_occlusiondepthbuffer.GetInt() );
+	if ( bUseDepthBuffer ? !m_DepthBuffer.HasOccluders() : ( m_WingedEdgeList.EdgeCount() == 0 ) )
+		return false;
+
+	Vector pVecProjectedVertex[8];
+	if ( !ProjectBox( vecAbsMins, vecAbsMaxs, pVecProjectedVertex ) )
+		return false;
+
+	++m_nTests;
+
+	bool bOccluded;
+	if ( m_nOcclusionTests == ( OCCLUSION_TEST_EDGE_LIST | OCCLUSION_TEST_DEPTH_BUFFER ) )
+	{
+		bool bEdgeListOccluded = IsOccludedByEdgeList( vecAbsMins, vecAbsMaxs, pVecProjectedVertex );
+		bool bDepthBufferOccluded = m_DepthBuffer.IsOccluded( pVecProjectedVertex );
+		if ( bDepthBufferOccluded && !bEdgeListOccluded )
+		{
+			++m_nDepthOnlyOccluded;
+		}
+		else if ( bEdgeListOccluded && !bDepthBufferOccluded )
+		{
+			++m_nEdgeOnlyOccluded;
+		}
+		bOccluded = bUseDepthBuffer ? bDepthBufferOccluded : bEdgeListOccluded;
+	}
+	else if ( bUseDepthBuffer )
+	{
+		bOccluded = m_DepthBuffer.IsOccluded( pVecProjectedVertex );
+	}
+	else
+	{
+		bOccluded = IsOccludedByEdgeList( vecAbsMins, vecAbsMaxs, pVecProjectedVertex );
+	}
+
+	if (bOccluded)
+		++m_nOccluded;
+
+	return bOccluded;
+}
+
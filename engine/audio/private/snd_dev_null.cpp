@@ -0,0 +1,316 @@
+//========= Copyright (c) 1996-2003, Valve LLC, All rights reserved. ==========
+//
+// Purpose: Audio device that mixes like a real one but plays to nowhere.
+//			The output position advances with the clock, so everything up to
+//			the transfer runs as it would with hardware, on machines that
+//			don't have any.  Selected with -simsound.
+//
+//=============================================================================
+
+#include <math.h>
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "convar.h"
+#include "snd_device.h"
+#include "sound_private.h"
+#include "snd_mix_buf.h"
+#include "snd_channels.h"
+#include "snd_dev_null.h"
+
+extern qboolean snd_firsttime;
+extern ConVar snd_mixahead;
+extern void MIX_ScaleChannelVolume( paintbuffer_t *ppaint, channel_t *pChannel, int volume[CCHANVOLUMES], int mixchans );
+
+// 64K like the wave device, > 1/3 second at 16-bit stereo 44k
+#define NULLMIX_BUFFER_SIZE		0x10000
+
+// NOTE: This only does 16-bit stereo
+class CAudioNullMix : public IAudioDevice
+{
+public:
+	CAudioNullMix();
+
+	bool		IsActive( void );
+	bool		Init( void );
+	void		Shutdown( void );
+	void		PaintEnd( void );
+	int			GetOutputPosition( void );
+	void		ChannelReset( int entnum, int channelIndex, float distanceMod );
+	void		Pause( void );
+	void		UnPause( void );
+	float		MixDryVolume( void );
+	bool		Should3DMix( void );
+	void		StopAllSounds( void );
+
+	int			PaintBegin( int soundtime, int paintedtime );
+	void		ClearBuffer( void );
+	void		UpdateListener( const Vector& position, const Vector& forward, const Vector& right, const Vector& up );
+	void		MixBegin( int sampleCount );
+	void		MixUpsample( int sampleCount, int filtertype );
+	void		Mix8Mono( channel_t *pChannel, char *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress );
+	void		Mix8Stereo( channel_t *pChannel, char *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress );
+	void		Mix16Mono( channel_t *pChannel, short *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress );
+	void		Mix16Stereo( channel_t *pChannel, short *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress );
+
+	void		TransferSamples( int end );
+	void		SpatializeChannel( int volume[4], int master_vol, const Vector& sourceDir, float gain, float dotRight, float dotFront );
+	void		ApplyDSPEffects( int idsp, portable_samplepair_t *pbuffront, portable_samplepair_t *pbufrear, int samplecount );
+
+	const char *DeviceName( void )			{ return "Null (mixing)"; }
+	int			DeviceChannels( void )		{ return 2; }
+	int			DeviceSampleBits( void )	{ return 16; }
+	int			DeviceSampleBytes( void )	{ return 2; }
+	int			DeviceDmaSpeed( void )		{ return SOUND_DMA_SPEED; }
+	int			DeviceSampleCount( void )	{ return NULLMIX_BUFFER_SIZE / DeviceSampleBytes(); }
+
+	void		*DeviceLockBuffer( void );
+	void		DeviceUnlockBuffer( void *pbuffer );
+
+private:
+	double		GetPlayTime( void );
+
+	void		*m_pBuffer;
+
+	double		m_flStartTime;		// Plat_FloatTime the output position counts from
+	double		m_flPauseTime;		// Plat_FloatTime the first pause started
+	int			m_pauseCount;
+};
+
+
+IAudioDevice *Audio_CreateNullMixDevice( void )
+{
+	CAudioNullMix *pDevice = new CAudioNullMix;
+
+	if ( pDevice->Init() )
+		return pDevice;
+
+	delete pDevice;
+	return NULL;
+}
+
+CAudioNullMix::CAudioNullMix()
+{
+	m_pBuffer = NULL;
+	m_flStartTime = 0;
+	m_flPauseTime = 0;
+	m_pauseCount = 0;
+}
+
+bool CAudioNullMix::Init( void )
+{
+	m_pBuffer = malloc( NULLMIX_BUFFER_SIZE );
+	if ( !m_pBuffer )
+		return false;
+
+	memset( m_pBuffer, 0, NULLMIX_BUFFER_SIZE );
+
+	m_flStartTime = Plat_FloatTime();
+	m_pauseCount = 0;
+
+	if (snd_firsttime)
+		DevMsg ("Null mixing sound initialized\n");
+
+	return true;
+}
+
+
+void CAudioNullMix::Shutdown( void )
+{
+	free( m_pBuffer );
+	m_pBuffer = NULL;
+}
+
+
+void CAudioNullMix::PaintEnd( void )
+{
+}
+
+
+// seconds of sound played since Init, not counting pauses
+double CAudioNullMix::GetPlayTime( void )
+{
+	if ( m_pauseCount )
+		return m_flPauseTime - m_flStartTime;
+
+	return Plat_FloatTime() - m_flStartTime;
+}
+
+
+int CAudioNullMix::GetOutputPosition( void )
+{
+	int fullsamples = DeviceSampleCount() / DeviceChannels();
+
+	int s = (int)fmod( GetPlayTime() * DeviceDmaSpeed(), (double)fullsamples );
+
+	return s * DeviceChannels();
+}
+
+
+int CAudioNullMix::PaintBegin( int soundtime, int paintedtime )
+{
+	//  soundtime - total samples that have been played out to hardware at dmaspeed
+	//  paintedtime - total samples that have been mixed at speed
+	//  endtime - target for samples in mixahead buffer at speed
+
+	int endtime = soundtime + snd_mixahead.GetFloat() * DeviceDmaSpeed();
+	
+	int samps = DeviceSampleCount() >> (DeviceChannels()-1);
+
+	if ((int)(endtime - soundtime) > samps)
+		endtime = soundtime + samps;
+
+	return endtime;
+}
+
+
+void CAudioNullMix::Pause( void )
+{
+	m_pauseCount++;
+
+	if (m_pauseCount == 1)
+		m_flPauseTime = Plat_FloatTime();
+}
+
+
+void CAudioNullMix::UnPause( void )
+{
+	if ( m_pauseCount > 0 )
+	{
+		m_pauseCount--;
+
+		// don't count the time spent paused as played
+		if ( !m_pauseCount )
+			m_flStartTime += Plat_FloatTime() - m_flPauseTime;
+	}
+}
+
+bool CAudioNullMix::IsActive( void )
+{
+	if ( m_pauseCount )
+		return false;
+
+	return true;
+}
+
+float CAudioNullMix::MixDryVolume( void )
+{
+	return 0;
+}
+
+
+bool CAudioNullMix::Should3DMix( void )
+{
+	return false;
+}
+
+
+void CAudioNullMix::ClearBuffer( void )
+{
+	if ( !m_pBuffer )
+		return;
+
+	memset( m_pBuffer, 0, NULLMIX_BUFFER_SIZE );
+}
+
+void CAudioNullMix::UpdateListener( const Vector& position, const Vector& forward, const Vector& right, const Vector& up )
+{
+}
+
+
+void CAudioNullMix::MixBegin( int sampleCount )
+{
+	MIX_ClearAllPaintBuffers( sampleCount, false );
+}
+
+
+void CAudioNullMix::MixUpsample( int sampleCount, int filtertype )
+{
+	paintbuffer_t *ppaint = MIX_GetCurrentPaintbufferPtr();
+	int ifilter = ppaint->ifilter;
+	
+	Assert (ifilter < CPAINTFILTERS);
+
+	S_MixBufferUpsample2x( sampleCount, ppaint->pbuf, &(ppaint->fltmem[ifilter][0]), CPAINTFILTERMEM, filtertype );
+
+	ppaint->ifilter++;
+}
+
+
+void CAudioNullMix::Mix8Mono( channel_t *pChannel, char *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress )
+{
+	int volume[CCHANVOLUMES];
+	paintbuffer_t *ppaint = MIX_GetCurrentPaintbufferPtr();
+
+	MIX_ScaleChannelVolume( ppaint, pChannel, volume, 1);
+
+	Mix8MonoWavtype( pChannel, ppaint->pbuf + outputOffset, volume, (byte *)pData, inputOffset, rateScaleFix, outCount );
+}
+
+
+void CAudioNullMix::Mix8Stereo( channel_t *pChannel, char *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress )
+{
+	int volume[CCHANVOLUMES];
+	paintbuffer_t *ppaint = MIX_GetCurrentPaintbufferPtr();
+
+	MIX_ScaleChannelVolume( ppaint, pChannel, volume, 2 );
+
+	Mix8StereoWavtype( pChannel, ppaint->pbuf + outputOffset, volume, (byte *)pData, inputOffset, rateScaleFix, outCount );
+}
+
+
+void CAudioNullMix::Mix16Mono( channel_t *pChannel, short *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress )
+{
+	int volume[CCHANVOLUMES];
+	paintbuffer_t *ppaint = MIX_GetCurrentPaintbufferPtr();
+
+	MIX_ScaleChannelVolume( ppaint, pChannel, volume, 1 );
+
+	Mix16MonoWavtype( pChannel, ppaint->pbuf + outputOffset, volume, pData, inputOffset, rateScaleFix, outCount );
+}
+
+
+void CAudioNullMix::Mix16Stereo( channel_t *pChannel, short *pData, int outputOffset, int inputOffset, fixedint rateScaleFix, int outCount, int timecompress )
+{
+	int volume[CCHANVOLUMES];
+	paintbuffer_t *ppaint = MIX_GetCurrentPaintbufferPtr();
+
+	MIX_ScaleChannelVolume( ppaint, pChannel, volume, 2 );
+
+	Mix16StereoWavtype( pChannel, ppaint->pbuf + outputOffset, volume, pData, inputOffset, rateScaleFix, outCount );
+}
+
+
+void CAudioNullMix::ChannelReset( int entnum, int channelIndex, float distanceMod )
+{
+}
+
+
+void *CAudioNullMix::DeviceLockBuffer( void )
+{
+	return m_pBuffer;
+}
+
+void CAudioNullMix::DeviceUnlockBuffer( void *pbuffer )
+{
+}
+
+
+void CAudioNullMix::TransferSamples( int end )
+{
+	S_TransferStereo16( end );
+}
+
+void CAudioNullMix::SpatializeChannel( int volume[4], int master_vol, const Vector& sourceDir, float gain, float dotRight, float dotFront )
+{
+	S_SpatializeChannel( volume, master_vol, gain, dotRight );
+}
+
+void CAudioNullMix::StopAllSounds( void )
+{
+}
+
+
+void CAudioNullMix::ApplyDSPEffects( int idsp, portable_samplepair_t *pbuffront, portable_samplepair_t *pbufrear, int samplecount )
+{
+	DSP_Process( idsp, pbuffront, pbufrear, samplecount );
+}
@@ -0,0 +1,15 @@
+//========= Copyright (c) 1996-2003, Valve LLC, All rights reserved. ==========
+//
+// Purpose: Audio device that mixes like a real one but plays to nowhere
+//
+//=============================================================================
+
+#ifndef SND_DEV_NULL_H
+#define SND_DEV_NULL_H
+#pragma once
+
+class IAudioDevice;
+
+IAudioDevice *Audio_CreateNullMixDevice( void );
+
+#endif // SND_DEV_NULL_H
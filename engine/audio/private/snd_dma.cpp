@@ -21,6 +21,8 @@
 #include "snd_device.h"
 #include "snd_sfx.h"
 #include "snd_convars.h"
+#include "snd_mixthread.h"
+#include "snd_wave_data.h"
 
 #include "vox_private.h"
 #include "../../traceinit.h"
@@ -304,8 +306,12 @@ void S_Init (void)
 // =======================================================================
 void S_Shutdown(void)
 {
+	MIX_ThreadShutdown();
+
 	S_StopAllSounds( true );
 
+	WaveDataStream_Shutdown();
+
 	SNDDMA_Shutdown();
 
 	int c = s_Sounds.Count();
@@ -2316,6 +2322,9 @@ void S_StopAllSounds(qboolean clear)
 
 	Q_memset(channels, 0, MAX_CHANNELS * sizeof(channel_t));
 
+	// stop the mix thread's copies now rather than next frame
+	MIX_ThreadPostChannels();
+
 	if (clear)
 	{
 		S_ClearBuffer ();
@@ -2334,6 +2343,8 @@ void S_StopAllSoundsC (void)
 
 void S_ClearBuffer (void)
 {
+	CAutoLock lock( g_MixThreadMutex );
+
 	g_AudioDevice->ClearBuffer();
 	DSP_ClearState();
 	MIX_ClearAllPaintBuffers( PAINTBUFFER_SIZE, true );
@@ -2520,6 +2531,9 @@ void S_Update( Vector const &origin, Vector const &forward, Vector const &right,
 		}
 	}
 
+	// hand the channels to the mix thread, if it's running
+	MIX_ThreadFrame();
+
 // mix some sound
 	S_Update_();
 }
@@ -2547,7 +2561,12 @@ void GetSoundtime(void)
 		{	// time to chop things off to avoid 32 bit limits
 			buffers = 0;
 			paintedtime = fullsamples;
-			S_StopAllSounds (true);
+
+			// the mix thread can't touch channels[], it has the game thread do it
+			if ( MIX_ThreadActive() )
+				MIX_ThreadStopAllSounds();
+			else
+				S_StopAllSounds (true);
 		}
 	}
 	oldsamplepos = samplepos;
@@ -2586,11 +2605,21 @@ extern void DEBUG_StopSoundMeasure(int type, int samplecount );
 
 void S_Update_(void)
 {
-	unsigned        endtime;
-
 	if (!g_AudioDevice->IsActive())
 		return;
 
+	// the mix thread keeps itself ahead of the device
+	if ( MIX_ThreadActive() )
+		return;
+
+	S_PaintAhead( 0 );
+}
+
+bool S_PaintAhead( int maxAhead )
+{
+	unsigned        endtime;
+	bool			underrun;
+
 	DEBUG_StartSoundMeasure(4, 0);
 
 // Get soundtime, which tells how many samples have
@@ -2601,6 +2630,8 @@ void S_Update_(void)
 // paintedtime indicates how many samples we've actually mixed
 // and sent to the dma buffer since sound system startup.
 
+	underrun = paintedtime < soundtime;
+
 	if (paintedtime < soundtime)
 	{
 		// if soundtime > paintedtime, then the dma buffer
@@ -2619,6 +2650,16 @@ void S_Update_(void)
 
 	endtime = g_AudioDevice->PaintBegin( soundtime, paintedtime );
 
+	// the mix thread stays a fixed distance ahead, whatever snd_mixahead is.
+	// keep the mix a multiple of 4 samples like PaintBegin does.
+
+	if ( maxAhead > 0 && (int)(endtime - soundtime) > maxAhead )
+	{
+		endtime = soundtime + maxAhead;
+		if ( (int)(endtime - paintedtime) > 0 )
+			endtime -= (endtime - paintedtime) & 0x3;
+	}
+
 	DEBUG_StartSoundMeasure(2, endtime - paintedtime);
 	
 	MIX_PaintChannels (endtime);
@@ -2628,6 +2669,8 @@ void S_Update_(void)
 	SNDDMA_Submit ();
 
 	DEBUG_StopSoundMeasure( 4, 0 );
+
+	return underrun;
 }
 
 /*
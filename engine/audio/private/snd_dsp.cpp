@@ -20,8 +20,12 @@
 #include "snd_convars.h"
 #include "SoundService.h"
 #include "commonmacros.h"
+#include "snd_mixthread.h"
+#include "vstdlib/random.h"
+#include "../../cmd.h"
 
 #include "mathlib.h"
+#include <emmintrin.h>
 
 
 // hard clip input value to -32767 <= y <= 32767
@@ -495,6 +499,165 @@ inline int dly_allpass ( int D, int t, int *w, int **p, int a, int b, int x )
 	return ( (y * b) >> PBITS );
 }
 
+/////////////////////////////////////////
+// block versions of the delay lines
+/////////////////////////////////////////
+
+// The reverberators above read tap t, then write the head of the delay line,
+// one sample at a time.  A sample written now is not read back for another t
+// samples (D+1 if t is 0), so up to that many taps can be read at once, the
+// outputs computed for the whole run, and the new samples written back at once.
+// Results match the single sample versions bit for bit.  The gain stages use
+// SSE2 when the cpu has it.
+
+#define DSP_BLOCK		256			// max samples processed per block
+
+ConVar dsp_block ("dsp_block", "1", 0, "Process delays, reverbs and diffusors a block at a time" );
+
+inline bool DSP_UseBlock( void ) { return dsp_block.GetInt() != 0; }
+
+// low 32 bits of 4 signed 32 bit products, SSE2 has no pmulld
+
+inline __m128i dsp_mullo32 ( __m128i a, __m128i b )
+{
+	__m128i even = _mm_mul_epu32( a, b );
+	__m128i odd = _mm_mul_epu32( _mm_srli_si128( a, 4 ), _mm_srli_si128( b, 4 ) );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+// number of samples, up to count, that delay line D tapped at t can process as one block
+
+inline int dly_blocksize ( int D, int t, int count )
+{
+	int n = t ? t : D + 1;
+
+	return min( min( n, count ), DSP_BLOCK );
+}
+
+// copy the next n outputs of tap t into s[], without updating the delay line
+// D delay line size in samples w[0..D]
+// w delay line buffer pointer, dimension D+1
+// p circular pointer
+
+inline void dly_gather ( int D, int *w, int *p, int t, int *s, int n )
+{
+	int i = (p - w + t) % (D + 1);
+	int c, k;
+
+	// the pointer moves down through w[], wrapping from w[0] to w[D]
+
+	while ( n )
+	{
+		c = min( n, i + 1 );
+		for ( k = 0; k < c; k++ )
+			*s++ = w[i - k];
+		n -= c;
+		i = D;
+	}
+}
+
+// write the next n delay inputs from v[] and update the circular pointer
+
+inline void dly_scatter ( int D, int *w, int **p, int *v, int n )
+{
+	int i = *p - w;
+	int j = i - n;
+	int c, k;
+
+	while ( n )
+	{
+		c = min( n, i + 1 );
+		for ( k = 0; k < c; k++ )
+			w[i - k] = *v++;
+		n -= c;
+		i = D;
+	}
+
+	if ( j < 0 )
+		j += D + 1;
+
+	*p = w + j;
+}
+
+// plain reverberator stage for n samples, given delay outputs s[]
+// x input samples, replaced with output samples
+// v delay inputs
+
+inline void dly_plain_block ( int *x, int *s, int *v, int a, int b, int n )
+{
+	int i = 0;
+	int y;
+
+	if ( MathLib_SSE2Enabled() )
+	{
+		__m128i va = _mm_set1_epi32( a );
+		__m128i vb = _mm_set1_epi32( b );
+
+		for ( ; i + 4 <= n; i += 4 )
+		{
+			__m128i vy = _mm_srai_epi32( dsp_mullo32( va, _mm_loadu_si128( (__m128i *)(s + i) ) ), PBITS );
+			vy = _mm_add_epi32( _mm_loadu_si128( (__m128i *)(x + i) ), vy );
+			_mm_storeu_si128( (__m128i *)(v + i), vy );
+			_mm_storeu_si128( (__m128i *)(x + i), _mm_srai_epi32( dsp_mullo32( vy, vb ), PBITS ) );
+		}
+	}
+
+	for ( ; i < n; i++ )
+	{
+		y = x[i] + (( a * s[i] ) >> PBITS);
+		v[i] = y;
+		x[i] = ( (y * b) >> PBITS );
+	}
+}
+
+// allpass reverberator stage for n samples, given delay outputs s[]
+
+inline void dly_allpass_block ( int *x, int *s, int *v, int a, int b, int n )
+{
+	int i = 0;
+	int y, s0;
+
+	if ( MathLib_SSE2Enabled() )
+	{
+		__m128i va = _mm_set1_epi32( a );
+		__m128i vna = _mm_set1_epi32( -a );
+		__m128i vb = _mm_set1_epi32( b );
+
+		for ( ; i + 4 <= n; i += 4 )
+		{
+			__m128i vsD = _mm_loadu_si128( (__m128i *)(s + i) );
+			__m128i vs0 = _mm_add_epi32( _mm_loadu_si128( (__m128i *)(x + i) ), _mm_srai_epi32( dsp_mullo32( va, vsD ), PBITS ) );
+			__m128i vy = _mm_add_epi32( _mm_srai_epi32( dsp_mullo32( vna, vs0 ), PBITS ), vsD );
+			_mm_storeu_si128( (__m128i *)(v + i), vs0 );
+			_mm_storeu_si128( (__m128i *)(x + i), _mm_srai_epi32( dsp_mullo32( vy, vb ), PBITS ) );
+		}
+	}
+
+	for ( ; i < n; i++ )
+	{
+		s0 = x[i] + (( a * s[i] ) >> PBITS);
+		y = ( ( -a * s0 ) >> PBITS ) + s[i];
+		v[i] = s0;
+		x[i] = ( (y * b) >> PBITS );
+	}
+}
+
+// pOut += pIn for n samples
+
+inline void dsp_add_block ( int *pOut, int *pIn, int n )
+{
+	int i = 0;
+
+	if ( MathLib_SSE2Enabled() )
+	{
+		for ( ; i + 4 <= n; i += 4 )
+			_mm_storeu_si128( (__m128i *)(pOut + i), _mm_add_epi32( _mm_loadu_si128( (__m128i *)(pOut + i) ), _mm_loadu_si128( (__m128i *)(pIn + i) ) ) );
+	}
+
+	for ( ; i < n; i++ )
+		pOut[i] += pIn[i];
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////
 // fixed point math for real-time wave table traversing, pitch shifting, resampling
@@ -531,6 +694,56 @@ typedef void (*prc_Mod_t) (void *pdata, float v);				// modulation function for
 #define OP_RIGHT			1		// batch process right channel in place
 #define OP_LEFT_DUPLICATE	2		// batch process left channel in place, duplicate to right channel
 
+typedef void (*dsp_GetNextBlock_t) ( void *pdata, int *pbuf, int count );	// block version of getnext, count <= DSP_BLOCK
+
+// batch process through a block function: copy the channel selected by op out of
+// pbuffer DSP_BLOCK samples at a time, process the block, then copy it back
+
+void DSP_GetNextBlockN( void *pdata, dsp_GetNextBlock_t pfnGetNextBlock, portable_samplepair_t *pbuffer, int SampleCount, int op )
+{
+	int x[DSP_BLOCK];
+	int count, i;
+	portable_samplepair_t *pb = pbuffer;
+
+	while ( SampleCount > 0 )
+	{
+		count = min( SampleCount, DSP_BLOCK );
+
+		if ( op == OP_RIGHT )
+		{
+			for ( i = 0; i < count; i++ )
+				x[i] = pb[i].right;
+		}
+		else
+		{
+			for ( i = 0; i < count; i++ )
+				x[i] = pb[i].left;
+		}
+
+		pfnGetNextBlock( pdata, x, count );
+
+		switch (op)
+		{
+		default:
+		case OP_LEFT:
+			for ( i = 0; i < count; i++ )
+				pb[i].left = x[i];
+			break;
+		case OP_RIGHT:
+			for ( i = 0; i < count; i++ )
+				pb[i].right = x[i];
+			break;
+		case OP_LEFT_DUPLICATE:
+			for ( i = 0; i < count; i++ )
+				pb[i].left = pb[i].right = x[i];
+			break;
+		}
+
+		pb += count;
+		SampleCount -= count;
+	}
+}
+
 #define PRC_NULL			0		// pass through - must be 0
 #define PRC_DLY				1		// simple feedback reverb
 #define PRC_RVA				2		// parallel reverbs
@@ -1470,12 +1683,63 @@ int DLY_GetNext ( dly_t *pdly, int x )
 	}		
 }
 
+// block version of DLY_GetNext - process count <= DSP_BLOCK samples in pbuf in place
+
+void DLY_GetNextBlock ( dly_t *pdly, int *pbuf, int count )
+{
+	int s[DSP_BLOCK];			// delay outputs
+	int v[DSP_BLOCK];			// delay inputs
+	int n, i;
+	flt_t *pflt = pdly->pflt;
+
+	while ( count > 0 )
+	{
+		n = dly_blocksize( pdly->D, pdly->t, count );
+
+		dly_gather( pdly->D, pdly->w, pdly->p, pdly->t, s, n );
+
+		switch (pdly->type)
+		{
+		default:
+		case DLY_PLAIN:
+			dly_plain_block( pbuf, s, v, pdly->a, pdly->b, n );
+			break;
+		case DLY_ALLPASS:
+			dly_allpass_block( pbuf, s, v, pdly->a, pdly->b, n );
+			break;
+		case DLY_LOWPASS:
+			// the feedback filter is recursive, so it still runs a sample at a time
+
+			for ( i = 0; i < n; i++ )
+				s[i] = iir_filter( pflt->M, pflt->a, pflt->L, pflt->b, pflt->w, s[i] );
+
+			dly_plain_block( pbuf, s, v, pdly->a, pdly->b, n );
+			break;
+		case DLY_LINEAR:
+			Q_memcpy( v, pbuf, n * sizeof (int) );
+			Q_memcpy( pbuf, s, n * sizeof (int) );
+			break;
+		}
+
+		dly_scatter( pdly->D, pdly->w, &pdly->p, v, n );
+
+		pbuf += n;
+		count -= n;
+	}
+}
+
 // batch version for performance
 
 void DLY_GetNextN( dly_t *pdly, portable_samplepair_t *pbuffer, int SampleCount, int op )
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
+
+	if ( DSP_UseBlock() )
+	{
+		DSP_GetNextBlockN( pdly, (dsp_GetNextBlock_t)DLY_GetNextBlock, pbuffer, SampleCount, op );
+		return;
+	}
 	
 	switch (op)
 	{
@@ -1733,12 +1997,54 @@ inline int RVA_GetNext( rva_t *prva, int x )
 	return y;
 }
 
+// block version of RVA_GetNext - run each parallel delay over the block and sum
+
+void RVA_GetNextBlock( rva_t *prva, int *pbuf, int count )
+{
+	int sum[DSP_BLOCK];
+	int y[DSP_BLOCK];
+	int m = prva->m;
+	int i;
+
+	if ( m )
+	{
+		for ( i = 0; i < m; i++ )
+		{
+			Q_memcpy( y, pbuf, count * sizeof (int) );
+
+			DLY_GetNextBlock( prva->pdlys[i], y, count );
+
+			if ( i )
+				dsp_add_block( sum, y, count );
+			else
+				Q_memcpy( sum, y, count * sizeof (int) );
+		}
+
+		for ( i = 0; i < count; i++ )
+			pbuf[i] = sum[i] / m;
+	}
+
+	// run series filter if present
+
+	if ( prva->pflt && !prva->fparallel )
+	{
+		for ( i = 0; i < count; i++ )
+			pbuf[i] = FLT_GetNext( prva->pflt, pbuf[i] );
+	}
+}
+
 // batch version for performance
 
 inline void RVA_GetNextN( rva_t *prva, portable_samplepair_t *pbuffer, int SampleCount, int op )
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
+
+	if ( DSP_UseBlock() )
+	{
+		DSP_GetNextBlockN( prva, (dsp_GetNextBlock_t)RVA_GetNextBlock, pbuffer, SampleCount, op );
+		return;
+	}
 	
 	switch (op)
 	{
@@ -2030,12 +2336,27 @@ inline int DFR_GetNext( dfr_t *pdfr, int x )
 #endif 
 }
 
+// block version of DFR_GetNext - each allpass only depends on its own history,
+// so the series can be run one delay at a time over the whole block
+
+void DFR_GetNextBlock( dfr_t *pdfr, int *pbuf, int count )
+{
+	for ( int i = 0; i < pdfr->n; i++ )
+		DLY_GetNextBlock( pdfr->pdlys[i], pbuf, count );
+}
+
 // batch version for performance
 
 inline void DFR_GetNextN( dfr_t *pdfr, portable_samplepair_t *pbuffer, int SampleCount, int op )
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
+
+	if ( DSP_UseBlock() )
+	{
+		DSP_GetNextBlockN( pdfr, (dsp_GetNextBlock_t)DFR_GetNextBlock, pbuffer, SampleCount, op );
+		return;
+	}
 	
 	switch (op)
 	{
@@ -3579,12 +3900,54 @@ int MDY_GetNext( mdy_t *pmdy, int x )
 	return xout;
 }
 
+// block version of MDY_GetNext - the delay tap is fixed until a ramp starts or
+// the self modulation timer runs out, so run the delay a block at a time until then
+
+void MDY_GetNextBlock( mdy_t *pmdy, int *pbuf, int count )
+{
+	int n;
+
+	while ( count > 0 )
+	{
+		n = 0;
+
+		if ( !pmdy->fchanging )
+			n = pmdy->mtime ? min( count, pmdy->mtimecur ) : count;
+
+		if ( n > 0 )
+		{
+			DLY_GetNextBlock( pmdy->pdly, pbuf, n );
+
+			if ( pmdy->mtime )
+				pmdy->mtimecur -= n;
+
+			pmdy->xprev = pbuf[n-1];
+		}
+		else
+		{
+			// ramping, or time to pick a new delay
+
+			*pbuf = MDY_GetNext( pmdy, *pbuf );
+			n = 1;
+		}
+
+		pbuf += n;
+		count -= n;
+	}
+}
+
 // batch version for performance
 
 inline void MDY_GetNextN( mdy_t *pmdy, portable_samplepair_t *pbuffer, int SampleCount, int op )
 {
 	int count = SampleCount;
 	portable_samplepair_t *pb = pbuffer;
+
+	if ( DSP_UseBlock() )
+	{
+		DSP_GetNextBlockN( pmdy, (dsp_GetNextBlock_t)MDY_GetNextBlock, pbuffer, SampleCount, op );
+		return;
+	}
 	
 	switch (op)
 	{
@@ -6270,6 +6633,112 @@ void DSP_Process( int idsp, portable_samplepair_t *pbfront, portable_samplepair_
 
 }
 
+//===============================================================================
+// Block processing check.  Runs each batch processed preset over the same test
+// signal a sample at a time and a block at a time, and compares the output.
+//===============================================================================
+
+#define DSP_COMPARE_SEED	1234
+
+static void DSP_BlockCompare_f( void )
+{
+	int seconds = 1;
+	if ( Cmd_Argc() > 1 )
+	{
+		seconds = max( atoi( Cmd_Argv( 1 ) ), 1 );
+	}
+
+	int count = SOUND_DMA_SPEED * seconds;
+	int cpsettemplates = sizeof(psettemplates) / sizeof(pset_t);
+	int save_block = dsp_block.GetInt();
+	int cfailed = 0;
+	int i;
+
+	portable_samplepair_t *pbuf[2];
+	pbuf[0] = new portable_samplepair_t[count];
+	pbuf[1] = new portable_samplepair_t[count];
+
+	for ( int ipset = 0; ipset < cpsettemplates; ipset++ )
+	{
+		// only simple and linear presets go through the batch processors
+
+		if ( !FBatchPreset( &psettemplates[ipset] ) )
+			continue;
+
+		double times[2];
+		bool fok = true;
+
+		for ( int block = 0; block < 2 && fok; block++ )
+		{
+			// 100ms noise bursts separated by silence, to exercise the reverb tails
+
+			unsigned int seed = 1;
+			for ( i = 0; i < count; i++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				pbuf[block][i].left = pbuf[block][i].right = ( (i / (SOUND_DMA_SPEED / 10)) & 1 ) ? 0 : (short)(seed >> 16);
+			}
+
+			CAutoLock lock( g_MixThreadMutex );
+
+			// mod delays pick random delay times, both runs must see the same ones
+
+			RandomSeed( DSP_COMPARE_SEED );
+
+			pset_t *ppset = PSET_Alloc( ipset );
+			if ( !ppset )
+			{
+				fok = false;
+				break;
+			}
+
+			dsp_block.SetValue( block );
+
+			double start = Plat_FloatTime();
+
+			for ( i = 0; i < count; i += PAINTBUFFER_SIZE )
+				PSET_GetNextN( ppset, pbuf[block] + i, min( count - i, PAINTBUFFER_SIZE ), OP_LEFT_DUPLICATE );
+
+			times[block] = Plat_FloatTime() - start;
+
+			PSET_Free( ppset );
+		}
+
+		if ( !fok )
+		{
+			Msg( "preset %2d: failed to allocate\n", ipset );
+			cfailed++;
+			continue;
+		}
+
+		int differ = 0;
+		for ( i = 0; i < count; i++ )
+		{
+			if ( pbuf[0][i].left != pbuf[1][i].left )
+				differ++;
+		}
+
+		if ( differ )
+			cfailed++;
+
+		Msg( "preset %2d: sample %.3f ms, block %.3f ms, %d of %d samples differ\n", 
+			ipset, times[0] * 1000.0, times[1] * 1000.0, differ, count );
+	}
+
+	dsp_block.SetValue( save_block );
+	RandomSeed( (int)( Plat_FloatTime() * 1000.0 ) );
+
+	delete [] pbuf[0];
+	delete [] pbuf[1];
+
+	if ( cfailed )
+		Msg( "%d presets differ or failed\n", cfailed );
+	else
+		Msg( "all presets match\n" );
+}
+
+static ConCommand dsp_block_compare( "dsp_block_compare", DSP_BlockCompare_f, "Runs the dsp presets over a test signal with and without block processing and compares: dsp_block_compare [seconds]" );
+
 // DSP helpers
 
 // free all dsp processors 
@@ -30,9 +30,13 @@
 #include "snd_audio_source.h"
 #include "snd_sfx.h"
 #include "snd_convars.h"
+#include "snd_mixthread.h"
 #include "icliententity.h"
 #include "SoundService.h"
 #include "commonmacros.h" 
+#include "mathlib.h"
+#include "../../cmd.h"
+#include <emmintrin.h>
 
 // NOTE: !!!!!! YOU MUST UPDATE SND_MIXA.S IF THIS VALUE IS CHANGED !!!!!
 #define SND_SCALE_BITS		7
@@ -139,6 +143,196 @@ short	*snd_out;
 
 float DSP_GetGain( int idsp );
 
+//===============================================================================
+// SSE2 mixing kernels.  These give the same results as the C loops they
+// replace, bit for bit, and are used when the CPU has SSE2 and snd_mix_sse2 is set.
+//===============================================================================
+
+static ConVar snd_mix_sse2( "snd_mix_sse2", "1", 0, "Use the SSE2 mixing routines when the CPU supports them" );
+
+inline bool MIX_UseSSE2( void )
+{
+	return snd_mix_sse2.GetInt() && MathLib_SSE2Enabled();
+}
+
+// low 32 bits of 4 signed 32 bit products, SSE2 has no pmulld
+
+inline __m128i MIX_MulLo32( __m128i a, __m128i b )
+{
+	__m128i even = _mm_mul_epu32( a, b );
+	__m128i odd = _mm_mul_epu32( _mm_srli_si128( a, 4 ), _mm_srli_si128( b, 4 ) );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+// signed divide by 1<<shift, rounding towards zero like the C divide
+
+inline __m128i MIX_DivPow2( __m128i x, int shift )
+{
+	__m128i bias = _mm_and_si128( _mm_srai_epi32( x, 31 ), _mm_set1_epi32( (1 << shift) - 1 ) );
+	return _mm_sra_epi32( _mm_add_epi32( x, bias ), _mm_cvtsi32_si128( shift ) );
+}
+
+// the following work on count ints, 2 per sample pair, and allow pOut to be any of the inputs
+
+// pOut = pIn1 + pIn2
+
+void MIX_AddSamples( int *pOut, const int *pIn1, const int *pIn2, int count )
+{
+	int i = 0;
+	if ( MIX_UseSSE2() )
+	{
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128i x = _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pIn1 + i) ), _mm_loadu_si128( (const __m128i *)(pIn2 + i) ) );
+			_mm_storeu_si128( (__m128i *)(pOut + i), x );
+		}
+	}
+
+	for ( ; i < count; i++ )
+		pOut[i] = pIn1[i] + pIn2[i];
+}
+
+// pOut = pIn1 + AVG( pIn2, pIn3 )
+
+void MIX_AddAvgSamples( int *pOut, const int *pIn1, const int *pIn2, const int *pIn3, int count )
+{
+	int i = 0;
+	if ( MIX_UseSSE2() )
+	{
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128i avg = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pIn2 + i) ), _mm_loadu_si128( (const __m128i *)(pIn3 + i) ) ), 1 );
+			_mm_storeu_si128( (__m128i *)(pOut + i), _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pIn1 + i) ), avg ) );
+		}
+	}
+
+	for ( ; i < count; i++ )
+		pOut[i] = pIn1[i] + ((pIn2[i] + pIn3[i]) >> 1);
+}
+
+// pOut = AVG( pIn1, pIn2 ) + AVG( pIn3, pIn4 )
+
+void MIX_AddAvg2Samples( int *pOut, const int *pIn1, const int *pIn2, const int *pIn3, const int *pIn4, int count )
+{
+	int i = 0;
+	if ( MIX_UseSSE2() )
+	{
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128i avg1 = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pIn1 + i) ), _mm_loadu_si128( (const __m128i *)(pIn2 + i) ) ), 1 );
+			__m128i avg2 = _mm_srai_epi32( _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(pIn3 + i) ), _mm_loadu_si128( (const __m128i *)(pIn4 + i) ) ), 1 );
+			_mm_storeu_si128( (__m128i *)(pOut + i), _mm_add_epi32( avg1, avg2 ) );
+		}
+	}
+
+	for ( ; i < count; i++ )
+		pOut[i] = ((pIn1[i] + pIn2[i]) >> 1) + ((pIn3[i] + pIn4[i]) >> 1);
+}
+
+// pBuf = (pBuf * gain) >> 8
+
+void MIX_ScaleSamples( int *pBuf, int gain, int count )
+{
+	int i = 0;
+	if ( MIX_UseSSE2() )
+	{
+		__m128i vgain = _mm_set1_epi32( gain );
+		for ( ; i + 4 <= count; i += 4 )
+		{
+			__m128i x = MIX_MulLo32( _mm_loadu_si128( (const __m128i *)(pBuf + i) ), vgain );
+			_mm_storeu_si128( (__m128i *)(pBuf + i), _mm_srai_epi32( x, 8 ) );
+		}
+	}
+
+	for ( ; i < count; i++ )
+		pBuf[i] = (pBuf[i] * gain) >> 8;
+}
+
+// adds 4 sample pairs of 16 bit samples * 16 bit volumes >> shift into pOutput
+
+inline void MIX_AccumulateSSE2( portable_samplepair_t *pOutput, __m128i samples, __m128i volumes, __m128i shift )
+{
+	__m128i lo = _mm_mullo_epi16( samples, volumes );
+	__m128i hi = _mm_mulhi_epi16( samples, volumes );
+	__m128i *pOut = (__m128i *)pOutput;
+
+	_mm_storeu_si128( pOut, _mm_add_epi32( _mm_loadu_si128( pOut ), _mm_sra_epi32( _mm_unpacklo_epi16( lo, hi ), shift ) ) );
+	_mm_storeu_si128( pOut + 1, _mm_add_epi32( _mm_loadu_si128( pOut + 1 ), _mm_sra_epi32( _mm_unpackhi_epi16( lo, hi ), shift ) ) );
+}
+
+// channel mixing without pitch shift, a multiple of 4 samples.  Returns the number of samples mixed.
+// stereo is 1 for interleaved stereo data.  8 bit volumes must be scaletable indices << SND_SCALE_SHIFT.
+
+int MIX_Mix16SSE2( portable_samplepair_t *pOutput, int *volume, short *pData, int outCount, int stereo )
+{
+	if ( volume[0] < -32768 || volume[0] > 32767 || volume[1] < -32768 || volume[1] > 32767 )
+		return 0;
+
+	__m128i volumes = _mm_set_epi16( volume[1], volume[0], volume[1], volume[0], volume[1], volume[0], volume[1], volume[0] );
+	__m128i shift = _mm_cvtsi32_si128( 8 );
+
+	int i;
+	for ( i = 0; i + 4 <= outCount; i += 4 )
+	{
+		__m128i samples;
+		if ( stereo )
+		{
+			samples = _mm_loadu_si128( (const __m128i *)(pData + i * 2) );
+		}
+		else
+		{
+			samples = _mm_loadl_epi64( (const __m128i *)(pData + i) );
+			samples = _mm_unpacklo_epi16( samples, samples );
+		}
+
+		MIX_AccumulateSSE2( pOutput + i, samples, volumes, shift );
+	}
+	return i;
+}
+
+int MIX_Mix8SSE2( portable_samplepair_t *pOutput, int *volume, byte *pData, int outCount, int stereo )
+{
+	// the scaletable only covers these anyway
+	if ( volume[0] < 0 || volume[0] > 255 || volume[1] < 0 || volume[1] > 255 )
+		return 0;
+
+	// snd_scaletable[vol >> SND_SCALE_SHIFT][data] == (signed char)data * ((vol >> SND_SCALE_SHIFT) << SND_SCALE_SHIFT)
+	short vol0 = (volume[0] >> SND_SCALE_SHIFT) << SND_SCALE_SHIFT;
+	short vol1 = (volume[1] >> SND_SCALE_SHIFT) << SND_SCALE_SHIFT;
+	__m128i volumes = _mm_set_epi16( vol1, vol0, vol1, vol0, vol1, vol0, vol1, vol0 );
+	__m128i shift = _mm_cvtsi32_si128( 0 );
+
+	int i;
+	for ( i = 0; i + 4 <= outCount; i += 4 )
+	{
+		__m128i samples;
+		if ( stereo )
+		{
+			samples = _mm_loadl_epi64( (const __m128i *)(pData + i * 2) );
+		}
+		else
+		{
+			int data;
+			memcpy( &data, pData + i, sizeof(data) );
+			samples = _mm_cvtsi32_si128( data );
+			samples = _mm_unpacklo_epi8( samples, samples );
+		}
+
+		// sign extend the bytes to 16 bits
+		samples = _mm_srai_epi16( _mm_unpacklo_epi8( samples, samples ), 8 );
+
+		MIX_AccumulateSSE2( pOutput + i, samples, volumes, shift );
+	}
+	return i;
+}
+
+// true if the mixer steps through the source one sample at a time
+
+inline bool MIX_IsUnpitched( int inputOffset, fixedint rateScaleFix )
+{
+	return ( rateScaleFix == FIX(1) ) && ( FIX_INTPART(inputOffset) == 0 );
+}
+
 //===============================================================================
 // Mix buffer (paintbuffer) management routines
 //===============================================================================
@@ -400,13 +594,31 @@ void S_FreeChannel(channel_t *ch)
 	ch->isSentence = false;
 //	Msg("End sound %s\n", ch->sfx->getname() );
 	
-	delete ch->pMixer;
+	// mixers on the mix thread are deleted once it releases them
+	if ( !MIX_ThreadOwnsMixer( ch ) )
+	{
+		delete ch->pMixer;
+	}
 	ch->pMixer = NULL;
 	ch->sfx = NULL;
 
 	SND_CloseMouth(ch);
 }
 
+// free a channel that's done playing.  The mix thread hands it back to the game thread instead.
+
+static void MIX_FreeFinishedChannel( channel_t *ch, bool bThreaded )
+{
+	if ( bThreaded )
+	{
+		MIX_ThreadReleaseChannel( ch );
+	}
+	else
+	{
+		S_FreeChannel( ch );
+	}
+}
+
 
 // Mix all channels into active paintbuffers until paintbuffer is full or 'endtime' is reached.
 // endtime: time in 44khz samples to mix
@@ -421,11 +633,22 @@ void MIX_MixChannelsToPaintbuffer(int endtime, int flags, int rate, int outputRa
 {
 	int		i;
 	channel_t *ch;
+	int		channelCount;
 	int		sampleCount;
+	bool	bThreaded = MIX_ThreadActive();
 
-	// mix each channel into paintbuffer
+	// mix each channel into paintbuffer.  The mix thread mixes its own copy of the channels.
 
-	ch = channels;
+	if ( bThreaded )
+	{
+		ch = MIX_ThreadChannels();
+		channelCount = MAX_CHANNELS;
+	}
+	else
+	{
+		ch = channels;
+		channelCount = total_channels;
+	}
 	
 	// validate parameters
 	Assert (outputRate <= SOUND_DMA_SPEED);
@@ -437,7 +660,7 @@ void MIX_MixChannelsToPaintbuffer(int endtime, int flags, int rate, int outputRa
 	if ( sampleCount <= 0 )
 		return;
 
-	for ( i = 0; i < total_channels ; i++, ch++ )
+	for ( i = 0; i < channelCount ; i++, ch++ )
 	{
 		if (!ch->sfx) 
 		{
@@ -463,7 +686,9 @@ void MIX_MixChannelsToPaintbuffer(int endtime, int flags, int rate, int outputRa
 		// UNDONE: Can get away with not filling the cache until
 		// we decide it should be mixed
 
-		CAudioSource *pSource = S_LoadSound( ch->sfx, ch );
+		// The game thread loaded the sound before posting the channel to the mix thread
+
+		CAudioSource *pSource = bThreaded ? ch->pMixer->GetSource() : S_LoadSound( ch->sfx, ch );
 
 		// Don't mix sound data for sounds with zero volume. If it's a non-looping sound, 
 		// just remove the sound when its volume goes to zero.
@@ -482,7 +707,7 @@ void MIX_MixChannelsToPaintbuffer(int endtime, int flags, int rate, int outputRa
 			// to keep the character's lips moving and the captions happening.
 			if ( !pSource || pSource->GetSentence() == NULL )
 			{
-				S_FreeChannel( ch );
+				MIX_FreeFinishedChannel( ch, bThreaded );
 				continue;
 			}
 		}
@@ -510,7 +735,9 @@ void MIX_MixChannelsToPaintbuffer(int endtime, int flags, int rate, int outputRa
 		// get playback pitch
 		ch->pitch = ch->pMixer->ModifyPitch( ch->basePitch * 0.01f );
 
-		if (entitylist->GetClientEntity(ch->soundsource) && 
+		// the mix thread can't touch entities, the game thread moves mouths with SND_MoveAllMouths
+
+		if (!bThreaded && entitylist->GetClientEntity(ch->soundsource) && 
 			(ch->entchannel == CHAN_VOICE || ch->entchannel == CHAN_STREAM))
 		{
 			// UNDONE: recode this as a member function of CAudioMixer
@@ -524,7 +751,7 @@ void MIX_MixChannelsToPaintbuffer(int endtime, int flags, int rate, int outputRa
 
 		if ( !ch->pMixer->ShouldContinueMixing() )
 		{
-			S_FreeChannel( ch );
+			MIX_FreeFinishedChannel( ch, bThreaded );
 		}
 	}
 }
@@ -546,6 +773,53 @@ inline portable_samplepair_t * S_GetNextpFilter(int i, portable_samplepair_t *pb
 	return (&(pbuffer[(i-2)*2 + 1]));
 }
 
+// write out psamp1 and the sample cubic interpolated halfway between psamp1 and psamp2
+
+inline void S_Interpolate2xCubicSample( portable_samplepair_t *psamp0, portable_samplepair_t *psamp1, 
+	portable_samplepair_t *psamp2, portable_samplepair_t *psamp3, portable_samplepair_t *pout )
+{
+	int a, b, c;
+	int xm1, x0, x1, x2;
+
+	// write out original sample to interpolation buffer
+
+	pout[0] = *psamp1;
+
+	// get all left samples for interpolation window
+
+	xm1 = psamp0->left;
+	x0 = psamp1->left;
+	x1 = psamp2->left;
+	x2 = psamp3->left;
+	
+	// interpolate
+
+	a = (3 * (x0-x1) - xm1 + x2) / 2;
+	b = 2*x1 + xm1 - (5*x0 + x2) / 2;
+	c = (x1 - xm1) / 2;
+	
+	// write out interpolated sample
+
+	pout[1].left = a/8 + b/4 + c/2 + x0;
+	
+	// get all right samples for window
+
+	xm1 = psamp0->right;
+	x0 = psamp1->right;
+	x1 = psamp2->right;
+	x2 = psamp3->right;
+	
+	// interpolate
+
+	a = (3 * (x0-x1) - xm1 + x2) / 2;
+	b = 2*x1 + xm1 - (5*x0 + x2) / 2;
+	c = (x1 - xm1) / 2;
+	
+	// write out interpolated sample
+
+	pout[1].right = a/8 + b/4 + c/2 + x0;
+}
+
 // pass forward over passed in buffer and cubic interpolate all odd samples
 // pbuffer: buffer to filter (in place)
 // prevfilter:  filter memory. NOTE: this must match the filtertype ie: filtercubic[] for FILTERTYPE_CUBIC
@@ -574,70 +848,69 @@ void S_Interpolate2xCubic( portable_samplepair_t *pbuffer, portable_samplepair_t
 //		y [outpos] = (((a * finpos) + b) * finpos + c) * finpos + x0;
 
 	int i, upCount = count << 1;
-	int a, b, c;
-	int xm1, x0, x1, x2;
-	portable_samplepair_t *psamp0;
-	portable_samplepair_t *psamp1;
-	portable_samplepair_t *psamp2;
-	portable_samplepair_t *psamp3;
 	int outpos = 0;
 
 	Assert (upCount <= PAINTBUFFER_SIZE);
 
 	// pfiltermem holds 6 samples from previous buffer pass
 
-	// process 'count' samples
+	// process 'count' samples.  The first samples' windows reach into filter memory.
 
-	for ( i = 0; i < count; i++)
+	int nFilterCount = min( count, 3 );
+	for ( i = 0; i < nFilterCount; i++ )
 	{
-		
-		// get source sample pointer
-
-		psamp0 = S_GetNextpFilter(i-1, pbuffer, pfiltermem);
-		psamp1 = S_GetNextpFilter(i,   pbuffer, pfiltermem);
-		psamp2 = S_GetNextpFilter(i+1, pbuffer, pfiltermem);
-		psamp3 = S_GetNextpFilter(i+2, pbuffer, pfiltermem);
-
-		// write out original sample to interpolation buffer
-
-		temppaintbuffer[outpos++] = *psamp1;
-
-		// get all left samples for interpolation window
-
-		xm1 = psamp0->left;
-		x0 = psamp1->left;
-		x1 = psamp2->left;
-		x2 = psamp3->left;
-		
-		// interpolate
-
-		a = (3 * (x0-x1) - xm1 + x2) / 2;
-		b = 2*x1 + xm1 - (5*x0 + x2) / 2;
-		c = (x1 - xm1) / 2;
-		
-		// write out interpolated sample
-
-		temppaintbuffer[outpos].left = a/8 + b/4 + c/2 + x0;
-		
-		// get all right samples for window
+		S_Interpolate2xCubicSample( S_GetNextpFilter(i-1, pbuffer, pfiltermem), S_GetNextpFilter(i, pbuffer, pfiltermem),
+			S_GetNextpFilter(i+1, pbuffer, pfiltermem), S_GetNextpFilter(i+2, pbuffer, pfiltermem), &temppaintbuffer[outpos] );
+		outpos += 2;
+	}
 
-		xm1 = psamp0->right;
-		x0 = psamp1->right;
-		x1 = psamp2->right;
-		x2 = psamp3->right;
-		
-		// interpolate
+	if ( MIX_UseSSE2() )
+	{
+		// 2 samples at a time, left and right together.  Source sample k is at pbuffer[(k-2)*2 + 1].
 
-		a = (3 * (x0-x1) - xm1 + x2) / 2;
-		b = 2*x1 + xm1 - (5*x0 + x2) / 2;
-		c = (x1 - xm1) / 2;
-		
-		// write out interpolated sample, increment output counter
+		for ( ; i + 2 <= count; i += 2 )
+		{
+			portable_samplepair_t *psamp = &pbuffer[(i-3)*2 + 1];
+			__m128i sm1 = _mm_loadl_epi64( (const __m128i *)&psamp[0] );
+			__m128i s0 = _mm_loadl_epi64( (const __m128i *)&psamp[2] );
+			__m128i s1 = _mm_loadl_epi64( (const __m128i *)&psamp[4] );
+			__m128i s2 = _mm_loadl_epi64( (const __m128i *)&psamp[6] );
+			__m128i s3 = _mm_loadl_epi64( (const __m128i *)&psamp[8] );
+
+			__m128i xm1 = _mm_unpacklo_epi64( sm1, s0 );
+			__m128i x0 = _mm_unpacklo_epi64( s0, s1 );
+			__m128i x1 = _mm_unpacklo_epi64( s1, s2 );
+			__m128i x2 = _mm_unpacklo_epi64( s2, s3 );
+
+			// a = (3 * (x0-x1) - xm1 + x2) / 2;
+			__m128i d = _mm_sub_epi32( x0, x1 );
+			__m128i a = _mm_add_epi32( _mm_add_epi32( d, d ), d );
+			a = MIX_DivPow2( _mm_add_epi32( _mm_sub_epi32( a, xm1 ), x2 ), 1 );
+
+			// b = 2*x1 + xm1 - (5*x0 + x2) / 2;
+			__m128i b = _mm_add_epi32( _mm_add_epi32( _mm_slli_epi32( x0, 2 ), x0 ), x2 );
+			b = _mm_sub_epi32( _mm_add_epi32( _mm_add_epi32( x1, x1 ), xm1 ), MIX_DivPow2( b, 1 ) );
+
+			// c = (x1 - xm1) / 2;
+			__m128i c = MIX_DivPow2( _mm_sub_epi32( x1, xm1 ), 1 );
+
+			__m128i y = _mm_add_epi32( _mm_add_epi32( MIX_DivPow2( a, 3 ), MIX_DivPow2( b, 2 ) ), _mm_add_epi32( MIX_DivPow2( c, 1 ), x0 ) );
+
+			// original sample, then the interpolated one
+			_mm_storeu_si128( (__m128i *)&temppaintbuffer[outpos], _mm_unpacklo_epi64( x0, y ) );
+			_mm_storeu_si128( (__m128i *)&temppaintbuffer[outpos + 2], _mm_unpackhi_epi64( x0, y ) );
+			outpos += 4;
+		}
+	}
 
-		temppaintbuffer[outpos++].right = a/8 + b/4 + c/2 + x0;
-		
-		Assert (outpos <= ARRAYSIZE(temppaintbuffer));
+	for ( ; i < count; i++ )
+	{
+		S_Interpolate2xCubicSample( S_GetNextpFilter(i-1, pbuffer, pfiltermem), S_GetNextpFilter(i, pbuffer, pfiltermem),
+			S_GetNextpFilter(i+1, pbuffer, pfiltermem), S_GetNextpFilter(i+2, pbuffer, pfiltermem), &temppaintbuffer[outpos] );
+		outpos += 2;
 	}
+
+	Assert (outpos <= ARRAYSIZE(temppaintbuffer));
 	
 	Assert(cfltmem >= 3);
 
@@ -649,8 +922,7 @@ void S_Interpolate2xCubic( portable_samplepair_t *pbuffer, portable_samplepair_t
 
 	// copy temppaintbuffer back into paintbuffer
 
-	for (i = 0; i < upCount; i++)
-		pbuffer[i] = temppaintbuffer[i];
+	memcpy( pbuffer, temppaintbuffer, upCount * sizeof(portable_samplepair_t) );
 }
 
 // pass forward over passed in buffer and linearly interpolate all odd samples
@@ -671,7 +943,23 @@ void S_Interpolate2xLinear( portable_samplepair_t *pbuffer, portable_samplepair_
 	pbuffer[0].left = (pfiltermem->left + pbuffer[0].left) >> 1;
 	pbuffer[0].right = (pfiltermem->right + pbuffer[0].right) >> 1;
 
-	for ( i = 2; i < upCount; i+=2)
+	i = 2;
+	if ( MIX_UseSSE2() )
+	{
+		// 2 even samples at a time, averaged with the odd samples before them
+
+		for ( ; i + 2 < upCount; i += 4 )
+		{
+			__m128i x0 = _mm_loadu_si128( (const __m128i *)&pbuffer[i-1] );
+			__m128i x1 = _mm_loadu_si128( (const __m128i *)&pbuffer[i+1] );
+			__m128i avg = _mm_srai_epi32( _mm_add_epi32( _mm_unpacklo_epi64( x0, x1 ), _mm_unpackhi_epi64( x0, x1 ) ), 1 );
+
+			_mm_storel_epi64( (__m128i *)&pbuffer[i], avg );
+			_mm_storel_epi64( (__m128i *)&pbuffer[i+2], _mm_srli_si128( avg, 8 ) );
+		}
+	}
+
+	for ( ; i < upCount; i+=2)
 	{
 		// use linear interpolation for upsampling
 
@@ -935,7 +1223,6 @@ void MIX_MixPaintbuffers(int ibuf1, int ibuf2, int ibuf3, int count, float fgain
 	portable_samplepair_t *pbuf1, *pbuf2, *pbuf3, *pbuft;
 	portable_samplepair_t *pbufrear1, *pbufrear2, *pbufrear3, *pbufreart;
 	int cchan1, cchan2, cchan3, cchant;
-	int xl,xr;
 	int gain;
 
 	gain = 256 * fgain;
@@ -967,8 +1254,6 @@ void MIX_MixPaintbuffers(int ibuf1, int ibuf2, int ibuf3, int count, float fgain
 		SWAP( pbufrear1, pbufrear2, pbufreart );
 	}
 
-	// UNDONE: implement fast mixing routines for each of the following sections
-
 	// destination buffer stereo - average n chans down to stereo 
 
 	if ( cchan3 == 2 )
@@ -982,11 +1267,7 @@ void MIX_MixPaintbuffers(int ibuf1, int ibuf2, int ibuf3, int count, float fgain
 		{
 			// mix front channels
 
-			for (i = 0; i < count; i++)
-			{
-				pbuf3[i].left  = pbuf1[i].left  + pbuf2[i].left;
-				pbuf3[i].right = pbuf1[i].right + pbuf2[i].right;
-			}
+			MIX_AddSamples( &pbuf3->left, &pbuf1->left, &pbuf2->left, count * 2 );
 			goto gain2ch;
 		}
 
@@ -994,11 +1275,7 @@ void MIX_MixPaintbuffers(int ibuf1, int ibuf2, int ibuf3, int count, float fgain
 		{
 			// avg rear chan l/r
 
-			for (i = 0; i < count; i++)
-			{
-				pbuf3[i].left  = pbuf1[i].left  + AVG( pbuf2[i].left,  pbufrear2[i].left );
-				pbuf3[i].right = pbuf1[i].right + AVG( pbuf2[i].right, pbufrear2[i].right );
-			}
+			MIX_AddAvgSamples( &pbuf3->left, &pbuf1->left, &pbuf2->left, &pbufrear2->left, count * 2 );
 			goto gain2ch;
 		}
 
@@ -1006,11 +1283,7 @@ void MIX_MixPaintbuffers(int ibuf1, int ibuf2, int ibuf3, int count, float fgain
 		{
 			// avg rear chan l/r
 
-			for (i = 0; i < count; i++)
-			{
-				pbuf3[i].left  = AVG( pbuf1[i].left, pbufrear1[i].left)  + AVG( pbuf2[i].left,  pbufrear2[i].left );
-				pbuf3[i].right = AVG( pbuf1[i].right, pbufrear1[i].right) + AVG( pbuf2[i].right, pbufrear2[i].right );
-			}
+			MIX_AddAvg2Samples( &pbuf3->left, &pbuf1->left, &pbufrear1->left, &pbuf2->left, &pbufrear2->left, count * 2 );
 			goto gain2ch;
 		}
 	
@@ -1029,34 +1302,19 @@ void MIX_MixPaintbuffers(int ibuf1, int ibuf2, int ibuf3, int count, float fgain
 		{
 			// mix front -> front, rear -> rear
 
-			for (i = 0; i < count; i++)
-			{
-				pbuf3[i].left  = pbuf1[i].left  + pbuf2[i].left;
-				pbuf3[i].right = pbuf1[i].right + pbuf2[i].right;
-
-				pbufrear3[i].left  = pbufrear1[i].left  + pbufrear2[i].left;
-				pbufrear3[i].right = pbufrear1[i].right + pbufrear2[i].right;
-			}
+			MIX_AddSamples( &pbuf3->left, &pbuf1->left, &pbuf2->left, count * 2 );
+			MIX_AddSamples( &pbufrear3->left, &pbufrear1->left, &pbufrear2->left, count * 2 );
 			goto gain4ch;
 		}
 
 		if ( cchan1 == 2 && cchan2 == 4)
 		{
-				
-			for (i = 0; i < count; i++)
-			{
-				// split 2 ch left ->  front left, rear left
-				// split 2 ch right -> front right, rear right
-
-				xl = pbuf1[i].left;
-				xr = pbuf1[i].right;
+			// split 2 ch left ->  front left, rear left
+			// split 2 ch right -> front right, rear right
+			// NOTE: pbuf3 is 4ch, so it can't be pbuf1
 
-				pbuf3[i].left  = xl + pbuf2[i].left;
-				pbuf3[i].right = xr + pbuf2[i].right;
-
-				pbufrear3[i].left  = xl + pbufrear2[i].left;
-				pbufrear3[i].right = xr + pbufrear2[i].right;
-			}
+			MIX_AddSamples( &pbufrear3->left, &pbuf1->left, &pbufrear2->left, count * 2 );
+			MIX_AddSamples( &pbuf3->left, &pbuf1->left, &pbuf2->left, count * 2 );
 			goto gain4ch;
 		}
 
@@ -1064,14 +1322,8 @@ void MIX_MixPaintbuffers(int ibuf1, int ibuf2, int ibuf3, int count, float fgain
 		{
 			// mix l,r, split into front l, front r
 
-			for (i = 0; i < count; i++)
-			{
-				xl = pbuf1[i].left  + pbuf2[i].left;
-				xr = pbuf1[i].right + pbuf2[i].right;
-
-				pbufrear3[i].left  = pbuf3[i].left  = xl;
-				pbufrear3[i].right = pbuf3[i].right = xr;
-			}
+			MIX_AddSamples( &pbuf3->left, &pbuf1->left, &pbuf2->left, count * 2 );
+			memcpy( pbufrear3, pbuf3, count * sizeof(portable_samplepair_t) );
 			goto gain4ch;
 		}
 	}
@@ -1080,24 +1332,15 @@ gain2ch:
     if ( gain == 256)		// KDB: perf
 		return;
 
-	for (i = 0; i < count; i++)
-	{
-		pbuf3[i].left  = (pbuf3[i].left * gain) >> 8;
-		pbuf3[i].right = (pbuf3[i].right * gain) >> 8;
-	}
+	MIX_ScaleSamples( &pbuf3->left, gain, count * 2 );
 	return;
 
 gain4ch:
 	if ( gain == 256)		// KDB: perf
 		return;
 
-	for (i = 0; i < count; i++)
-	{
-		pbuf3[i].left  = (pbuf3[i].left * gain) >> 8;
-		pbuf3[i].right = (pbuf3[i].right * gain) >> 8;
-		pbufrear3[i].left  = (pbufrear3[i].left * gain) >> 8;
-		pbufrear3[i].right = (pbufrear3[i].right * gain) >> 8;
-	}
+	MIX_ScaleSamples( &pbuf3->left, gain, count * 2 );
+	MIX_ScaleSamples( &pbufrear3->left, gain, count * 2 );
 	return;
 }
 
@@ -1685,10 +1928,23 @@ void MIX_ScaleChannelVolume( paintbuffer_t *ppaint, channel_t *pChannel, int vol
 #if	!id386
 void Snd_WriteLinearBlastStereo16 (void)
 {
-	int		i;
+	int		i = 0;
 	int		val;
 
-	for (i=0 ; i<snd_linear_count ; i+=2)
+	if ( MIX_UseSSE2() )
+	{
+		// packs saturates to 16 bits, same as the clipping below
+
+		__m128i vol = _mm_set1_epi32( snd_vol );
+		for ( ; i + 8 <= snd_linear_count; i += 8 )
+		{
+			__m128i x0 = _mm_srai_epi32( MIX_MulLo32( _mm_loadu_si128( (const __m128i *)(snd_p + i) ), vol ), 8 );
+			__m128i x1 = _mm_srai_epi32( MIX_MulLo32( _mm_loadu_si128( (const __m128i *)(snd_p + i + 4) ), vol ), 8 );
+			_mm_storeu_si128( (__m128i *)(snd_out + i), _mm_packs_epi32( x0, x1 ) );
+		}
+	}
+
+	for ( ; i<snd_linear_count ; i+=2)
 	{
 		val = (snd_p[i]*snd_vol)>>8;
 		if (val > 0x7fff)
@@ -2043,6 +2299,14 @@ void SW_Mix16StereoDistVar( float distmix, portable_samplepair_t *pOutput, int *
 
 void SW_Mix8Mono( portable_samplepair_t *pOutput, int *volume, byte *pData, int inputOffset, fixedint rateScaleFix, int outCount )
 {
+	if ( MIX_IsUnpitched( inputOffset, rateScaleFix ) && MIX_UseSSE2() )
+	{
+		int nMixed = MIX_Mix8SSE2( pOutput, volume, pData, outCount, 0 );
+		pOutput += nMixed;
+		pData += nMixed;
+		outCount -= nMixed;
+	}
+
 	// Not using pitch shift?
 	if ( rateScaleFix == FIX(1) )
 	{
@@ -2076,6 +2340,14 @@ void SW_Mix8Mono( portable_samplepair_t *pOutput, int *volume, byte *pData, int
 
 void SW_Mix8Stereo( portable_samplepair_t *pOutput, int *volume, byte *pData, int inputOffset, fixedint rateScaleFix, int outCount )
 {
+	if ( MIX_IsUnpitched( inputOffset, rateScaleFix ) && MIX_UseSSE2() )
+	{
+		int nMixed = MIX_Mix8SSE2( pOutput, volume, pData, outCount, 1 );
+		pOutput += nMixed;
+		pData += nMixed * 2;
+		outCount -= nMixed;
+	}
+
 	int sampleIndex = 0;
 	fixedint sampleFrac = inputOffset;
 	int		*lscale, *rscale;
@@ -2114,6 +2386,18 @@ void SW_Mix16Mono( portable_samplepair_t *pOutput, int *volume, short *pData, in
 
 void SW_Mix16Mono( portable_samplepair_t *pOutput, int *volume, short *pData, int inputOffset, fixedint rateScaleFix, int outCount )
 {
+	if ( MIX_IsUnpitched( inputOffset, rateScaleFix ) && MIX_UseSSE2() )
+	{
+		// the asm below always mixes pairs, so finish the odd samples here
+		int i = MIX_Mix16SSE2( pOutput, volume, pData, outCount, 0 );
+		for ( ; i < outCount; i++ )
+		{
+			pOutput[i].left += (volume[0] * (int)(pData[i]))>>8;
+			pOutput[i].right += (volume[1] * (int)(pData[i]))>>8;
+		}
+		return;
+	}
+
 	int vol0 = volume[0];
 	int vol1 = volume[1];
 
@@ -2193,6 +2477,14 @@ END:
 
 void SW_Mix16Stereo( portable_samplepair_t *pOutput, int *volume, short *pData, int inputOffset, fixedint rateScaleFix, int outCount )
 {
+	if ( MIX_IsUnpitched( inputOffset, rateScaleFix ) && MIX_UseSSE2() )
+	{
+		int nMixed = MIX_Mix16SSE2( pOutput, volume, pData, outCount, 1 );
+		pOutput += nMixed;
+		pData += nMixed * 2;
+		outCount -= nMixed;
+	}
+
 	int sampleIndex = 0;
 	fixedint sampleFrac = inputOffset;
 
@@ -2383,6 +2675,31 @@ void SND_MoveMouth8( channel_t *ch, CAudioSource *pSource, int count )
 }
 
 
+// Mouth movement for the channels the mix thread is playing, which can't do it
+// itself.  Called on the game thread with g_MixThreadMutex held.
+
+void SND_MoveAllMouths( int count )
+{
+	int i;
+	channel_t *ch = channels;
+
+	for ( i = 0; i < total_channels; i++, ch++ )
+	{
+		if ( !ch->sfx || !ch->pMixer )
+			continue;
+
+		if ( ch->entchannel != CHAN_VOICE && ch->entchannel != CHAN_STREAM )
+			continue;
+
+		CAudioSource *pSource = ch->pMixer->GetSource();
+		if ( pSource )
+		{
+			SND_MoveMouth8( ch, pSource, count );
+		}
+	}
+}
+
+
 void SND_UpdateMouth( channel_t *pChannel )
 {
 	CMouthInfo *m = GetMouthInfoForChannel( pChannel );
@@ -2407,6 +2724,10 @@ void SND_ClearMouth( channel_t *pChannel )
 
 bool SND_IsMouth( channel_t *pChannel )
 {
+	// the mix thread leaves mouths to the game thread
+	if ( MIX_ThreadActive() )
+		return false;
+
 	if ( entitylist->GetClientEntity( pChannel->soundsource ) )
 	{
 		if ( pChannel->entchannel == CHAN_VOICE || pChannel->entchannel == CHAN_STREAM )
@@ -2461,3 +2782,137 @@ void SND_RecordBuffer( void )
 
 	WaveAppendTmpFile( cl_moviename, tmp, bufferSize );
 }
+
+//===============================================================================
+// Mixing benchmark.  Runs the mixer on synthetic data without touching the
+// audio device, once with the C routines and once with SSE2, and compares.
+//===============================================================================
+
+#define BENCHMARK_CHANNELS	40
+
+static void MIX_Benchmark_f( void )
+{
+	int iterations = 1000;
+	if ( Cmd_Argc() > 1 )
+	{
+		iterations = max( atoi( Cmd_Argv( 1 ) ), 1 );
+	}
+
+	if ( !MathLib_SSE2Enabled() )
+	{
+		Msg( "SSE2 isn't available, both runs use the C routines\n" );
+	}
+
+	// half rate source data, upsampled 2x like 22k sounds
+
+	int count = PAINTBUFFER_SIZE / 2;
+
+	static short data16[PAINTBUFFER_SIZE];
+	static byte data8[PAINTBUFFER_SIZE];
+	static portable_samplepair_t mixbuffer[2][PAINTBUFFER_SIZE+1];
+	static portable_samplepair_t roommixbuffer[PAINTBUFFER_SIZE+1];
+	static short outbuffer[2][PAINTBUFFER_SIZE*2];
+
+	unsigned int seed = 1;
+	int i;
+	for ( i = 0; i < PAINTBUFFER_SIZE; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		data16[i] = (short)(seed >> 16);
+		data8[i] = (byte)(seed >> 24);
+	}
+
+	int *save_p = snd_p;
+	short *save_out = snd_out;
+	int save_linear_count = snd_linear_count;
+	int save_vol = snd_vol;
+	int save_sse2 = snd_mix_sse2.GetInt();
+
+	double times[2][3];
+	for ( int sse2 = 0; sse2 < 2; sse2++ )
+	{
+		snd_mix_sse2.SetValue( sse2 );
+		times[sse2][0] = times[sse2][1] = times[sse2][2] = 0.0;
+
+		portable_samplepair_t filtermem[CPAINTFILTERMEM];
+		memset( filtermem, 0, sizeof(filtermem) );
+
+		for ( int iteration = 0; iteration < iterations; iteration++ )
+		{
+			portable_samplepair_t *pbuf = mixbuffer[sse2];
+			double start = Plat_FloatTime();
+
+			memset( pbuf, 0, (count*2+1) * sizeof(portable_samplepair_t) );
+			memset( roommixbuffer, 0, (count*2+1) * sizeof(portable_samplepair_t) );
+
+			for ( int channel = 0; channel < BENCHMARK_CHANNELS; channel++ )
+			{
+				int volume[2];
+				volume[0] = 32 + ( channel * 37 ) % 224;
+				volume[1] = 255 - volume[0];
+
+				portable_samplepair_t *pOutput = ( channel & 4 ) ? roommixbuffer : pbuf;
+				switch ( channel & 3 )
+				{
+				case 0:
+					SW_Mix16Mono( pOutput, volume, data16, 0, FIX(1), count );
+					break;
+				case 1:
+					SW_Mix16Stereo( pOutput, volume, data16, 0, FIX(1), count );
+					break;
+				case 2:
+					SW_Mix8Mono( pOutput, volume, data8, 0, FIX(1), count );
+					break;
+				case 3:
+					SW_Mix8Stereo( pOutput, volume, data8, 0, FIX(1), count );
+					break;
+				}
+			}
+
+			double mixed = Plat_FloatTime();
+
+			MIX_AddAvgSamples( &pbuf->left, &pbuf->left, &roommixbuffer->left, &pbuf->left, count * 2 );
+			MIX_ScaleSamples( &pbuf->left, 200, count * 2 );
+			S_MixBufferUpsample2x( count, pbuf, filtermem, CPAINTFILTERMEM, FILTERTYPE_CUBIC );
+
+			double painted = Plat_FloatTime();
+
+			snd_p = &pbuf->left;
+			snd_out = outbuffer[sse2];
+			snd_linear_count = count * 4;
+			snd_vol = 179;
+			Snd_WriteLinearBlastStereo16();
+
+			double transferred = Plat_FloatTime();
+
+			times[sse2][0] += mixed - start;
+			times[sse2][1] += painted - mixed;
+			times[sse2][2] += transferred - painted;
+		}
+	}
+
+	snd_p = save_p;
+	snd_out = save_out;
+	snd_linear_count = save_linear_count;
+	snd_vol = save_vol;
+	snd_mix_sse2.SetValue( save_sse2 );
+
+	int differ = 0;
+	for ( i = 0; i < count * 2; i++ )
+	{
+		if ( mixbuffer[0][i].left != mixbuffer[1][i].left || mixbuffer[0][i].right != mixbuffer[1][i].right )
+			differ++;
+	}
+
+	for ( i = 0; i < 2; i++ )
+	{
+		Msg( "%s: %d channels %.3f ms, paintbuffers + upsample %.3f ms, transfer %.3f ms per %d samples\n", 
+			i ? "SSE2" : "C   ", BENCHMARK_CHANNELS, times[i][0] * 1000.0 / iterations, times[i][1] * 1000.0 / iterations, 
+			times[i][2] * 1000.0 / iterations, count * 2 );
+	}
+
+	Msg( "%d of %d mixed samples differ, output %s\n", differ, count * 2, 
+		memcmp( outbuffer[0], outbuffer[1], count * 4 * sizeof(short) ) ? "differs" : "is identical" );
+}
+
+static ConCommand snd_mix_benchmark( "snd_mix_benchmark", MIX_Benchmark_f, "Times the mixing routines on synthetic data with and without SSE2: snd_mix_benchmark [iterations]" );
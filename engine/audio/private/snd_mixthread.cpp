@@ -0,0 +1,433 @@
+//========= Copyright (c) 1996-2003, Valve LLC, All rights reserved. ==========
+//
+// Purpose: Mixes the paintbuffers on a dedicated thread, see snd_mixthread.h
+//
+//=============================================================================
+
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "convar.h"
+#include "sound.h"
+#include "sound_private.h"
+#include "snd_mix_buf.h"
+#include "snd_channels.h"
+#include "snd_device.h"
+#include "snd_audio_source.h"
+#include "snd_mixthread.h"
+
+extern char cl_moviename[];
+
+static ConVar snd_mixthread( "snd_mixthread", "1", 0, "Mix sound on a dedicated thread" );
+static ConVar snd_mixthread_latency( "snd_mixthread_latency", "0.05", 0, "Seconds of sound the mix thread keeps mixed ahead of the device's play position" );
+
+CThreadMutex g_MixThreadMutex;
+
+//-----------------------------------------------------------------------------
+// Single producer, single consumer ring.  The producer publishes an element
+// by moving the write index after the element is written and the consumer
+// frees the slot by moving the read index after it's read, so neither side
+// ever waits on the other.  Holds SIZE - 1 elements, SIZE is a power of two.
+//-----------------------------------------------------------------------------
+template< class T, int SIZE >
+class CMixThreadRing
+{
+public:
+	CMixThreadRing() : m_nRead( 0 ), m_nWrite( 0 ) {}
+
+	// Producer side, false if the ring is full
+	bool Push( const T &element )
+	{
+		long nWrite = m_nWrite;
+		long nNext = ( nWrite + 1 ) & ( SIZE - 1 );
+		if ( nNext == m_nRead )
+			return false;
+
+		m_Elements[nWrite] = element;
+		Plat_InterlockedExchange( &m_nWrite, nNext );
+		return true;
+	}
+
+	// Consumer side, false if the ring is empty
+	bool Pop( T &element )
+	{
+		long nRead = m_nRead;
+		if ( nRead == m_nWrite )
+			return false;
+
+		element = m_Elements[nRead];
+		Plat_InterlockedExchange( &m_nRead, ( nRead + 1 ) & ( SIZE - 1 ) );
+		return true;
+	}
+
+private:
+	T				m_Elements[SIZE];
+	volatile long	m_nRead;
+	volatile long	m_nWrite;
+};
+
+enum
+{
+	MIXCMD_START = 0,		// the channel has a new mixer
+	MIXCMD_UPDATE,			// new volumes, pitch and dsp mix for the channel's mixer
+	MIXCMD_STOP,			// release channel.pMixer
+};
+
+struct mixcommand_t
+{
+	int			type;
+	int			index;
+	channel_t	channel;
+};
+
+struct mixrelease_t
+{
+	int			index;
+	CAudioMixer	*pMixer;
+};
+
+// Every mixer on the mix thread is in a shadow channel or a queued start, so the
+// release ring can't fill up as long as it's bigger than both of those together.
+#define MIX_COMMAND_RING_SIZE	512
+#define MIX_RELEASE_RING_SIZE	1024
+
+static CMixThreadRing< mixcommand_t, MIX_COMMAND_RING_SIZE > s_Commands;
+static CMixThreadRing< mixrelease_t, MIX_RELEASE_RING_SIZE > s_Releases;
+
+// Mix thread state
+static channel_t		s_MixChannels[MAX_CHANNELS];
+
+// Game thread state, the mixer last posted for each channel
+static CAudioMixer		*s_pPostedMixers[MAX_CHANNELS];
+
+static ThreadHandle_t	s_hMixThread = NULL;
+static CThreadEvent		s_MixThreadWake;
+static volatile bool	s_bMixThreadActive = false;
+static volatile bool	s_bMixThreadExit = false;
+static volatile bool	s_bStopAllSounds = false;
+
+static int				s_nMouthTime;
+
+// Statistics for snd_mixthread_status, written by the mix thread
+static int				s_nMixPasses;
+static int				s_nUnderruns;
+static double			s_flMixTime;
+static double			s_flMaxMixTime;
+static int				s_nCommandRingFull;
+
+//-----------------------------------------------------------------------------
+// Mix thread
+//-----------------------------------------------------------------------------
+channel_t *MIX_ThreadChannels( void )
+{
+	return s_MixChannels;
+}
+
+void MIX_ThreadReleaseChannel( channel_t *ch )
+{
+	mixrelease_t release;
+	release.index = ch - s_MixChannels;
+	release.pMixer = ch->pMixer;
+
+	bool bPushed = s_Releases.Push( release );
+	Assert( bPushed );
+
+	ch->pMixer = NULL;
+	ch->sfx = NULL;
+}
+
+void MIX_ThreadStopAllSounds( void )
+{
+	s_bStopAllSounds = true;
+}
+
+static void MIX_ThreadProcessCommands( void )
+{
+	mixcommand_t cmd;
+	while ( s_Commands.Pop( cmd ) )
+	{
+		channel_t *ch = &s_MixChannels[cmd.index];
+
+		switch ( cmd.type )
+		{
+		case MIXCMD_START:
+			Assert( !ch->pMixer );
+			if ( ch->pMixer )
+			{
+				MIX_ThreadReleaseChannel( ch );
+			}
+			*ch = cmd.channel;
+			break;
+
+		case MIXCMD_UPDATE:
+			// The sound may have finished since this was posted.  Sentences
+			// switch sfx per word and the pitch is modulated by the mixer,
+			// so those two stay as the mix thread left them.
+			if ( ch->pMixer == cmd.channel.pMixer )
+			{
+				CSfxTable *sfx = ch->sfx;
+				float pitch = ch->pitch;
+
+				*ch = cmd.channel;
+				ch->sfx = sfx;
+				ch->pitch = pitch;
+			}
+			break;
+
+		case MIXCMD_STOP:
+			if ( ch->pMixer == cmd.channel.pMixer )
+			{
+				MIX_ThreadReleaseChannel( ch );
+			}
+			break;
+		}
+	}
+}
+
+static unsigned MIX_ThreadFunc( void *pParam )
+{
+	while ( !s_bMixThreadExit )
+	{
+		float latency = max( snd_mixthread_latency.GetFloat(), 0.01f );
+
+		{
+			CAutoLock lock( g_MixThreadMutex );
+
+			MIX_ThreadProcessCommands();
+
+			if ( g_AudioDevice->IsActive() )
+			{
+				double start = Plat_FloatTime();
+
+				if ( S_PaintAhead( (int)( latency * g_AudioDevice->DeviceDmaSpeed() ) ) )
+				{
+					s_nUnderruns++;
+				}
+
+				double elapsed = Plat_FloatTime() - start;
+				s_flMixTime += elapsed;
+				s_flMaxMixTime = max( s_flMaxMixTime, elapsed );
+				s_nMixPasses++;
+			}
+		}
+
+		// wake up a few times per latency period to stay that far ahead
+		s_MixThreadWake.Wait( max( (int)( latency * 1000.0f / 4.0f ), 1 ) );
+	}
+
+	// release whatever the game thread stopped on the way out
+	CAutoLock lock( g_MixThreadMutex );
+	MIX_ThreadProcessCommands();
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Game thread
+//-----------------------------------------------------------------------------
+bool MIX_ThreadActive( void )
+{
+	return s_bMixThreadActive;
+}
+
+bool MIX_ThreadOwnsMixer( channel_t *ch )
+{
+	return ch->pMixer && s_pPostedMixers[ch - channels] == ch->pMixer;
+}
+
+static void MIX_ThreadPostCommand( int type, int index, const channel_t *ch )
+{
+	mixcommand_t cmd;
+	cmd.type = type;
+	cmd.index = index;
+	cmd.channel = *ch;
+
+	while ( !s_Commands.Push( cmd ) )
+	{
+		// Get the mix thread to drain the ring
+		s_nCommandRingFull++;
+		s_MixThreadWake.Set();
+		Plat_Sleep( 1 );
+	}
+}
+
+static void MIX_ThreadDeleteReleasedMixers( void )
+{
+	mixrelease_t release;
+	if ( !s_Releases.Pop( release ) )
+		return;
+
+	// No lock: once released, nothing on the mix thread references the mixer,
+	// and the sources it frees have no other mixers left
+	do
+	{
+		channel_t *ch = &channels[release.index];
+
+		// The sound finished on the mix thread, free the channel
+		if ( ch->pMixer == release.pMixer )
+		{
+			s_pPostedMixers[release.index] = NULL;
+			ch->pMixer = NULL;
+			S_FreeChannel( ch );
+		}
+
+		delete release.pMixer;
+	}
+	while ( s_Releases.Pop( release ) );
+}
+
+void MIX_ThreadPostChannels( void )
+{
+	if ( !s_bMixThreadActive )
+		return;
+
+	MIX_ThreadDeleteReleasedMixers();
+
+	channel_t *ch = channels;
+	for ( int i = 0; i < MAX_CHANNELS; i++, ch++ )
+	{
+		// Stopped, or replaced by another sound
+		if ( s_pPostedMixers[i] && s_pPostedMixers[i] != ch->pMixer )
+		{
+			channel_t stop;
+			memset( &stop, 0, sizeof(stop) );
+			stop.pMixer = s_pPostedMixers[i];
+			MIX_ThreadPostCommand( MIXCMD_STOP, i, &stop );
+			s_pPostedMixers[i] = NULL;
+		}
+
+		if ( !ch->pMixer || !ch->sfx )
+			continue;
+
+		if ( s_pPostedMixers[i] != ch->pMixer )
+		{
+			MIX_ThreadPostCommand( MIXCMD_START, i, ch );
+			s_pPostedMixers[i] = ch->pMixer;
+		}
+		else
+		{
+			MIX_ThreadPostCommand( MIXCMD_UPDATE, i, ch );
+		}
+	}
+
+	s_MixThreadWake.Set();
+}
+
+static void MIX_ThreadStart( void )
+{
+	int i;
+
+	// The mixers already playing move over as they are
+	memset( s_MixChannels, 0, sizeof(s_MixChannels) );
+	memset( s_pPostedMixers, 0, sizeof(s_pPostedMixers) );
+	for ( i = 0; i < MAX_CHANNELS; i++ )
+	{
+		if ( channels[i].pMixer && channels[i].sfx )
+		{
+			s_MixChannels[i] = channels[i];
+			s_pPostedMixers[i] = channels[i].pMixer;
+		}
+	}
+
+	s_nMouthTime = paintedtime;
+	s_bMixThreadExit = false;
+	s_bMixThreadActive = true;
+
+	s_hMixThread = Plat_CreateThread( MIX_ThreadFunc, NULL, "Sound Mixer" );
+	if ( !s_hMixThread )
+	{
+		DevMsg( "Couldn't start the sound mixing thread\n" );
+		s_bMixThreadActive = false;
+		memset( s_MixChannels, 0, sizeof(s_MixChannels) );
+		memset( s_pPostedMixers, 0, sizeof(s_pPostedMixers) );
+	}
+}
+
+static void MIX_ThreadStop( void )
+{
+	int i;
+
+	// get any stops that haven't gone out yet processed on the way out
+	MIX_ThreadPostChannels();
+
+	s_bMixThreadExit = true;
+	s_MixThreadWake.Set();
+	Plat_JoinThread( s_hMixThread );
+	s_hMixThread = NULL;
+	s_bMixThreadActive = false;
+
+	MIX_ThreadDeleteReleasedMixers();
+
+	// All stops were processed before the thread exited, so every mixer still
+	// on a shadow channel is also on the matching game channel
+	for ( i = 0; i < MAX_CHANNELS; i++ )
+	{
+		if ( !s_MixChannels[i].pMixer )
+			continue;
+
+		Assert( channels[i].pMixer == s_MixChannels[i].pMixer );
+		channels[i].sfx = s_MixChannels[i].sfx;
+		channels[i].pitch = s_MixChannels[i].pitch;
+	}
+
+	memset( s_MixChannels, 0, sizeof(s_MixChannels) );
+	memset( s_pPostedMixers, 0, sizeof(s_pPostedMixers) );
+}
+
+void MIX_ThreadFrame( void )
+{
+	// Movies mix exactly one frame of sound per frame, which the thread can't do
+	bool bWantThread = snd_mixthread.GetBool() && !cl_moviename[0] && g_AudioDevice != Audio_GetNullDevice();
+
+	if ( bWantThread != s_bMixThreadActive )
+	{
+		if ( bWantThread )
+		{
+			MIX_ThreadStart();
+		}
+		else
+		{
+			MIX_ThreadStop();
+		}
+	}
+
+	if ( !s_bMixThreadActive )
+		return;
+
+	// the clock wrapped on the mix thread
+	if ( s_bStopAllSounds )
+	{
+		s_bStopAllSounds = false;
+		S_StopAllSounds( true );
+	}
+
+	MIX_ThreadPostChannels();
+
+	// The mix thread can't touch entities, so mouths move here
+	CAutoLock lock( g_MixThreadMutex );
+	SND_MoveAllMouths( clamp( paintedtime - s_nMouthTime, 0, PAINTBUFFER_SIZE ) );
+	s_nMouthTime = paintedtime;
+}
+
+void MIX_ThreadShutdown( void )
+{
+	if ( s_bMixThreadActive )
+	{
+		MIX_ThreadStop();
+	}
+}
+
+static void MIX_ThreadStatus_f( void )
+{
+	if ( !s_bMixThreadActive )
+	{
+		Msg( "Sound is mixed on the main thread\n" );
+		return;
+	}
+
+	Msg( "Sound device: %s\n", g_AudioDevice->DeviceName() );
+	Msg( "%d mix passes, %.3f ms average, %.3f ms max\n", s_nMixPasses, 
+		s_nMixPasses ? s_flMixTime * 1000.0 / s_nMixPasses : 0.0, s_flMaxMixTime * 1000.0 );
+	Msg( "%d underruns, command ring full %d times\n", s_nUnderruns, s_nCommandRingFull );
+}
+
+static ConCommand snd_mixthread_status( "snd_mixthread_status", MIX_ThreadStatus_f, "Shows mix thread timing and underruns" );
@@ -0,0 +1,62 @@
+//========= Copyright (c) 1996-2003, Valve LLC, All rights reserved. ==========
+//
+// Purpose: Mixes the paintbuffers on a dedicated thread.
+//
+//			The game thread owns channels[].  While the mix thread runs it owns
+//			a shadow copy of each playing channel and the mixer attached to it.
+//			Channel starts, stops and new spatialization are posted to it once
+//			a frame through a lock free command ring, and the mixers it's done
+//			with come back through a second ring to be deleted on the game
+//			thread.  g_MixThreadMutex is held for every mix pass, the game
+//			thread only takes it to clear the paintbuffers, reset the DSP,
+//			pause the device and move mouths.
+//
+//			The mix thread never touches the zone cache or loads a sound.
+//			Cached sources copy their data out of the cache when the game
+//			thread creates their first mixer and drop the copy when it
+//			deletes the last one, and sentences load all of their words
+//			when they start.
+//
+//=============================================================================
+
+#ifndef SND_MIXTHREAD_H
+#define SND_MIXTHREAD_H
+
+#if defined( _WIN32 )
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+
+struct channel_t;
+
+extern CThreadMutex g_MixThreadMutex;
+
+// Starts or stops the mix thread to match snd_mixthread, posts this frame's
+// channel changes and deletes the mixers the mix thread has released.
+// Called by S_Update on the game thread.
+void MIX_ThreadFrame( void );
+
+// Posts channel starts, stops and spatialization without waiting for the next frame
+void MIX_ThreadPostChannels( void );
+
+// Stops the mix thread and hands the mixers back to the game thread
+void MIX_ThreadShutdown( void );
+
+// true while the mix thread is running and owns the posted mixers
+bool MIX_ThreadActive( void );
+
+// Game thread: true if the channel's mixer was posted to the mix thread, in
+// which case the mix thread releases it rather than the caller deleting it
+bool MIX_ThreadOwnsMixer( channel_t *ch );
+
+// Mix thread: the shadow channels to mix, MAX_CHANNELS of them
+channel_t *MIX_ThreadChannels( void );
+
+// Mix thread: drops a shadow channel that's done playing
+void MIX_ThreadReleaseChannel( channel_t *ch );
+
+// Mix thread: asks the game thread to stop all sounds
+void MIX_ThreadStopAllSounds( void );
+
+#endif // SND_MIXTHREAD_H
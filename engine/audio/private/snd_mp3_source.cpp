@@ -9,11 +9,19 @@
 #include "tier0/dbg.h"
 #include "snd_wave_mixer.h"
 #include "snd_wave_data.h"
+#include "snd_pcm_cache.h"
 
 CAudioSourceMP3::CAudioSourceMP3( const char *pFileName )
 {
 	m_sampleRate = 44100;
 	m_pName = pFileName;
+	m_fileSize = 0;
+	m_refCount = 0;
+}
+
+CAudioSourceMP3::~CAudioSourceMP3( void )
+{
+	PCMCache_Remove( this );
 }
 
 // mixer's references
@@ -34,6 +42,8 @@ bool CAudioSourceMP3::CanDelete( void )
 }
 
 
+// Mixes from its own copy of the file while mixers reference it, like
+// CAudioSourceMemWaveCache, so the mix thread never touches the cache
 class CAudioSourceMP3Cache : public CAudioSourceMP3
 {
 public:
@@ -48,10 +58,14 @@ public:
 	int						GetOutputData( void **pData, int samplePosition, int sampleCount, char copyBuf[AUDIOSOURCE_COPYBUF_SIZE] );
 	CAudioMixer				*CreateMixer( void );
 
+	virtual void			ReferenceAdd( CAudioMixer *pMixer );
+	virtual void			ReferenceRemove( CAudioMixer *pMixer );
+
 protected:
 	virtual char			*GetDataPointer( void );
 
 	cache_user_t	m_cache;
+	char			*m_pPinnedData;		// copy of the file while mixers reference this
 
 private:
 	CAudioSourceMP3Cache( const CAudioSourceMP3Cache & );
@@ -65,6 +79,7 @@ CAudioSourceMP3Cache::CAudioSourceMP3Cache( const char *pName ) :
 	CAudioSourceMP3( pName )
 {
 	memset( &m_cache, 0, sizeof(m_cache) );
+	m_pPinnedData = NULL;
 }
 
 
@@ -74,6 +89,7 @@ CAudioSourceMP3Cache::CAudioSourceMP3Cache( const char *pName ) :
 CAudioSourceMP3Cache::~CAudioSourceMP3Cache( void )
 {
 	CacheUnload();
+	delete[] m_pPinnedData;
 }
 
 
@@ -122,8 +138,47 @@ void CAudioSourceMP3Cache::CacheUnload( void )
 	Cache_Free( &m_cache );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Copies the file out of the cache for the first mixer.  Mixers are
+//			created and deleted on the main thread, so only it gets here.
+//-----------------------------------------------------------------------------
+void CAudioSourceMP3Cache::ReferenceAdd( CAudioMixer *pMixer )
+{
+	CAudioSourceMP3::ReferenceAdd( pMixer );
+
+	if ( m_pPinnedData )
+		return;
+
+	char *pData = (char *)Cache_Check( &m_cache );
+	if ( !pData )
+	{
+		CacheLoad();
+		pData = (char *)Cache_Check( &m_cache );
+	}
+
+	if ( pData )
+	{
+		m_pPinnedData = new char[m_fileSize];
+		memcpy( m_pPinnedData, pData, m_fileSize );
+	}
+}
+
+void CAudioSourceMP3Cache::ReferenceRemove( CAudioMixer *pMixer )
+{
+	CAudioSourceMP3::ReferenceRemove( pMixer );
+
+	if ( CanDelete() )
+	{
+		delete[] m_pPinnedData;
+		m_pPinnedData = NULL;
+	}
+}
+
 char *CAudioSourceMP3Cache::GetDataPointer( void )
 {
+	if ( m_pPinnedData )
+		return m_pPinnedData;
+
 	char *pData = (char *)Cache_Check( &m_cache );
 	if ( !pData )
 		CacheLoad();
@@ -21,6 +21,7 @@ class CAudioSourceMP3 : public CAudioSource
 public:
 
 	CAudioSourceMP3( const char *pFileName );
+	virtual ~CAudioSourceMP3( void );
 	// Create an instance (mixer) of this audio source
 	virtual CAudioMixer			*CreateMixer( void ) = 0;
 	
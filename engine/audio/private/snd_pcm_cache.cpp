@@ -0,0 +1,269 @@
+//========= Copyright (c) 1996-2003, Valve LLC, All rights reserved. ==========
+//
+// Purpose: Cache of fully decoded compressed sounds, see snd_pcm_cache.h
+//
+//=============================================================================
+
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include "convar.h"
+#include "utllinkedlist.h"
+#include "utlmap.h"
+#include "snd_audio_source.h"
+#include "snd_pcm_cache.h"
+
+static ConVar snd_pcmcache( "snd_pcmcache", "1", 0, "Decode short ADPCM and MP3 sounds once and mix them from memory" );
+static ConVar snd_pcmcache_size( "snd_pcmcache_size", "8", 0, "Megabytes of decoded sound to keep" );
+static ConVar snd_pcmcache_maxlength( "snd_pcmcache_maxlength", "3", 0, "Longest sound, in seconds, to decode into the cache" );
+
+struct pcmcache_t
+{
+	CAudioSource	*pSource;		// NULL once the source is deleted
+	short			*pSamples;		// NULL if the source was rejected
+	int				sampleCount;
+	int				channels;
+	int				size;			// in bytes
+	int				refCount;		// mixers playing from this entry
+};
+
+static bool PCMCacheSourceLessFunc( CAudioSource * const &lhs, CAudioSource * const &rhs )
+{
+	return lhs < rhs;
+}
+
+// mixers are created and deleted on the main thread, but the mix thread may
+// release a mixer while the main thread starts another, so everything is locked
+
+static CThreadMutex s_PCMCacheMutex;
+static CUtlLinkedList< pcmcache_t, PCMCacheHandle_t > s_PCMCache;		// least recently used first
+static CUtlMap< CAudioSource *, PCMCacheHandle_t > s_PCMCacheSources( 0, 0, PCMCacheSourceLessFunc );
+
+static int s_nPCMCacheSize;
+static int s_nPCMCachePeakSize;
+static int s_nPCMCacheHits;
+static int s_nPCMCacheMisses;
+static int s_nPCMCacheEvictions;
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees an entry and its samples
+//-----------------------------------------------------------------------------
+static void PCMCache_Free( PCMCacheHandle_t h )
+{
+	pcmcache_t &entry = s_PCMCache[h];
+
+	if ( entry.pSource )
+	{
+		s_PCMCacheSources.Remove( entry.pSource );
+	}
+
+	s_nPCMCacheSize -= entry.size;
+	delete[] entry.pSamples;
+	s_PCMCache.Remove( h );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees the least recently used entries that aren't playing until the
+//			cache fits in snd_pcmcache_size
+//-----------------------------------------------------------------------------
+static void PCMCache_Evict( void )
+{
+	int budget = snd_pcmcache.GetInt() ? (int)( snd_pcmcache_size.GetFloat() * 1024 * 1024 ) : 0;
+
+	PCMCacheHandle_t h = s_PCMCache.Head();
+	while ( s_nPCMCacheSize > budget && h != s_PCMCache.InvalidIndex() )
+	{
+		PCMCacheHandle_t next = s_PCMCache.Next( h );
+		if ( !s_PCMCache[h].refCount )
+		{
+			PCMCache_Free( h );
+			s_nPCMCacheEvictions++;
+		}
+		h = next;
+	}
+}
+
+int PCMCache_MaxSamples( int sampleRate )
+{
+	if ( !snd_pcmcache.GetInt() )
+		return 0;
+
+	return (int)( snd_pcmcache_maxlength.GetFloat() * sampleRate );
+}
+
+pcmcachelookup_t PCMCache_Lock( CAudioSource *pSource, pcmcachedata_t &data )
+{
+	CAutoLock lock( s_PCMCacheMutex );
+
+	unsigned short i = s_PCMCacheSources.Find( pSource );
+	if ( i == s_PCMCacheSources.InvalidIndex() )
+	{
+		s_nPCMCacheMisses++;
+		return PCMCACHE_MISS;
+	}
+
+	PCMCacheHandle_t h = s_PCMCacheSources[i];
+	pcmcache_t &entry = s_PCMCache[h];
+	if ( !entry.pSamples )
+		return PCMCACHE_REJECTED;
+
+	// most recently used
+	s_PCMCache.LinkToTail( h );
+	entry.refCount++;
+	s_nPCMCacheHits++;
+
+	data.handle = h;
+	data.pSamples = entry.pSamples;
+	data.sampleCount = entry.sampleCount;
+	data.channels = entry.channels;
+	return PCMCACHE_HIT;
+}
+
+void PCMCache_Add( CAudioSource *pSource, short *pSamples, int sampleCount, int channels, pcmcachedata_t &data )
+{
+	CAutoLock lock( s_PCMCacheMutex );
+
+	// replace any copy that's already there
+	unsigned short i = s_PCMCacheSources.Find( pSource );
+	if ( i != s_PCMCacheSources.InvalidIndex() )
+	{
+		PCMCacheHandle_t old = s_PCMCacheSources[i];
+		s_PCMCacheSources.RemoveAt( i );
+		s_PCMCache[old].pSource = NULL;
+		if ( !s_PCMCache[old].refCount )
+		{
+			PCMCache_Free( old );
+		}
+	}
+
+	pcmcache_t entry;
+	entry.pSource = pSource;
+	entry.pSamples = pSamples;
+	entry.sampleCount = sampleCount;
+	entry.channels = channels;
+	entry.size = sampleCount * channels * sizeof(short);
+	entry.refCount = 1;
+
+	PCMCacheHandle_t h = s_PCMCache.AddToTail( entry );
+	s_PCMCacheSources.Insert( pSource, h );
+
+	s_nPCMCacheSize += entry.size;
+	if ( s_nPCMCacheSize > s_nPCMCachePeakSize )
+	{
+		s_nPCMCachePeakSize = s_nPCMCacheSize;
+	}
+
+	data.handle = h;
+	data.pSamples = pSamples;
+	data.sampleCount = sampleCount;
+	data.channels = channels;
+
+	PCMCache_Evict();
+}
+
+void PCMCache_Reject( CAudioSource *pSource )
+{
+	CAutoLock lock( s_PCMCacheMutex );
+
+	if ( s_PCMCacheSources.Find( pSource ) != s_PCMCacheSources.InvalidIndex() )
+		return;
+
+	pcmcache_t entry;
+	entry.pSource = pSource;
+	entry.pSamples = NULL;
+	entry.sampleCount = 0;
+	entry.channels = 0;
+	entry.size = 0;
+	entry.refCount = 0;
+
+	s_PCMCacheSources.Insert( pSource, s_PCMCache.AddToTail( entry ) );
+}
+
+void PCMCache_Release( pcmcachedata_t &data )
+{
+	CAutoLock lock( s_PCMCacheMutex );
+
+	pcmcache_t &entry = s_PCMCache[data.handle];
+
+	Assert( entry.refCount > 0 );
+	entry.refCount--;
+
+	if ( !entry.refCount && !entry.pSource )
+	{
+		// the source was deleted while this was playing
+		PCMCache_Free( data.handle );
+	}
+	else
+	{
+		PCMCache_Evict();
+	}
+
+	data.pSamples = NULL;
+}
+
+void PCMCache_Remove( CAudioSource *pSource )
+{
+	CAutoLock lock( s_PCMCacheMutex );
+
+	unsigned short i = s_PCMCacheSources.Find( pSource );
+	if ( i == s_PCMCacheSources.InvalidIndex() )
+		return;
+
+	PCMCacheHandle_t h = s_PCMCacheSources[i];
+	s_PCMCacheSources.RemoveAt( i );
+	s_PCMCache[h].pSource = NULL;
+
+	if ( !s_PCMCache[h].refCount )
+	{
+		PCMCache_Free( h );
+	}
+}
+
+static void PCMCache_Status_f( void )
+{
+	CAutoLock lock( s_PCMCacheMutex );
+
+	int decoded = 0;
+	int playing = 0;
+	FOR_EACH_LL( s_PCMCache, h )
+	{
+		if ( s_PCMCache[h].pSamples )
+		{
+			decoded++;
+		}
+		if ( s_PCMCache[h].refCount )
+		{
+			playing++;
+		}
+	}
+
+	int lookups = s_nPCMCacheHits + s_nPCMCacheMisses;
+
+	Msg( "%d decoded sounds, %d playing, %.2f MB of %.2f MB, peak %.2f MB\n", decoded, playing, 
+		s_nPCMCacheSize / (1024.0f * 1024.0f), snd_pcmcache_size.GetFloat(), s_nPCMCachePeakSize / (1024.0f * 1024.0f) );
+	Msg( "%d hits, %d misses, %.1f%% hit rate, %d evicted\n", s_nPCMCacheHits, s_nPCMCacheMisses, 
+		lookups ? 100.0f * s_nPCMCacheHits / lookups : 0.0f, s_nPCMCacheEvictions );
+}
+
+static ConCommand snd_pcmcache_status( "snd_pcmcache_status", PCMCache_Status_f, "Shows decoded sound cache memory use and hit rate" );
+
+static void PCMCache_Flush_f( void )
+{
+	CAutoLock lock( s_PCMCacheMutex );
+
+	PCMCacheHandle_t h = s_PCMCache.Head();
+	while ( h != s_PCMCache.InvalidIndex() )
+	{
+		PCMCacheHandle_t next = s_PCMCache.Next( h );
+		// forget the rejected sources too, in case snd_pcmcache_maxlength changed
+		if ( !s_PCMCache[h].refCount )
+		{
+			PCMCache_Free( h );
+		}
+		h = next;
+	}
+
+	s_nPCMCacheHits = s_nPCMCacheMisses = s_nPCMCacheEvictions = 0;
+	s_nPCMCachePeakSize = s_nPCMCacheSize;
+}
+
+static ConCommand snd_pcmcache_flush( "snd_pcmcache_flush", PCMCache_Flush_f, "Frees the decoded sounds that aren't playing and clears the counters" );
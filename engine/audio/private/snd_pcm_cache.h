@@ -0,0 +1,59 @@
+//========= Copyright (c) 1996-2003, Valve LLC, All rights reserved. ==========
+//
+// Purpose: Cache of fully decoded compressed sounds.
+//
+//			Short ADPCM and MP3 sounds are decoded once, the first time they
+//			play, and every later channel playing the same source mixes
+//			straight from the decoded samples.  Entries are shared by all the
+//			mixers playing a source, and the least recently used ones nobody
+//			is playing are freed to stay under snd_pcmcache_size.
+//
+//=============================================================================
+
+#ifndef SND_PCM_CACHE_H
+#define SND_PCM_CACHE_H
+
+#if defined( _WIN32 )
+#pragma once
+#endif
+
+class CAudioSource;
+
+typedef unsigned short PCMCacheHandle_t;
+
+// Decoded samples of one source, valid until the mixer releases them
+struct pcmcachedata_t
+{
+	PCMCacheHandle_t	handle;
+	short				*pSamples;		// 16 bit samples, interleaved if stereo
+	int					sampleCount;	// number of samples (pairs for stereo)
+	int					channels;
+};
+
+// Longest sound, in samples at sampleRate, that should be decoded into the cache. 0 if the cache is off
+int PCMCache_MaxSamples( int sampleRate );
+
+enum pcmcachelookup_t
+{
+	PCMCACHE_MISS = 0,
+	PCMCACHE_HIT,
+	PCMCACHE_REJECTED,		// don't bother decoding, see PCMCache_Reject
+};
+
+// Finds the decoded samples for a source and holds them until PCMCache_Release on a hit
+pcmcachelookup_t PCMCache_Lock( CAudioSource *pSource, pcmcachedata_t &data );
+
+// Adds the decoded samples for a source and holds them until PCMCache_Release.
+// The cache takes ownership of pSamples, which must be allocated with new[]
+void PCMCache_Add( CAudioSource *pSource, short *pSamples, int sampleCount, int channels, pcmcachedata_t &data );
+
+// Remembers that a source turned out to be too long to cache, so it isn't decoded again
+void PCMCache_Reject( CAudioSource *pSource );
+
+// Called by a mixer when it's done with the samples
+void PCMCache_Release( pcmcachedata_t &data );
+
+// Called when a source is deleted
+void PCMCache_Remove( CAudioSource *pSource );
+
+#endif // SND_PCM_CACHE_H
@@ -12,6 +12,9 @@
 //-----------------------------------------------------------------------------
 // Purpose: This replaces the old sentence logic that was integrated with the
 //			sound code.  Now it is a hierarchical mixer.
+//			Every word is loaded and gets its mixer up front, and they're all
+//			freed with the sentence, so the mix thread never loads or frees
+//			sounds while it plays one.
 //-----------------------------------------------------------------------------
 class CSentenceMixer : public CAudioMixer
 {
@@ -37,12 +40,13 @@ public:
 
 	virtual void SetStartupDelaySamples( int delaySamples );
 private:
-	void				LoadWord( void );
-	void				FreeWord( void );
+	void				LoadWords( void );
+	void				FreeWords( void );
 
 	CAudioMixer			*m_pCurrentWord;
 	int					m_wordIndex;
 	voxword_t			m_words[CVOXWORDMAX];		// UNDONE: Dynamically allocate this?
+	CAudioMixer			*m_pWordMixers[CVOXWORDMAX];
 };
 
 
@@ -66,16 +70,16 @@ CSentenceMixer::CSentenceMixer( voxword_t *pwords )
 		
 	m_words[j].sfx = NULL;
 
+	LoadWords();
+
 	m_wordIndex = 0;
-	m_pCurrentWord = NULL;
-	LoadWord();
+	m_pCurrentWord = m_pWordMixers[0];
 }
 
 
 CSentenceMixer::~CSentenceMixer( void )
 {
-	if ( m_pCurrentWord )
-		delete m_pCurrentWord;
+	FreeWords();
 }
 
 
@@ -127,59 +131,66 @@ void CSentenceMixer::SetStartupDelaySamples( int delaySamples )
 	}
 }
 
-void CSentenceMixer::FreeWord( void )
+void CSentenceMixer::FreeWords( void )
 {
-	delete m_pCurrentWord;
 	m_pCurrentWord = NULL;
 
-	if ( m_words[m_wordIndex].sfx )
+	for ( int i = 0; m_words[i].sfx; i++ )
 	{
+		delete m_pWordMixers[i];
+		m_pWordMixers[i] = NULL;
+
 		// If this wave wasn't precached by the game code
-		if (!m_words[m_wordIndex].fKeepCached)
+		CAudioSource *pSource = m_words[i].sfx->pSource;
+		if ( !m_words[i].fKeepCached && pSource )
 		{
 			// If this was the last mixer that had a reference
-			if ( m_words[m_wordIndex].sfx->pSource->CanDelete() )
+			if ( pSource->CanDelete() )
 			{
 				// free the source
-				delete m_words[m_wordIndex].sfx->pSource;
-				m_words[m_wordIndex].sfx->pSource = NULL;
+				delete pSource;
+				m_words[i].sfx->pSource = NULL;
 			}
 		}
 	}
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Make sure the current word is loaded
+// Purpose: Load every word and create its mixer.  A word that doesn't load
+//			ends the sentence there, like it always has.
 //-----------------------------------------------------------------------------
-void CSentenceMixer::LoadWord( void )
+void CSentenceMixer::LoadWords( void )
 {
-	if ( m_words[m_wordIndex].sfx )
+	memset( m_pWordMixers, 0, sizeof(m_pWordMixers) );
+
+	for ( int i = 0; m_words[i].sfx; i++ )
 	{
-		CAudioSource *pSource = S_LoadSound( m_words[m_wordIndex].sfx, NULL );
-		if ( pSource )
+		CAudioSource *pSource = S_LoadSound( m_words[i].sfx, NULL );
+		if ( !pSource )
+			continue;
+
+		CAudioMixer *pMixer = pSource->CreateMixer();
+		m_pWordMixers[i] = pMixer;
+		if ( !pMixer )
+			continue;
+
+		int start = m_words[i].start;
+		int end = m_words[i].end;
+		
+		// don't allow overlapped ranges
+		if ( end <= start )
+			end = 0;
+
+		if ( start || end )
 		{
-			m_pCurrentWord = pSource->CreateMixer();
-			if ( m_pCurrentWord )
+			int sampleCount = pMixer->GetSource()->SampleCount();
+			if ( start )
 			{
-				int start = m_words[m_wordIndex].start;
-				int end = m_words[m_wordIndex].end;
-				
-				// don't allow overlapped ranges
-				if ( end <= start )
-					end = 0;
-
-				if ( start || end )
-				{
-					int sampleCount = m_pCurrentWord->GetSource()->SampleCount();
-					if ( start )
-					{
-						m_pCurrentWord->SetSampleStart( (int)(sampleCount * 0.01f * start) );
-					}
-					if ( end )
-					{
-						m_pCurrentWord->SetSampleEnd( (int)(sampleCount * 0.01f * end) );
-					}
-				}
+				pMixer->SetSampleStart( (int)(sampleCount * 0.01f * start) );
+			}
+			if ( end )
+			{
+				pMixer->SetSampleEnd( (int)(sampleCount * 0.01f * end) );
 			}
 		}
 	}
@@ -242,9 +253,8 @@ int CSentenceMixer::MixDataToDevice( IAudioDevice *pDevice, channel_t *pChannel,
 				SND_ClearMouth( pChannel );
 			}
 
-			FreeWord();
 			m_wordIndex++;
-			LoadWord();
+			m_pCurrentWord = m_pWordMixers[m_wordIndex];
 			if ( m_pCurrentWord )
 			{
 				pChannel->sfx = m_words[m_wordIndex].sfx;
@@ -1,6 +1,13 @@
 #include "snd_wave_data.h"
 #include "riff.h"
 #include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "convar.h"
+#include "utllinkedlist.h"
+#include "vstdlib/strtools.h"
+#include "filesystem.h"
+#include "filesystem_engine.h"
+#include <stdio.h>
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -20,6 +27,9 @@ public:
 	{
 		return m_source.GetOutputData( pData, sampleIndex, sampleCount, copyBuf );
 	}
+
+	// the whole file is in memory, so it can be decoded up front unless it loops
+	virtual bool CanCacheDecoded( void ) { return !m_source.IsLooped(); }
 private:
 	CAudioSource		&m_source;	// pointer to source
 };
@@ -27,6 +37,30 @@ private:
 
 // UNDONE: Allocate this in cache instead?
 #define BUFFER_SIZE 16384
+
+// most buffers a stream can read ahead of the one being mixed
+#define STREAM_MAX_LOOKAHEAD	4
+
+static ConVar snd_async_stream( "snd_async_stream", "1", 0, "Read streaming sounds ahead of the mixer on a separate thread" );
+static ConVar snd_async_lookahead( "snd_async_lookahead", "2", 0, "Buffers each streaming sound reads ahead of the mixer (1-4), for sounds started afterwards" );
+static ConVar snd_async_latency( "snd_async_latency", "0", 0, "Testing: milliseconds every read of a streaming sound started afterwards is delayed by" );
+
+enum
+{
+	STREAMBUF_FREE = 0,
+	STREAMBUF_QUEUED,		// waiting for, or being read by, the streaming thread
+	STREAMBUF_READY,
+};
+
+struct streambuffer_t
+{
+	int				sampleIndex;	// sample index of first sample in buffer
+	int				sampleCount;	// samples asked for until it's ready, then samples read
+	volatile long	state;
+	bool			converted;		// UpdateSamples has been called on it
+	char			data[BUFFER_SIZE];
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: This is an instance of a stream.
 //			This contains the file handle and streaming buffer
@@ -36,7 +70,7 @@ private:
 class CWaveDataStream : public IWaveData
 {
 public:
-	CWaveDataStream( CAudioSource &source, IWaveStreamSource *pStreamSource, IFileReadBinary &io, const char *pFileName, int fileStart, int fileSize );
+	CWaveDataStream( CAudioSource &source, IWaveStreamSource *pStreamSource, IFileReadBinary &io, IFileReadBinary &asyncIO, const char *pFileName, int fileStart, int fileSize );
 	~CWaveDataStream( void );
 
 	// return the source pointer (mixer needs this to determine some things like sampling rate)
@@ -46,9 +80,21 @@ public:
 	// Get the data from the buffer (or reload from disk)
 	virtual int ReadSourceData( void **pData, int sampleIndex, int sampleCount, char copyBuf[AUDIOSOURCE_COPYBUF_SIZE] );
 
+	// Reads a queued buffer from the file, on the streaming thread
+	void ReadBuffer( int index );
+
 private:
 	CWaveDataStream( const CWaveDataStream & );
 
+	int						ReadSourceDataAsync( void **pData, int sampleIndex, int sampleCount );
+	int						FindBuffer( int sampleIndex, int state );
+	int						BufferSamples( int sampleIndex );
+	int						NextBufferStart( int sampleIndex, int sampleCount );
+	int						ReadBufferNow( int sampleIndex );
+	void					QueueAhead( int current );
+	void					WaitForBuffer( int index );
+	void					CancelReads( void );
+
 	CAudioSource			&m_source;					// wave source
 	IWaveStreamSource		*m_pStreamSource;			// streaming
 	int						m_sampleSize;				// size of a sample in bytes
@@ -61,15 +107,228 @@ private:
 	int						m_dataStart;
 	// UNDONE: Do we need this?  Just use the global?
 	IFileReadBinary			&m_io;						// I/O interface
+	IFileReadBinary			&m_asyncIO;					// private file reads for m_pBuffers, see CStdioFileReadBinary
+	int						m_asyncFile;
+
+	// read ahead by the streaming thread, NULL if the stream reads synchronously into m_buffer
+	streambuffer_t			*m_pBuffers;
+	int						m_bufferTotal;
+	bool					m_bStarted;					// has read its first buffer
+};
+
+
+//-----------------------------------------------------------------------------
+// Streaming thread.  Every stream queues reads for the buffers after the one
+// being mixed, and this thread reads them in order, so a slow disk delays the
+// next buffer instead of the mix.  It only reads through CStdioFileReadBinary,
+// sounds that are only in a pack file are read by the mixer as before.
+//-----------------------------------------------------------------------------
+struct streamrequest_t
+{
+	CWaveDataStream		*pStream;
+	int					index;
 };
 
+static CThreadMutex								s_StreamMutex;
+static CUtlLinkedList< streamrequest_t, int >	s_StreamRequests;
+static CWaveDataStream							*s_pStreamReading = NULL;	// stream being read right now
+
+static ThreadHandle_t	s_hStreamThread = NULL;
+static CThreadEvent		s_StreamWake;
+static CThreadEvent		s_StreamReadDone;
+static volatile bool	s_bStreamThreadExit = false;
+
+// Statistics for snd_async_status
+static int				s_nStreamReads;			// read ahead by the streaming thread
+static int				s_nStreamWaits;			// the mixer had to wait for a queued read
+static int				s_nStreamSyncReads;		// the mixer had to read (seeks and underruns)
+static int				s_nStreamStarts;
+
+static unsigned Stream_ThreadFunc( void *pParam )
+{
+	while ( !s_bStreamThreadExit )
+	{
+		streamrequest_t request;
+		request.pStream = NULL;
+
+		s_StreamMutex.Lock();
+		int head = s_StreamRequests.Head();
+		if ( head != s_StreamRequests.InvalidIndex() )
+		{
+			request = s_StreamRequests[head];
+			s_StreamRequests.Remove( head );
+			s_pStreamReading = request.pStream;
+		}
+		s_StreamMutex.Unlock();
+
+		if ( !request.pStream )
+		{
+			s_StreamWake.Wait( 100 );
+			continue;
+		}
 
-CWaveDataStream::CWaveDataStream( CAudioSource &source, IWaveStreamSource *pStreamSource, IFileReadBinary &io, const char *pFileName, int fileStart, int fileSize ) 
-		: m_source(source), m_dataStart(fileStart), m_io(io), m_pStreamSource(pStreamSource)
+		request.pStream->ReadBuffer( request.index );
+		s_nStreamReads++;
+
+		s_StreamMutex.Lock();
+		s_pStreamReading = NULL;
+		s_StreamMutex.Unlock();
+
+		s_StreamReadDone.Set();
+	}
+
+	return 0;
+}
+
+static void Stream_StartThread( void )
+{
+	CAutoLock lock( s_StreamMutex );
+
+	if ( !s_hStreamThread )
+	{
+		s_bStreamThreadExit = false;
+		s_hStreamThread = Plat_CreateThread( Stream_ThreadFunc, NULL, "Sound Streaming" );
+	}
+}
+
+static void Stream_QueueRead( CWaveDataStream *pStream, int index )
+{
+	streamrequest_t request;
+	request.pStream = pStream;
+	request.index = index;
+
+	s_StreamMutex.Lock();
+	s_StreamRequests.AddToTail( request );
+	s_StreamMutex.Unlock();
+
+	s_StreamWake.Set();
+}
+
+void WaveDataStream_Shutdown( void )
+{
+	if ( !s_hStreamThread )
+		return;
+
+	s_bStreamThreadExit = true;
+	s_StreamWake.Set();
+	Plat_JoinThread( s_hStreamThread );
+	s_hStreamThread = NULL;
+}
+
+static void Stream_Status_f( void )
+{
+	Msg( "streaming thread %s, %d reads ahead, %d streams started\n", s_hStreamThread ? "running" : "stopped", s_nStreamReads, s_nStreamStarts );
+	Msg( "%d underruns: the mixer waited for %d reads and read %d itself\n", s_nStreamWaits + s_nStreamSyncReads, s_nStreamWaits, s_nStreamSyncReads );
+}
+
+static ConCommand snd_async_status( "snd_async_status", Stream_Status_f, "Shows how often streaming sounds had to wait for the disk" );
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads a loose sound file through its own stdio handle.  The
+//			filesystem isn't thread safe (pack files share one FILE* and a
+//			Seek then Read isn't atomic), so the streaming thread never goes
+//			through it.  open() resolves the name on the calling thread and
+//			fails for sounds that only exist in a pack file.
+//-----------------------------------------------------------------------------
+class CStdioFileReadBinary : public IFileReadBinary
+{
+public:
+	int open( const char *pFileName )
+	{
+		char namebuffer[512];
+		char localPath[512];
+
+		// same sound/ prefix as the engine's sound filesystem
+		Q_strcpy( namebuffer, "sound" );
+		if ( pFileName[0] != '/' )
+			Q_strcat( namebuffer, "/" );
+		Q_strcat( namebuffer, pFileName );
+
+		if ( g_pFileSystem->GetLocalPathLen( namebuffer ) >= (int)sizeof( localPath ) )
+			return 0;
+		if ( !g_pFileSystem->GetLocalPath( namebuffer, localPath ) )
+			return 0;
+
+		return (int)fopen( localPath, "rb" );
+	}
+	int read( void *pOutput, int size, int file )
+	{
+		if ( !file )
+			return 0;
+		return fread( pOutput, 1, size, (FILE *)file );
+	}
+	void seek( int file, int pos )
+	{
+		if ( file )
+			fseek( (FILE *)file, pos, SEEK_SET );
+	}
+	unsigned int tell( int file )
+	{
+		return file ? ftell( (FILE *)file ) : 0;
+	}
+	unsigned int size( int file )
+	{
+		if ( !file )
+			return 0;
+
+		FILE *fp = (FILE *)file;
+		long pos = ftell( fp );
+		fseek( fp, 0, SEEK_END );
+		long size = ftell( fp );
+		fseek( fp, pos, SEEK_SET );
+		return size;
+	}
+	void close( int file )
+	{
+		if ( file )
+			fclose( (FILE *)file );
+	}
+};
+
+static CStdioFileReadBinary s_StdioIO;
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Test stand-in for the sound filesystem, delays every read by
+//			snd_async_latency milliseconds to simulate a slow or busy disk
+//-----------------------------------------------------------------------------
+class CLatentFileReadBinary : public IFileReadBinary
+{
+public:
+	CLatentFileReadBinary( void ) : m_pIO( NULL ) {}
+
+	void SetIO( IFileReadBinary *pIO ) { m_pIO = pIO; }
+
+	int open( const char *pFileName ) { return m_pIO->open( pFileName ); }
+	int read( void *pOutput, int size, int file )
+	{
+		Plat_Sleep( max( snd_async_latency.GetInt(), 0 ) );
+		return m_pIO->read( pOutput, size, file );
+	}
+	void close( int file ) { m_pIO->close( file ); }
+	void seek( int file, int pos ) { m_pIO->seek( file, pos ); }
+	unsigned int tell( int file ) { return m_pIO->tell( file ); }
+	unsigned int size( int file ) { return m_pIO->size( file ); }
+
+private:
+	IFileReadBinary *m_pIO;
+};
+
+static CLatentFileReadBinary s_LatentIO;
+static CLatentFileReadBinary s_LatentStdioIO;
+
+
+CWaveDataStream::CWaveDataStream( CAudioSource &source, IWaveStreamSource *pStreamSource, IFileReadBinary &io, IFileReadBinary &asyncIO, const char *pFileName, int fileStart, int fileSize ) 
+		: m_source(source), m_dataStart(fileStart), m_io(io), m_asyncIO(asyncIO), m_pStreamSource(pStreamSource)
 {
 	// nothing in the buffer yet
 	m_bufferCount = 0;
 	m_sampleIndex = 0;
+	m_pBuffers = NULL;
+	m_bufferTotal = 0;
+	m_bStarted = false;
+	m_asyncFile = 0;
 
 	m_file = m_io.open( pFileName );
 
@@ -84,7 +343,41 @@ CWaveDataStream::CWaveDataStream( CAudioSource &source, IWaveStreamSource *pStre
 		// This is the size in samples (not bytes) of the wave itself
 		m_waveSize = fileSize / m_sampleSize;
 
-		// UNDONE: Read a buffer here?
+		if ( snd_async_stream.GetInt() )
+		{
+			m_asyncFile = m_asyncIO.open( pFileName );
+
+			// a loose file shadowed by a different one in a pack file has to
+			// be read through the filesystem like one that's only in a pack
+			if ( m_asyncFile && m_asyncIO.size( m_asyncFile ) != m_io.size( m_file ) )
+			{
+				m_asyncIO.close( m_asyncFile );
+				m_asyncFile = 0;
+			}
+		}
+
+		if ( m_asyncFile )
+		{
+			m_bufferTotal = clamp( snd_async_lookahead.GetInt(), 1, STREAM_MAX_LOOKAHEAD ) + 1;
+			m_pBuffers = new streambuffer_t[m_bufferTotal];
+			for ( int i = 0; i < m_bufferTotal; i++ )
+			{
+				m_pBuffers[i].state = STREAMBUF_FREE;
+			}
+
+			Stream_StartThread();
+
+			// start reading the beginning before the mixer asks for it
+			streambuffer_t &first = m_pBuffers[0];
+			first.sampleIndex = 0;
+			first.sampleCount = BufferSamples( 0 );
+			first.converted = false;
+			if ( first.sampleCount > 0 )
+			{
+				first.state = STREAMBUF_QUEUED;
+				Stream_QueueRead( this, 0 );
+			}
+		}
 	}
 }
 
@@ -92,6 +385,17 @@ CWaveDataStream::CWaveDataStream( CAudioSource &source, IWaveStreamSource *pStre
 // close the file
 CWaveDataStream::~CWaveDataStream( void ) 
 {
+	if ( m_pBuffers )
+	{
+		CancelReads();
+		delete[] m_pBuffers;
+	}
+
+	if ( m_asyncFile )
+	{
+		m_asyncIO.close( m_asyncFile );
+	}
+
 	m_io.close( m_file );
 }
 
@@ -100,6 +404,11 @@ CWaveDataStream::~CWaveDataStream( void )
 // Get the data from the buffer (or reload from disk)
 int CWaveDataStream::ReadSourceData( void **pData, int sampleIndex, int sampleCount, char copyBuf[AUDIOSOURCE_COPYBUF_SIZE] )
 {
+	if ( m_pBuffers )
+	{
+		return ReadSourceDataAsync( pData, sampleIndex, sampleCount );
+	}
+
 	// wrap position if looping
 	if ( m_source.IsLooped() )
 	{
@@ -183,9 +492,286 @@ int CWaveDataStream::ReadSourceData( void **pData, int sampleIndex, int sampleCo
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns samples from the read ahead buffers, and queues reads for
+//			the ones after it
+//-----------------------------------------------------------------------------
+int CWaveDataStream::ReadSourceDataAsync( void **pData, int sampleIndex, int sampleCount )
+{
+	// wrap position if looping
+	if ( m_source.IsLooped() )
+	{
+		sampleIndex = m_pStreamSource->UpdateLoopingSamplePosition( sampleIndex );
+	}
+
+	int current = FindBuffer( sampleIndex, STREAMBUF_READY );
+	if ( current < 0 )
+	{
+		// the mixer caught up with the streaming thread
+		current = FindBuffer( sampleIndex, STREAMBUF_QUEUED );
+		if ( current >= 0 )
+		{
+			// waiting for the first buffer is just the sound starting
+			if ( m_bStarted )
+			{
+				s_nStreamWaits++;
+			}
+			WaitForBuffer( current );
+			if ( FindBuffer( sampleIndex, STREAMBUF_READY ) != current )
+			{
+				current = -1;
+			}
+		}
+	}
+
+	// nothing was read for this position, the stream just started or seeked
+	if ( current < 0 )
+	{
+		current = ReadBufferNow( sampleIndex );
+		if ( current < 0 )
+			return 0;
+	}
+
+	streambuffer_t &buffer = m_pBuffers[current];
+
+	// do any conversion the source needs (mixer will decode/decompress)
+	if ( !buffer.converted )
+	{
+		m_pStreamSource->UpdateSamples( buffer.data, buffer.sampleCount );
+		buffer.converted = true;
+	}
+
+	QueueAhead( current );
+
+	sampleIndex -= buffer.sampleIndex;
+	*pData = (void *)&buffer.data[sampleIndex * m_sampleSize];
+
+	int available = buffer.sampleCount - sampleIndex;
+	if ( available > sampleCount )
+		available = sampleCount;
+
+	return available;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the buffer in the given state holding sampleIndex, -1 if none
+//-----------------------------------------------------------------------------
+int CWaveDataStream::FindBuffer( int sampleIndex, int state )
+{
+	for ( int i = 0; i < m_bufferTotal; i++ )
+	{
+		streambuffer_t &buffer = m_pBuffers[i];
+		if ( buffer.state == state && sampleIndex >= buffer.sampleIndex && sampleIndex < buffer.sampleIndex + buffer.sampleCount )
+			return i;
+	}
+
+	return -1;
+}
+
+
+// samples a buffer starting at sampleIndex holds
+int CWaveDataStream::BufferSamples( int sampleIndex )
+{
+	int count = m_waveSize - sampleIndex;
+	if ( count > m_bufferSize )
+		count = m_bufferSize;
+
+	return count;
+}
+
+
+// where the buffer after this one starts, -1 at the end of the sound
+int CWaveDataStream::NextBufferStart( int sampleIndex, int sampleCount )
+{
+	if ( sampleCount <= 0 )
+		return -1;
+
+	sampleIndex += sampleCount;
+	if ( sampleIndex >= m_waveSize )
+	{
+		if ( !m_source.IsLooped() )
+			return -1;
+
+		sampleIndex = m_pStreamSource->UpdateLoopingSamplePosition( sampleIndex );
+		if ( sampleIndex >= m_waveSize )
+			return -1;
+	}
+
+	return sampleIndex;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops the queued reads and reads the buffer at sampleIndex on the
+//			calling thread
+// Output : index of the buffer, -1 past the end of the sound
+//-----------------------------------------------------------------------------
+int CWaveDataStream::ReadBufferNow( int sampleIndex )
+{
+	// past the end of the file?  stop the wave.
+	if ( sampleIndex < 0 || sampleIndex >= m_waveSize )
+		return -1;
+
+	CancelReads();
+
+	if ( m_bStarted )
+	{
+		s_nStreamSyncReads++;
+	}
+	else
+	{
+		s_nStreamStarts++;
+		m_bStarted = true;
+	}
+
+	streambuffer_t &buffer = m_pBuffers[0];
+	buffer.sampleIndex = sampleIndex;
+	buffer.sampleCount = BufferSamples( sampleIndex );
+	ReadBuffer( 0 );
+
+	return buffer.sampleCount > 0 ? 0 : -1;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Queues reads for the snd_async_lookahead buffers after current
+//-----------------------------------------------------------------------------
+void CWaveDataStream::QueueAhead( int current )
+{
+	int starts[STREAM_MAX_LOOKAHEAD];
+	int count = 0;
+
+	// first buffer mixed is the one the stream starts on
+	if ( !m_bStarted )
+	{
+		s_nStreamStarts++;
+		m_bStarted = true;
+	}
+
+	int sampleIndex = m_pBuffers[current].sampleIndex;
+	int sampleCount = m_pBuffers[current].sampleCount;
+	while ( count < m_bufferTotal - 1 )
+	{
+		sampleIndex = NextBufferStart( sampleIndex, sampleCount );
+		if ( sampleIndex < 0 )
+			break;
+
+		sampleCount = BufferSamples( sampleIndex );
+		starts[count++] = sampleIndex;
+	}
+
+	for ( int i = 0; i < count; i++ )
+	{
+		int j, free = -1;
+		for ( j = 0; j < m_bufferTotal; j++ )
+		{
+			streambuffer_t &buffer = m_pBuffers[j];
+			if ( buffer.state != STREAMBUF_FREE && buffer.sampleIndex == starts[i] )
+				break;
+
+			// reuse buffers that have been mixed, but not the one being mixed now
+			if ( free < 0 && j != current && buffer.state != STREAMBUF_QUEUED )
+			{
+				int k;
+				for ( k = 0; k < count; k++ )
+				{
+					if ( buffer.state == STREAMBUF_READY && buffer.sampleIndex == starts[k] )
+						break;
+				}
+				if ( k == count )
+				{
+					free = j;
+				}
+			}
+		}
+
+		// already read or queued
+		if ( j < m_bufferTotal || free < 0 )
+			continue;
+
+		streambuffer_t &buffer = m_pBuffers[free];
+		buffer.sampleIndex = starts[i];
+		buffer.sampleCount = BufferSamples( starts[i] );
+		buffer.converted = false;
+		buffer.state = STREAMBUF_QUEUED;
+		Stream_QueueRead( this, free );
+	}
+}
+
+
+void CWaveDataStream::ReadBuffer( int index )
+{
+	streambuffer_t &buffer = m_pBuffers[index];
+
+	m_asyncIO.seek( m_asyncFile, m_dataStart + (buffer.sampleIndex * m_sampleSize) );
+
+	int bytes = m_asyncIO.read( buffer.data, buffer.sampleCount * m_sampleSize, m_asyncFile );
+	buffer.sampleCount = max( bytes, 0 ) / m_sampleSize;
+	buffer.converted = false;
+
+	// publish the samples before the state
+	Plat_InterlockedExchange( &buffer.state, STREAMBUF_READY );
+}
+
+
+void CWaveDataStream::WaitForBuffer( int index )
+{
+	while ( m_pBuffers[index].state == STREAMBUF_QUEUED )
+	{
+		// the streaming thread was shut down with reads still queued
+		if ( !s_hStreamThread )
+		{
+			CancelReads();
+			return;
+		}
+
+		s_StreamReadDone.Wait( 1 );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops this stream's queued reads and waits for the one being read,
+//			so the file and buffers are only touched by the caller afterwards
+//-----------------------------------------------------------------------------
+void CWaveDataStream::CancelReads( void )
+{
+	s_StreamMutex.Lock();
+
+	int i = s_StreamRequests.Head();
+	while ( i != s_StreamRequests.InvalidIndex() )
+	{
+		int next = s_StreamRequests.Next( i );
+		if ( s_StreamRequests[i].pStream == this )
+		{
+			m_pBuffers[s_StreamRequests[i].index].state = STREAMBUF_FREE;
+			s_StreamRequests.Remove( i );
+		}
+		i = next;
+	}
+
+	while ( s_pStreamReading == this )
+	{
+		s_StreamMutex.Unlock();
+		s_StreamReadDone.Wait( 1 );
+		s_StreamMutex.Lock();
+	}
+
+	s_StreamMutex.Unlock();
+}
+
+
 IWaveData *CreateWaveDataStream( CAudioSource &source, IWaveStreamSource *pStreamSource, IFileReadBinary &io, const char *pFileName, int dataOffset, int dataSize )
 {
-	return new CWaveDataStream( source, pStreamSource, io, pFileName, dataOffset, dataSize );
+	if ( snd_async_latency.GetInt() > 0 )
+	{
+		s_LatentIO.SetIO( &io );
+		s_LatentStdioIO.SetIO( &s_StdioIO );
+		return new CWaveDataStream( source, pStreamSource, s_LatentIO, s_LatentStdioIO, pFileName, dataOffset, dataSize );
+	}
+
+	return new CWaveDataStream( source, pStreamSource, io, s_StdioIO, pFileName, dataOffset, dataSize );
 }
 
 IWaveData *CreateWaveDataMemory( CAudioSource &source )
@@ -23,6 +23,8 @@ public:
 	virtual						~IWaveData( void ) {}
 	virtual CAudioSource		&Source( void ) = 0;
 	virtual int					ReadSourceData( void **pData, int sampleIndex, int sampleCount, char copyBuf[AUDIOSOURCE_COPYBUF_SIZE] ) = 0;
+	// true if the mixer may decode the whole source once and share it through the PCM cache
+	virtual bool				CanCacheDecoded( void ) { return false; }
 };
 
 class IWaveStreamSource
@@ -37,4 +39,7 @@ class IFileReadBinary;
 extern IWaveData *CreateWaveDataStream( CAudioSource &source, IWaveStreamSource *pStreamSource, IFileReadBinary &io, const char *pFileName, int dataOffset, int dataSize );
 extern IWaveData *CreateWaveDataMemory( CAudioSource &source );
 
+// Stops the thread that reads streaming sounds ahead of the mixer
+extern void WaveDataStream_Shutdown( void );
+
 #endif // SND_WAVE_DATA_H
@@ -12,6 +12,7 @@
 #include "snd_wave_mixer_private.h"
 #include "snd_device.h"
 #include "snd_wave_data.h"
+#include "snd_pcm_cache.h"
 
 #include <mmreg.h>
 
@@ -37,6 +38,7 @@ public:
 	virtual void SetStartupDelaySamples( int delaySamples );
 
 private:
+	void					SetupCache( void );
 	bool					DecodeBlock( void );
 	int						NumChannels( void );
 	void					DecompressBlockMono( short *pOut, const char *pIn, int count );
@@ -52,6 +54,11 @@ private:
 
 	int						m_blockSize;
 	int						m_offset;
+
+	// decoded samples shared with the other mixers playing this source
+	pcmcachedata_t			m_cache;
+	bool					m_bCached;
+	short					*m_pBlockSamples;	// current block, m_pSamples or in the cache
 };
 
 
@@ -62,6 +69,8 @@ CAudioMixerWaveADPCM::CAudioMixerWaveADPCM( IWaveData *data ) : CAudioMixerWave(
 	m_samplePosition = 0;
 	m_offset = 0;
 	m_delaySamples = 0;
+	m_bCached = false;
+	m_pBlockSamples = NULL;
 
 	CAudioSourceWave &source = reinterpret_cast<CAudioSourceWave &>(m_pData->Source());
 
@@ -84,16 +93,77 @@ CAudioMixerWaveADPCM::CAudioMixerWaveADPCM( IWaveData *data ) : CAudioMixerWave(
 		// size of channel header
 		m_blockSize += 7 * m_pFormat->wfx.nChannels;
 //		Assert(m_blockSize < MAX_BLOCK_SIZE);
+
+		m_pBlockSamples = m_pSamples;
+		SetupCache();
 	}
 }
 
 
 CAudioMixerWaveADPCM::~CAudioMixerWaveADPCM( void )
 {
+	if ( m_bCached )
+	{
+		PCMCache_Release( m_cache );
+	}
 	delete[] m_pSamples;
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Mix short sounds from the PCM cache, decoding the whole sound into
+//			it the first time it plays
+//-----------------------------------------------------------------------------
+void CAudioMixerWaveADPCM::SetupCache( void )
+{
+	CAudioSource &source = m_pData->Source();
+
+	if ( !m_pData->CanCacheDecoded() || source.SampleCount() > PCMCache_MaxSamples( source.SampleRate() ) )
+		return;
+
+	pcmcachelookup_t lookup = PCMCache_Lock( &source, m_cache );
+	if ( lookup != PCMCACHE_MISS )
+	{
+		m_bCached = ( lookup == PCMCACHE_HIT );
+		return;
+	}
+
+	// run the block decoder over the whole file so the cache holds exactly what it produces
+	int samplesPerBlock = m_pFormat->wSamplesPerBlock;
+	int channels = NumChannels();
+	int maxSamples = (source.SampleCount() / samplesPerBlock + 1) * samplesPerBlock;
+	short *pSamples = new short[maxSamples * channels];
+	int sampleCount = 0;
+	bool valid = true;
+
+	while ( DecodeBlock() )
+	{
+		// only the last block may be short, or the cached blocks won't line up
+		if ( sampleCount % samplesPerBlock || m_sampleCount <= 0 || sampleCount + m_sampleCount > maxSamples )
+		{
+			valid = false;
+			break;
+		}
+		memcpy( pSamples + sampleCount * channels, m_pSamples, m_sampleCount * channels * sizeof(short) );
+		sampleCount += m_sampleCount;
+	}
+
+	m_offset = 0;
+	m_sampleCount = 0;
+	m_samplePosition = 0;
+
+	if ( !valid || !sampleCount )
+	{
+		delete[] pSamples;
+		PCMCache_Reject( &source );
+		return;
+	}
+
+	PCMCache_Add( &source, pSamples, sampleCount, channels, m_cache );
+	m_bCached = true;
+}
+
+
 int	CAudioMixerWaveADPCM::NumChannels( void )
 {
 	if ( m_pFormat )
@@ -321,6 +391,24 @@ void CAudioMixerWaveADPCM::DecompressBlockStereo( short *pOut, const char *pIn,
 //-----------------------------------------------------------------------------
 bool CAudioMixerWaveADPCM::DecodeBlock( void )
 {
+	if ( m_bCached )
+	{
+		// hand out the same blocks the decoder would, straight from the cache
+		int samplesPerBlock = m_pFormat->wSamplesPerBlock;
+		int start = (m_offset / m_blockSize) * samplesPerBlock;
+		if ( start >= m_cache.sampleCount )
+			return false;
+
+		m_offset += m_blockSize;
+		m_sampleCount = m_cache.sampleCount - start;
+		if ( m_sampleCount > samplesPerBlock )
+			m_sampleCount = samplesPerBlock;
+
+		m_samplePosition = 0;
+		m_pBlockSamples = m_cache.pSamples + start * m_cache.channels;
+		return true;
+	}
+
 	char tmpBlock[MAX_BLOCK_SIZE];
 	char *pData;
 
@@ -388,7 +476,7 @@ int CAudioMixerWaveADPCM::GetOutputData( void **pData, int sampleCount, char cop
 
 	if ( m_samplePosition < m_sampleCount )
 	{
-		*pData = (void *)(m_pSamples + m_samplePosition * NumChannels());
+		*pData = (void *)(m_pBlockSamples + m_samplePosition * NumChannels());
 		int available = m_sampleCount - m_samplePosition;
 		if ( available > sampleCount )
 			available = sampleCount;
@@ -12,6 +12,7 @@
 #include "snd_device.h"
 #include "snd_wave_data.h"
 #include "vaudio/ivaudio.h"
+#include "snd_pcm_cache.h"
 
 extern IVAudio *vaudio;
 
@@ -38,6 +39,7 @@ public:
 	virtual void SetStartupDelaySamples( int delaySamples );
 
 private:
+	void					SetupCache( void );
 	bool					DecodeBlock( void );
 
 	IAudioStream			*m_pStream;
@@ -47,6 +49,12 @@ private:
 	int						m_channelCount;
 	int						m_offset;
 	int						m_delaySamples;
+
+	// decoded samples shared with the other mixers playing this source
+	pcmcachedata_t			m_cache;
+	bool					m_bCached;
+	int						m_cacheOffset;		// next byte to hand out
+	char					*m_pBlock;			// current block, m_samples or in the cache
 };
 
 
@@ -56,14 +64,96 @@ CAudioMixerWaveMP3::CAudioMixerWaveMP3( IWaveData *data ) : CAudioMixerWave( dat
 	m_samplePosition = 0;
 	m_offset = 0;
 	m_delaySamples = 0;
-	m_pStream = vaudio->CreateMP3StreamDecoder( static_cast<IAudioStreamEvent *>(this) );
-	m_channelCount = m_pStream->GetOutputChannels();
-	Assert( m_pStream->GetOutputRate() == m_pData->Source().SampleRate() );
+	m_bCached = false;
+	m_cacheOffset = 0;
+	m_pBlock = m_samples;
+	m_pStream = NULL;
+
+	SetupCache();
+
+	if ( !m_bCached )
+	{
+		m_pStream = vaudio->CreateMP3StreamDecoder( static_cast<IAudioStreamEvent *>(this) );
+		m_channelCount = m_pStream->GetOutputChannels();
+		Assert( m_pStream->GetOutputRate() == m_pData->Source().SampleRate() );
+	}
 }
 
 
 CAudioMixerWaveMP3::~CAudioMixerWaveMP3( void )
 {
+	if ( m_bCached )
+	{
+		PCMCache_Release( m_cache );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Mix short sounds from the PCM cache, decoding the whole sound into
+//			it the first time it plays.  Cached mixers don't need a decoder.
+//-----------------------------------------------------------------------------
+void CAudioMixerWaveMP3::SetupCache( void )
+{
+	CAudioSource &source = m_pData->Source();
+
+	if ( !m_pData->CanCacheDecoded() )
+		return;
+
+	int maxSamples = PCMCache_MaxSamples( source.SampleRate() );
+	if ( !maxSamples )
+		return;
+
+	pcmcachelookup_t lookup = PCMCache_Lock( &source, m_cache );
+	if ( lookup == PCMCACHE_HIT )
+	{
+		m_channelCount = m_cache.channels;
+		m_bCached = true;
+		return;
+	}
+	else if ( lookup == PCMCACHE_REJECTED )
+	{
+		return;
+	}
+
+	// MP3 doesn't know its decoded length up front, so decode until the sound
+	// ends or turns out to be too long for the cache
+	IAudioStream *pStream = vaudio->CreateMP3StreamDecoder( static_cast<IAudioStreamEvent *>(this) );
+	int channels = pStream->GetOutputChannels();
+	int maxBytes = maxSamples * channels * sizeof(short) + MP3_BUFFER_SIZE;
+	char *pSamples = (char *)new short[maxBytes / sizeof(short)];
+	int bytes = 0;
+	bool valid = true;
+
+	for ( ;; )
+	{
+		if ( bytes + MP3_BUFFER_SIZE > maxBytes )
+		{
+			valid = false;
+			break;
+		}
+
+		int decoded = pStream->Decode( pSamples + bytes, MP3_BUFFER_SIZE );
+		if ( decoded <= 0 )
+			break;
+
+		bytes += decoded;
+	}
+
+	vaudio->DestroyMP3StreamDecoder( pStream );
+	m_offset = 0;
+
+	int sampleCount = bytes / (channels * sizeof(short));
+	if ( !valid || !sampleCount )
+	{
+		delete[] (short *)pSamples;
+		PCMCache_Reject( &source );
+		return;
+	}
+
+	PCMCache_Add( &source, (short *)pSamples, sampleCount, channels, m_cache );
+	m_channelCount = channels;
+	m_bCached = true;
 }
 
 
@@ -118,6 +208,20 @@ int CAudioMixerWaveMP3::StreamRequestData( void *pBuffer, int bytesRequested, in
 
 bool CAudioMixerWaveMP3::DecodeBlock()
 {
+	if ( m_bCached )
+	{
+		// hand out decoder sized blocks from the cache
+		int bytes = m_cache.sampleCount * m_cache.channels * sizeof(short);
+		m_sampleCount = bytes - m_cacheOffset;
+		if ( m_sampleCount > MP3_BUFFER_SIZE )
+			m_sampleCount = MP3_BUFFER_SIZE;
+
+		m_pBlock = (char *)m_cache.pSamples + m_cacheOffset;
+		m_cacheOffset += m_sampleCount;
+		m_samplePosition = 0;
+		return m_sampleCount > 0;
+	}
+
 	m_sampleCount = m_pStream->Decode( m_samples, sizeof(m_samples) );
 	m_samplePosition = 0;
 	return m_sampleCount > 0;
@@ -140,7 +244,7 @@ int CAudioMixerWaveMP3::GetOutputData( void **pData, int sampleCount, char copyB
 	if ( m_samplePosition < m_sampleCount )
 	{
 		int sampleSize = m_channelCount * 2;
-		*pData = (void *)(m_samples + m_samplePosition);
+		*pData = (void *)(m_pBlock + m_samplePosition);
 		int available = m_sampleCount - m_samplePosition;
 		int bytesRequired = sampleCount * sampleSize;
 		if ( available > bytesRequired )
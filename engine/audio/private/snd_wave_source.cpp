@@ -22,6 +22,7 @@
 #include "../../cache.h"
 #include "vstdlib/strtools.h"
 #include "snd_mp3_source.h"
+#include "snd_pcm_cache.h"
 #include "utlsymbol.h"
 #include "filesystem.h"
 #include "../../filesystem_engine.h"
@@ -88,6 +89,8 @@ CAudioSourceWave::~CAudioSourceWave( void )
 
 	// for non-standard waves, we store a copy of the header in RAM
 	delete[] m_pHeader;
+
+	PCMCache_Remove( this );
 }
 
 
@@ -743,6 +746,9 @@ int	CAudioSourceMemWave::ZeroCrossingAfter( int sample )
 
 
 // This is a CAudioSourceMemWave and gets all of its data from the cache.
+// While mixers reference it, it mixes from its own copy of the data instead,
+// so the mix thread never touches the cache and the data can't be flushed
+// or moved while it plays.
 class CAudioSourceMemWaveCache : public CAudioSourceMemWave
 {
 public:
@@ -757,10 +763,15 @@ public:
 	void					CacheLoad( void );
 	void					CacheUnload( void );
 
+	virtual void			ReferenceAdd( CAudioMixer *pMixer );
+	virtual void			ReferenceRemove( CAudioMixer *pMixer );
+
 protected:
 	virtual char			*GetDataPointer( void );
 
 	cache_user_t	m_cache;
+	int				m_dataSize;
+	char			*m_pPinnedData;		// copy of the data while mixers reference this
 
 private:
 	CAudioSourceMemWaveCache( const CAudioSourceMemWaveCache & );
@@ -774,6 +785,8 @@ CAudioSourceMemWaveCache::CAudioSourceMemWaveCache( const char *pName ) :
 	CAudioSourceMemWave( pName )
 {
 	memset( &m_cache, 0, sizeof(m_cache) );
+	m_dataSize = 0;
+	m_pPinnedData = NULL;
 }
 
 
@@ -783,6 +796,7 @@ CAudioSourceMemWaveCache::CAudioSourceMemWaveCache( const char *pName ) :
 CAudioSourceMemWaveCache::~CAudioSourceMemWaveCache( void )
 {
 	CacheUnload();
+	delete[] m_pPinnedData;
 }
 
 
@@ -813,6 +827,7 @@ void CAudioSourceMemWaveCache::ParseChunk( IterateRIFF &walk, int chunkName )
 void CAudioSourceMemWaveCache::ParseDataChunk( IterateRIFF &walk )
 {
 	int size = walk.ChunkSize();
+	m_dataSize = size;
 	
 	// create a buffer for the samples
 	char *pData = (char *)Cache_Alloc( &m_cache, size, m_pName );
@@ -895,8 +910,52 @@ void CAudioSourceMemWaveCache::CacheUnload( void )
 	Cache_Free( &m_cache );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Copies the data out of the cache for the first mixer.  Mixers are
+//			created and deleted on the main thread, so only it gets here.
+//-----------------------------------------------------------------------------
+void CAudioSourceMemWaveCache::ReferenceAdd( CAudioMixer *pMixer )
+{
+	CAudioSourceWave::ReferenceAdd( pMixer );
+
+	if ( m_pPinnedData )
+		return;
+
+	char *pData = (char *)Cache_Check( &m_cache );
+	if ( !pData )
+	{
+		CacheLoad();
+		pData = (char *)Cache_Check( &m_cache );
+	}
+
+	if ( pData )
+	{
+		m_pPinnedData = new char[m_dataSize];
+		memcpy( m_pPinnedData, pData, m_dataSize );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops the copy with the last mixer, the cache still has the data
+//-----------------------------------------------------------------------------
+void CAudioSourceMemWaveCache::ReferenceRemove( CAudioMixer *pMixer )
+{
+	CAudioSourceWave::ReferenceRemove( pMixer );
+
+	if ( CanDelete() )
+	{
+		delete[] m_pPinnedData;
+		m_pPinnedData = NULL;
+	}
+}
+
+
 char *CAudioSourceMemWaveCache::GetDataPointer( void )
 {
+	if ( m_pPinnedData )
+		return m_pPinnedData;
+
 	char *pData = (char *)Cache_Check( &m_cache );
 	if ( !pData )
 		CacheLoad();
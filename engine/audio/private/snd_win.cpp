@@ -8,6 +8,8 @@
 #include "snd_device.h"
 #include "snd_dev_direct.h"
 #include "snd_dev_wave.h"
+#include "snd_dev_null.h"
+#include "snd_mixthread.h"
 #include "snd_sfx.h"
 #include "snd_audio_source.h"
 #include "voice_sound_engine_interface.h"
@@ -106,6 +108,7 @@ void S_BlockSound (void)
 	if ( !g_AudioDevice )
 		return;
 
+	CAutoLock lock( g_MixThreadMutex );
 	g_AudioDevice->Pause();
 }
 
@@ -120,6 +123,7 @@ void S_UnblockSound (void)
 	if ( !g_AudioDevice )
 		return;
 
+	CAutoLock lock( g_MixThreadMutex );
 	g_AudioDevice->UnPause();
 }
 
@@ -206,11 +210,13 @@ IAudioDevice *IAudioDevice::AutoDetectInit( bool waveOnly )
 {
 	IAudioDevice *pDevice = NULL;
 
-	// JAY: UNDONE: Handle fake sound device here "fakedma"
-//	if (g_pSoundServices->CheckParm("-simsound"))
-//		fakedma = true;
+	// mixes without sound hardware, for timing the mixer
+	if ( g_pSoundServices->CheckParm("-simsound") )
+	{
+		pDevice = Audio_CreateNullMixDevice();
+	}
 
-	if ( waveOnly )
+	if ( waveOnly && !pDevice )
 	{
 		pDevice = Audio_CreateWaveDevice();
 		if ( !pDevice )
@@ -48,6 +48,10 @@ void S_LocalSound (char *s);
 void SND_InitScaletable (void);
 void SNDDMA_Submit(void);
 
+// Mixes ahead of the device's play position, no more than maxAhead samples
+// if it's non-zero.  Returns true if the device had played past the mix.
+bool S_PaintAhead( int maxAhead );
+
 void S_AmbientOff (void);
 void S_AmbientOn (void);
 void S_FreeChannel(channel_t *ch);
@@ -77,6 +81,7 @@ extern void SND_InitMouth(int entnum, int entchannel);
 extern void SND_UpdateMouth( channel_t *pChannel );
 extern void SND_ClearMouth( channel_t *pChannel );
 extern bool SND_IsMouth( channel_t *pChannel );
+extern void SND_MoveAllMouths( int count );
 
 void MIX_PaintChannels(int endtime);
 // Play a big of zeroed out sound
@@ -54,6 +54,7 @@
 #include "gl_matsysiface.h"
 #include "cl_ents_parse.h"
 #include "staticpropmgr.h"
+#include "lightcache.h"
 #include "ISpatialPartitionInternal.h"
 #include "cl_localnetworkbackdoor.h"
 #include "vstdlib/icommandline.h"
@@ -1464,6 +1465,7 @@ void CL_SignonReply (void)
 			// that raycasts against the world is supported (owing to the fact
 			// that the world entity has been created by this point)
 			StaticPropMgr()->LevelInitClient();
+			LightcacheLevelInit();
  			g_ClientDLL->LevelInitPostEntity();
 
 			SpatialPartition()->SuppressLists( PARTITION_ALL_CLIENT_EDICTS, true );
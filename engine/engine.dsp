@@ -3983,6 +3983,26 @@ SOURCE=.\audio\private\snd_dev_direct.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\audio\private\snd_dev_null.cpp
+
+!IF  "$(CFG)" == "engine - Win32 Debug"
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Release"
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Dedicated Debug"
+
+# PROP Exclude_From_Build 1
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Dedicated Release"
+
+# PROP BASE Exclude_From_Build 1
+# PROP Exclude_From_Build 1
+
+!ENDIF 
+
+# End Source File
+# Begin Source File
+
 SOURCE=.\audio\private\snd_dev_wave.cpp
 
 !IF  "$(CFG)" == "engine - Win32 Debug"
@@ -4093,6 +4113,26 @@ InputName=snd_mixa
 # End Source File
 # Begin Source File
 
+SOURCE=.\audio\private\snd_mixthread.cpp
+
+!IF  "$(CFG)" == "engine - Win32 Debug"
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Release"
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Dedicated Debug"
+
+# PROP Exclude_From_Build 1
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Dedicated Release"
+
+# PROP BASE Exclude_From_Build 1
+# PROP Exclude_From_Build 1
+
+!ENDIF 
+
+# End Source File
+# Begin Source File
+
 SOURCE=.\audio\private\snd_mp3_source.cpp
 
 !IF  "$(CFG)" == "engine - Win32 Debug"
@@ -4113,6 +4153,26 @@ SOURCE=.\audio\private\snd_mp3_source.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\audio\private\snd_pcm_cache.cpp
+
+!IF  "$(CFG)" == "engine - Win32 Debug"
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Release"
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Dedicated Debug"
+
+# PROP Exclude_From_Build 1
+
+!ELSEIF  "$(CFG)" == "engine - Win32 Dedicated Release"
+
+# PROP BASE Exclude_From_Build 1
+# PROP Exclude_From_Build 1
+
+!ENDIF 
+
+# End Source File
+# Begin Source File
+
 SOURCE=.\audio\private\snd_sentence_mixer.cpp
 
 !IF  "$(CFG)" == "engine - Win32 Debug"
@@ -4425,6 +4485,10 @@ SOURCE=.\audio\private\snd_dev_direct.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\audio\private\snd_dev_null.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\audio\private\snd_dev_wave.h
 # End Source File
 # Begin Source File
@@ -4445,6 +4509,14 @@ SOURCE=.\audio\private\snd_mix_buf.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\audio\private\snd_mixthread.h
+# End Source File
+# Begin Source File
+
+SOURCE=.\audio\private\snd_pcm_cache.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\audio\private\snd_sfx.h
 # End Source File
 # Begin Source File
@@ -11,6 +11,8 @@
 #include <malloc.h>
 #include "filesystem.h"
 #include "tgawriter.h"
+#include "KeyValues.h"
+#include "utlvector.h"
 
 IFileSystem *g_pFileSystem;
 CreateInterfaceFn g_FileSystemFactory = 0;
@@ -25,6 +27,78 @@ void FileSystem_Path_f( void )
 
 static ConCommand path( "path", FileSystem_Path_f );
 
+//-----------------------------------------------------------------------------
+// Purpose: Times parsing every .txt in a directory as text, then twice through
+//			the binary KeyValues cache (the first pass writes the cache files)
+//-----------------------------------------------------------------------------
+struct KVBenchmarkFile_t
+{
+	char m_szName[ MAX_OSPATH ];
+};
+
+static float FileSystem_TimeKeyValuesLoad( const CUtlVector< KVBenchmarkFile_t > &files, int &nLoaded )
+{
+	nLoaded = 0;
+	double start = Plat_FloatTime();
+	for ( int i = 0; i < files.Count(); i++ )
+	{
+		KeyValues *kv = new KeyValues( "benchmark" );
+		if ( kv->LoadFromFile( g_pFileSystem, files[i].m_szName, "GAME" ) )
+		{
+			++nLoaded;
+		}
+		kv->deleteThis();
+	}
+	return (float)( Plat_FloatTime() - start );
+}
+
+void FileSystem_KeyValuesBenchmark_f( void )
+{
+	if ( !g_pFileSystem )
+		return;
+
+	const char *pDir = ( Cmd_Argc() > 1 ) ? Cmd_Argv( 1 ) : "scripts";
+
+	char wildcard[ MAX_OSPATH ];
+	Q_snprintf( wildcard, sizeof( wildcard ), "%s/*.txt", pDir );
+
+	CUtlVector< KVBenchmarkFile_t > files;
+	FileFindHandle_t findHandle;
+	for ( const char *pFile = g_pFileSystem->FindFirst( wildcard, &findHandle ); pFile; pFile = g_pFileSystem->FindNext( findHandle ) )
+	{
+		if ( g_pFileSystem->FindIsDirectory( findHandle ) )
+			continue;
+
+		int i = files.AddToTail();
+		Q_snprintf( files[i].m_szName, sizeof( files[i].m_szName ), "%s/%s", pDir, pFile );
+	}
+	g_pFileSystem->FindClose( findHandle );
+
+	if ( !files.Count() )
+	{
+		Con_Printf( "kv_benchmark: no files match %s\n", wildcard );
+		return;
+	}
+
+	bool bWasEnabled = KeyValues::IsBinaryCacheEnabled();
+	int nLoaded;
+
+	KeyValues::SetBinaryCacheEnabled( false );
+	float flText = FileSystem_TimeKeyValuesLoad( files, nLoaded );
+	Con_Printf( "kv_benchmark: %d/%d files as text: %.2f ms\n", nLoaded, files.Count(), flText * 1000.0f );
+
+	KeyValues::SetBinaryCacheEnabled( true );
+	float flBuild = FileSystem_TimeKeyValuesLoad( files, nLoaded );
+	Con_Printf( "kv_benchmark: %d/%d files building cache: %.2f ms\n", nLoaded, files.Count(), flBuild * 1000.0f );
+
+	float flCached = FileSystem_TimeKeyValuesLoad( files, nLoaded );
+	Con_Printf( "kv_benchmark: %d/%d files from cache: %.2f ms\n", nLoaded, files.Count(), flCached * 1000.0f );
+
+	KeyValues::SetBinaryCacheEnabled( bWasEnabled );
+}
+
+static ConCommand kv_benchmark( "kv_benchmark", FileSystem_KeyValuesBenchmark_f, "kv_benchmark [dir] : times loading dir/*.txt with and without the binary KeyValues cache" );
+
 void FileSystem_Init( CreateInterfaceFn fileSystemFactory )
 {
 	g_FileSystemFactory = fileSystemFactory;
@@ -205,9 +205,11 @@ Take a cubemap at each "cubemap" entity in the current map.
 ===============
 */
 #ifdef _WIN32
-static bool LoadSrcVTFFiles( IVTFTexture *pSrcVTFTextures[6], const char *pSkyboxBaseName )
+// Only the mips down from nMinSize get read in
+static bool LoadSrcVTFFiles( IVTFTexture *pSrcVTFTextures[6], const char *pSkyboxBaseName, int nMinSize )
 {
 	const char *facingName[6] = { "rt", "lf", "bk", "ft", "up", "dn" };
+	int nSkipMipLevels = 0;
 	int i;
 	for( i = 0; i < 6; i++ )
 	{
@@ -220,17 +222,43 @@ static bool LoadSrcVTFFiles( IVTFTexture *pSrcVTFTextures[6], const char *pSkybo
 		{
 			return false;
 		}
-		g_pFileSystem->Seek( fp, 0, FILESYSTEM_SEEK_TAIL );
-		int srcVTFLength = g_pFileSystem->Tell( fp );
-		g_pFileSystem->Seek( fp, 0, FILESYSTEM_SEEK_HEAD );
 
+		// Read the header first so we know which mips we need
+		int nHeaderSize = VTFFileHeaderSize();
 		CUtlBuffer buf;
-		buf.EnsureCapacity( srcVTFLength );
-		g_pFileSystem->Read( buf.Base(), srcVTFLength, fp );
-		g_pFileSystem->Close( fp );
+		buf.EnsureCapacity( nHeaderSize );
+		g_pFileSystem->Read( buf.Base(), nHeaderSize, fp );
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nHeaderSize );
 
 		pSrcVTFTextures[i] = CreateVTFTexture();
-		if (!pSrcVTFTextures[i]->Unserialize(buf))
+		if (!pSrcVTFTextures[i]->Unserialize( buf, true ))
+		{
+			g_pFileSystem->Close( fp );
+			Warning("*** Error unserializing skybox texture: %s\n", pSkyboxBaseName );
+			return false;
+		}
+
+		// Every face skips as many mips as the first one, so faces of
+		// different sizes still fail the size check below
+		if( i == 0 )
+		{
+			while( ( pSrcVTFTextures[0]->Width() >> ( nSkipMipLevels + 1 ) ) >= nMinSize )
+			{
+				++nSkipMipLevels;
+			}
+		}
+
+		int nImageOffset, nImageSize;
+		pSrcVTFTextures[i]->MipRangeFileInfo( nSkipMipLevels, &nImageOffset, &nImageSize );
+
+		buf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+		buf.EnsureCapacity( nImageSize );
+		g_pFileSystem->Seek( fp, nImageOffset, FILESYSTEM_SEEK_HEAD );
+		g_pFileSystem->Read( buf.Base(), nImageSize, fp );
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nImageSize );
+		g_pFileSystem->Close( fp );
+
+		if (!pSrcVTFTextures[i]->UnserializeMipRange( buf, nSkipMipLevels ))
 		{
 			Warning("*** Error unserializing skybox texture: %s\n", pSkyboxBaseName );
 			return false;
@@ -265,7 +293,7 @@ void Cubemap_CreateDefaultCubemap( const char *pMapName, IBSPPack *iBSPPack )
 
 	const char *pSkyboxBaseName = pSkyboxBaseNameConVar->GetString();
 
-	if( !LoadSrcVTFFiles( pSrcVTFTextures, pSkyboxBaseName ) )
+	if( !LoadSrcVTFFiles( pSrcVTFTextures, pSkyboxBaseName, DEFAULT_CUBEMAP_SIZE ) )
 	{
 		Warning( "Can't load skybox file %s to build the default cubemap!\n", pSkyboxBaseName );
 		return;
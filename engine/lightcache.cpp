@@ -27,6 +27,7 @@
 #include "icliententitylist.h"
 #include "icliententity.h"
 #include "enginetrace.h"
+#include <xmmintrin.h>
 
 
 // this should be prime to make the hash better
@@ -45,7 +46,14 @@ void RecomputeStaticLighting();
 static Vector	s_raddir[NUMVERTEXNORMALS] = {
 #include "anorms.h"
 };
-static Vector s_radcolor[NUMVERTEXNORMALS];
+
+// The spherical samples are padded out to a multiple of 4 for the SSE accumulation
+#define NUMVERTEXNORMALS_PADDED	( ( NUMVERTEXNORMALS + 3 ) & ~3 )
+
+// How much each spherical sample contributes to each ambient cube direction,
+// already divided by the total so the cube colors come out as averages
+static float s_AmbientSampleWeight[6][NUMVERTEXNORMALS_PADDED];
+static bool s_bAmbientSampleWeightsValid = false;
 
 static int s_LightcacheFrame = -1;
 
@@ -153,6 +161,7 @@ static ConVar  r_lightdebug	("r_lightdebug", "0");
 static ConVar  r_minnewsamples	("r_minnewsamples", "3");
 static ConVar  r_maxnewsamples	("r_maxnewsamples", "6");
 static ConVar  r_maxsampledist	("r_maxsampledist", "128");
+static ConVar  r_lightcache_precache_nodes	("r_lightcache_precache_nodes", "0", 0, "Compute the lighting cache at every AI node when a level loads" );
 
 static lightcache_t lightcache[MAX_CACHE_ENTRY];
 static lightcache_t	*lightbuckets[MAX_CACHE_BUCKETS];
@@ -172,6 +181,15 @@ static lightcache_t	lightlru, lightlrutail;
 // Used to convert RGB colors to greyscale intensity
 static Vector s_Grayscale( 0.299f, 0.587f, 0.114f ); 
 
+// World light origins and cull radii, 4 lights at a time laid out as 
+// x[4] y[4] z[4] radiusSq[4] so the SSE range test can load them directly
+static CUtlVector<float> s_WorldLightCull;
+static dworldlight_t *s_pCullWorldLights = NULL;
+static int s_nCullWorldLights = 0;
+
+// AI nodes sit on the floor, entities are lit from their centers
+#define LIGHTCACHE_NODE_HEIGHT	36.0f
+
 #define BIT_SET( a, b ) ((a)[(b)>>3] & (1<<((b)&7)))
 
 
@@ -435,6 +453,106 @@ static void ComputeAmbientFromSurface( int surfID, dworldlight_t* pSkylight,
 }
 
 
+//-----------------------------------------------------------------------------
+// The sample directions and the ambient cube directions never change, so
+// the weight of every sample in every cube direction is only computed once
+//-----------------------------------------------------------------------------
+static void ComputeAmbientSampleWeights( void )
+{
+	const Vector* pBoxDirs = g_pStudioRender->GetAmbientLightDirections();
+	int nBoxDirs = g_pStudioRender->GetNumAmbientLightSamples();
+	Assert( nBoxDirs <= 6 );
+
+	memset( s_AmbientSampleWeight, 0, sizeof(s_AmbientSampleWeight) );
+	for (int j = 0; j < nBoxDirs; ++j)
+	{
+		float t = 0;
+		int i;
+		for (i = 0; i < NUMVERTEXNORMALS; i++)
+		{
+			float c = DotProduct( s_raddir[i], pBoxDirs[j] );
+			if (c > 0)
+			{
+				t += c;
+				s_AmbientSampleWeight[j][i] = c;
+			}
+		}
+
+		for (i = 0; i < NUMVERTEXNORMALS; i++)
+		{
+			s_AmbientSampleWeight[j][i] /= t;
+		}
+	}
+
+	s_bAmbientSampleWeightsValid = true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Accumulates the spherical samples into the ambient cube
+//-----------------------------------------------------------------------------
+static inline float SumSSE( __m128 v )
+{
+	float f[4];
+	_mm_storeu_ps( f, v );
+	return (f[0] + f[1]) + (f[2] + f[3]);
+}
+
+static void AccumulateAmbientSamples( const Vector* pRadColor, Vector* lightBoxColor )
+{
+	if (!s_bAmbientSampleWeightsValid)
+	{
+		ComputeAmbientSampleWeights();
+	}
+
+	// Split the colors into channels, zeroing the padding
+	float r[NUMVERTEXNORMALS_PADDED];
+	float g[NUMVERTEXNORMALS_PADDED];
+	float b[NUMVERTEXNORMALS_PADDED];
+	int i;
+	for (i = 0; i < NUMVERTEXNORMALS; i++)
+	{
+		r[i] = pRadColor[i].x;
+		g[i] = pRadColor[i].y;
+		b[i] = pRadColor[i].z;
+	}
+	for ( ; i < NUMVERTEXNORMALS_PADDED; i++)
+	{
+		r[i] = g[i] = b[i] = 0.0f;
+	}
+
+	for (int j = g_pStudioRender->GetNumAmbientLightSamples(); --j >= 0; )
+	{
+		const float *pWeight = s_AmbientSampleWeight[j];
+
+		if (MathLib_SSEEnabled())
+		{
+			__m128 sumR = _mm_setzero_ps();
+			__m128 sumG = _mm_setzero_ps();
+			__m128 sumB = _mm_setzero_ps();
+			for (i = 0; i < NUMVERTEXNORMALS_PADDED; i += 4)
+			{
+				__m128 w = _mm_loadu_ps( pWeight + i );
+				sumR = _mm_add_ps( sumR, _mm_mul_ps( w, _mm_loadu_ps( r + i ) ) );
+				sumG = _mm_add_ps( sumG, _mm_mul_ps( w, _mm_loadu_ps( g + i ) ) );
+				sumB = _mm_add_ps( sumB, _mm_mul_ps( w, _mm_loadu_ps( b + i ) ) );
+			}
+			lightBoxColor[j].Init( SumSSE( sumR ), SumSSE( sumG ), SumSSE( sumB ) );
+		}
+		else
+		{
+			lightBoxColor[j].Init( 0, 0, 0 );
+			for (i = 0; i < NUMVERTEXNORMALS; i++)
+			{
+				lightBoxColor[j].x += pWeight[i] * r[i];
+				lightBoxColor[j].y += pWeight[i] * g[i];
+				lightBoxColor[j].z += pWeight[i] * b[i];
+			}
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Computes the ambient term from a large number of spherical samples
 //-----------------------------------------------------------------------------
@@ -445,6 +563,7 @@ static void ComputeAmbientFromSphericalSamples( const Vector& start,
 	dworldlight_t *pSkylight = FindAmbientLight();
 
 	// sample world by casting N rays distributed across a sphere
+	Vector radcolor[NUMVERTEXNORMALS];
 	Vector upend;
 	int i;
 	for ( i = 0; i < NUMVERTEXNORMALS; i++)
@@ -453,35 +572,15 @@ static void ComputeAmbientFromSphericalSamples( const Vector& start,
 		VectorMA( start, COORD_EXTENT * 1.74, s_raddir[i], upend );
 
 		// Now that we've got a ray, see what surface we've hit
-		int surfID = R_LightVec (start, upend, false, s_radcolor[i] );
+		int surfID = R_LightVec (start, upend, false, radcolor[i] );
 		if (!IS_SURF_VALID(surfID) )
 			continue;
 
-		ComputeAmbientFromSurface( surfID, pSkylight, s_radcolor[i] );
+		ComputeAmbientFromSurface( surfID, pSkylight, radcolor[i] );
 	}
 
 	// accumulate samples into radiant box
-	const Vector* pBoxDirs = g_pStudioRender->GetAmbientLightDirections();
-	for (int j = g_pStudioRender->GetNumAmbientLightSamples(); --j >= 0; )
-	{
-		float c, t;
-		t = 0;
-
-		lightBoxColor[j][0] = 0;
-		lightBoxColor[j][1] = 0;
-		lightBoxColor[j][2] = 0;
-
-		for (i = 0; i < NUMVERTEXNORMALS; i++)
-		{
-			c = DotProduct( s_raddir[i], pBoxDirs[j] );
-			if (c > 0)
-			{
-				t += c;
-				VectorMA( lightBoxColor[j], c, s_radcolor[i], lightBoxColor[j] );
-			}
-		}
-		VectorMultiply( lightBoxColor[j], 1/t, lightBoxColor[j] );
-	}
+	AccumulateAmbientSamples( radcolor, lightBoxColor );
 }
 
 
@@ -1308,11 +1407,84 @@ static void AddDLightsForStaticProps( LightingStateInfo_t& info, LightingState_t
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Builds the world light range test data for the current world
+//-----------------------------------------------------------------------------
+static void BuildWorldLightCullInfo( void )
+{
+	s_pCullWorldLights = host_state.worldmodel->brush.worldlights;
+	s_nCullWorldLights = host_state.worldmodel->brush.numworldlights;
+
+	int nGroups = ( s_nCullWorldLights + 3 ) >> 2;
+	s_WorldLightCull.RemoveAll();
+	s_WorldLightCull.EnsureCount( nGroups * 16 );
+
+	for (int i = 0; i < nGroups * 4; ++i)
+	{
+		float *pGroup = &s_WorldLightCull[ (i >> 2) * 16 ];
+		int k = i & 3;
+
+		if (i >= s_nCullWorldLights)
+		{
+			// padding is never in range
+			pGroup[k] = pGroup[4 + k] = pGroup[8 + k] = 0.0f;
+			pGroup[12 + k] = -1.0f;
+			continue;
+		}
+
+		dworldlight_t *wl = &s_pCullWorldLights[i];
+		pGroup[k] = wl->origin[0];
+		pGroup[4 + k] = wl->origin[1];
+		pGroup[8 + k] = wl->origin[2];
+
+		// Only these types are cut off at their radius by Engine_WorldLightDistanceFalloff
+		bool bHasRadius = ( wl->radius != 0 ) && 
+			( wl->type == emit_surface || wl->type == emit_point || wl->type == emit_spotlight );
+		pGroup[12 + k] = bHasRadius ? wl->radius * wl->radius : FLT_MAX;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns a bit for each of the 4 world lights in a group that can reach the point
+//-----------------------------------------------------------------------------
+static int WorldLightsInRange( int nGroup, const Vector& origin )
+{
+	const float *pGroup = &s_WorldLightCull[ nGroup * 16 ];
+
+	if (MathLib_SSEEnabled())
+	{
+		__m128 dx = _mm_sub_ps( _mm_loadu_ps( pGroup ), _mm_set1_ps( origin.x ) );
+		__m128 dy = _mm_sub_ps( _mm_loadu_ps( pGroup + 4 ), _mm_set1_ps( origin.y ) );
+		__m128 dz = _mm_sub_ps( _mm_loadu_ps( pGroup + 8 ), _mm_set1_ps( origin.z ) );
+		__m128 distSq = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+		return _mm_movemask_ps( _mm_cmple_ps( distSq, _mm_loadu_ps( pGroup + 12 ) ) );
+	}
+
+	int nMask = 0;
+	for (int k = 0; k < 4; ++k)
+	{
+		Vector delta( pGroup[k] - origin.x, pGroup[4 + k] - origin.y, pGroup[8 + k] - origin.z );
+		if (DotProduct( delta, delta ) <= pGroup[12 + k])
+		{
+			nMask |= ( 1 << k );
+		}
+	}
+	return nMask;
+}
+
+
 //-----------------------------------------------------------------------------
 // Add static lighting to the lighting state
 //-----------------------------------------------------------------------------
 static void AddStaticLighting( lightcache_t* pCache, const Vector& origin, byte* pVis )
 {
+	if ( s_pCullWorldLights != host_state.worldmodel->brush.worldlights ||
+		 s_nCullWorldLights != host_state.worldmodel->brush.numworldlights )
+	{
+		BuildWorldLightCullInfo();
+	}
+
 	// First, blat out the lighting state
 	int i;
 	pCache->m_StaticLightingState.numlights = 0;
@@ -1325,10 +1497,17 @@ static void AddStaticLighting( lightcache_t* pCache, const Vector& origin, byte*
 	// Next, add each static light one at a time into the lighting state,
 	// ejecting less relevant local lights + folding them into the ambient cube
 	// Also, we need to add *all* new lights into the total box color
+	int nInRange = 0;
 	for (i = 0; i < host_state.worldmodel->brush.numworldlights; ++i)
 	{
 		dworldlight_t *wl = &host_state.worldmodel->brush.worldlights[i];
 
+		// Range test the lights 4 at a time
+		if ((i & 3) == 0)
+		{
+			nInRange = WorldLightsInRange( i >> 2, origin );
+		}
+
 #ifdef TROIKA
 		// Go ahead and add lightstyles in here.
 		if (wl->style != 0)
@@ -1344,6 +1523,10 @@ static void AddStaticLighting( lightcache_t* pCache, const Vector& origin, byte*
 			continue;
 #endif // TROIKA
 
+		// Lights that can't reach us would come out with zero intensity anyway
+		if (!(nInRange & (1 << (i & 3))))
+			continue;
+
 		// Now add that world light into our list of worldlights
 		AddWorldLightToLightingState( wl, pCache->m_StaticLightingState, *pCache, origin, pVis, false, false );
 	}
@@ -1803,12 +1986,10 @@ ITexture *LightcacheGet( LightCacheHandle_t cache, LightingState_t& lightingStat
 
 
 //-----------------------------------------------------------------------------
-// Get or create the lighting information for this point
-// This is the version for dynamic objects.
+// Resets the lighting cache if any of the convars it was built with changed
 //-----------------------------------------------------------------------------
-ITexture *LightcacheGet( const Vector& origin, LightingState_t& lightingState )
+static void CheckLightcacheConVars( void )
 {
-	// Initialize the lighting cache, if necessary
 	if (cached_r_worldlights != r_worldlights.GetInt() ||
 		cached_r_radiosity != r_radiosity.GetInt() ||
 		cached_r_avglight != r_avglight.GetInt() ||
@@ -1816,6 +1997,17 @@ ITexture *LightcacheGet( const Vector& origin, LightingState_t& lightingState )
 	{
 		R_StudioInitLightingCache();
 	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Get or create the lighting information for this point
+// This is the version for dynamic objects.
+//-----------------------------------------------------------------------------
+ITexture *LightcacheGet( const Vector& origin, LightingState_t& lightingState )
+{
+	// Initialize the lighting cache, if necessary
+	CheckLightcacheConVars();
 
 	// generate the hashing vars
 	int leaf = CM_PointLeafnum(origin);
@@ -1913,6 +2105,121 @@ ITexture *LightcacheGet( const Vector& origin, const Vector &mins, const Vector
 }
 
 
+//-----------------------------------------------------------------------------
+// Computes the static lighting for a batch of points up front so objects
+// showing up there later hit the cache. Points that share a cache entry
+// are only computed once, and since nothing is drawn yet the per frame
+// r_maxnewsamples limit doesn't apply. Returns the number of new entries.
+//-----------------------------------------------------------------------------
+int LightcachePrefetch( int nCount, const Vector *pOrigins )
+{
+	CheckLightcacheConVars();
+
+	int nComputed = 0;
+	for (int i = 0; i < nCount; ++i)
+	{
+		// Any more would start throwing out the entries we just computed
+		if (nComputed >= MAX_CACHE_ENTRY)
+			break;
+
+		const Vector &origin = pOrigins[i];
+		int leaf = CM_PointLeafnum(origin);
+
+		int x = ((unsigned int)origin[0]) >> HASH_GRID_SIZEX;
+		int y = ((unsigned int)origin[1]) >> HASH_GRID_SIZEY;
+		int z = ((unsigned int)origin[2]) >> HASH_GRID_SIZEZ;
+
+		int bucket = LightcacheHashKey( x, y, z, leaf );
+		if (FindInCache( bucket, x, y, z, leaf ))
+			continue;
+
+		lightcache_t *pcache = NewLightcacheEntry(bucket);
+		pcache->x = x;
+		pcache->y = y;
+		pcache->z = z;
+		pcache->leaf = leaf;
+
+		pcache->m_pEnvCubemapTexture = FindEnvCubemapForPoint( origin );
+		ComputeStaticLightingForCacheEntry( pcache, origin, leaf );
+		++nComputed;
+	}
+
+	return nComputed;
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds the AI nodes in the map's entity lump
+//-----------------------------------------------------------------------------
+static void FindNodeOrigins( CUtlVector<Vector> &origins )
+{
+	char *pData = CM_EntityString();
+	while ( (pData = COM_Parse( pData )) != NULL )
+	{
+		if (com_token[0] != '{')
+			break;
+
+		bool bIsNode = false;
+		bool bHasOrigin = false;
+		Vector origin;
+
+		char key[256];
+		while ( (pData = COM_Parse( pData )) != NULL )
+		{
+			if (com_token[0] == '}')
+				break;
+
+			Q_strncpy( key, com_token, sizeof( key ) );
+			pData = COM_Parse( pData );
+			if (!pData)
+				break;
+
+			if (!Q_stricmp( key, "classname" ))
+			{
+				// info_node, info_node_air, info_node_climb...
+				bIsNode = !Q_strnicmp( com_token, "info_node", 9 );
+			}
+			else if (!Q_stricmp( key, "origin" ))
+			{
+				bHasOrigin = ( sscanf( com_token, "%f %f %f", &origin.x, &origin.y, &origin.z ) == 3 );
+			}
+		}
+
+		if (bIsNode && bHasOrigin)
+		{
+			origin.z += LIGHTCACHE_NODE_HEIGHT;
+			origins.AddToTail( origin );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Called once the client's world is loaded
+//-----------------------------------------------------------------------------
+void LightcacheLevelInit( void )
+{
+	if (!host_state.worldmodel)
+		return;
+
+	BuildWorldLightCullInfo();
+
+	// AI nodes are where NPCs go, so they're a good guess at where
+	// the lighting cache is going to be needed
+	if (!r_lightcache_precache_nodes.GetInt())
+		return;
+
+	double flStartTime = Sys_FloatTime();
+
+	CUtlVector<Vector> origins;
+	FindNodeOrigins( origins );
+	int nComputed = LightcachePrefetch( origins.Count(), origins.Base() );
+
+	Con_DPrintf( "Lighting cache: %d entries for %d nodes in %.1f ms\n", nComputed, origins.Count(), 
+		( Sys_FloatTime() - flStartTime ) * 1000.0 );
+}
+
+
 //-----------------------------------------------------------------------------
 // Compute the comtribution of D- and E- lights at a point + normal
 //-----------------------------------------------------------------------------
@@ -60,6 +60,12 @@ dworldlight_t* FindAmbientLight();
 LightCacheHandle_t CreateStaticLightingCache( const Vector& origin );
 void ClearStaticLightingCache();
 
+// Computes the cache entries for a batch of points ahead of time
+int LightcachePrefetch( int nCount, const Vector *pOrigins );
+
+// Called once the client's world is loaded
+void LightcacheLevelInit( void );
+
 // Computes the static vertex lighting term from a large number of spherical samples
 bool ComputeVertexLightingFromSphericalSamples( const Vector& vecVertex, 
 	const Vector &vecNormal, IHandleEntity *pIgnoreEnt, Vector *pLinearColor );
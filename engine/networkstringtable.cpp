@@ -10,6 +10,21 @@
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+//-----------------------------------------------------------------------------
+// Purpose: Case insensitive string hash, matches the stricmp used by the table
+//-----------------------------------------------------------------------------
+static unsigned int HashStringCaseless( const char *pString )
+{
+	unsigned int hash = 0;
+	for ( ; *pString; ++pString )
+	{
+		hash = hash * 31 + tolower( (unsigned char)*pString );
+	}
+
+	// fold the high bits in, the bucket is taken from the low bits
+	return hash ^ ( hash >> 16 );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : id - 
@@ -32,6 +47,9 @@ CNetworkStringTable::CNetworkStringTable( TABLEID id, const char *tableName, int
 	{
 		Host_Error( "String tables must be powers of two in size!, %i is not a power of 2\n", maxentries );
 	}
+
+	m_HashBuckets.SetSize( m_nMaxEntries );
+	ClearStringHash();
 }
 
 //-----------------------------------------------------------------------------
@@ -50,6 +68,64 @@ CNetworkStringTable::~CNetworkStringTable( void )
 void CNetworkStringTable::DeleteAllStrings( void )
 {
 	m_Items.Purge();
+	ClearStringHash();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Empties the string hash
+//-----------------------------------------------------------------------------
+void CNetworkStringTable::ClearStringHash( void )
+{
+	for ( int i = 0; i < m_HashBuckets.Count(); i++ )
+	{
+		m_HashBuckets[ i ] = -1;
+	}
+
+	m_HashNext.RemoveAll();
+	m_StringHash.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Links a string into its hash bucket, after any strings already there
+//			so the lowest numbered duplicate is the one found
+// Input  : stringNumber - 
+//-----------------------------------------------------------------------------
+void CNetworkStringTable::AddToStringHash( int stringNumber )
+{
+	m_HashNext.EnsureCount( stringNumber + 1 );
+	m_StringHash.EnsureCount( stringNumber + 1 );
+
+	unsigned int hash = HashStringCaseless( m_Items.GetElementName( stringNumber ) );
+	m_StringHash[ stringNumber ] = hash;
+	m_HashNext[ stringNumber ] = -1;
+
+	int *pLink = &m_HashBuckets[ hash & ( m_nMaxEntries - 1 ) ];
+	while ( *pLink != -1 )
+	{
+		pLink = &m_HashNext[ *pLink ];
+	}
+	*pLink = stringNumber;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Unlinks a string from its hash bucket
+// Input  : stringNumber - 
+//-----------------------------------------------------------------------------
+void CNetworkStringTable::RemoveFromStringHash( int stringNumber )
+{
+	int *pLink = &m_HashBuckets[ m_StringHash[ stringNumber ] & ( m_nMaxEntries - 1 ) ];
+	while ( *pLink != -1 )
+	{
+		if ( *pLink == stringNumber )
+		{
+			*pLink = m_HashNext[ stringNumber ];
+			m_HashNext[ stringNumber ] = -1;
+			return;
+		}
+		pLink = &m_HashNext[ *pLink ];
+	}
+
+	Assert( 0 );
 }
 
 //-----------------------------------------------------------------------------
@@ -112,8 +188,8 @@ int CNetworkStringTable::AddString( const char *value, int length /*= 0*/, const
 	}
 
 	// See if it's already there
-	int i = m_Items.Find( value );
-	if ( m_Items.IsValidIndex( i ) )
+	int i = FindStringIndex( value );
+	if ( i != -1 )
 	{
 		return i;
 	}
@@ -128,6 +204,7 @@ int CNetworkStringTable::AddString( const char *value, int length /*= 0*/, const
 	CNetworkStringTableItem	newItem;
 	
 	i = m_Items.Insert( value, newItem );
+	AddToStringHash( i );
 
 	CNetworkStringTableItem *temp = &m_Items[ i ];
 
@@ -151,7 +228,9 @@ void CNetworkStringTable::SetString( int stringNumber, const char *value )
 	if ( !stricmp( m_Items.GetElementName( stringNumber ), value ) )
 		return;
 
+	RemoveFromStringHash( stringNumber );
 	m_Items.SetElementName( stringNumber, value );
+	AddToStringHash( stringNumber );
 
 	DataChanged( stringNumber, p );
 }
@@ -222,9 +301,17 @@ int CNetworkStringTable::GetNumStrings( void )
 //-----------------------------------------------------------------------------
 int CNetworkStringTable::FindStringIndex( char const *string )
 {
-	int i = m_Items.Find( string );
-	if ( m_Items.IsValidIndex( i ) )
-		return i;
+	if ( !string )
+		return -1;
+
+	// Don't go through m_Items.Find, it adds every string it's asked about to the dictionary's symbol table
+	unsigned int hash = HashStringCaseless( string );
+	for ( int i = m_HashBuckets[ hash & ( m_nMaxEntries - 1 ) ]; i != -1; i = m_HashNext[ i ] )
+	{
+		if ( m_StringHash[ i ] == hash && !stricmp( m_Items.GetElementName( i ), string ) )
+			return i;
+	}
+
 	return -1;
 }
 
@@ -14,6 +14,7 @@
 #include "networkstringtableitem.h"
 
 #include "utldict.h"
+#include "utlvector.h"
 
 //-----------------------------------------------------------------------------
 // Purpose: Client/Server shared string table definition
@@ -52,6 +53,11 @@ public:
 private:
 	CNetworkStringTable( const CNetworkStringTable & ); // not implemented, not allowed
 
+	// Case insensitive hash of the strings, kept in step with m_Items
+	void					AddToStringHash( int stringNumber );
+	void					RemoveFromStringHash( int stringNumber );
+	void					ClearStringHash( void );
+
 	TABLEID					m_id;
 	char					*m_pszTableName;
 	// Must be a power of 2, so encoding can determine # of bits to use based on log2
@@ -59,6 +65,12 @@ private:
 	int						m_nEntryBits;
 
 	CUtlDict< CNetworkStringTableItem, int > m_Items;
+
+	// m_nMaxEntries buckets, each the first string number in its chain or -1
+	CUtlVector< int >		m_HashBuckets;
+	// Per string number, the next string in the same bucket and the string's hash
+	CUtlVector< int >		m_HashNext;
+	CUtlVector< unsigned int > m_StringHash;
 };
 
 #endif // NETWORKSTRINGTABLE_H
@@ -22,6 +22,7 @@
 #include "util.h"
 #include "scriptevent.h"
 #include "npcevent.h"
+#include "igamesystem.h"
 
 #if !defined( CLIENT_DLL )
 #include "enginecallback.h"
@@ -657,3 +658,32 @@ int GetHitboxSetCount( studiohdr_t *pstudiohdr )
 
 	return pstudiohdr->numhitboxsets;
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: Budget for bone setup's animation seek cache, and flushing it when
+//			models may go away
+//-----------------------------------------------------------------------------
+static void AnimCacheBudgetChanged( ConVar *var, char const *pOldString )
+{
+	Studio_SetAnimCacheBudget( var->GetInt() * 1024 );
+}
+
+static ConVar anim_cache_budget( "anim_cache_budget", "4096", 0, "KB of animation seek indices bone setup can keep, 0 turns the cache off", AnimCacheBudgetChanged );
+
+class CAnimCacheSystem : public CAutoGameSystem
+{
+public:
+	virtual bool Init()
+	{
+		Studio_SetAnimCacheBudget( anim_cache_budget.GetInt() * 1024 );
+		return true;
+	}
+
+	// the cache holds pointers into model data
+	virtual void LevelShutdownPostEntity()
+	{
+		Studio_FlushAnimCache();
+	}
+};
+
+static CAnimCacheSystem g_AnimCacheSystem;
@@ -5,13 +5,17 @@
 #include "bone_setup.h"
 //#include <string> // VXP
 #include <string.h>
+#include <xmmintrin.h>
 //#include <algorithm> // VXP
 
 #include "collisionutils.h"
 #include "vstdlib/random.h"
 #include "tier0/vprof.h"
+#include "tier0/threadtools.h"
 
 #include "engine/ISharedModelCache.h"
+#include "utlrbtree.h"
+#include "utllinkedlist.h"
 
 #include "tier0/memdbgon.h"
 
@@ -25,6 +29,59 @@ void BuildBoneChain(
 	int	iBone,
 	matrix3x4_t *pBoneToWorld );
 
+#if STUDIO_VERSION >= 37
+// Bone setup can run on worker threads, only one of them may load a shared model
+static CThreadMutex s_SharedModelMutex;
+
+//-----------------------------------------------------------------------------
+// Purpose: loads the shared model behind a sequence group if nobody has yet
+//-----------------------------------------------------------------------------
+static void LoadSharedSeqGroup( const studiohdr_t *pStudioHdr, mstudioseqgroup_t *pSeqGroup )
+{
+	CAutoLock lock( s_SharedModelMutex );
+
+	// Another thread may have loaded it while we waited
+	if(pSeqGroup->cache != Cache_NeedsLoading)
+		return;
+
+	// Attempt to load the shared model
+	pSeqGroup->cache = g_pSharedModelCache->Load(pSeqGroup->pszName());
+	
+	// Check we loaded the shared model successfully
+	if(pSeqGroup->cache == Cache_Invalid)
+	{
+		Warning("Failed to load shared model (%s) of model (%s)\n", pSeqGroup->pszName(), pStudioHdr->name);
+	}
+}
+
+static bool IsSharedSeqGroup( mstudioseqgroup_t *pSeqGroup )
+{
+	// NOTE: in some models pszName() and pszLabel() are the same string
+	return pSeqGroup->szlabelindex == pSeqGroup->sznameindex || !Q_strcmp(pSeqGroup->pszLabel(), "shared_animation");
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// Purpose: loads every shared model a model's sequences use, so they don't
+//			get loaded in the middle of bone setup
+//-----------------------------------------------------------------------------
+void Studio_LoadSharedAnimations( const studiohdr_t *pStudioHdr )
+{
+#if STUDIO_VERSION >= 37
+	if ( pStudioHdr->numanimgroup == 0 || pStudioHdr->unused[0] > 0 )
+		return;
+
+	for ( int i = 1; i < pStudioHdr->numseqgroups; i++ )
+	{
+		mstudioseqgroup_t *pSeqGroup = pStudioHdr->pSeqgroup( i );
+		if ( pSeqGroup->cache == Cache_NeedsLoading && IsSharedSeqGroup( pSeqGroup ) )
+		{
+			LoadSharedSeqGroup( pStudioHdr, pSeqGroup );
+		}
+	}
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: returns a model animation from the sequence group and returns a
 //          usable animation description
@@ -95,17 +152,9 @@ static mstudioanimdesc_t *GetAnimDesc( const studiohdr_t *pStudioHdr, const mstu
 		return g_pSharedModelCache->GetSharedModel(pSeqGroup->cache)->pAnimdesc(iAnimIndex);
 	
 	// If we've reached this, the cache MUST need loading
-	Assert(pSeqGroup->cache == Cache_NeedsLoading);
-	
-	// Attempt to load the shared model
-	pSeqGroup->cache = g_pSharedModelCache->Load(pSeqGroup->pszName());
-	
-	// Check we loaded the shared model successfully
+	LoadSharedSeqGroup(pStudioHdr, pSeqGroup);
 	if(pSeqGroup->cache == Cache_Invalid)
-	{
-		Warning("Failed to load shared model (%s) of model (%s)\n", pSeqGroup->pszName(), pStudioHdr->name);
 		return pStudioHdr->pAnimdesc(0); // Fall back to Jesus-pose
-	}
 
 	return g_pSharedModelCache->GetSharedModel(pSeqGroup->cache)->pAnimdesc(iAnimIndex);
 #else
@@ -114,11 +163,338 @@ static mstudioanimdesc_t *GetAnimDesc( const studiohdr_t *pStudioHdr, const mstu
 #endif
 }
 
+//-----------------------------------------------------------------------------
+// Seek index for one channel of a bone's animation: where each frame's run of
+// packed values starts, and the frame's position inside the run
+//-----------------------------------------------------------------------------
+struct animseek_t
+{
+	unsigned short	run;	// offset of the run from the start of the channel's values
+	unsigned short	k;		// frame within the run
+};
+
+#define ANIM_SEEK_CACHE_DEFAULT_BUDGET	( 4 * 1024 * 1024 )
+
+//-----------------------------------------------------------------------------
+// Purpose: Keeps seek indices for recently used animations, so bone setup doesn't
+//			walk the run length encoded values from frame 0 for every bone.
+//			Indices are built on first use and the least recently used are
+//			thrown out to stay under the budget.  Bone setup may run on several
+//			threads at once, so indices in use are held and never thrown out.
+//-----------------------------------------------------------------------------
+class CAnimSeekCache
+{
+public:
+	struct animindex_t
+	{
+		const mstudioanimdesc_t	*m_pAnimDesc;
+		long					m_nChecksum;
+		int						m_nBones;
+		int						m_nFrames;
+		int						m_nBytes;
+		int						m_nRefs;
+		unsigned short			m_LRU;
+		animseek_t				**m_ppChannels;	// six per bone, NULL where the values have to be walked
+		animseek_t				*m_pSeek;
+	};
+
+	CAnimSeekCache();
+	~CAnimSeekCache();
+
+	// Returns the held index, or NULL if the animation can't be cached.  Release
+	// it when done with the channels.
+	animindex_t *AcquireIndex( const studiohdr_t *pStudioHdr, const mstudioanimdesc_t *panimdesc );
+	void	ReleaseIndex( animindex_t *pIndex );
+
+	void	SetBudget( int nBytes );
+	int		GetBudget() const { return m_nBudget; }
+	void	Flush();
+
+	int		Count() const { return m_LRU.Count(); }
+	int		Bytes() const { return m_nBytes; }
+
+private:
+	static bool IndexLessFunc( animindex_t * const &lhs, animindex_t * const &rhs );
+	static bool BuildChannelIndex( const mstudioanimvalue_t *pValues, int nFrames, animseek_t *pSeek );
+
+	animindex_t *BuildIndex( const studiohdr_t *pStudioHdr, const mstudioanimdesc_t *panimdesc );
+	bool	FreeLeastRecentlyUsed();
+	void	FreeIndex( animindex_t *pIndex );
+
+	CThreadMutex	m_Mutex;
+	CUtlRBTree< animindex_t *, int >	m_Indices;
+	CUtlLinkedList< animindex_t *, unsigned short >	m_LRU;	// head is the least recently used
+	int		m_nBudget;
+	int		m_nBytes;
+};
+
+static CAnimSeekCache g_AnimSeekCache;
+
+// Turned off by the benchmark to time the uncached path
+static bool s_bUseAnimSeekCache = true;
+
+CAnimSeekCache::CAnimSeekCache() : m_Indices( 0, 0, IndexLessFunc )
+{
+	m_nBudget = ANIM_SEEK_CACHE_DEFAULT_BUDGET;
+	m_nBytes = 0;
+}
+
+CAnimSeekCache::~CAnimSeekCache()
+{
+	Flush();
+}
+
+bool CAnimSeekCache::IndexLessFunc( animindex_t * const &lhs, animindex_t * const &rhs )
+{
+	if ( lhs->m_pAnimDesc != rhs->m_pAnimDesc )
+		return lhs->m_pAnimDesc < rhs->m_pAnimDesc;
+	if ( lhs->m_nChecksum != rhs->m_nChecksum )
+		return lhs->m_nChecksum < rhs->m_nChecksum;
+	if ( lhs->m_nBones != rhs->m_nBones )
+		return lhs->m_nBones < rhs->m_nBones;
+	return lhs->m_nFrames < rhs->m_nFrames;
+}
+
+void CAnimSeekCache::SetBudget( int nBytes )
+{
+	CAutoLock lock( m_Mutex );
+	m_nBudget = max( nBytes, 0 );
+
+	while ( m_nBytes > m_nBudget && FreeLeastRecentlyUsed() )
+		;
+}
+
+void CAnimSeekCache::Flush()
+{
+	CAutoLock lock( m_Mutex );
+	while ( FreeLeastRecentlyUsed() )
+		;
+
+	Assert( m_LRU.Count() == 0 );
+}
+
+// Returns false if every index is held
+bool CAnimSeekCache::FreeLeastRecentlyUsed()
+{
+	for ( unsigned short i = m_LRU.Head(); i != m_LRU.InvalidIndex(); i = m_LRU.Next( i ) )
+	{
+		if ( m_LRU[i]->m_nRefs == 0 )
+		{
+			FreeIndex( m_LRU[i] );
+			return true;
+		}
+	}
+	return false;
+}
+
+void CAnimSeekCache::FreeIndex( animindex_t *pIndex )
+{
+	m_Indices.Remove( pIndex );
+	m_LRU.Remove( pIndex->m_LRU );
+	m_nBytes -= pIndex->m_nBytes;
+
+	delete[] pIndex->m_ppChannels;
+	delete[] pIndex->m_pSeek;
+	delete pIndex;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Records the run and offset the walk in SeekAnimValue ends on for each
+//			frame. Returns false for streams the walk treats specially (empty runs,
+//			or runs with more values than frames), those are left to the walk.
+//-----------------------------------------------------------------------------
+bool CAnimSeekCache::BuildChannelIndex( const mstudioanimvalue_t *pValues, int nFrames, animseek_t *pSeek )
+{
+	const mstudioanimvalue_t *panimvalue = pValues;
+	int start = 0;
+
+	for ( int frame = 0; frame < nFrames; frame++ )
+	{
+		if ( panimvalue->num.total == 0 || panimvalue->num.total < panimvalue->num.valid )
+			return false;
+
+		while ( frame - start >= panimvalue->num.total )
+		{
+			start += panimvalue->num.total;
+			panimvalue += panimvalue->num.valid + 1;
+
+			if ( panimvalue->num.total == 0 || panimvalue->num.total < panimvalue->num.valid )
+				return false;
+		}
+
+		int run = panimvalue - pValues;
+		if ( run > 0xFFFF )
+			return false;
+
+		pSeek[frame].run = run;
+		pSeek[frame].k = frame - start;
+	}
+
+	return true;
+}
+
+CAnimSeekCache::animindex_t *CAnimSeekCache::BuildIndex( const studiohdr_t *pStudioHdr, const mstudioanimdesc_t *panimdesc )
+{
+	int nBones = pStudioHdr->numbones;
+	int nFrames = panimdesc->numframes;
+	if ( nFrames <= 0 || nBones <= 0 )
+		return NULL;
+
+	int i, j;
+	int nChannels = 0;
+	const mstudioanim_t *panim = panimdesc->pAnim( 0 );
+	for ( i = 0; i < nBones; i++, panim++ )
+	{
+		for ( j = 0; j < 6; j++ )
+		{
+			int animated = ( j < 3 ) ? STUDIO_POS_ANIMATED : STUDIO_ROT_ANIMATED;
+			if ( ( panim->flags & animated ) && panim->u.offset[j] != 0 )
+			{
+				nChannels++;
+			}
+		}
+	}
+
+	int nBytes = sizeof( animindex_t ) + nBones * 6 * sizeof( animseek_t * ) + nChannels * nFrames * sizeof( animseek_t );
+	if ( nBytes > m_nBudget )
+		return NULL;
+
+	while ( m_nBytes + nBytes > m_nBudget )
+	{
+		if ( !FreeLeastRecentlyUsed() )
+			return NULL;
+	}
+
+	animindex_t *pIndex = new animindex_t;
+	pIndex->m_pAnimDesc = panimdesc;
+	pIndex->m_nChecksum = pStudioHdr->checksum;
+	pIndex->m_nBones = nBones;
+	pIndex->m_nFrames = nFrames;
+	pIndex->m_nBytes = nBytes;
+	pIndex->m_nRefs = 0;
+	pIndex->m_ppChannels = new animseek_t *[ nBones * 6 ];
+	pIndex->m_pSeek = new animseek_t[ max( nChannels * nFrames, 1 ) ];
+
+	animseek_t *pSeek = pIndex->m_pSeek;
+	panim = panimdesc->pAnim( 0 );
+	for ( i = 0; i < nBones; i++, panim++ )
+	{
+		for ( j = 0; j < 6; j++ )
+		{
+			animseek_t **ppChannel = &pIndex->m_ppChannels[ i * 6 + j ];
+			*ppChannel = NULL;
+
+			int animated = ( j < 3 ) ? STUDIO_POS_ANIMATED : STUDIO_ROT_ANIMATED;
+			if ( !( panim->flags & animated ) || panim->u.offset[j] == 0 )
+				continue;
+
+			if ( BuildChannelIndex( panim->pAnimvalue( j ), nFrames, pSeek ) )
+			{
+				*ppChannel = pSeek;
+			}
+			pSeek += nFrames;
+		}
+	}
+
+	m_Indices.Insert( pIndex );
+	pIndex->m_LRU = m_LRU.AddToTail( pIndex );
+	m_nBytes += nBytes;
+
+	return pIndex;
+}
+
+CAnimSeekCache::animindex_t *CAnimSeekCache::AcquireIndex( const studiohdr_t *pStudioHdr, const mstudioanimdesc_t *panimdesc )
+{
+	if ( m_nBudget <= 0 || !s_bUseAnimSeekCache )
+		return NULL;
+
+	CAutoLock lock( m_Mutex );
+
+	animindex_t search;
+	search.m_pAnimDesc = panimdesc;
+	search.m_nChecksum = pStudioHdr->checksum;
+	search.m_nBones = pStudioHdr->numbones;
+	search.m_nFrames = panimdesc->numframes;
+
+	animindex_t *pIndex;
+	int i = m_Indices.Find( &search );
+	if ( i != m_Indices.InvalidIndex() )
+	{
+		pIndex = m_Indices[i];
+
+		// most recently used goes to the back of the line
+		m_LRU.Unlink( pIndex->m_LRU );
+		m_LRU.LinkToTail( pIndex->m_LRU );
+	}
+	else
+	{
+		pIndex = BuildIndex( pStudioHdr, panimdesc );
+		if ( !pIndex )
+			return NULL;
+	}
+
+	pIndex->m_nRefs++;
+	return pIndex;
+}
+
+void CAnimSeekCache::ReleaseIndex( animindex_t *pIndex )
+{
+	CAutoLock lock( m_Mutex );
+	Assert( pIndex->m_nRefs > 0 );
+	pIndex->m_nRefs--;
+}
+
+void Studio_SetAnimCacheBudget( int nBytes )
+{
+	g_AnimSeekCache.SetBudget( nBytes );
+}
+
+void Studio_FlushAnimCache( void )
+{
+	g_AnimSeekCache.Flush();
+}
+
+void Studio_GetAnimCacheStats( int &nAnims, int &nBytes )
+{
+	nAnims = g_AnimSeekCache.Count();
+	nBytes = g_AnimSeekCache.Bytes();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: finds the run of packed values holding a frame, and the frame's offset into it
+//-----------------------------------------------------------------------------
+static inline mstudioanimvalue_t *SeekAnimValue( const mstudioanim_t *panim, int channel, int frame, const animseek_t *pSeek, int &k )
+{
+	mstudioanimvalue_t *panimvalue = panim->pAnimvalue( channel );
+
+	if ( pSeek )
+	{
+		k = pSeek[frame].k;
+		return panimvalue + pSeek[frame].run;
+	}
+
+	k = frame;
+	// DEBUG
+	if (panimvalue->num.total < panimvalue->num.valid)
+		k = 0;
+	// find span of values that includes the frame we want
+	while (panimvalue->num.total <= k)
+	{
+		k -= panimvalue->num.total;
+		panimvalue += panimvalue->num.valid + 1;
+		// DEBUG
+		if (panimvalue->num.total < panimvalue->num.valid)
+			k = 0;
+	}
+
+	return panimvalue;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: return a sub frame rotation for a single bone
 //-----------------------------------------------------------------------------
-void CalcBoneQuaternion( const studiohdr_t *pStudioHdr, int frame, float s, 
-						const mstudiobone_t *pbone, const mstudioanim_t *panim, Quaternion &q )
+static void CalcBoneQuaternion( const studiohdr_t *pStudioHdr, int frame, float s, 
+						const mstudiobone_t *pbone, const mstudioanim_t *panim, const animseek_t * const *ppSeek, Quaternion &q )
 {
 
 	int					j, k;
@@ -140,19 +516,7 @@ void CalcBoneQuaternion( const studiohdr_t *pStudioHdr, int frame, float s,
 		}
 		else
 		{
-			panimvalue = panim->pAnimvalue( j+3 );
-			k = frame;
-			// DEBUG
-			if (panimvalue->num.total < panimvalue->num.valid)
-				k = 0;
-			while (panimvalue->num.total <= k)
-			{
-				k -= panimvalue->num.total;
-				panimvalue += panimvalue->num.valid + 1;
-				// DEBUG
-				if (panimvalue->num.total < panimvalue->num.valid)
-					k = 0;
-			}
+			panimvalue = SeekAnimValue( panim, j+3, frame, ppSeek ? ppSeek[j+3] : NULL, k );
 			// Bah, missing blend!
 			if (panimvalue->num.valid > k)
 			{
@@ -227,8 +591,8 @@ static mstudiobonecontroller_t* FindController( const studiohdr_t *pStudioHdr, i
 //-----------------------------------------------------------------------------
 // Purpose: return a sub frame position for a single bone
 //-----------------------------------------------------------------------------
-void CalcBonePosition( const studiohdr_t *pStudioHdr, int frame, float s, 
-	const mstudiobone_t *pbone, const mstudioanim_t *panim, Vector &pos	)
+static void CalcBonePosition( const studiohdr_t *pStudioHdr, int frame, float s, 
+	const mstudiobone_t *pbone, const mstudioanim_t *panim, const animseek_t * const *ppSeek, Vector &pos	)
 {
 	int					j, k;
 	mstudioanimvalue_t	*panimvalue;
@@ -244,25 +608,7 @@ void CalcBonePosition( const studiohdr_t *pStudioHdr, int frame, float s,
 		pos[j] = pbone->value[j]; // default;
 		if (panim->u.offset[j] != 0)
 		{
-			panimvalue = panim->pAnimvalue( j );
-			/*
-			if (i == 0 && j == 0)
-				Con_DPrintf("%d  %d:%d  %f\n", frame, panimvalue->num.valid, panimvalue->num.total, s );
-			*/
-			
-			k = frame;
-			// DEBUG
-			if (panimvalue->num.total < panimvalue->num.valid)
-				k = 0;
-			// find span of values that includes the frame we want
-			while (panimvalue->num.total <= k)
-			{
-				k -= panimvalue->num.total;
-				panimvalue += panimvalue->num.valid + 1;
-  				// DEBUG
-				if (panimvalue->num.total < panimvalue->num.valid)
-					k = 0;
-			}
+			panimvalue = SeekAnimValue( panim, j, frame, ppSeek ? ppSeek[j] : NULL, k );
 			// if we're inside the span
 			if (panimvalue->num.valid > k)
 			{
@@ -295,6 +641,19 @@ void CalcBonePosition( const studiohdr_t *pStudioHdr, int frame, float s,
 }
 
 
+void CalcBoneQuaternion( const studiohdr_t *pStudioHdr, int frame, float s, 
+						const mstudiobone_t *pbone, const mstudioanim_t *panim, Quaternion &q )
+{
+	CalcBoneQuaternion( pStudioHdr, frame, s, pbone, panim, NULL, q );
+}
+
+void CalcBonePosition( const studiohdr_t *pStudioHdr, int frame, float s, 
+	const mstudiobone_t *pbone, const mstudioanim_t *panim, Vector &pos	)
+{
+	CalcBonePosition( pStudioHdr, frame, s, pbone, panim, NULL, pos );
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -315,14 +674,28 @@ static void CalcRotations( const studiohdr_t *pStudioHdr,	Vector *pos, Quaternio
 
 	mstudioanim_t *panim = panimdesc->pAnim( 0 );
 
+	// the seek index only covers the animation's own frames
+	CAnimSeekCache::animindex_t *pIndex = NULL;
+	if ( iFrame >= 0 && iFrame < panimdesc->numframes )
+	{
+		pIndex = g_AnimSeekCache.AcquireIndex( pStudioHdr, panimdesc );
+	}
+
 	for (i = 0; i < pStudioHdr->numbones; i++, pbone++, panim++) 
 	{
 		if (pseqdesc->weight(i) > 0 && (pbone->flags & boneMask))
 		{
-			CalcBoneQuaternion( pStudioHdr, iFrame, s, pbone, panim, q[i] );
-			CalcBonePosition  ( pStudioHdr, iFrame, s, pbone, panim, pos[i] );
+			const animseek_t * const *ppSeek = pIndex ? pIndex->m_ppChannels + i * 6 : NULL;
+
+			CalcBoneQuaternion( pStudioHdr, iFrame, s, pbone, panim, ppSeek, q[i] );
+			CalcBonePosition  ( pStudioHdr, iFrame, s, pbone, panim, ppSeek, pos[i] );
 		}
 	}
+
+	if ( pIndex )
+	{
+		g_AnimSeekCache.ReleaseIndex( pIndex );
+	}
 }
 
 // qt = ( s * p ) * q
@@ -365,6 +738,336 @@ void QuaternionAccumulate( const Quaternion &p, float s, const Quaternion &q, Qu
 	qt[3] = p[3] + s * qt[3];
 }
 
+//-----------------------------------------------------------------------------
+// SSE bone blending.  The blend routines below gather the bones they touch into
+// a list, then blend them four at a time with each quaternion and position
+// component transposed into its own register.  Results match the per bone
+// mathlib routines to within float precision.
+//-----------------------------------------------------------------------------
+
+static bool s_bUseSSEBoneBlend = true;
+
+static inline bool UseSSEBoneBlend( void )
+{
+	return s_bUseSSEBoneBlend && MathLib_SSEEnabled();
+}
+
+void Studio_SetSSEBoneBlend( bool bEnable )
+{
+	s_bUseSSEBoneBlend = bEnable;
+}
+
+class CBoneBlendList
+{
+public:
+	CBoneBlendList() : m_nBones( 0 ) {}
+
+	void AddBone( int iBone, float flWeight )
+	{
+		m_Index[m_nBones] = iBone;
+		m_Weight[m_nBones] = flWeight;
+		m_nBones++;
+	}
+
+	// repeat the last bone so the list can be read four entries at a time,
+	// the repeated lanes just store the same result again
+	void Pad( void )
+	{
+		for ( int i = m_nBones; ( i & 3 ) && i > 0; i++ )
+		{
+			m_Index[i] = m_Index[i-1];
+			m_Weight[i] = m_Weight[i-1];
+		}
+	}
+
+	int		m_nBones;
+	int		m_Index[MAXSTUDIOBONES+3];
+	float	m_Weight[MAXSTUDIOBONES+3];
+};
+
+static inline __m128 SelectSSE( __m128 mask, __m128 a, __m128 b )
+{
+	return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+}
+
+static inline void LoadQuaternionsSSE( const Quaternion *q, const int *pIndex, __m128 &x, __m128 &y, __m128 &z, __m128 &w )
+{
+	x = _mm_loadu_ps( &q[pIndex[0]].x );
+	y = _mm_loadu_ps( &q[pIndex[1]].x );
+	z = _mm_loadu_ps( &q[pIndex[2]].x );
+	w = _mm_loadu_ps( &q[pIndex[3]].x );
+	_MM_TRANSPOSE4_PS( x, y, z, w );
+}
+
+static inline void StoreQuaternionsSSE( Quaternion *q, const int *pIndex, __m128 x, __m128 y, __m128 z, __m128 w )
+{
+	_MM_TRANSPOSE4_PS( x, y, z, w );
+	_mm_storeu_ps( &q[pIndex[0]].x, x );
+	_mm_storeu_ps( &q[pIndex[1]].x, y );
+	_mm_storeu_ps( &q[pIndex[2]].x, z );
+	_mm_storeu_ps( &q[pIndex[3]].x, w );
+}
+
+// pos1 = pos1 * s1 + pos2 * s2
+static inline void BlendPositionsSSE( Vector *pos1, const Vector *pos2, const int *pIndex, __m128 s1, __m128 s2 )
+{
+	const Vector &a0 = pos1[pIndex[0]], &a1 = pos1[pIndex[1]], &a2 = pos1[pIndex[2]], &a3 = pos1[pIndex[3]];
+	const Vector &b0 = pos2[pIndex[0]], &b1 = pos2[pIndex[1]], &b2 = pos2[pIndex[2]], &b3 = pos2[pIndex[3]];
+
+	float x[4], y[4], z[4];
+	_mm_storeu_ps( x, _mm_add_ps( _mm_mul_ps( _mm_setr_ps( a0.x, a1.x, a2.x, a3.x ), s1 ), _mm_mul_ps( _mm_setr_ps( b0.x, b1.x, b2.x, b3.x ), s2 ) ) );
+	_mm_storeu_ps( y, _mm_add_ps( _mm_mul_ps( _mm_setr_ps( a0.y, a1.y, a2.y, a3.y ), s1 ), _mm_mul_ps( _mm_setr_ps( b0.y, b1.y, b2.y, b3.y ), s2 ) ) );
+	_mm_storeu_ps( z, _mm_add_ps( _mm_mul_ps( _mm_setr_ps( a0.z, a1.z, a2.z, a3.z ), s1 ), _mm_mul_ps( _mm_setr_ps( b0.z, b1.z, b2.z, b3.z ), s2 ) ) );
+
+	for ( int i = 0; i < 4; i++ )
+	{
+		pos1[pIndex[i]].Init( x[i], y[i], z[i] );
+	}
+}
+
+// acos over [-1,1], Abramowitz & Stegun 4.4.46, |error| <= 2e-8
+static inline __m128 ArcCosSSE( __m128 x )
+{
+	__m128 one = _mm_set1_ps( 1.0f );
+	__m128 ax = _mm_min_ps( _mm_andnot_ps( _mm_set1_ps( -0.0f ), x ), one );
+
+	__m128 poly = _mm_set1_ps( -0.0012624911f );
+	poly = _mm_add_ps( _mm_mul_ps( poly, ax ), _mm_set1_ps( 0.0066700901f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, ax ), _mm_set1_ps( -0.0170881256f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, ax ), _mm_set1_ps( 0.0308918810f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, ax ), _mm_set1_ps( -0.0501743046f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, ax ), _mm_set1_ps( 0.0889789874f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, ax ), _mm_set1_ps( -0.2145988016f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, ax ), _mm_set1_ps( 1.5707963050f ) );
+
+	__m128 r = _mm_mul_ps( _mm_sqrt_ps( _mm_sub_ps( one, ax ) ), poly );
+
+	// acos( -x ) = pi - acos( x )
+	return SelectSSE( _mm_cmplt_ps( x, _mm_setzero_ps() ), _mm_sub_ps( _mm_set1_ps( M_PI_F ), r ), r );
+}
+
+// sin over [0,pi], folded onto [0,pi/2] and expanded to x^11
+static inline __m128 SinSSE( __m128 x )
+{
+	x = _mm_min_ps( x, _mm_sub_ps( _mm_set1_ps( M_PI_F ), x ) );
+	__m128 x2 = _mm_mul_ps( x, x );
+
+	__m128 poly = _mm_set1_ps( -2.5052108e-8f );
+	poly = _mm_add_ps( _mm_mul_ps( poly, x2 ), _mm_set1_ps( 2.7557319e-6f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, x2 ), _mm_set1_ps( -1.9841270e-4f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, x2 ), _mm_set1_ps( 8.3333333e-3f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, x2 ), _mm_set1_ps( -1.6666667e-1f ) );
+	poly = _mm_add_ps( _mm_mul_ps( poly, x2 ), _mm_set1_ps( 1.0f ) );
+
+	return _mm_mul_ps( x, poly );
+}
+
+static inline __m128 DotSSE( __m128 px, __m128 py, __m128 pz, __m128 pw, __m128 qx, __m128 qy, __m128 qz, __m128 qw )
+{
+	// same order of summation as the scalar code, so QuaternionAlign() ties break the same way
+	return _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, qx ), _mm_mul_ps( py, qy ) ), _mm_mul_ps( pz, qz ) ), _mm_mul_ps( pw, qw ) );
+}
+
+// QuaternionAlign(), flips q in place where it's more than 180 degrees from p
+static inline void AlignQuaternionsSSE( __m128 px, __m128 py, __m128 pz, __m128 pw, __m128 &qx, __m128 &qy, __m128 &qz, __m128 &qw )
+{
+	__m128 dx = _mm_sub_ps( px, qx ), dy = _mm_sub_ps( py, qy ), dz = _mm_sub_ps( pz, qz ), dw = _mm_sub_ps( pw, qw );
+	__m128 sx = _mm_add_ps( px, qx ), sy = _mm_add_ps( py, qy ), sz = _mm_add_ps( pz, qz ), sw = _mm_add_ps( pw, qw );
+	__m128 a = DotSSE( dx, dy, dz, dw, dx, dy, dz, dw );
+	__m128 b = DotSSE( sx, sy, sz, sw, sx, sy, sz, sw );
+
+	__m128 flip = _mm_and_ps( _mm_cmpgt_ps( a, b ), _mm_set1_ps( -0.0f ) );
+	qx = _mm_xor_ps( qx, flip );
+	qy = _mm_xor_ps( qy, flip );
+	qz = _mm_xor_ps( qz, flip );
+	qw = _mm_xor_ps( qw, flip );
+}
+
+// QuaternionNormalize()
+static inline void NormalizeQuaternionsSSE( __m128 &x, __m128 &y, __m128 &z, __m128 &w )
+{
+	__m128 one = _mm_set1_ps( 1.0f );
+	__m128 radius = DotSSE( x, y, z, w, x, y, z, w );
+	__m128 iradius = _mm_div_ps( one, _mm_sqrt_ps( radius ) );
+	iradius = SelectSSE( _mm_cmpneq_ps( radius, _mm_setzero_ps() ), iradius, one );
+
+	x = _mm_mul_ps( x, iradius );
+	y = _mm_mul_ps( y, iradius );
+	z = _mm_mul_ps( z, iradius );
+	w = _mm_mul_ps( w, iradius );
+}
+
+// QuaternionScale()
+static inline void ScaleQuaternionsSSE( __m128 &x, __m128 &y, __m128 &z, __m128 &w, __m128 t )
+{
+	__m128 one = _mm_set1_ps( 1.0f );
+	__m128 sinom = _mm_min_ps( _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, x ), _mm_mul_ps( y, y ) ), _mm_mul_ps( z, z ) ) ), one );
+
+	// asin( x ) = pi/2 - acos( x )
+	__m128 sinsom = SinSSE( _mm_mul_ps( _mm_sub_ps( _mm_set1_ps( 0.5f * M_PI_F ), ArcCosSSE( sinom ) ), t ) );
+
+	__m128 scale = _mm_div_ps( sinsom, _mm_add_ps( sinom, _mm_set1_ps( FLT_EPSILON ) ) );
+	x = _mm_mul_ps( x, scale );
+	y = _mm_mul_ps( y, scale );
+	z = _mm_mul_ps( z, scale );
+
+	// rescale rotation, keeping its sign
+	__m128 r = _mm_sqrt_ps( _mm_max_ps( _mm_sub_ps( one, _mm_mul_ps( sinsom, sinsom ) ), _mm_setzero_ps() ) );
+	w = _mm_or_ps( r, _mm_and_ps( _mm_cmplt_ps( w, _mm_setzero_ps() ), _mm_set1_ps( -0.0f ) ) );
+}
+
+// QuaternionMult(), r = p * q
+static inline void MultQuaternionsSSE( __m128 px, __m128 py, __m128 pz, __m128 pw, __m128 qx, __m128 qy, __m128 qz, __m128 qw,
+	__m128 &rx, __m128 &ry, __m128 &rz, __m128 &rw )
+{
+	AlignQuaternionsSSE( px, py, pz, pw, qx, qy, qz, qw );
+
+	rx = _mm_add_ps( _mm_sub_ps( _mm_add_ps( _mm_mul_ps( px, qw ), _mm_mul_ps( py, qz ) ), _mm_mul_ps( pz, qy ) ), _mm_mul_ps( pw, qx ) );
+	ry = _mm_add_ps( _mm_add_ps( _mm_sub_ps( _mm_mul_ps( py, qw ), _mm_mul_ps( px, qz ) ), _mm_mul_ps( pz, qx ) ), _mm_mul_ps( pw, qy ) );
+	rz = _mm_add_ps( _mm_add_ps( _mm_sub_ps( _mm_mul_ps( px, qy ), _mm_mul_ps( py, qx ) ), _mm_mul_ps( pz, qw ) ), _mm_mul_ps( pw, qz ) );
+	rw = _mm_sub_ps( _mm_sub_ps( _mm_sub_ps( _mm_mul_ps( pw, qw ), _mm_mul_ps( px, qx ) ), _mm_mul_ps( py, qy ) ), _mm_mul_ps( pz, qz ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: the per bone steps of SlerpBones()
+//-----------------------------------------------------------------------------
+static inline void SlerpBone( Quaternion q1[], Vector pos1[], const Quaternion q2[], const Vector pos2[], int i, float s2, bool bFixedAlignment )
+{
+	Quaternion q3;
+	float s1 = 1.0 - s2;
+
+	if (bFixedAlignment)
+	{
+		QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
+	}
+	else
+	{
+		QuaternionSlerp( q2[i], q1[i], s1, q3 );
+	}
+	q1[i][0] = q3[0];
+	q1[i][1] = q3[1];
+	q1[i][2] = q3[2];
+	q1[i][3] = q3[3];
+	pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
+	pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
+	pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+}
+
+static void SlerpBonesSSE( Quaternion q1[], Vector pos1[], const Quaternion q2[], const Vector pos2[], const CBoneBlendList &list, bool bFixedAlignment )
+{
+	__m128 one = _mm_set1_ps( 1.0f );
+	__m128 epsilon = _mm_set1_ps( 0.000001f );
+
+	for ( int i = 0; i < list.m_nBones; i += 4 )
+	{
+		const int *pIndex = &list.m_Index[i];
+
+		// QuaternionSlerp( q2, q1, s1 )
+		__m128 px, py, pz, pw, qx, qy, qz, qw;
+		LoadQuaternionsSSE( q2, pIndex, px, py, pz, pw );
+		LoadQuaternionsSSE( q1, pIndex, qx, qy, qz, qw );
+		if ( !bFixedAlignment )
+		{
+			AlignQuaternionsSSE( px, py, pz, pw, qx, qy, qz, qw );
+		}
+
+		__m128 cosom = DotSSE( px, py, pz, pw, qx, qy, qz, qw );
+
+		// opposing quaternions are rare, let the scalar path pick their perpendicular
+		if ( _mm_movemask_ps( _mm_cmple_ps( _mm_add_ps( one, cosom ), epsilon ) ) )
+		{
+			for ( int j = i; j < i + 4 && j < list.m_nBones; j++ )
+			{
+				SlerpBone( q1, pos1, q2, pos2, list.m_Index[j], list.m_Weight[j], bFixedAlignment );
+			}
+			continue;
+		}
+
+		__m128 s2 = _mm_loadu_ps( &list.m_Weight[i] );
+		__m128 s1 = _mm_sub_ps( one, s2 );
+
+		// nearly identical quaternions blend linearly
+		__m128 linear = _mm_cmple_ps( _mm_sub_ps( one, cosom ), epsilon );
+		__m128 omega = ArcCosSSE( cosom );
+		__m128 sinom = SelectSSE( linear, one, SinSSE( omega ) );
+		__m128 sclp = _mm_div_ps( SinSSE( _mm_mul_ps( _mm_sub_ps( one, s1 ), omega ) ), sinom );
+		__m128 sclq = _mm_div_ps( SinSSE( _mm_mul_ps( s1, omega ) ), sinom );
+		sclp = SelectSSE( linear, _mm_sub_ps( one, s1 ), sclp );
+		sclq = SelectSSE( linear, s1, sclq );
+
+		StoreQuaternionsSSE( q1, pIndex,
+			_mm_add_ps( _mm_mul_ps( px, sclp ), _mm_mul_ps( qx, sclq ) ),
+			_mm_add_ps( _mm_mul_ps( py, sclp ), _mm_mul_ps( qy, sclq ) ),
+			_mm_add_ps( _mm_mul_ps( pz, sclp ), _mm_mul_ps( qz, sclq ) ),
+			_mm_add_ps( _mm_mul_ps( pw, sclp ), _mm_mul_ps( qw, sclq ) ) );
+
+		BlendPositionsSSE( pos1, pos2, pIndex, s1, s2 );
+	}
+}
+
+static void DeltaBonesSSE( Quaternion q1[], Vector pos1[], const Quaternion q2[], const Vector pos2[], const CBoneBlendList &list, bool bPost )
+{
+	__m128 one = _mm_set1_ps( 1.0f );
+
+	for ( int i = 0; i < list.m_nBones; i += 4 )
+	{
+		const int *pIndex = &list.m_Index[i];
+		__m128 s2 = _mm_loadu_ps( &list.m_Weight[i] );
+
+		__m128 ax, ay, az, aw, bx, by, bz, bw, rx, ry, rz, rw;
+		LoadQuaternionsSSE( q2, pIndex, ax, ay, az, aw );
+		LoadQuaternionsSSE( q1, pIndex, bx, by, bz, bw );
+		ScaleQuaternionsSSE( ax, ay, az, aw, s2 );
+
+		if ( bPost )
+		{
+			// QuaternionMA( q1, s2, q2 )
+			MultQuaternionsSSE( bx, by, bz, bw, ax, ay, az, aw, rx, ry, rz, rw );
+		}
+		else
+		{
+			// QuaternionSM( s2, q2, q1 )
+			MultQuaternionsSSE( ax, ay, az, aw, bx, by, bz, bw, rx, ry, rz, rw );
+		}
+		NormalizeQuaternionsSSE( rx, ry, rz, rw );
+		StoreQuaternionsSSE( q1, pIndex, rx, ry, rz, rw );
+
+		BlendPositionsSSE( pos1, pos2, pIndex, one, s2 );
+	}
+}
+
+static void BlendBonesSSE( Quaternion q1[], Vector pos1[], const Quaternion q2[], const Vector pos2[], const CBoneBlendList &list, float s, bool bFixedAlignment )
+{
+	float s1 = 1.0 - s;
+
+	__m128 t = _mm_set1_ps( s1 );
+	__m128 sclp = _mm_set1_ps( 1.0f - s1 );
+	__m128 s2 = _mm_set1_ps( s );
+
+	for ( int i = 0; i < list.m_nBones; i += 4 )
+	{
+		const int *pIndex = &list.m_Index[i];
+
+		// QuaternionBlend( q2, q1, s1 )
+		__m128 px, py, pz, pw, qx, qy, qz, qw;
+		LoadQuaternionsSSE( q2, pIndex, px, py, pz, pw );
+		LoadQuaternionsSSE( q1, pIndex, qx, qy, qz, qw );
+		if ( !bFixedAlignment )
+		{
+			AlignQuaternionsSSE( px, py, pz, pw, qx, qy, qz, qw );
+		}
+
+		__m128 rx = _mm_add_ps( _mm_mul_ps( px, sclp ), _mm_mul_ps( qx, t ) );
+		__m128 ry = _mm_add_ps( _mm_mul_ps( py, sclp ), _mm_mul_ps( qy, t ) );
+		__m128 rz = _mm_add_ps( _mm_mul_ps( pz, sclp ), _mm_mul_ps( qz, t ) );
+		__m128 rw = _mm_add_ps( _mm_mul_ps( pw, sclp ), _mm_mul_ps( qw, t ) );
+		NormalizeQuaternionsSSE( rx, ry, rz, rw );
+		StoreQuaternionsSSE( q1, pIndex, rx, ry, rz, rw );
+
+		BlendPositionsSSE( pos1, pos2, pIndex, t, s2 );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -380,8 +1083,7 @@ void SlerpBones(
 	int boneMask )
 {
 	int			i;
-	Quaternion		q3, q4;
-	float		s1, s2;
+	float		s2;
 
 	if (s <= 0.0f) 
 	{
@@ -392,6 +1094,47 @@ void SlerpBones(
 		s = 1.0f;		
 	}
 
+	if (UseSSEBoneBlend())
+	{
+		CBoneBlendList aligned, fixed;
+
+		for (i = 0; i < pStudioHdr->numbones; i++)
+		{
+			// skip unused bones
+			if (!(pStudioHdr->pBone(i)->flags & boneMask))
+			{
+				continue;
+			}
+
+			s2 = s * pseqdesc->weight( i );
+			if (s2 > 0.0)
+			{
+				if (!(pseqdesc->flags & STUDIO_DELTA) && (pStudioHdr->pBone(i)->flags & BONE_FIXED_ALIGNMENT))
+				{
+					fixed.AddBone( i, s2 );
+				}
+				else
+				{
+					aligned.AddBone( i, s2 );
+				}
+			}
+		}
+
+		aligned.Pad();
+		fixed.Pad();
+
+		if (pseqdesc->flags & STUDIO_DELTA)
+		{
+			DeltaBonesSSE( q1, pos1, q2, pos2, aligned, (pseqdesc->flags & STUDIO_POST) != 0 );
+		}
+		else
+		{
+			SlerpBonesSSE( q1, pos1, q2, pos2, aligned, false );
+			SlerpBonesSSE( q1, pos1, q2, pos2, fixed, true );
+		}
+		return;
+	}
+
 	if (pseqdesc->flags & STUDIO_DELTA)
 	{
 		for (i = 0; i < pStudioHdr->numbones; i++)
@@ -439,23 +1182,7 @@ void SlerpBones(
 			s2 = s * pseqdesc->weight( i );	// blend in based on this animations weights
 			if (s2 > 0.0)
 			{
-				s1 = 1.0 - s2;
-
-				if (pStudioHdr->pBone(i)->flags & BONE_FIXED_ALIGNMENT)
-				{
-					QuaternionSlerpNoAlign( q2[i], q1[i], s1, q3 );
-				}
-				else
-				{
-					QuaternionSlerp( q2[i], q1[i], s1, q3 );
-				}
-				q1[i][0] = q3[0];
-				q1[i][1] = q3[1];
-				q1[i][2] = q3[2];
-				q1[i][3] = q3[3];
-				pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s2;
-				pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s2;
-				pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
+				SlerpBone( q1, pos1, q2, pos2, i, s2, (pStudioHdr->pBone(i)->flags & BONE_FIXED_ALIGNMENT) != 0 );
 			}
 		}
 	}
@@ -503,6 +1230,39 @@ void BlendBones(
 		return;
 	}
 
+	if (UseSSEBoneBlend())
+	{
+		CBoneBlendList aligned, fixed;
+
+		for (i = 0; i < pStudioHdr->numbones; i++)
+		{
+			// skip unused bones
+			if (!(pStudioHdr->pBone(i)->flags & boneMask))
+			{
+				continue;
+			}
+
+			if (pseqdesc->weight( i ) > 0.0)
+			{
+				if (pStudioHdr->pBone(i)->flags & BONE_FIXED_ALIGNMENT)
+				{
+					fixed.AddBone( i, s );
+				}
+				else
+				{
+					aligned.AddBone( i, s );
+				}
+			}
+		}
+
+		aligned.Pad();
+		fixed.Pad();
+
+		BlendBonesSSE( q1, pos1, q2, pos2, aligned, s, false );
+		BlendBonesSSE( q1, pos1, q2, pos2, fixed, s, true );
+		return;
+	}
+
 	float s2 = s;
 	float s1 = 1.0 - s2;
 
@@ -670,13 +1430,11 @@ bool CalcPoseSingle(
 	int boneMask
 	)
 {
-	ASSERT_NO_REENTRY();
-	
 	mstudioseqdesc_t	*pseqdesc;
-	static Vector		pos2[MAXSTUDIOBONES];
-	static Quaternion	q2[MAXSTUDIOBONES];
-	static Vector		pos3[MAXSTUDIOBONES];
-	static Quaternion	q3[MAXSTUDIOBONES];
+	Vector				pos2[MAXSTUDIOBONES];
+	Quaternion			q2[MAXSTUDIOBONES];
+	Vector				pos3[MAXSTUDIOBONES];
+	Quaternion			q3[MAXSTUDIOBONES];
 
 	if (sequence >= pStudioHdr->numseq) 
 	{
@@ -1106,12 +1864,10 @@ public:
 //   (2) Solve for S
 //   (3) Q = Minv(S)         -- rotate back again
 
-   static float Mfwd[3][3];
-   static float Minv[3][3];
-
    static bool solve(float A, float B, float const P[], float const D[], float Q[]) {
       float R[3];
-      defineM(P,D);
+      float Mfwd[3][3], Minv[3][3];	// per call, bone setup can run on several threads
+      defineM(P,D,Mfwd,Minv);
       rot(Minv,P,R);
 	  float r = length(R);
       //float d = findD(A,B,length(R));
@@ -1131,7 +1887,7 @@ public:
 //
 // Given that constraint, define the forward and inverse of M as follows:
 
-   static void defineM(float const P[], float const D[]) {
+   static void defineM(float const P[], float const D[], float Mfwd[3][3], float Minv[3][3]) {
       float *X = Minv[0], *Y = Minv[1], *Z = Minv[2];
 
 // Minv defines a coordinate system whose x axis contains P, so X = unit(P).
@@ -1184,9 +1940,6 @@ public:
    }
 };
 
-float ik::Mfwd[3][3];
-float ik::Minv[3][3];
-
 
 
 //-----------------------------------------------------------------------------
@@ -1770,7 +2523,7 @@ void CIKContext::AddDependencies(
 void CIKContext::AddAutoplayLocks( Vector pos[], Quaternion q[] )
 {
 	int i;
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t boneToWorld[MAXSTUDIOBONES];
 
 	for (i = 0; i < m_pStudioHdr->numikautoplaylocks; i++)
 	{
@@ -1803,7 +2556,7 @@ void CIKContext::AddAutoplayLocks( Vector pos[], Quaternion q[] )
 void CIKContext::AddSequenceLocks( mstudioseqdesc_t *pSeqDesc, Vector pos[], Quaternion q[] )
 {
 	int i;
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t boneToWorld[MAXSTUDIOBONES];
 
 	for (i = 0; i < pSeqDesc->numiklocks; i++)
 	{
@@ -2056,9 +2809,7 @@ void CIKContext::SolveAutoplayLocks(
 	Quaternion q[]
 	)
 {
-	ASSERT_NO_REENTRY();
-	
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t boneToWorld[MAXSTUDIOBONES];
 	int i;
 
 	for (i = 0; i < m_ikRule.Count(); i++)
@@ -2108,9 +2859,7 @@ void CIKContext::SolveSequenceLocks(
 	Quaternion q[]
 	)
 {
-	ASSERT_NO_REENTRY();
-	
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t boneToWorld[MAXSTUDIOBONES];
 	int i;
 
 	for (i = 0; i < m_ikRule.Count(); i++)
@@ -2161,8 +2910,6 @@ void CalcAutoplaySequences(
 	float time
 	)
 {
-	ASSERT_NO_REENTRY();
-	
 	int			i;
 
 	if ( pIKContext )
@@ -3880,3 +4627,151 @@ const char *Studio_GetKeyValueText( const studiohdr_t *pStudioHdr, int iSequence
 	return NULL;
 }
 
+
+//-----------------------------------------------------------------------------
+// Purpose: Compares and times pose setup for every sequence of a model, with and without
+//			the animation seek cache
+//-----------------------------------------------------------------------------
+static void BenchmarkPoses( const studiohdr_t *pStudioHdr, int nSteps, const float poseParameter[], Vector *pos, Quaternion *q )
+{
+	for ( int i = 0; i < pStudioHdr->numseq; i++ )
+	{
+		for ( int j = 0; j < nSteps; j++ )
+		{
+			CalcPoseSingle( pStudioHdr, pos, q, i, (float)j / ( nSteps - 1 ), poseParameter, BONE_USED_BY_ANYTHING );
+		}
+	}
+}
+
+bool Studio_BenchmarkAnimCache( const studiohdr_t *pStudioHdr, int nSteps, float &flUncachedMs, float &flCachedMs )
+{
+	static Vector pos1[MAXSTUDIOBONES], pos2[MAXSTUDIOBONES];
+	static Quaternion q1[MAXSTUDIOBONES], q2[MAXSTUDIOBONES];
+
+	float poseParameter[MAXSTUDIOPOSEPARAM];
+	memset( poseParameter, 0, sizeof( poseParameter ) );
+
+	nSteps = max( nSteps, 2 );
+
+	// check every pose comes out the same both ways, this also fills the cache
+	bool bMatch = true;
+	for ( int i = 0; i < pStudioHdr->numseq; i++ )
+	{
+		for ( int j = 0; j < nSteps; j++ )
+		{
+			float cycle = (float)j / ( nSteps - 1 );
+
+			memset( pos1, 0, sizeof( pos1 ) );
+			memset( pos2, 0, sizeof( pos2 ) );
+			memset( q1, 0, sizeof( q1 ) );
+			memset( q2, 0, sizeof( q2 ) );
+
+			s_bUseAnimSeekCache = false;
+			CalcPoseSingle( pStudioHdr, pos1, q1, i, cycle, poseParameter, BONE_USED_BY_ANYTHING );
+			s_bUseAnimSeekCache = true;
+			CalcPoseSingle( pStudioHdr, pos2, q2, i, cycle, poseParameter, BONE_USED_BY_ANYTHING );
+
+			if ( memcmp( pos1, pos2, pStudioHdr->numbones * sizeof( Vector ) ) ||
+				 memcmp( q1, q2, pStudioHdr->numbones * sizeof( Quaternion ) ) )
+			{
+				bMatch = false;
+			}
+		}
+	}
+
+	double start = Plat_FloatTime();
+	s_bUseAnimSeekCache = false;
+	BenchmarkPoses( pStudioHdr, nSteps, poseParameter, pos1, q1 );
+	flUncachedMs = ( Plat_FloatTime() - start ) * 1000.0f;
+
+	start = Plat_FloatTime();
+	s_bUseAnimSeekCache = true;
+	BenchmarkPoses( pStudioHdr, nSteps, poseParameter, pos1, q1 );
+	flCachedMs = ( Plat_FloatTime() - start ) * 1000.0f;
+
+	return bMatch;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Poses every sequence at nSteps cycles, weights and pose parameter
+//			settings, layered over sequence 0, to run the blended, delta and
+//			autolayered bones of a model through SlerpBones and BlendBones
+//-----------------------------------------------------------------------------
+static void BenchmarkBlends( const studiohdr_t *pStudioHdr, int nSteps, int iSequence, int iStep, Vector *pos, Quaternion *q )
+{
+	float poseParameter[MAXSTUDIOPOSEPARAM];
+	float flFraction = (float)iStep / ( nSteps - 1 );
+	for ( int i = 0; i < MAXSTUDIOPOSEPARAM; i++ )
+	{
+		poseParameter[i] = flFraction;
+	}
+
+	CalcPose( pStudioHdr, NULL, pos, q, 0, flFraction, poseParameter, BONE_USED_BY_ANYTHING, 1.0f );
+	AccumulatePose( pStudioHdr, NULL, pos, q, iSequence, flFraction, poseParameter, BONE_USED_BY_ANYTHING, flFraction );
+}
+
+static float BoneBlendError( const studiohdr_t *pStudioHdr, const Vector *pos1, const Quaternion *q1, const Vector *pos2, const Quaternion *q2 )
+{
+	float flMaxError = 0.0f;
+	for ( int i = 0; i < pStudioHdr->numbones; i++ )
+	{
+		for ( int j = 0; j < 4; j++ )
+		{
+			// q and -q are the same rotation
+			float flError = min( fabs( q1[i][j] - q2[i][j] ), fabs( q1[i][j] + q2[i][j] ) );
+			flMaxError = max( flMaxError, flError );
+		}
+		for ( int j = 0; j < 3; j++ )
+		{
+			float flError = fabs( pos1[i][j] - pos2[i][j] ) / ( 1.0f + fabs( pos1[i][j] ) );
+			flMaxError = max( flMaxError, flError );
+		}
+	}
+	return flMaxError;
+}
+
+bool Studio_BenchmarkBoneBlend( const studiohdr_t *pStudioHdr, int nSteps, float &flMaxError, float &flScalarMs, float &flSSEMs )
+{
+	static Vector pos1[MAXSTUDIOBONES], pos2[MAXSTUDIOBONES];
+	static Quaternion q1[MAXSTUDIOBONES], q2[MAXSTUDIOBONES];
+
+	nSteps = max( nSteps, 2 );
+	flMaxError = 0.0f;
+	flScalarMs = flSSEMs = 0.0f;
+
+	if ( !MathLib_SSEEnabled() )
+		return false;
+
+	for ( int i = 0; i < pStudioHdr->numseq; i++ )
+	{
+		for ( int j = 0; j < nSteps; j++ )
+		{
+			s_bUseSSEBoneBlend = false;
+			BenchmarkBlends( pStudioHdr, nSteps, i, j, pos1, q1 );
+			s_bUseSSEBoneBlend = true;
+			BenchmarkBlends( pStudioHdr, nSteps, i, j, pos2, q2 );
+
+			flMaxError = max( flMaxError, BoneBlendError( pStudioHdr, pos1, q1, pos2, q2 ) );
+		}
+	}
+
+	for ( int k = 0; k < 2; k++ )
+	{
+		s_bUseSSEBoneBlend = ( k != 0 );
+
+		double start = Plat_FloatTime();
+		for ( int i = 0; i < pStudioHdr->numseq; i++ )
+		{
+			for ( int j = 0; j < nSteps; j++ )
+			{
+				BenchmarkBlends( pStudioHdr, nSteps, i, j, pos1, q1 );
+			}
+		}
+		( k ? flSSEMs : flScalarMs ) = ( Plat_FloatTime() - start ) * 1000.0f;
+	}
+	s_bUseSSEBoneBlend = true;
+
+	// rotations within a few degrees of 180 lose precision to QuaternionScale() in either path
+	return flMaxError < 1e-3f;
+}
@@ -49,6 +49,21 @@ void SlerpBones(
 	int boneMask
 	);
 
+//-----------------------------------------------------------------------------
+// Purpose: blends q1,pos1 towards q2,pos2 by s for the bones the sequence
+//			weights, ignoring how much it weights them
+//-----------------------------------------------------------------------------
+void BlendBones( 
+	const studiohdr_t *pStudioHdr,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	mstudioseqdesc_t *pseqdesc,
+	const Quaternion q2[MAXSTUDIOBONES], 
+	const Vector pos2[MAXSTUDIOBONES], 
+	float s,
+	int boneMask
+	);
+
 
 void InitPose(
 	const studiohdr_t *pStudioHdr,
@@ -100,6 +115,27 @@ void CalcBoneAdj(
 	);
 
 
+// Loads the shared animation models a model's sequences play from, which otherwise
+// happens the first time bone setup needs them.
+void Studio_LoadSharedAnimations( const studiohdr_t *pStudioHdr );
+
+// Bone setup keeps seek indices into the compressed animation data of recently used
+// animations, under a byte budget (0 turns it off). Flush it when models are unloaded.
+void Studio_SetAnimCacheBudget( int nBytes );
+void Studio_FlushAnimCache( void );
+void Studio_GetAnimCacheStats( int &nAnims, int &nBytes );
+
+// Times CalcPoseSingle over every sequence of a model with and without the animation
+// cache. Returns false if the two ever produce different bones.
+bool Studio_BenchmarkAnimCache( const studiohdr_t *pStudioHdr, int nSteps, float &flUncachedMs, float &flCachedMs );
+
+// Compares and times the SSE and scalar paths of SlerpBones and BlendBones over every
+// sequence of a model. Returns false if SSE is unavailable or the results disagree.
+bool Studio_BenchmarkBoneBlend( const studiohdr_t *pStudioHdr, int nSteps, float &flMaxError, float &flScalarMs, float &flSSEMs );
+
+// Lets tests run SlerpBones and BlendBones down the scalar path even when SSE is there
+void Studio_SetSSEBoneBlend( bool bEnable );
+
 // Given two samples of a bone separated in time by dt, 
 // compute the velocity and angular velocity of that bone
 void CalcBoneDerivatives( Vector &velocity, AngularImpulse &angVel, const matrix3x4_t &prev, const matrix3x4_t &current, float dt );
@@ -21,6 +21,8 @@
 
 extern IFileSystem *filesystem;
 
+static ConVar movement_tracecache( "movement_tracecache", "1", 0, "Reuse identical player hull traces within a single movement command" );
+
 void COM_Log( char *pszFile, char *fmt, ...)
 {
 	va_list		argptr;
@@ -69,6 +71,10 @@ CGameMovement::CGameMovement( void )
 
 	m_surfaceProps = 0;
 	m_surfaceFriction = 1.0f;
+
+	m_nCachedTraces = 0;
+	m_nNextCachedTrace = 0;
+	m_bTraceCacheActive = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -113,21 +119,96 @@ const Vector& CGameMovement::GetPlayerViewOffset( bool ducked ) const
 //-----------------------------------------------------------------------------
 // Traces player movement + position
 //-----------------------------------------------------------------------------
-inline void CGameMovement::TracePlayerBBox( const Vector& start, const Vector& end, unsigned int fMask, int collisionGroup, trace_t& pm )
+void CGameMovement::TracePlayerHull( const Vector& start, const Vector& end, unsigned int fMask, int collisionGroup, trace_t& pm )
 {
-	VPROF( "CGameMovement::TracePlayerBBox" );
+	const Vector &mins = GetPlayerMins( player->m_Local.m_bDucked );
+	const Vector &maxs = GetPlayerMaxs( player->m_Local.m_bDucked );
+
+	if ( m_bTraceCacheActive )
+	{
+		for ( int i = 0; i < m_nCachedTraces; i++ )
+		{
+			const CachedTrace_t &cached = m_TraceCache[ i ];
+			if ( cached.m_fMask == fMask && cached.m_nCollisionGroup == collisionGroup &&
+				 cached.m_vecStart == start && cached.m_vecEnd == end &&
+				 cached.m_vecMins == mins && cached.m_vecMaxs == maxs )
+			{
+				pm = cached.m_Trace;
+				return;
+			}
+		}
+	}
 
 	Ray_t ray;
-	ray.Init( start, end, GetPlayerMins( player->m_Local.m_bDucked ), GetPlayerMaxs( player->m_Local.m_bDucked ) );
+	ray.Init( start, end, mins, maxs );
 	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
+
+	if ( m_bTraceCacheActive )
+	{
+		CachedTrace_t &cached = m_TraceCache[ m_nNextCachedTrace ];
+		cached.m_vecStart = start;
+		cached.m_vecEnd = end;
+		cached.m_vecMins = mins;
+		cached.m_vecMaxs = maxs;
+		cached.m_fMask = fMask;
+		cached.m_nCollisionGroup = collisionGroup;
+		cached.m_Trace = pm;
+
+		m_nNextCachedTrace = ( m_nNextCachedTrace + 1 ) % TRACE_CACHE_SIZE;
+		m_nCachedTraces = min( m_nCachedTraces + 1, (int)TRACE_CACHE_SIZE );
+	}
+}
+
+void CGameMovement::TracePlayerHulls( PlayerHullTrace_t *pTraces, int nCount )
+{
+	VPROF( "CGameMovement::TracePlayerHulls" );
+
+	for ( int i = 0; i < nCount; i++ )
+	{
+		PlayerHullTrace_t &query = pTraces[ i ];
+
+		// Nothing moves between the queries, so an identical earlier one has the answer
+		int j;
+		for ( j = 0; j < i; j++ )
+		{
+			const PlayerHullTrace_t &earlier = pTraces[ j ];
+			if ( earlier.m_fMask == query.m_fMask && earlier.m_nCollisionGroup == query.m_nCollisionGroup &&
+				 earlier.m_vecStart == query.m_vecStart && earlier.m_vecEnd == query.m_vecEnd )
+			{
+				break;
+			}
+		}
+
+		if ( j < i )
+		{
+			query.m_Trace = pTraces[ j ].m_Trace;
+		}
+		else
+		{
+			TracePlayerHull( query.m_vecStart, query.m_vecEnd, query.m_fMask, query.m_nCollisionGroup, query.m_Trace );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Is the player hull blocked by something it can't pass through?
+//-----------------------------------------------------------------------------
+static inline bool IsPlayerPositionBlocked( const trace_t &pm )
+{
+	return ( pm.contents & MASK_PLAYERSOLID ) && pm.m_pEnt;
+}
+
+inline void CGameMovement::TracePlayerBBox( const Vector& start, const Vector& end, unsigned int fMask, int collisionGroup, trace_t& pm )
+{
+	VPROF( "CGameMovement::TracePlayerBBox" );
+
+	TracePlayerHull( start, end, fMask, collisionGroup, pm );
 }
 
 inline CBaseHandle CGameMovement::TestPlayerPosition( const Vector& pos, int collisionGroup, trace_t& pm )
 {
-	Ray_t ray;
-	ray.Init( pos, pos, GetPlayerMins( player->m_Local.m_bDucked ), GetPlayerMaxs( player->m_Local.m_bDucked ) );
-	UTIL_TraceRay( ray, MASK_PLAYERSOLID, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
-	if ( (pm.contents & MASK_PLAYERSOLID) && pm.m_pEnt )
+	TracePlayerHull( pos, pos, MASK_PLAYERSOLID, collisionGroup, pm );
+	if ( IsPlayerPositionBlocked( pm ) )
 	{
 		return pm.m_pEnt->GetRefEHandle();
 	}
@@ -729,8 +810,15 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 	//  flag globally here once per usercmd cycle.
 	m_bSpeedCropped = false;
 
+	// Start with an empty trace cache, anything could have moved since the last command
+	m_nCachedTraces = 0;
+	m_nNextCachedTrace = 0;
+	m_bTraceCacheActive = movement_tracecache.GetBool();
+
 	// Run the recursive portion of the move
 	_ProcessMovement( pPlayer, pMove );
+
+	m_bTraceCacheActive = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -2433,6 +2521,9 @@ float CGameMovement::CalcRoll ( const QAngle &angles, const Vector &velocity, fl
 
 #define CHECKSTUCK_MINTIME 0.05  // Don't check again too quickly.
 
+// Candidate unstuck positions are hull traced this many at a time
+#define STUCK_TRACE_BATCH_SIZE	6
+
 static Vector rgv3tStuckTable[54];
 static int rgStuckLast[32][2];
 
@@ -2627,22 +2718,40 @@ int CGameMovement::CheckStuck( void )
 	{
 		if ( MoveHelper()->IsWorldEntity( hitent ) )
 		{
+			// Offsets are taken in the same order as testing them one at a time, and
+			// the first clear one wins, so grouping the traces doesn't change the result
+			PlayerHullTrace_t traces[ STUCK_TRACE_BATCH_SIZE ];
 			int nReps = 0;
 			ResetStuckOffsets(player->entindex(), player->IsServer());
 			do 
 			{
-				i = GetRandomStuckOffsets(player->entindex(), player->IsServer(), offset);
+				int j;
+				for ( j = 0; j < STUCK_TRACE_BATCH_SIZE; j++ )
+				{
+					GetRandomStuckOffsets(player->entindex(), player->IsServer(), offset);
 
-				VectorAdd(base, offset, test);
-				
-				if (TestPlayerPosition( test, COLLISION_GROUP_PLAYER_MOVEMENT, traceresult ) == INVALID_ENTITY_HANDLE)
+					VectorAdd(base, offset, traces[j].m_vecStart);
+					traces[j].m_vecEnd = traces[j].m_vecStart;
+					traces[j].m_fMask = MASK_PLAYERSOLID;
+					traces[j].m_nCollisionGroup = COLLISION_GROUP_PLAYER_MOVEMENT;
+				}
+
+				TracePlayerHulls( traces, STUCK_TRACE_BATCH_SIZE );
+
+				for ( j = 0; j < STUCK_TRACE_BATCH_SIZE; j++ )
 				{
-					ResetStuckOffsets(player->entindex(), player->IsServer());
-					VectorCopy(test, mv->m_vecOrigin);
-					return 0;
+					if ( !IsPlayerPositionBlocked( traces[j].m_Trace ) )
+					{
+						ResetStuckOffsets(player->entindex(), player->IsServer());
+						VectorCopy(traces[j].m_vecStart, mv->m_vecOrigin);
+						return 0;
+					}
 				}
-				nReps++;
+				nReps += STUCK_TRACE_BATCH_SIZE;
 			} while (nReps < 54);
+
+			// Leave the last test's result behind, as testing them one at a time did
+			traceresult = traces[ STUCK_TRACE_BATCH_SIZE - 1 ].m_Trace;
 		}
 	}
 
@@ -2995,13 +3104,31 @@ void CGameMovement::FixPlayerCrouchStuck( bool upward )
 	if (hitent == INVALID_ENTITY_HANDLE )
 		return;
 	
+	// Step the same way as testing one position at a time, and take the first clear one
+	PlayerHullTrace_t traces[ STUCK_TRACE_BATCH_SIZE ];
 	VectorCopy( mv->m_vecOrigin, test );	
-	for ( i = 0; i < 36; i++ )
+	for ( i = 0; i < 36; i += STUCK_TRACE_BATCH_SIZE )
 	{
-		mv->m_vecOrigin[2] += direction;
-		hitent = TestPlayerPosition( mv->m_vecOrigin, COLLISION_GROUP_PLAYER_MOVEMENT, dummy );
-		if (hitent == INVALID_ENTITY_HANDLE )
-			return;
+		int j;
+		for ( j = 0; j < STUCK_TRACE_BATCH_SIZE; j++ )
+		{
+			mv->m_vecOrigin[2] += direction;
+			traces[j].m_vecStart = mv->m_vecOrigin;
+			traces[j].m_vecEnd = mv->m_vecOrigin;
+			traces[j].m_fMask = MASK_PLAYERSOLID;
+			traces[j].m_nCollisionGroup = COLLISION_GROUP_PLAYER_MOVEMENT;
+		}
+
+		TracePlayerHulls( traces, STUCK_TRACE_BATCH_SIZE );
+
+		for ( j = 0; j < STUCK_TRACE_BATCH_SIZE; j++ )
+		{
+			if ( !IsPlayerPositionBlocked( traces[j].m_Trace ) )
+			{
+				VectorCopy( traces[j].m_vecStart, mv->m_vecOrigin );
+				return;
+			}
+		}
 	}
 
 	VectorCopy( test, mv->m_vecOrigin ); // Failed
@@ -27,6 +27,18 @@ struct surfacedata_t;
 
 class CBasePlayer;
 
+//-----------------------------------------------------------------------------
+// One query in a group of player hull traces, see TracePlayerHulls
+//-----------------------------------------------------------------------------
+struct PlayerHullTrace_t
+{
+	Vector			m_vecStart;
+	Vector			m_vecEnd;
+	unsigned int	m_fMask;
+	int				m_nCollisionGroup;
+	trace_t			m_Trace;		// Filled in by TracePlayerHulls
+};
+
 class CGameMovement : public IGameMovement
 {
 public:
@@ -207,6 +219,13 @@ protected:
 	// Tests the player position
 	CBaseHandle		TestPlayerPosition( const Vector& pos, int collisionGroup, trace_t& pm );
 
+	// Runs a hull trace for the player, or reuses an identical one from earlier in the same ProcessMovement
+	void			TracePlayerHull( const Vector& start, const Vector& end, unsigned int fMask, int collisionGroup, trace_t& pm );
+
+	// Runs a group of independent hull traces for the player. Queries repeated within the
+	// group, or from earlier in the same ProcessMovement, are only traced once.
+	void			TracePlayerHulls( PlayerHullTrace_t *pTraces, int nCount );
+
 	// Checks to see if we should actually jump 
 	void			PlaySwimSound();
 
@@ -230,6 +249,30 @@ protected:
 
 //private:
 	bool			m_bSpeedCropped;
+
+private:
+	// Hull traces made during one ProcessMovement. Nothing but the player moves while its
+	// movement runs, and its own traces ignore it, so the same query gives the same result.
+	enum
+	{
+		TRACE_CACHE_SIZE = 4
+	};
+
+	struct CachedTrace_t
+	{
+		Vector			m_vecStart;
+		Vector			m_vecEnd;
+		Vector			m_vecMins;
+		Vector			m_vecMaxs;
+		unsigned int	m_fMask;
+		int				m_nCollisionGroup;
+		trace_t			m_Trace;
+	};
+
+	CachedTrace_t	m_TraceCache[ TRACE_CACHE_SIZE ];
+	int				m_nCachedTraces;
+	int				m_nNextCachedTrace;
+	bool			m_bTraceCacheActive;
 };
 
 #endif // GAMEMOVEMENT_H
@@ -38,6 +38,8 @@
 #include "texturemanager.h"
 #include "itextureinternal.h"
 #include "mempool.h"
+#include "materialcache.h"
+#include "checksum_crc.h"
 
 
 //-----------------------------------------------------------------------------
@@ -169,6 +171,7 @@ public:
 	// Gets at the shader parameters
 	virtual int ShaderParamCount() const;
 	virtual IMaterialVar **GetShaderParams( void );
+	virtual const char *GetShaderName() const;
 
 	virtual void AddMaterialVar( IMaterialVar *pMaterialVar );
 
@@ -180,7 +183,7 @@ private:
 	void SetupErrorShader();
 
 	// Parses a .VMT file and generates a key value list
-	bool LoadVMTFile( KeyValues& vmtKeyValues );
+	bool LoadVMTFile( KeyValues& vmtKeyValues, MaterialCacheFiles_t *pSourceFiles );
 	
 	// Prints material flags.
 	void PrintMaterialFlags( int flags, int flagsDefined );
@@ -198,7 +201,10 @@ private:
 	char const* GetPreviewImageFileName( void ) const;
 
 	// Hooks up the shader, returns keyvalues of fallback that was used
-	KeyValues* InitializeShader( KeyValues& keyValues );
+	KeyValues* InitializeShader( KeyValues& keyValues, CUtlBuffer *pCompiled );
+
+	// Hooks up the shader, vars + proxies from the material cache
+	bool LoadCompiledMaterial();
 
 	// Finds the flag associated with a particular flag name
 	int FindMaterialVarFlag( char const* pFlagName ) const;
@@ -208,7 +214,7 @@ private:
 	void CleanUpStateSnapshots();
 
 	// Initializes, cleans up the material proxy
-	void InitializeMaterialProxy( KeyValues* pFallbackKeyValues );
+	void InitializeMaterialProxy( KeyValues* pProxySection );
 	void CleanUpMaterialProxy();
 
 	// Grabs the texture width and height from the var list for faster access
@@ -429,15 +435,13 @@ void CMaterial::CleanUpShaderParams()
 //-----------------------------------------------------------------------------
 // Initializes the material proxy
 //-----------------------------------------------------------------------------
-void CMaterial::InitializeMaterialProxy( KeyValues* pFallbackKeyValues )
+void CMaterial::InitializeMaterialProxy( KeyValues* pProxySection )
 {
 	IMaterialProxyFactory *pMaterialProxyFactory;
 	pMaterialProxyFactory = MaterialSystem()->GetMaterialProxyFactory();	
 	if( !pMaterialProxyFactory )
 		return;
 
-	// See if we've got a proxy section; obey fallbacks
-	KeyValues* pProxySection = pFallbackKeyValues->FindKey("Proxies");
 	if (!pProxySection)
 		return;
 
@@ -704,6 +708,136 @@ static IMaterialVar* CreateMaterialVarFromKeyValue( IMaterial* pMaterial, KeyVal
 }
 
 
+//-----------------------------------------------------------------------------
+// Compiled materials hold the shaders the fallback search went through, the
+// material vars as parsed for the last of those shaders, then the proxies.
+// The shaders' param lists go into a CRC so a changed shader DLL recompiles.
+//-----------------------------------------------------------------------------
+static void AddShaderToCRC( CRC32_t &crc, IShader* pShader )
+{
+	CRC32_ProcessBuffer( &crc, (void*)pShader->GetName(), strlen( pShader->GetName() ) );
+	for (int i = 0; i < pShader->GetNumParams(); ++i)
+	{
+		char const* pParamName = pShader->GetParamName(i);
+		CRC32_ProcessBuffer( &crc, (void*)pParamName, strlen( pParamName ) );
+	}
+}
+
+static bool WriteCompiledVar( CUtlBuffer& buf, IMaterialVar* pVar )
+{
+	MaterialVarType_t type = pVar->GetType();
+	buf.PutString( pVar->GetName() );
+	buf.PutUnsignedChar( type );
+
+	switch( type )
+	{
+	case MATERIAL_VAR_TYPE_INT:
+		buf.PutInt( pVar->GetIntValue() );
+		return true;
+
+	case MATERIAL_VAR_TYPE_FLOAT:
+		buf.PutFloat( pVar->GetFloatValue() );
+		return true;
+
+	case MATERIAL_VAR_TYPE_STRING:
+		buf.PutString( pVar->GetStringValue() );
+		return true;
+
+	case MATERIAL_VAR_TYPE_VECTOR:
+		buf.PutUnsignedChar( pVar->VectorSize() );
+		buf.Put( pVar->GetVecValue(), pVar->VectorSize() * sizeof(float) );
+		return true;
+
+	case MATERIAL_VAR_TYPE_MATRIX:
+		{
+			VMatrix const& mat = pVar->GetMatrixValue();
+			buf.Put( mat.m, sizeof(mat.m) );
+		}
+		return true;
+
+	case MATERIAL_VAR_TYPE_UNDEFINED:
+		return true;
+	}
+
+	// Textures + the like only show up after parsing, so we can't store them
+	return false;
+}
+
+static bool WriteCompiledVars( CUtlBuffer& buf, IMaterialVar** ppVars, int varCount )
+{
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, 0 );
+	buf.PutInt( varCount );
+	for (int i = 0; i < varCount; ++i)
+	{
+		if (!WriteCompiledVar( buf, ppVars[i] ))
+			return false;
+	}
+	return buf.IsValid();
+}
+
+static IMaterialVar* ReadCompiledVar( IMaterial* pMaterial, CUtlBuffer& buf )
+{
+	char pName[256];
+	char *pString;
+	int nStringLen;
+	float vecVal[4];
+	int numComps;
+	VMatrix mat;
+
+	buf.GetString( pName, sizeof(pName) );
+
+	IMaterialVar* pVar = 0;
+	switch( buf.GetUnsignedChar() )
+	{
+	case MATERIAL_VAR_TYPE_INT:
+		pVar = IMaterialVar::Create( pMaterial, pName, buf.GetInt() );
+		break;
+
+	case MATERIAL_VAR_TYPE_FLOAT:
+		pVar = IMaterialVar::Create( pMaterial, pName, buf.GetFloat() );
+		break;
+
+	case MATERIAL_VAR_TYPE_STRING:
+		// Size the buffer from the stored string so long values aren't truncated
+		nStringLen = buf.Size() - buf.TellGet();
+		if (nStringLen <= 0)
+			return 0;
+		pString = (char *)memchr( buf.PeekGet(), 0, nStringLen );
+		if (!pString)
+			return 0;
+		nStringLen = pString - (char *)buf.PeekGet() + 1;
+		pString = (char *)stackalloc( nStringLen );
+		buf.GetString( pString, nStringLen );
+		pVar = IMaterialVar::Create( pMaterial, pName, pString );
+		break;
+
+	case MATERIAL_VAR_TYPE_VECTOR:
+		numComps = buf.GetUnsignedChar();
+		if (numComps > 4)
+			return 0;
+		buf.Get( vecVal, numComps * sizeof(float) );
+		pVar = IMaterialVar::Create( pMaterial, pName, vecVal, numComps );
+		break;
+
+	case MATERIAL_VAR_TYPE_MATRIX:
+		buf.Get( mat.m, sizeof(mat.m) );
+		pVar = IMaterialVar::Create( pMaterial, pName, mat );
+		break;
+
+	case MATERIAL_VAR_TYPE_UNDEFINED:
+		pVar = IMaterialVar::Create( pMaterial, pName );
+		break;
+	}
+
+	if (pVar && !buf.IsValid())
+	{
+		IMaterialVar::Destroy( pVar );
+		return 0;
+	}
+	return pVar;
+}
+
+
 //-----------------------------------------------------------------------------
 // Reads out common flags, prevents them from becoming material vars
 //-----------------------------------------------------------------------------
@@ -891,9 +1025,10 @@ nextVar:
 
 
 //-----------------------------------------------------------------------------
-// Hooks up the shader
+// Hooks up the shader. If pCompiled is set, the outcome of the fallback
+// search is written into it for the material cache, unless it can't be stored.
 //-----------------------------------------------------------------------------
-KeyValues* CMaterial::InitializeShader( KeyValues& keyValues )
+KeyValues* CMaterial::InitializeShader( KeyValues& keyValues, CUtlBuffer *pCompiled )
 {
 	KeyValues* pCurrentFallback = &keyValues;
 	KeyValues* pFallbackSection = 0;
@@ -910,6 +1045,8 @@ KeyValues* CMaterial::InitializeShader( KeyValues& keyValues )
 	IMaterialVar*	ppVars[256];
 	int varCount = 0;
 	bool modelDefault = false;
+	CUtlVector< IShader* > shaderChain;
+	CUtlBuffer compiledVars( 0, 1024 );
 
 	// Keep going until there's no more fallbacks...
 	while( true )
@@ -923,12 +1060,23 @@ KeyValues* CMaterial::InitializeShader( KeyValues& keyValues )
 			pShaderName = "wireframe";
 			pShader = ShaderSystem()->FindShader( pShaderName );
 			Assert( pShader );
+
+			// Keep the warning coming until the material is fixed
+			pCompiled = 0;
 		}
 
 		// Here we must set up all flags + material vars that the shader needs
 		// because it may look at them when choosing shader fallback.
 		varCount = ParseMaterialVars( pShader, keyValues, pFallbackSection, modelDefault, ppVars );
 
+		// Only the vars parsed for the last shader end up compiled
+		if (pCompiled)
+		{
+			shaderChain.AddToTail( pShader );
+			if (!WriteCompiledVars( compiledVars, ppVars, varCount ))
+				pCompiled = 0;
+		}
+
 		// Make sure we set default values before the fallback is looked for
 		ShaderSystem()->InitShaderParameters( pShader, ppVars, GetName() );
 
@@ -984,9 +1132,111 @@ KeyValues* CMaterial::InitializeShader( KeyValues& keyValues )
 	}
 #endif
 
+	if (pCompiled)
+	{
+		CRC32_t crc;
+		CRC32_Init( &crc );
+		pCompiled->PutInt( shaderChain.Count() );
+		for (int i = 0; i < shaderChain.Count(); ++i)
+		{
+			pCompiled->PutString( shaderChain[i]->GetName() );
+			AddShaderToCRC( crc, shaderChain[i] );
+		}
+		CRC32_Final( &crc );
+		pCompiled->PutUnsignedInt( crc );
+		pCompiled->Put( compiledVars.Base(), compiledVars.TellPut() );
+	}
+
 	return pCurrentFallback;
 }
 
+
+//-----------------------------------------------------------------------------
+// Hooks up the shader, material vars + proxies from the material cache
+//-----------------------------------------------------------------------------
+bool CMaterial::LoadCompiledMaterial()
+{
+	CUtlBuffer buf;
+	if (!MaterialCache_Find( GetName(), buf ))
+		return false;
+
+	// Make sure none of the shaders went away or changed their params
+	IShader* pShader = 0;
+	char pShaderName[256];
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	int shaderCount = buf.GetInt();
+	for (int i = 0; i < shaderCount; ++i)
+	{
+		buf.GetString( pShaderName, sizeof(pShaderName) );
+		pShader = ShaderSystem()->FindShader( pShaderName );
+		if (!pShader)
+			return false;
+
+		AddShaderToCRC( crc, pShader );
+	}
+	CRC32_Final( &crc );
+	if (!pShader || (buf.GetUnsignedInt() != crc))
+		return false;
+
+	int varCount = buf.GetInt();
+	if (!buf.IsValid() || (varCount < pShader->GetNumParams()) || (varCount > 256))
+		return false;
+
+	IMaterialVar* ppVars[256];
+	int readCount;
+	for (readCount = 0; readCount < varCount; ++readCount)
+	{
+		ppVars[readCount] = ReadCompiledVar( this, buf );
+		if (!ppVars[readCount])
+			break;
+	}
+
+	KeyValues* pProxySection = 0;
+	if ((readCount == varCount) && buf.GetUnsignedChar())
+	{
+		pProxySection = new KeyValues( "Proxies" );
+		if (!pProxySection->ReadAsBinary( buf ))
+		{
+			pProxySection->deleteThis();
+			pProxySection = 0;
+			readCount = 0;
+		}
+	}
+
+	if ((readCount != varCount) || !buf.IsValid())
+	{
+		for (int i = 0; i < readCount; ++i)
+		{
+			IMaterialVar::Destroy( ppVars[i] );
+		}
+		if (pProxySection)
+		{
+			pProxySection->deleteThis();
+		}
+		return false;
+	}
+
+	// Needed to prevent re-entrancy
+	m_Flags |= MATERIAL_VARS_IS_PRECACHED;
+
+	// The vars are as they were before InitializeShader set the defaults
+	ShaderSystem()->InitShaderParameters( pShader, ppVars, GetName() );
+
+	m_pShader = pShader;
+	m_VarCount = varCount;
+	m_pShaderParams = (IMaterialVar**)malloc( varCount * sizeof(IMaterialVar*) );
+	memcpy( m_pShaderParams, ppVars, varCount * sizeof(IMaterialVar*) );
+
+	InitializeMaterialProxy( pProxySection );
+	if (pProxySection)
+	{
+		pProxySection->deleteThis();
+	}
+
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 // Gets the texturemap size
 //-----------------------------------------------------------------------------
@@ -1388,10 +1638,16 @@ bool CMaterial::PrecacheVars()
 	if( IsPrecachedVars() )
 		return true;
 
+	// Skip the parse if the vmt hasn't changed since it was compiled
+	bool useCache = MaterialCache_IsEnabled() && !IsManuallyCreated();
+	if( useCache && LoadCompiledMaterial() )
+		return true;
+
 	// load data from the vmt file
 	KeyValues * vmtKeyValues = new KeyValues("vmt");
+	MaterialCacheFiles_t sourceFiles;
 
-	if( !LoadVMTFile( *vmtKeyValues ) )
+	if( !LoadVMTFile( *vmtKeyValues, useCache ? &sourceFiles : NULL ) )
 	{
 		Warning( "CMaterial::PrecacheVars: error loading vmt file for %s\n", GetName() );
 		vmtKeyValues->deleteThis();
@@ -1402,7 +1658,8 @@ bool CMaterial::PrecacheVars()
 	m_Flags |= MATERIAL_VARS_IS_PRECACHED;
 
 	// Create shader and the material vars...
-	KeyValues* pFallbackKeyValues = InitializeShader( *vmtKeyValues );
+	CUtlBuffer compiled( 0, 1024 );
+	KeyValues* pFallbackKeyValues = InitializeShader( *vmtKeyValues, useCache ? &compiled : NULL );
 	if (!pFallbackKeyValues)
 	{
 		vmtKeyValues->deleteThis();
@@ -1410,7 +1667,26 @@ bool CMaterial::PrecacheVars()
 	}
 
 	// Gotta initialize the proxies too, using the fallback proxies
-	InitializeMaterialProxy(pFallbackKeyValues);
+	KeyValues* pProxySection = pFallbackKeyValues->FindKey("Proxies");
+	InitializeMaterialProxy( pProxySection );
+
+	if( compiled.TellPut() > 0 )
+	{
+		bool ok = true;
+		compiled.PutUnsignedChar( pProxySection != NULL );
+		if( pProxySection )
+		{
+			// Don't take the rest of the vmt along with it
+			KeyValues* pProxyCopy = pProxySection->MakeCopy();
+			ok = pProxyCopy->WriteAsBinary( compiled );
+			pProxyCopy->deleteThis();
+		}
+
+		if( ok )
+		{
+			MaterialCache_Store( GetName(), sourceFiles, compiled );
+		}
+	}
 
 	vmtKeyValues->deleteThis();
 
@@ -2143,6 +2419,11 @@ int CMaterial::ShaderParamCount() const
 	return m_VarCount;
 }
 
+const char *CMaterial::GetShaderName() const
+{
+	return m_pShader ? m_pShader->GetName() : "";
+}
+
 
 //-----------------------------------------------------------------------------
 // VMT parser
@@ -2176,7 +2457,7 @@ static void WriteKeyValuesToFile( const char *pFileName, KeyValues& keyValues )
 	keyValues.SaveToFile( g_pFileSystem, pFileName );
 }
 
-static void ExpandPatchFile( KeyValues& keyValues )
+static void ExpandPatchFile( KeyValues& keyValues, MaterialCacheFiles_t *pSourceFiles )
 {
 	int count = 0;
 	while( count < 10 && stricmp( keyValues.GetName(), "patch" ) == 0 )
@@ -2189,6 +2470,10 @@ static void ExpandPatchFile( KeyValues& keyValues )
 			char *pFileName = ( char * )_alloca( strlen( pIncludeFileName ) + 
 												 strlen( "materials/.vmt" ) + 1 );
 			sprintf( pFileName, "%s", pIncludeFileName );
+			if( pSourceFiles )
+			{
+				MaterialCache_AddSourceFile( *pSourceFiles, pFileName );
+			}
 			bool success = includeKeyValues->LoadFromFile( g_pFileSystem, pFileName );
 			if( success )
 			{
@@ -2223,16 +2508,20 @@ static void ExpandPatchFile( KeyValues& keyValues )
 	}
 }
 
-bool CMaterial::LoadVMTFile( KeyValues& vmtKeyValues )
+bool CMaterial::LoadVMTFile( KeyValues& vmtKeyValues, MaterialCacheFiles_t *pSourceFiles )
 {
 	char pFileName[256];
 	sprintf( pFileName, "materials/%s.vmt", GetName() );
+	if( pSourceFiles )
+	{
+		MaterialCache_AddSourceFile( *pSourceFiles, pFileName );
+	}
 	if (!vmtKeyValues.LoadFromFile( g_pFileSystem, pFileName))
 	{
 		Warning( "CMaterial::LoadVMTFile: can't open \"%s\"\n", pFileName );
 		return false;
 	}
-	ExpandPatchFile( vmtKeyValues );
+	ExpandPatchFile( vmtKeyValues, pSourceFiles );
 
 	return true;
 }
@@ -44,6 +44,7 @@
 #include "icvar.h"
 #include "stdshaders/common_hlsl_cpp_consts.h" // hack hack hack!
 #include "vstdlib/ICommandLine.h"
+#include "materialcache.h"
 
 // NOTE: This must be the last file included!!!
 #include "tier0/memdbgon.h"
@@ -937,6 +938,9 @@ void CMaterialSystem::Shutdown( )
 	// Clean up all materials..
 	RemoveAllMaterials();
 
+	// Write out anything that got compiled
+	MaterialCache_Shutdown();
+
 	// Clean up all lightmaps
 	CleanupLightmaps();
 
@@ -3416,6 +3420,8 @@ void CMaterialSystem::BeginFrame( void )
 	}
 
 	g_pShaderAPI->BeginFrame();
+
+	TextureManager()->UpdateStreaming();
 }
 
 void CMaterialSystem::EndFrame( void )
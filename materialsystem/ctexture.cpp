@@ -38,6 +38,7 @@
 #include "texturemanager.h"
 #include "utlbuffer.h"
 #include "pixelwriter.h"
+#include "texturestreaming.h"
 #include "tier0/memdbgon.h"
 
 //-----------------------------------------------------------------------------
@@ -47,6 +48,7 @@ enum InternalTextureFlags
 {
 	TEXTUREFLAGS_ERROR = (TEXTUREFLAGS_LASTFLAG << 1),
 	TEXTUREFLAGS_ALLOCATED = (TEXTUREFLAGS_LASTFLAG << 2),
+	TEXTUREFLAGS_STREAMED = (TEXTUREFLAGS_LASTFLAG << 3),
 };
 
 
@@ -168,6 +170,14 @@ public:
 //	virtual void CopyFrameBufferToMe( void );
 	virtual void CopyFrameBufferToMe( int nRenderTargetID, Rect_t *pSrcRect, Rect_t *pDstRect );
 
+	// Texture streaming
+	virtual bool IsStreamed() const;
+	virtual int GetLastBindFrame() const;
+	virtual int GetStreamedMemory( bool bFullRes ) const;
+	virtual bool IsStreamedFullRes() const;
+	virtual void QueueStream( bool bFullRes );
+	virtual bool UpdateStream();
+
 protected:
 	void ReconstructTexture();
 	void ReconstructPartialTexture( Rect_t *pRect );
@@ -194,6 +204,13 @@ protected:
 	// Compute the actual mip count based on the actual size
 	int ComputeActualMipCount( ) const;
 
+	// Shrinks the actual size down to what streamed textures load up front
+	// Returns the number of skipped mip levels
+	int ComputeStreamedLowResSize( int nMipSkipCount, int nMipCount );
+
+	// Frees the pending streaming read, if any
+	void FreeStream();
+
 	// Creates/releases the shader api texture
 	void AllocateShaderAPITextures( );
 	void FreeShaderAPITextures();
@@ -201,6 +218,7 @@ protected:
 	// Download bits
 	void DownloadTexture(Rect_t *pRect);
 	void ReconstructTextureBits(Rect_t *pRect);
+	void DownloadTextureBits( IVTFTexture *pVTFTexture );
 
 	// Gets us modifying a particular frame of our texture
 	void Modify( int iFrame );
@@ -290,6 +308,16 @@ protected:
 
 	ITextureRegenerator *m_pTextureRegenerator;
 
+	// Streaming info: the mip levels skipped at full res, with just the low
+	// mips loaded, and right now, plus the read bringing in different mips
+	unsigned char m_nFullResMipSkip;
+	unsigned char m_nLowResMipSkip;
+	unsigned char m_nMipSkipCount;
+	TextureStreamHandle_t m_hStreamJob;
+
+	// Used to pick which textures get streamed in first
+	int m_nLastBindFrame;
+
 	// Fixed-size allocator
 //	DECLARE_FIXEDSIZE_ALLOCATOR( CTexture );
 public:
@@ -374,6 +402,12 @@ CTexture::CTexture() : m_ImageFormat((ImageFormat)-1)
 	m_LowResImageHeight = 0;
 	m_pLowResImage = 0;
 
+	m_nFullResMipSkip = 0;
+	m_nLowResMipSkip = 0;
+	m_nMipSkipCount = 0;
+	m_hStreamJob = TEXTURE_STREAM_INVALID_HANDLE;
+	m_nLastBindFrame = -1;
+
 #ifdef _DEBUG
 	m_pDebugName = NULL;
 #endif
@@ -439,6 +473,8 @@ void CTexture::Shutdown()
 		m_pTextureRegenerator = NULL;
 	}
 
+	FreeStream();
+
 	// This deletes the textures,
 	FreeShaderAPITextures();
 	ReleaseTextureIDs();
@@ -804,6 +840,27 @@ int CTexture::ComputeActualSize( bool bIgnorePicmip )
 }
 
 
+//-----------------------------------------------------------------------------
+// Streamed textures load their low mips up front + stream the rest in later.
+// This keeps skipping mips until the texture fits in mat_texturestream_lowres.
+//-----------------------------------------------------------------------------
+int CTexture::ComputeStreamedLowResSize( int nMipSkipCount, int nMipCount )
+{
+	int nLowResSize = TextureStreaming_LowResSize();
+	while ( ( m_nActualWidth > nLowResSize || m_nActualHeight > nLowResSize ) &&
+			( m_nActualWidth > 1 && m_nActualHeight > 1 ) &&
+			( nMipSkipCount < nMipCount - 1 ) )
+	{
+		m_nActualWidth >>= 1;
+		m_nActualHeight >>= 1;
+		++nMipSkipCount;
+	}
+
+	m_nActualMipCount = ComputeActualMipCount();
+	return nMipSkipCount;
+}
+
+
 //-----------------------------------------------------------------------------
 // Used to modify the texture bits (procedural textures only)
 //-----------------------------------------------------------------------------
@@ -964,6 +1021,8 @@ void CTexture::Download( Rect_t *pRect )
 //-----------------------------------------------------------------------------
 void CTexture::Bind( TextureStage_t stage, int iFrame )
 {	
+	m_nLastBindFrame = g_FrameNum;
+
 	if( g_pShaderAPI->IsUsingGraphics() )
 	{
 		if( iFrame < 0 || iFrame >= m_nFrameCount )
@@ -1380,6 +1439,9 @@ IVTFTexture *CTexture::LoadTextureBitsFromFile( )
 	int nHeaderSize, nMipSkipCount, nFileSize;
 	IVTFTexture *pVTFTexture = GetScratchVTFTexture();
 
+	// Whatever was streaming in is out of date now
+	FreeStream();
+
 	// The texture name doubles as the relative file name
 	// It's assumed to have already been set by this point	
 	// Compute the cache name
@@ -1423,6 +1485,22 @@ IVTFTexture *CTexture::LoadTextureBitsFromFile( )
 	// Compute the actual texture size + format based on card information
 	nMipSkipCount = ComputeActualSize();
 
+	// If we're streaming, just load the low mips; the rest get streamed in
+	// once the texture's been used
+	if ( TextureStreaming_IsEnabled() && !IsProcedural() &&
+		( ( m_nFlags & ( TEXTUREFLAGS_NOMIP | TEXTUREFLAGS_NOLOD ) ) == 0 ) &&
+		!g_config.bShowMipLevels && !g_config.bShowLowResImage )
+	{
+		m_nFullResMipSkip = nMipSkipCount;
+		nMipSkipCount = ComputeStreamedLowResSize( nMipSkipCount, pVTFTexture->MipCount() );
+		m_nLowResMipSkip = nMipSkipCount;
+		if ( m_nLowResMipSkip != m_nFullResMipSkip )
+		{
+			m_nFlags |= TEXTUREFLAGS_STREAMED;
+		}
+	}
+	m_nMipSkipCount = nMipSkipCount;
+
 	// Determine how much of the file to read in
 	nFileSize = pVTFTexture->FileSize( nMipSkipCount );
 	buf.EnsureCapacity( nFileSize );
@@ -1469,7 +1547,7 @@ fileLoadFailed:
 	ConvertToActualFormat( pVTFTexture );
 
 	// Deactivate procedural texture...
-	m_nFlags &= ~TEXTUREFLAGS_PROCEDURAL;
+	m_nFlags &= ~(TEXTUREFLAGS_PROCEDURAL | TEXTUREFLAGS_STREAMED);
 	m_nFlags |= TEXTUREFLAGS_ERROR;
 
 	return pVTFTexture;
@@ -1692,6 +1770,15 @@ void CTexture::ReconstructTexture()
 	if (IsRenderTarget())
 		return;
 
+	DownloadTextureBits( pVTFTexture );
+}
+
+
+//-----------------------------------------------------------------------------
+// Blits the bits of all frames, faces + mips into board memory
+//-----------------------------------------------------------------------------
+void CTexture::DownloadTextureBits( IVTFTexture *pVTFTexture )
+{
 	int nFaceCount, nFirstFace;
 	GetDownloadFaceCount( nFirstFace, nFaceCount );
 	
@@ -1715,6 +1802,133 @@ void CTexture::ReconstructTexture()
 }
 
 
+//-----------------------------------------------------------------------------
+// Texture streaming
+//-----------------------------------------------------------------------------
+bool CTexture::IsStreamed() const
+{
+	return ( (m_nFlags & TEXTUREFLAGS_STREAMED) != 0 );
+}
+
+int CTexture::GetLastBindFrame() const
+{
+	return m_nLastBindFrame;
+}
+
+int CTexture::GetStreamedMemory( bool bFullRes ) const
+{
+	int nMipSkipCount = bFullRes ? m_nFullResMipSkip : m_nLowResMipSkip;
+	int nWidth = max( m_nMappingWidth >> nMipSkipCount, 1 );
+	int nHeight = max( m_nMappingHeight >> nMipSkipCount, 1 );
+	return m_nFrameCount * ImageLoader::GetMemRequired( nWidth, nHeight, m_ImageFormat, true );
+}
+
+//-----------------------------------------------------------------------------
+// Is the texture at full res, or will it be once the pending read comes in?
+//-----------------------------------------------------------------------------
+bool CTexture::IsStreamedFullRes() const
+{
+	if ( m_hStreamJob != TEXTURE_STREAM_INVALID_HANDLE )
+		return TextureStreaming_GetMipSkipCount( m_hStreamJob ) == m_nFullResMipSkip;
+
+	return m_nMipSkipCount == m_nFullResMipSkip;
+}
+
+//-----------------------------------------------------------------------------
+// Starts reading either all the mips or just the low ones
+//-----------------------------------------------------------------------------
+void CTexture::QueueStream( bool bFullRes )
+{
+	Assert( IsStreamed() );
+
+	FreeStream();
+
+	int nMipSkipCount = bFullRes ? m_nFullResMipSkip : m_nLowResMipSkip;
+	if ( nMipSkipCount == m_nMipSkipCount )
+		return;
+
+	char pCacheFileName[MATERIAL_MAX_PATH];
+	Q_snprintf( pCacheFileName, MATERIAL_MAX_PATH, "materials/%s.vtf", m_Name.String() );
+	m_hStreamJob = TextureStreaming_Read( pCacheFileName, nMipSkipCount, m_nLastBindFrame );
+}
+
+//-----------------------------------------------------------------------------
+// Uploads the pending read if it's come in. Returns true if it did.
+//-----------------------------------------------------------------------------
+bool CTexture::UpdateStream()
+{
+	if ( m_hStreamJob == TEXTURE_STREAM_INVALID_HANDLE )
+		return false;
+
+	if ( !TextureStreaming_IsDone( m_hStreamJob ) )
+	{
+		TextureStreaming_SetPriority( m_hStreamJob, m_nLastBindFrame );
+		return false;
+	}
+
+	IVTFTexture *pVTFTexture = TextureStreaming_GetTexture( m_hStreamJob );
+	int nMipSkipCount = TextureStreaming_GetMipSkipCount( m_hStreamJob );
+	bool bStreamed = false;
+	if ( pVTFTexture )
+	{
+		if ( g_pShaderAPI->IsUsingGraphics() )
+		{
+			ImageFormat dstFormat = ComputeActualFormat( pVTFTexture->Format() );
+			if ( pVTFTexture->Format() != dstFormat )
+			{
+				pVTFTexture->ConvertImageFormat( dstFormat, false );
+			}
+		}
+
+		// If the file changed since it was loaded, leave the texture alone;
+		// reloading it will pick up the changes
+		if ( ( pVTFTexture->Format() == m_ImageFormat ) &&
+			 ( pVTFTexture->FrameCount() == m_nFrameCount ) &&
+			 ( ( pVTFTexture->Width() << nMipSkipCount ) == m_nMappingWidth ) &&
+			 ( ( pVTFTexture->Height() << nMipSkipCount ) == m_nMappingHeight ) )
+		{
+			m_nActualWidth = pVTFTexture->Width();
+			m_nActualHeight = pVTFTexture->Height();
+			m_nActualMipCount = ComputeActualMipCount();
+			m_nMipSkipCount = nMipSkipCount;
+
+			// NOTE: Headless (shaderempty with -headlesstextures), nothing
+			// was ever allocated, so the read just changes the mips we track
+			if ( HasBeenAllocated() )
+			{
+				FreeShaderAPITextures();
+				AllocateShaderAPITextures();
+				DownloadTextureBits( pVTFTexture );
+				SetFilteringAndClampingMode();
+			}
+			bStreamed = true;
+		}
+	}
+
+	// If the read failed, keep the mips we've got and stop streaming this
+	// texture until it's reloaded, so the file doesn't get read every frame
+	if ( !bStreamed )
+	{
+		Warning( "Unable to stream texture \"%s\"\n", m_Name.String() );
+		m_nFullResMipSkip = m_nMipSkipCount;
+		m_nLowResMipSkip = m_nMipSkipCount;
+		m_nFlags &= ~TEXTUREFLAGS_STREAMED;
+	}
+
+	FreeStream();
+	return true;
+}
+
+void CTexture::FreeStream()
+{
+	if ( m_hStreamJob != TEXTURE_STREAM_INVALID_HANDLE )
+	{
+		TextureStreaming_Free( m_hStreamJob );
+		m_hStreamJob = TEXTURE_STREAM_INVALID_HANDLE;
+	}
+}
+
+
 void CTexture::GetLowResColorSample( float s, float t, float *color ) const
 {
 #if 1
@@ -19,6 +19,7 @@
 #endif
 
 #include "materialsystem/itexture.h"
+#include "texturestreaming.h"
 
 class Vector;
 enum TextureStage_t;
@@ -30,7 +31,7 @@ enum RenderTargetType_t
 	RENDER_TARGET_WITH_DEPTH = 2,
 };
 
-class ITextureInternal : public ITexture
+class ITextureInternal : public ITexture, public IStreamedTexture
 {
 public:
 	virtual void Bind( TextureStage_t stage, int frameNum = 0 ) = 0;
@@ -0,0 +1,339 @@
+//=========== (C) Copyright 1999 Valve, L.L.C. All rights reserved. ===========
+//
+// The copyright to the contents herein is the property of Valve, L.L.C.
+// The contents may be used and/or copied only with the written permission of
+// Valve, L.L.C., or in accordance with the terms and conditions stipulated in
+// the agreement/contract under which the contents have been supplied.
+//
+// Purpose:
+// On-disk cache of compiled materials. CMaterial decides what a compiled
+// material contains; this just keeps the blobs, checks them against the
+// files they came from and reads + writes the cache file.
+//
+//=============================================================================
+
+#include "materialcache.h"
+#include "materialsystem/materialsystem_config.h"
+#include "shaderapi.h"
+#include "IHardwareConfigInternal.h"
+#include "filesystem.h"
+#include "utldict.h"
+#include "utlbuffer.h"
+#include "checksum_crc.h"
+#include "vstdlib/strtools.h"
+#include "vstdlib/ICommandLine.h"
+
+// NOTE: This must be the last file included!!!
+#include "tier0/memdbgon.h"
+
+
+//-----------------------------------------------------------------------------
+// File layout:	int id, int version, int entry count, CRC of the entries,
+//				entries
+//		Entry:	name, signature, int source file count,
+//				source files (name, time, size), int data size, data
+//-----------------------------------------------------------------------------
+#define MATERIAL_CACHE_FILENAME		"materials/compiledmaterials.bin"
+#define MATERIAL_CACHE_ID			(('1'<<24)+('B'<<16)+('C'<<8)+'M')
+#define MATERIAL_CACHE_VERSION		1
+
+struct materialcacheentry_t
+{
+	// Hardware + config settings the shader fallbacks were chosen with
+	unsigned int				m_nSignature;
+	MaterialCacheFiles_t		m_Files;
+	CUtlVector< unsigned char >	m_Data;
+};
+
+static CUtlDict< materialcacheentry_t*, int > s_MaterialCache;
+static bool s_bMaterialCacheChecked = false;
+static bool s_bMaterialCacheEnabled = false;
+static bool s_bMaterialCacheLoaded = false;
+static bool s_bMaterialCacheDirty = false;
+static int s_nMaterialCacheHits = 0;
+static int s_nMaterialCacheCompiles = 0;
+
+
+//-----------------------------------------------------------------------------
+// Is the cache turned on?
+//-----------------------------------------------------------------------------
+bool MaterialCache_IsEnabled()
+{
+	if ( !s_bMaterialCacheChecked )
+	{
+		s_bMaterialCacheChecked = true;
+		s_bMaterialCacheEnabled = ( CommandLine()->FindParm( "-matcache" ) != 0 );
+	}
+
+	return s_bMaterialCacheEnabled;
+}
+
+
+//-----------------------------------------------------------------------------
+// Everything the shaders look at when picking a fallback, plus the settings
+// that change which material vars get parsed
+//-----------------------------------------------------------------------------
+static unsigned int ComputeSignature()
+{
+	int pSettings[] =
+	{
+		HardwareConfig()->GetDXSupportLevel(),
+		HardwareConfig()->GetNumTextureUnits(),
+		HardwareConfig()->SupportsVertexAndPixelShaders(),
+		HardwareConfig()->SupportsPixelShaders_1_4(),
+		HardwareConfig()->SupportsPixelShaders_2_0(),
+		HardwareConfig()->SupportsVertexShaders_2_0(),
+		HardwareConfig()->SupportsHardwareLighting(),
+		HardwareConfig()->SupportsHDR(),
+		HardwareConfig()->HasProjectedBumpEnv(),
+		g_config.bBumpmap,
+		g_config.bSoftwareLighting,
+		g_config.bEditMode,
+		g_pShaderAPI->IsUsingGraphics(),
+	};
+
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, pSettings, sizeof( pSettings ) );
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+//-----------------------------------------------------------------------------
+// Frees all entries
+//-----------------------------------------------------------------------------
+static void MaterialCache_Purge()
+{
+	for ( int i = s_MaterialCache.First(); i != s_MaterialCache.InvalidIndex(); i = s_MaterialCache.Next( i ) )
+	{
+		delete s_MaterialCache[i];
+	}
+	s_MaterialCache.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Reads the cache file; a missing, stale or damaged file just means an
+// empty cache
+//-----------------------------------------------------------------------------
+static void MaterialCache_Load()
+{
+	s_bMaterialCacheLoaded = true;
+
+	FileHandle_t f = g_pFileSystem->Open( MATERIAL_CACHE_FILENAME, "rb" );
+	if ( !f )
+		return;
+
+	int fileSize = g_pFileSystem->Size( f );
+	CUtlBuffer buf( 0, fileSize );
+	g_pFileSystem->Read( buf.Base(), fileSize, f );
+	g_pFileSystem->Close( f );
+
+	if ( buf.GetInt() != MATERIAL_CACHE_ID || buf.GetInt() != MATERIAL_CACHE_VERSION )
+		return;
+
+	int nEntries = buf.GetInt();
+	CRC32_t crc = buf.GetUnsignedInt();
+	if ( !buf.IsValid() )
+		return;
+
+	CRC32_t check;
+	CRC32_Init( &check );
+	CRC32_ProcessBuffer( &check, (void*)buf.PeekGet(), fileSize - buf.TellGet() );
+	CRC32_Final( &check );
+	if ( check != crc )
+	{
+		Warning( "Material cache \"%s\" is damaged, rebuilding it\n", MATERIAL_CACHE_FILENAME );
+		return;
+	}
+
+	char pName[MATERIAL_MAX_PATH];
+	for ( int i = 0; i < nEntries; ++i )
+	{
+		buf.GetString( pName, sizeof( pName ) );
+
+		materialcacheentry_t *pEntry = new materialcacheentry_t;
+		pEntry->m_nSignature = buf.GetUnsignedInt();
+
+		int nFiles = buf.GetInt();
+		for ( int j = 0; ( j < nFiles ) && buf.IsValid(); ++j )
+		{
+			MaterialCacheFile_t &file = pEntry->m_Files[ pEntry->m_Files.AddToTail() ];
+			buf.GetString( file.m_pFileName, sizeof( file.m_pFileName ) );
+			file.m_nFileTime = buf.GetInt();
+			file.m_nFileSize = buf.GetUnsignedInt();
+		}
+
+		int nDataSize = buf.GetInt();
+		if ( buf.IsValid() && ( nDataSize > 0 ) && ( nDataSize <= fileSize - buf.TellGet() ) )
+		{
+			pEntry->m_Data.AddMultipleToTail( nDataSize );
+			buf.Get( pEntry->m_Data.Base(), nDataSize );
+		}
+
+		if ( !buf.IsValid() || ( pEntry->m_Data.Count() == 0 ) )
+		{
+			delete pEntry;
+			MaterialCache_Purge();
+			return;
+		}
+
+		s_MaterialCache.Insert( pName, pEntry );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Records the current time + size of a source file
+//-----------------------------------------------------------------------------
+void MaterialCache_AddSourceFile( MaterialCacheFiles_t &files, char const *pFileName )
+{
+	MaterialCacheFile_t &file = files[ files.AddToTail() ];
+	Q_strncpy( file.m_pFileName, pFileName, sizeof( file.m_pFileName ) );
+
+	// Both of these come back zero for a missing file, so a file
+	// showing up later will also invalidate the material
+	file.m_nFileTime = g_pFileSystem->GetFileTime( pFileName );
+	file.m_nFileSize = g_pFileSystem->Size( pFileName );
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds an up-to-date compiled material
+//-----------------------------------------------------------------------------
+bool MaterialCache_Find( char const *pMaterialName, CUtlBuffer &buf )
+{
+	if ( !s_bMaterialCacheLoaded )
+	{
+		MaterialCache_Load();
+	}
+
+	int i = s_MaterialCache.Find( pMaterialName );
+	if ( i == s_MaterialCache.InvalidIndex() )
+		return false;
+
+	materialcacheentry_t *pEntry = s_MaterialCache[i];
+	if ( pEntry->m_nSignature != ComputeSignature() )
+		return false;
+
+	for ( int j = 0; j < pEntry->m_Files.Count(); ++j )
+	{
+		MaterialCacheFile_t const &file = pEntry->m_Files[j];
+		if ( ( g_pFileSystem->GetFileTime( file.m_pFileName ) != file.m_nFileTime ) ||
+			 ( g_pFileSystem->Size( file.m_pFileName ) != file.m_nFileSize ) )
+		{
+			return false;
+		}
+	}
+
+	buf.SetExternalBuffer( pEntry->m_Data.Base(), pEntry->m_Data.Count() );
+	++s_nMaterialCacheHits;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Stores a compiled material
+//-----------------------------------------------------------------------------
+void MaterialCache_Store( char const *pMaterialName, MaterialCacheFiles_t const &files, CUtlBuffer const &buf )
+{
+	if ( !s_bMaterialCacheLoaded )
+	{
+		MaterialCache_Load();
+	}
+
+	materialcacheentry_t *pEntry;
+	int i = s_MaterialCache.Find( pMaterialName );
+	if ( i != s_MaterialCache.InvalidIndex() )
+	{
+		pEntry = s_MaterialCache[i];
+	}
+	else
+	{
+		pEntry = new materialcacheentry_t;
+		s_MaterialCache.Insert( pMaterialName, pEntry );
+	}
+
+	pEntry->m_nSignature = ComputeSignature();
+	pEntry->m_Files.CopyArray( files.Base(), files.Count() );
+	pEntry->m_Data.CopyArray( (unsigned char const*)buf.Base(), buf.TellPut() );
+
+	s_bMaterialCacheDirty = true;
+	++s_nMaterialCacheCompiles;
+}
+
+
+//-----------------------------------------------------------------------------
+// Writes the cache file
+//-----------------------------------------------------------------------------
+static void MaterialCache_Save()
+{
+	CUtlBuffer entries( 0, 64 * 1024 );
+	for ( int i = s_MaterialCache.First(); i != s_MaterialCache.InvalidIndex(); i = s_MaterialCache.Next( i ) )
+	{
+		materialcacheentry_t *pEntry = s_MaterialCache[i];
+		entries.PutString( s_MaterialCache.GetElementName( i ) );
+		entries.PutUnsignedInt( pEntry->m_nSignature );
+
+		entries.PutInt( pEntry->m_Files.Count() );
+		for ( int j = 0; j < pEntry->m_Files.Count(); ++j )
+		{
+			entries.PutString( pEntry->m_Files[j].m_pFileName );
+			entries.PutInt( pEntry->m_Files[j].m_nFileTime );
+			entries.PutUnsignedInt( pEntry->m_Files[j].m_nFileSize );
+		}
+
+		entries.PutInt( pEntry->m_Data.Count() );
+		entries.Put( pEntry->m_Data.Base(), pEntry->m_Data.Count() );
+	}
+
+	if ( !entries.IsValid() )
+		return;
+
+	CRC32_t crc;
+	CRC32_Init( &crc );
+	CRC32_ProcessBuffer( &crc, entries.Base(), entries.TellPut() );
+	CRC32_Final( &crc );
+
+	FileHandle_t f = g_pFileSystem->Open( MATERIAL_CACHE_FILENAME, "wb" );
+	if ( !f )
+	{
+		Warning( "Unable to write material cache \"%s\"\n", MATERIAL_CACHE_FILENAME );
+		return;
+	}
+
+	CUtlBuffer header;
+	header.PutInt( MATERIAL_CACHE_ID );
+	header.PutInt( MATERIAL_CACHE_VERSION );
+	header.PutInt( s_MaterialCache.Count() );
+	header.PutUnsignedInt( crc );
+
+	g_pFileSystem->Write( header.Base(), header.TellPut(), f );
+	g_pFileSystem->Write( entries.Base(), entries.TellPut(), f );
+	g_pFileSystem->Close( f );
+}
+
+
+//-----------------------------------------------------------------------------
+// Saves the cache if it changed + frees it
+//-----------------------------------------------------------------------------
+void MaterialCache_Shutdown()
+{
+	if ( !s_bMaterialCacheLoaded )
+		return;
+
+	DevMsg( "Material cache: %d materials loaded compiled, %d compiled\n",
+		s_nMaterialCacheHits, s_nMaterialCacheCompiles );
+
+	if ( s_bMaterialCacheDirty )
+	{
+		MaterialCache_Save();
+	}
+
+	MaterialCache_Purge();
+	s_bMaterialCacheLoaded = false;
+	s_bMaterialCacheDirty = false;
+	s_nMaterialCacheHits = 0;
+	s_nMaterialCacheCompiles = 0;
+}
@@ -0,0 +1,67 @@
+//=========== (C) Copyright 1999 Valve, L.L.C. All rights reserved. ===========
+//
+// The copyright to the contents herein is the property of Valve, L.L.C.
+// The contents may be used and/or copied only with the written permission of
+// Valve, L.L.C., or in accordance with the terms and conditions stipulated in
+// the agreement/contract under which the contents have been supplied.
+//
+// Purpose:
+// On-disk cache of compiled materials, so materials whose .vmt files haven't
+// changed skip the text parse and the shader fallback search
+//
+//=============================================================================
+#ifndef MATERIALCACHE_H
+#define MATERIALCACHE_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "utlvector.h"
+#include "materialsystem_global.h"
+
+class CUtlBuffer;
+
+
+//-----------------------------------------------------------------------------
+// A source file a compiled material was built from
+//-----------------------------------------------------------------------------
+struct MaterialCacheFile_t
+{
+	char			m_pFileName[MATERIAL_MAX_PATH];
+	long			m_nFileTime;
+	unsigned int	m_nFileSize;
+};
+
+typedef CUtlVector< MaterialCacheFile_t > MaterialCacheFiles_t;
+
+
+//-----------------------------------------------------------------------------
+// Is the cache turned on? (-matcache on the command line)
+//-----------------------------------------------------------------------------
+bool MaterialCache_IsEnabled();
+
+//-----------------------------------------------------------------------------
+// Records the current time + size of a file a material is being built from
+//-----------------------------------------------------------------------------
+void MaterialCache_AddSourceFile( MaterialCacheFiles_t &files, char const *pFileName );
+
+//-----------------------------------------------------------------------------
+// Points buf at the compiled data for a material. Fails if there isn't any,
+// if any of its source files changed, or if it was compiled for different
+// hardware or config settings than the current ones
+//-----------------------------------------------------------------------------
+bool MaterialCache_Find( char const *pMaterialName, CUtlBuffer &buf );
+
+//-----------------------------------------------------------------------------
+// Stores the compiled data for a material, replacing any old version
+//-----------------------------------------------------------------------------
+void MaterialCache_Store( char const *pMaterialName, MaterialCacheFiles_t const &files, CUtlBuffer const &buf );
+
+//-----------------------------------------------------------------------------
+// Writes the cache back to disk if anything was added, then frees it
+//-----------------------------------------------------------------------------
+void MaterialCache_Shutdown();
+
+
+#endif // MATERIALCACHE_H
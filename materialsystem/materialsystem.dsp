@@ -126,6 +126,10 @@ SOURCE=..\public\characterset.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=..\public\checksum_crc.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\CMaterial.cpp
 # SUBTRACT CPP /YX /Yc /Yu
 # End Source File
@@ -181,6 +185,10 @@ SOURCE=.\MaterialSystem_Global.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\materialcache.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\Public\mathlib.cpp
 # End Source File
 # Begin Source File
@@ -207,6 +215,10 @@ SOURCE=.\TextureManager.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\texturestreaming.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=..\Public\tgaloader.cpp
 # End Source File
 # Begin Source File
@@ -351,6 +363,10 @@ SOURCE=..\public\KeyValues.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\materialcache.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\public\materialsystem\materialsystem_config.h
 # End Source File
 # Begin Source File
@@ -399,6 +415,10 @@ SOURCE=.\TextureManager.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\texturestreaming.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\Public\TGALoader.h
 # End Source File
 # Begin Source File
@@ -19,6 +19,7 @@
 #include "shaderapi.h"
 #include "materialsystem/imesh.h"
 #include "tier0/dbg.h"
+#include "vstdlib/ICommandLine.h"
 
 
 //-----------------------------------------------------------------------------
@@ -1112,9 +1113,13 @@ bool CShaderAPIEmpty::Prefer16BitTextures( ) const
 }
 
 // Can we download textures?
+// With -headlesstextures, file textures still get loaded + streamed (nothing
+// gets downloaded, since CTexture checks IsUsingGraphics) so loading and
+// streaming can be run and timed without a device
 bool CShaderAPIEmpty::CanDownloadTextures() const
 {
-	return false;
+	static bool s_bHeadlessTextures = ( CommandLine()->FindParm( "-headlesstextures" ) != 0 );
+	return s_bHeadlessTextures;
 }
 
 // Are we using graphics?
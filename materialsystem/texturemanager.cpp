@@ -27,6 +27,8 @@
 #include "basetypes.h"
 #include "utlbuffer.h"
 #include "filesystem.h"
+#include "convar.h"
+#include "texturestreaming.h"
 #include "tier0/memdbgon.h"
 
 // Render texture declaration
@@ -275,6 +277,10 @@ public:
 	// Generates an error texture pattern
 	virtual void GenerateErrorTexture( ITexture *pTexture, IVTFTexture *pVTFTexture );
 
+	// Texture streaming
+	virtual void UpdateStreaming();
+	void PrintStreamingStatus();
+
 protected:
 	ITextureInternal *FindTexture( const char *textureName, bool isBump = false );
 	ITextureInternal *LoadTexture( const char *textureName, bool isBump );
@@ -376,6 +382,8 @@ void CTextureManager::Shutdown()
 		ITextureInternal::Destroy( m_TextureList[i] );
 	}
 	m_TextureList.RemoveAll();
+
+	TextureStreaming_Shutdown();
 }
 
 
@@ -656,3 +664,63 @@ void CTextureManager::DebugPrintUsedTextures( void )
 		Warning( "Texture \"%s\" has refcount %d\n", pTexture->GetName(), pTexture->GetReferenceCount() );
 	}
 }
+
+
+//-----------------------------------------------------------------------------
+// Uploads streamed textures that came in + decides which ones to stream in
+// or out next
+//-----------------------------------------------------------------------------
+void CTextureManager::UpdateStreaming()
+{
+	if ( !TextureStreaming_IsEnabled() || !g_pShaderAPI->CanDownloadTextures() )
+		return;
+
+	CUtlVector< IStreamedTexture* > textures( 0, m_TextureList.Count() );
+	for ( int i = 0; i < m_TextureList.Count(); ++i )
+	{
+		textures.AddToTail( m_TextureList[i] );
+	}
+	TextureStreaming_Update( textures.Base(), textures.Count() );
+}
+
+
+//-----------------------------------------------------------------------------
+// Prints what texture streaming is up to
+//-----------------------------------------------------------------------------
+void CTextureManager::PrintStreamingStatus()
+{
+	int nStreamed = 0;
+	int nFullRes = 0;
+	int nMemory = 0;
+	for ( int i = 0; i < m_TextureList.Count(); ++i )
+	{
+		ITextureInternal *pTexture = m_TextureList[i];
+		if ( !pTexture->IsStreamed() )
+			continue;
+
+		bool bFullRes = pTexture->IsStreamedFullRes();
+		++nStreamed;
+		if ( bFullRes )
+		{
+			++nFullRes;
+		}
+		nMemory += pTexture->GetStreamedMemory( bFullRes );
+	}
+
+	int nReads, nBytesRead, nPending;
+	float flReadTime;
+	TextureStreaming_GetStats( nReads, nBytesRead, flReadTime, nPending );
+
+	Msg( "texture streaming %s: %d streamed textures, %d at full res, %.1f of %.1f MB\n", 
+		TextureStreaming_IsEnabled() ? "on" : "off", nStreamed, nFullRes, 
+		nMemory / ( 1024.0f * 1024.0f ), TextureStreaming_Budget() / ( 1024.0f * 1024.0f ) );
+	Msg( "%d reads, %.1f MB in %.2f seconds, %d waiting\n", 
+		nReads, nBytesRead / ( 1024.0f * 1024.0f ), flReadTime, nPending );
+}
+
+static void TextureStreamStatus_f( void )
+{
+	s_TextureManager.PrintStreamingStatus();
+}
+
+static ConCommand mat_texturestream_status( "mat_texturestream_status", TextureStreamStatus_f, "Shows how many textures are streamed in and how long the reads took." );
@@ -71,6 +71,10 @@ public:
 
 	// GR - named RT
 	virtual ITextureInternal *CreateNamedRenderTargetTexture( const char *pRTName, int w, int h, ImageFormat fmt, bool depth, bool bClampTexCoords, bool bAutoMipMap ) = 0;
+
+	// Uploads streamed textures that came in + decides which ones to stream
+	// in or out next. Call once a frame.
+	virtual void UpdateStreaming() = 0;
 };
 
 
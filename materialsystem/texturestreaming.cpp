@@ -0,0 +1,593 @@
+//=========== (C) Copyright 1999 Valve, L.L.C. All rights reserved. ===========
+//
+// The copyright to the contents herein is the property of Valve, L.L.C.
+// The contents may be used and/or copied only with the written permission of
+// Valve, L.L.C., or in accordance with the terms and conditions stipulated in
+// the agreement/contract under which the contents have been supplied.
+//
+// Purpose:
+// The texture streaming thread. It only reads + unserializes .vtf files into
+// textures of its own; converting and uploading the bits happens in CTexture
+// on the main thread, since the image conversion uses the (unlocked) scratch
+// allocator. The filesystem isn't thread safe either (pack files share one
+// FILE*, Open touches the list of opened files), so the thread reads loose
+// files through stdio handles of its own, and files that are only in a pack
+// file get handed back to the main thread, which reads one of them a frame.
+//
+//=============================================================================
+
+#include "texturestreaming.h"
+#include "materialsystem_global.h"
+#include "filesystem.h"
+#include "vtf/vtf.h"
+#include "utlbuffer.h"
+#include "utllinkedlist.h"
+#include "utlvector.h"
+#include "convar.h"
+#include "vstdlib/strtools.h"
+#include "tier0/threadtools.h"
+#include "tier0/platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// NOTE: This must be the last file included!!!
+#include "tier0/memdbgon.h"
+
+
+static ConVar mat_texturestream( "mat_texturestream", "0", 0, "Load file textures at low res and stream in the higher mips as they get used. Applies to textures loaded after it's changed." );
+static ConVar mat_texturestream_lowres( "mat_texturestream_lowres", "64", 0, "Largest dimension file textures are loaded at before the higher mips stream in." );
+static ConVar mat_texturestream_budget( "mat_texturestream_budget", "256", 0, "Megabytes streamed textures may use at full res." );
+static ConVar mat_texturestream_uploads( "mat_texturestream_uploads", "8", 0, "Max number of streamed textures uploaded per frame." );
+static ConVar mat_texturestream_reads( "mat_texturestream_reads", "4", 0, "Max number of streaming reads queued per frame." );
+
+
+//-----------------------------------------------------------------------------
+// Settings
+//-----------------------------------------------------------------------------
+bool TextureStreaming_IsEnabled()
+{
+	return mat_texturestream.GetInt() != 0;
+}
+
+int TextureStreaming_LowResSize()
+{
+	return max( mat_texturestream_lowres.GetInt(), 1 );
+}
+
+int TextureStreaming_Budget()
+{
+	return max( mat_texturestream_budget.GetInt(), 0 ) * 1024 * 1024;
+}
+
+int TextureStreaming_MaxUploadsPerFrame()
+{
+	return max( mat_texturestream_uploads.GetInt(), 1 );
+}
+
+int TextureStreaming_MaxReadsPerFrame()
+{
+	return max( mat_texturestream_reads.GetInt(), 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// A queued read
+//-----------------------------------------------------------------------------
+enum
+{
+	STREAMJOB_PENDING = 0,
+	STREAMJOB_READING,
+	STREAMJOB_MAINTHREAD,		// only in a pack file; the main thread reads it
+	STREAMJOB_DONE,
+};
+
+struct texturestreamjob_t
+{
+	char			m_pFileName[MATERIAL_MAX_PATH];
+	char			m_pLocalPath[512];		// what the streaming thread opens
+	int				m_nFileSize;		// what the filesystem says the size is
+	int				m_nMipSkipCount;
+	int				m_nPriority;
+	int				m_nState;
+	bool			m_bFreed;			// freed while it was being read
+	IVTFTexture		*m_pVTFTexture;		// NULL if the read failed
+};
+
+static CThreadMutex										s_StreamMutex;
+static CUtlLinkedList< texturestreamjob_t*, int >		s_StreamPending;
+static CUtlLinkedList< texturestreamjob_t*, int >		s_StreamMainThread;
+
+static ThreadHandle_t	s_hStreamThread = NULL;
+static CThreadEvent		s_StreamWake;
+static volatile bool	s_bStreamThreadExit = false;
+
+// Statistics for mat_texturestream_status
+static int				s_nStreamReads;
+static int				s_nStreamBytesRead;
+static double			s_flStreamReadTime;
+
+
+//-----------------------------------------------------------------------------
+// The file a read goes to: a stdio handle on the streaming thread, the
+// filesystem on the main thread
+//-----------------------------------------------------------------------------
+class CStreamFile
+{
+public:
+	CStreamFile() : m_fp( NULL ), m_hFile( FILESYSTEM_INVALID_HANDLE ) {}
+	~CStreamFile() { Close(); }
+
+	// NOTE: If a pack file shadows the loose file, the sizes usually differ;
+	// this clears the local path so the main thread reads it instead
+	bool Open( texturestreamjob_t *pJob )
+	{
+		if ( pJob->m_pLocalPath[0] )
+		{
+			m_fp = fopen( pJob->m_pLocalPath, "rb" );
+			if ( !m_fp )
+				return false;
+
+			fseek( m_fp, 0, SEEK_END );
+			if ( ftell( m_fp ) != pJob->m_nFileSize )
+			{
+				Close();
+				pJob->m_pLocalPath[0] = 0;
+				return false;
+			}
+			fseek( m_fp, 0, SEEK_SET );
+			return true;
+		}
+
+		m_hFile = g_pFileSystem->Open( pJob->m_pFileName, "rb" );
+		return ( m_hFile != FILESYSTEM_INVALID_HANDLE );
+	}
+
+	int Read( void *pOutput, int nSize )
+	{
+		if ( m_fp )
+			return fread( pOutput, 1, nSize, m_fp );
+		return g_pFileSystem->Read( pOutput, nSize, m_hFile );
+	}
+
+	void Seek( int nPos )
+	{
+		if ( m_fp )
+		{
+			fseek( m_fp, nPos, SEEK_SET );
+		}
+		else
+		{
+			g_pFileSystem->Seek( m_hFile, nPos, FILESYSTEM_SEEK_HEAD );
+		}
+	}
+
+	void Close()
+	{
+		if ( m_fp )
+		{
+			fclose( m_fp );
+			m_fp = NULL;
+		}
+		if ( m_hFile != FILESYSTEM_INVALID_HANDLE )
+		{
+			g_pFileSystem->Close( m_hFile );
+			m_hFile = FILESYSTEM_INVALID_HANDLE;
+		}
+	}
+
+private:
+	FILE			*m_fp;
+	FileHandle_t	m_hFile;
+};
+
+
+//-----------------------------------------------------------------------------
+// Reads a .vtf file minus its nMipSkipCount largest mips. This reads the
+// header and then only the image data for the mips we want; CTexture already
+// has the low-res image. Returns the number of bytes read, 0 if it failed.
+//-----------------------------------------------------------------------------
+static int StreamReadTexture( texturestreamjob_t *pJob )
+{
+	CStreamFile file;
+	if ( !file.Open( pJob ) )
+		return 0;
+
+	int nHeaderSize = VTFFileHeaderSize();
+	CUtlBuffer buf;
+	buf.EnsureCapacity( nHeaderSize );
+	if ( file.Read( buf.Base(), nHeaderSize ) != nHeaderSize )
+		return 0;
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, nHeaderSize );
+
+	// NOTE: Quiet, since this runs on the streaming thread; CTexture reports
+	// failed reads on the main thread
+	IVTFTexture *pVTFTexture = CreateVTFTexture();
+	if ( !pVTFTexture->Unserialize( buf, true, 0, true ) || ( pJob->m_nMipSkipCount >= pVTFTexture->MipCount() ) )
+	{
+		DestroyVTFTexture( pVTFTexture );
+		return 0;
+	}
+
+	int nImageOffset, nImageSize;
+	pVTFTexture->MipRangeFileInfo( pJob->m_nMipSkipCount, &nImageOffset, &nImageSize );
+
+	buf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, 0 );
+	buf.EnsureCapacity( nImageSize );
+	file.Seek( nImageOffset );
+	if ( file.Read( buf.Base(), nImageSize ) != nImageSize )
+	{
+		DestroyVTFTexture( pVTFTexture );
+		return 0;
+	}
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, nImageSize );
+	file.Close();
+
+	if ( !pVTFTexture->UnserializeMipRange( buf, pJob->m_nMipSkipCount, true ) )
+	{
+		DestroyVTFTexture( pVTFTexture );
+		return 0;
+	}
+
+	pJob->m_pVTFTexture = pVTFTexture;
+	return nHeaderSize + nImageSize;
+}
+
+static void StreamFreeJob( texturestreamjob_t *pJob )
+{
+	if ( pJob->m_pVTFTexture )
+	{
+		DestroyVTFTexture( pJob->m_pVTFTexture );
+	}
+	delete pJob;
+}
+
+// Finds the job with the highest priority. Call with s_StreamMutex locked.
+static int StreamFindBestJob( CUtlLinkedList< texturestreamjob_t*, int > &list )
+{
+	int nBest = list.InvalidIndex();
+	for ( int i = list.Head(); i != list.InvalidIndex(); i = list.Next( i ) )
+	{
+		if ( ( nBest == list.InvalidIndex() ) || ( list[i]->m_nPriority > list[nBest]->m_nPriority ) )
+		{
+			nBest = i;
+		}
+	}
+	return nBest;
+}
+
+// Call with s_StreamMutex locked
+static void StreamAddStats( double flStartTime, int nBytesRead )
+{
+	s_flStreamReadTime += Plat_FloatTime() - flStartTime;
+	s_nStreamBytesRead += nBytesRead;
+	s_nStreamReads++;
+}
+
+
+//-----------------------------------------------------------------------------
+// Streaming thread: reads the pending job with the highest priority
+//-----------------------------------------------------------------------------
+static unsigned TextureStream_ThreadFunc( void *pParam )
+{
+	while ( !s_bStreamThreadExit )
+	{
+		texturestreamjob_t *pJob = NULL;
+
+		s_StreamMutex.Lock();
+		int nBest = StreamFindBestJob( s_StreamPending );
+		if ( nBest != s_StreamPending.InvalidIndex() )
+		{
+			pJob = s_StreamPending[nBest];
+			pJob->m_nState = STREAMJOB_READING;
+			s_StreamPending.Remove( nBest );
+		}
+		s_StreamMutex.Unlock();
+
+		if ( !pJob )
+		{
+			s_StreamWake.Wait( 100 );
+			continue;
+		}
+
+		// NOTE: A failed read just leaves m_pVTFTexture NULL; CTexture
+		// reports it on the main thread
+		double flStartTime = Plat_FloatTime();
+		int nBytesRead = StreamReadTexture( pJob );
+
+		s_StreamMutex.Lock();
+		if ( pJob->m_bFreed )
+		{
+			StreamFreeJob( pJob );
+		}
+		else if ( !pJob->m_pLocalPath[0] )
+		{
+			pJob->m_nState = STREAMJOB_MAINTHREAD;
+			s_StreamMainThread.AddToTail( pJob );
+		}
+		else
+		{
+			StreamAddStats( flStartTime, nBytesRead );
+			pJob->m_nState = STREAMJOB_DONE;
+		}
+		s_StreamMutex.Unlock();
+	}
+
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Queues a read
+//-----------------------------------------------------------------------------
+TextureStreamHandle_t TextureStreaming_Read( char const *pFileName, int nMipSkipCount, int nPriority )
+{
+	texturestreamjob_t *pJob = new texturestreamjob_t;
+	Q_strncpy( pJob->m_pFileName, pFileName, sizeof( pJob->m_pFileName ) );
+	pJob->m_nMipSkipCount = nMipSkipCount;
+	pJob->m_nPriority = nPriority;
+	pJob->m_nState = STREAMJOB_PENDING;
+	pJob->m_bFreed = false;
+	pJob->m_pVTFTexture = NULL;
+
+	// Resolve the loose file here, since the filesystem can only be used on
+	// this thread. The streaming thread checks the size against it.
+	pJob->m_pLocalPath[0] = 0;
+	pJob->m_nFileSize = -1;
+	if ( ( g_pFileSystem->GetLocalPathLen( pFileName ) < (int)sizeof( pJob->m_pLocalPath ) ) &&
+		 g_pFileSystem->GetLocalPath( pFileName, pJob->m_pLocalPath ) )
+	{
+		pJob->m_nFileSize = g_pFileSystem->Size( pFileName );
+	}
+
+	s_StreamMutex.Lock();
+	if ( !pJob->m_pLocalPath[0] )
+	{
+		pJob->m_nState = STREAMJOB_MAINTHREAD;
+		s_StreamMainThread.AddToTail( pJob );
+		s_StreamMutex.Unlock();
+		return pJob;
+	}
+
+	if ( !s_hStreamThread )
+	{
+		s_bStreamThreadExit = false;
+		s_hStreamThread = Plat_CreateThread( TextureStream_ThreadFunc, NULL, "Texture Streaming" );
+	}
+	s_StreamPending.AddToTail( pJob );
+	s_StreamMutex.Unlock();
+
+	s_StreamWake.Set();
+	return pJob;
+}
+
+//-----------------------------------------------------------------------------
+// Reads the file that's only in a pack file with the highest priority, if
+// there is one. The filesystem can't be used on the streaming thread.
+//-----------------------------------------------------------------------------
+static void StreamReadMainThreadJob()
+{
+	s_StreamMutex.Lock();
+	texturestreamjob_t *pJob = NULL;
+	int nBest = StreamFindBestJob( s_StreamMainThread );
+	if ( nBest != s_StreamMainThread.InvalidIndex() )
+	{
+		pJob = s_StreamMainThread[nBest];
+		s_StreamMainThread.Remove( nBest );
+	}
+	s_StreamMutex.Unlock();
+
+	if ( !pJob )
+		return;
+
+	double flStartTime = Plat_FloatTime();
+	int nBytesRead = StreamReadTexture( pJob );
+
+	CAutoLock lock( s_StreamMutex );
+	StreamAddStats( flStartTime, nBytesRead );
+	pJob->m_nState = STREAMJOB_DONE;
+}
+
+void TextureStreaming_SetPriority( TextureStreamHandle_t hJob, int nPriority )
+{
+	// The streaming thread only looks at this when picking the next job,
+	// and a stale value just changes the order
+	hJob->m_nPriority = nPriority;
+}
+
+
+//-----------------------------------------------------------------------------
+// Sorts streamed textures, most recently used first
+//-----------------------------------------------------------------------------
+static int __cdecl CompareLastBindFrame( const void *p1, const void *p2 )
+{
+	IStreamedTexture *pTexture1 = *(IStreamedTexture**)p1;
+	IStreamedTexture *pTexture2 = *(IStreamedTexture**)p2;
+	return pTexture2->GetLastBindFrame() - pTexture1->GetLastBindFrame();
+}
+
+
+//-----------------------------------------------------------------------------
+// Uploads streamed textures that came in + decides which ones to stream in
+// or out next
+//-----------------------------------------------------------------------------
+void TextureStreaming_Update( IStreamedTexture **ppTextures, int nCount )
+{
+	StreamReadMainThreadJob();
+
+	// Upload whatever came in, and add up the memory streamed textures will
+	// use once the reads that are still pending come in
+	CUtlVector< IStreamedTexture* > streamed( 0, nCount );
+	int nUploads = 0;
+	int nMaxUploads = TextureStreaming_MaxUploadsPerFrame();
+	int nMemory = 0;
+	int i;
+	for ( i = 0; i < nCount; ++i )
+	{
+		IStreamedTexture *pTexture = ppTextures[i];
+		if ( !pTexture->IsStreamed() )
+			continue;
+
+		if ( ( nUploads < nMaxUploads ) && pTexture->UpdateStream() )
+		{
+			++nUploads;
+
+			// A texture whose read failed isn't streamed anymore
+			if ( !pTexture->IsStreamed() )
+				continue;
+		}
+
+		nMemory += pTexture->GetStreamedMemory( pTexture->IsStreamedFullRes() );
+		streamed.AddToTail( pTexture );
+	}
+
+	if ( streamed.Count() == 0 )
+		return;
+
+	qsort( streamed.Base(), streamed.Count(), sizeof( IStreamedTexture* ), CompareLastBindFrame );
+
+	// Stream in the most recently used textures first. If one doesn't fit,
+	// make room by streaming out textures that were used less recently.
+	// Queueing a read touches the filesystem, so only a few go per frame;
+	// the rest get queued on later frames.
+	int nBudget = TextureStreaming_Budget();
+	int nReads = TextureStreaming_MaxReadsPerFrame();
+	int nOldest = streamed.Count() - 1;
+	for ( i = 0; ( i < streamed.Count() ) && ( nReads > 0 ); ++i )
+	{
+		IStreamedTexture *pTexture = streamed[i];
+		if ( pTexture->IsStreamedFullRes() )
+			continue;
+
+		int nExtra = pTexture->GetStreamedMemory( true ) - pTexture->GetStreamedMemory( false );
+		while ( ( nMemory + nExtra > nBudget ) && ( nOldest > i ) && ( nReads > 0 ) )
+		{
+			IStreamedTexture *pOldTexture = streamed[nOldest--];
+			if ( pOldTexture->IsStreamedFullRes() && 
+				( pOldTexture->GetLastBindFrame() < pTexture->GetLastBindFrame() ) )
+			{
+				pOldTexture->QueueStream( false );
+				nMemory -= pOldTexture->GetStreamedMemory( true ) - pOldTexture->GetStreamedMemory( false );
+				--nReads;
+			}
+		}
+
+		if ( ( nMemory + nExtra > nBudget ) || ( nReads == 0 ) )
+			break;
+
+		pTexture->QueueStream( true );
+		nMemory += nExtra;
+		--nReads;
+	}
+
+	// This only happens if the budget was lowered
+	for ( i = streamed.Count(); ( nMemory > nBudget ) && ( nReads > 0 ) && ( --i >= 0 ); )
+	{
+		IStreamedTexture *pTexture = streamed[i];
+		if ( pTexture->IsStreamedFullRes() )
+		{
+			pTexture->QueueStream( false );
+			nMemory -= pTexture->GetStreamedMemory( true ) - pTexture->GetStreamedMemory( false );
+			--nReads;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Results
+//-----------------------------------------------------------------------------
+bool TextureStreaming_IsDone( TextureStreamHandle_t hJob )
+{
+	CAutoLock lock( s_StreamMutex );
+	return hJob->m_nState == STREAMJOB_DONE;
+}
+
+IVTFTexture *TextureStreaming_GetTexture( TextureStreamHandle_t hJob )
+{
+	Assert( hJob->m_nState == STREAMJOB_DONE );
+	return hJob->m_pVTFTexture;
+}
+
+int TextureStreaming_GetMipSkipCount( TextureStreamHandle_t hJob )
+{
+	return hJob->m_nMipSkipCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Frees a read. One that's being read right now gets freed by the streaming
+// thread when it's done, so this never waits on the disk.
+//-----------------------------------------------------------------------------
+void TextureStreaming_Free( TextureStreamHandle_t hJob )
+{
+	CAutoLock lock( s_StreamMutex );
+
+	switch ( hJob->m_nState )
+	{
+	case STREAMJOB_PENDING:
+		s_StreamPending.Remove( s_StreamPending.Find( hJob ) );
+		StreamFreeJob( hJob );
+		break;
+
+	case STREAMJOB_MAINTHREAD:
+		s_StreamMainThread.Remove( s_StreamMainThread.Find( hJob ) );
+		StreamFreeJob( hJob );
+		break;
+
+	case STREAMJOB_READING:
+		hJob->m_bFreed = true;
+		break;
+
+	default:
+		StreamFreeJob( hJob );
+		break;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Statistics
+//-----------------------------------------------------------------------------
+void TextureStreaming_GetStats( int &nReads, int &nBytesRead, float &flReadTime, int &nPending )
+{
+	CAutoLock lock( s_StreamMutex );
+	nReads = s_nStreamReads;
+	nBytesRead = s_nStreamBytesRead;
+	flReadTime = (float)s_flStreamReadTime;
+	nPending = s_StreamPending.Count() + s_StreamMainThread.Count();
+}
+
+
+//-----------------------------------------------------------------------------
+// Shutdown
+//-----------------------------------------------------------------------------
+void TextureStreaming_Shutdown()
+{
+	if ( s_hStreamThread )
+	{
+		s_bStreamThreadExit = true;
+		s_StreamWake.Set();
+		Plat_JoinThread( s_hStreamThread );
+		s_hStreamThread = NULL;
+	}
+
+	// Every texture frees its read when it's destroyed, so these are only
+	// here if textures leaked
+	while ( s_StreamPending.Count() )
+	{
+		int i = s_StreamPending.Head();
+		StreamFreeJob( s_StreamPending[i] );
+		s_StreamPending.Remove( i );
+	}
+	while ( s_StreamMainThread.Count() )
+	{
+		int i = s_StreamMainThread.Head();
+		StreamFreeJob( s_StreamMainThread[i] );
+		s_StreamMainThread.Remove( i );
+	}
+
+	s_nStreamReads = 0;
+	s_nStreamBytesRead = 0;
+	s_flStreamReadTime = 0.0;
+}
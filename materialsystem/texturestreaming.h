@@ -0,0 +1,113 @@
+//=========== (C) Copyright 1999 Valve, L.L.C. All rights reserved. ===========
+//
+// The copyright to the contents herein is the property of Valve, L.L.C.
+// The contents may be used and/or copied only with the written permission of
+// Valve, L.L.C., or in accordance with the terms and conditions stipulated in
+// the agreement/contract under which the contents have been supplied.
+//
+// Purpose:
+// Texture streaming. With mat_texturestream on, file textures load only their
+// low mips when they're created; the texture manager then asks for the rest
+// to be read on the streaming thread, most recently used textures first and
+// within mat_texturestream_budget, and uploads them when they come in.
+//
+//=============================================================================
+#ifndef TEXTURESTREAMING_H
+#define TEXTURESTREAMING_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+class IVTFTexture;
+
+
+//-----------------------------------------------------------------------------
+// What streaming needs from a texture; ITextureInternal implements it
+//-----------------------------------------------------------------------------
+class IStreamedTexture
+{
+public:
+	// Is this a file texture that loaded its low mips + can stream in the rest?
+	virtual bool IsStreamed() const = 0;
+
+	// Last frame the texture was bound, -1 if never
+	virtual int GetLastBindFrame() const = 0;
+
+	// Memory used with just the low mips, or with all of them
+	virtual int GetStreamedMemory( bool bFullRes ) const = 0;
+
+	// Is it at full res, or will it be once the pending read comes in?
+	virtual bool IsStreamedFullRes() const = 0;
+
+	// Starts reading either all the mips or just the low ones
+	virtual void QueueStream( bool bFullRes ) = 0;
+
+	// Uploads the pending read if it's come in. Returns true if it did.
+	virtual bool UpdateStream() = 0;
+};
+
+//-----------------------------------------------------------------------------
+// Handle to a texture file read running on the streaming thread
+//-----------------------------------------------------------------------------
+typedef struct texturestreamjob_t *TextureStreamHandle_t;
+#define TEXTURE_STREAM_INVALID_HANDLE	( (TextureStreamHandle_t)0 )
+
+
+//-----------------------------------------------------------------------------
+// Settings
+//-----------------------------------------------------------------------------
+bool TextureStreaming_IsEnabled();
+
+// Largest dimension file textures are loaded at before streaming in the rest
+int TextureStreaming_LowResSize();
+
+// Memory all streamed textures together may use, in bytes
+int TextureStreaming_Budget();
+
+// Max number of finished reads uploaded per frame
+int TextureStreaming_MaxUploadsPerFrame();
+
+// Max number of reads queued per frame
+int TextureStreaming_MaxReadsPerFrame();
+
+//-----------------------------------------------------------------------------
+// Call once a frame with every texture. Uploads reads that came in, reads one
+// of the files that are only in a pack file, then streams in the most
+// recently used textures that fit in the budget and streams out the rest.
+//-----------------------------------------------------------------------------
+void TextureStreaming_Update( IStreamedTexture **ppTextures, int nCount );
+
+//-----------------------------------------------------------------------------
+// Queues a read of a .vtf file, skipping nMipSkipCount of its largest mips.
+// The read with the highest priority goes first.
+//-----------------------------------------------------------------------------
+TextureStreamHandle_t TextureStreaming_Read( char const *pFileName, int nMipSkipCount, int nPriority );
+
+void TextureStreaming_SetPriority( TextureStreamHandle_t hJob, int nPriority );
+
+//-----------------------------------------------------------------------------
+// Once a read is done, this gets at the texture (NULL if the read failed).
+// The texture is still owned by the read.
+//-----------------------------------------------------------------------------
+bool TextureStreaming_IsDone( TextureStreamHandle_t hJob );
+IVTFTexture *TextureStreaming_GetTexture( TextureStreamHandle_t hJob );
+int TextureStreaming_GetMipSkipCount( TextureStreamHandle_t hJob );
+
+//-----------------------------------------------------------------------------
+// Frees a read; cancels it if it hasn't finished yet
+//-----------------------------------------------------------------------------
+void TextureStreaming_Free( TextureStreamHandle_t hJob );
+
+//-----------------------------------------------------------------------------
+// Reads finished so far, bytes + seconds they took, and reads still waiting
+//-----------------------------------------------------------------------------
+void TextureStreaming_GetStats( int &nReads, int &nBytesRead, float &flReadTime, int &nPending );
+
+//-----------------------------------------------------------------------------
+// Stops the streaming thread + frees reads nobody picked up
+//-----------------------------------------------------------------------------
+void TextureStreaming_Shutdown();
+
+
+#endif // TEXTURESTREAMING_H
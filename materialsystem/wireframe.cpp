@@ -6,7 +6,7 @@
 // $NoKeywords: $
 //=============================================================================
 
-#include "shaderlib/CShader.h"
+#include "shaderlib/cshader.h"
 
 BEGIN_SHADER( Wireframe, 
 			  "Help for Wireframe" )
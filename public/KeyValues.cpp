@@ -13,6 +13,7 @@
 #include <KeyValues.h>
 #include "FileSystem.h"
 #include <vstdlib/IKeyValuesSystem.h>
+#include <vstdlib/ICommandLine.h>
 
 #include <Color.h>
 #include <assert.h>
@@ -29,6 +30,102 @@ static char * s_LastFileLoadingFrom = "unknown"; // just needed for error messag
 
 #define KEYVALUES_TOKEN_SIZE	1024
 
+// sections with at least this many subkeys get a subkey index the first time a lookup walks them
+#define KEYVALUES_INDEX_MIN_SUBKEYS		32
+
+#define KEYVALUES_ARENA_BLOCK_SIZE		( 16 * 1024 )
+
+#define KEYVALUES_BINARY_ID				(('1'<<24)+('B'<<16)+('V'<<8)+'K')
+#define KEYVALUES_BINARY_VERSION		1
+
+#define KEYVALUES_CACHE_ID				(('1'<<24)+('C'<<16)+('V'<<8)+'K')
+#define KEYVALUES_CACHE_VERSION			1
+#define KEYVALUES_CACHE_EXTENSION		".kvb"
+
+// binary key flags
+#define KEYVALUES_BINARY_HAS_STRING		0x01
+#define KEYVALUES_BINARY_ESCAPE			0x02
+
+// Bumped whenever a key that may be in a subkey index is renamed, since the parent's
+// index can't see that
+static int s_nKeyNameGeneration = 0;
+
+// Counts #include directives parsed, so the binary cache can skip files that depend on others
+static int s_nIncludesParsed = 0;
+
+static bool s_bBinaryCacheChecked = false;
+static bool s_bBinaryCacheEnabled = false;
+
+//-----------------------------------------------------------------------------
+// Purpose: Bump allocator for binary loaded trees. Nothing is freed until the
+//			whole arena goes away.
+//-----------------------------------------------------------------------------
+class CKeyValuesArena
+{
+public:
+	CKeyValuesArena( int nSizeHint )
+	{
+		m_pBlocks = NULL;
+		m_nBlockSize = ( nSizeHint > KEYVALUES_ARENA_BLOCK_SIZE ) ? nSizeHint : KEYVALUES_ARENA_BLOCK_SIZE;
+	}
+
+	~CKeyValuesArena()
+	{
+		while ( m_pBlocks )
+		{
+			Block_t *pNext = m_pBlocks->m_pNext;
+			delete[] (char *)m_pBlocks;
+			m_pBlocks = pNext;
+		}
+	}
+
+	void *Alloc( int nSize )
+	{
+		nSize = ( nSize + 7 ) & ~7;
+
+		if ( !m_pBlocks || ( m_pBlocks->m_nUsed + nSize > m_pBlocks->m_nSize ) )
+		{
+			int nBlockSize = ( nSize > m_nBlockSize ) ? nSize : m_nBlockSize;
+			Block_t *pBlock = (Block_t *)new char[ sizeof( Block_t ) + nBlockSize ];
+			pBlock->m_pNext = m_pBlocks;
+			pBlock->m_nUsed = 0;
+			pBlock->m_nSize = nBlockSize;
+			m_pBlocks = pBlock;
+
+			// later blocks only need to cover edits, not the whole file
+			m_nBlockSize = KEYVALUES_ARENA_BLOCK_SIZE;
+		}
+
+		void *pMem = (char *)( m_pBlocks + 1 ) + m_pBlocks->m_nUsed;
+		m_pBlocks->m_nUsed += nSize;
+		return pMem;
+	}
+
+private:
+	struct Block_t
+	{
+		Block_t		*m_pNext;
+		int			m_nUsed;
+		int			m_nSize;
+		int			m_nPad[2];	// keeps the data that follows 8 byte aligned
+	};
+
+	Block_t		*m_pBlocks;
+	int			m_nBlockSize;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Open addressed symbol -> first subkey with that name
+//-----------------------------------------------------------------------------
+class CKeyValuesSubKeyIndex
+{
+public:
+	int			m_nGeneration;	// s_nKeyNameGeneration when built
+	int			m_nCount;
+	int			m_nMask;
+	KeyValues	*m_pSlots[1];
+};
+
 //-----------------------------------------------------------------------------
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
@@ -107,6 +204,12 @@ void KeyValues::Init()
 	m_pValue = NULL;
 	
 	m_bHasEscapeSequences = false;
+	m_bAllocatedInArena = false;
+	m_bValueInArena = false;
+	m_bInSubKeyIndex = false;
+
+	m_pArena = NULL;
+	m_pSubKeyIndex = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -128,17 +231,27 @@ void KeyValues::RemoveEverything()
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		dat->FreeKey();
 	}
 
 	for ( dat = m_pPeer; dat && dat != this; dat = datNext )
 	{
 		datNext = dat->m_pPeer;
 		dat->m_pPeer = NULL;
-		delete dat;
+		dat->FreeKey();
 	}
 
+	InvalidateSubKeyIndex();
+
+	// the keys above may live in the arena, so it has to go last
+	delete m_pArena;
+
+	// operator= renames us right after this, so remember if our parent indexed us
+	bool bAllocatedInArena = m_bAllocatedInArena;
+	bool bInSubKeyIndex = m_bInSubKeyIndex;
 	Init();	// reset all values
+	m_bAllocatedInArena = bAllocatedInArena;
+	m_bInSubKeyIndex = bInSubKeyIndex;
 }
 
 //-----------------------------------------------------------------------------
@@ -374,6 +487,17 @@ void KeyValues::UsesEscapeSequences(bool state)
 //-----------------------------------------------------------------------------
 
 bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID )
+{
+	if ( IsBinaryCacheEnabled() )
+		return LoadFromFileCached( filesystem, resourceName, pathID );
+
+	return LoadFromTextFile( filesystem, resourceName, pathID );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Load and parse a text keyValues file
+//-----------------------------------------------------------------------------
+bool KeyValues::LoadFromTextFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID )
 {
 	Assert(filesystem);
 	Assert(_heapchk() == _HEAPOK);
@@ -403,6 +527,92 @@ bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceN
 	return retOK;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Load keyValues from the binary cache of a file, parsing the text
+//			and (re)writing the cache if it's missing or out of date
+//-----------------------------------------------------------------------------
+bool KeyValues::LoadFromFileCached( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID )
+{
+	Assert(filesystem);
+
+	if ( !filesystem->FileExists( resourceName, pathID ) )
+		return false;
+
+	char cacheName[ 512 ];
+	Q_snprintf( cacheName, sizeof( cacheName ), "%s%s", resourceName, KEYVALUES_CACHE_EXTENSION );
+
+	int sourceTime = (int)filesystem->GetFileTime( resourceName, pathID );
+	unsigned int sourceSize = filesystem->Size( resourceName, pathID );
+	int escapeSequences = m_bHasEscapeSequences ? 1 : 0;
+
+	FileHandle_t f = filesystem->Open( cacheName, "rb", pathID );
+	if ( f )
+	{
+		int fileSize = filesystem->Size( f );
+		CUtlBuffer buf( 0, fileSize );
+		filesystem->Read( buf.Base(), fileSize, f );
+		filesystem->Close( f );
+
+		bool bUpToDate = ( buf.GetInt() == KEYVALUES_CACHE_ID ) &&
+			( buf.GetInt() == KEYVALUES_CACHE_VERSION ) &&
+			( buf.GetInt() == sourceTime ) &&
+			( buf.GetUnsignedInt() == sourceSize ) &&
+			( buf.GetInt() == escapeSequences );
+
+		if ( bUpToDate && ReadAsBinary( buf ) )
+			return true;
+
+		// ReadAsBinary cleared us out, put back what the caller asked for
+		UsesEscapeSequences( escapeSequences != 0 );
+	}
+
+	int nIncludesParsed = s_nIncludesParsed;
+	if ( !LoadFromTextFile( filesystem, resourceName, pathID ) )
+		return false;
+
+	// the included files could change without this one changing, so don't cache it
+	if ( s_nIncludesParsed != nIncludesParsed )
+		return true;
+
+	CUtlBuffer buf( 0, 4096 );
+	buf.PutInt( KEYVALUES_CACHE_ID );
+	buf.PutInt( KEYVALUES_CACHE_VERSION );
+	buf.PutInt( sourceTime );
+	buf.PutUnsignedInt( sourceSize );
+	buf.PutInt( escapeSequences );
+	if ( WriteAsBinary( buf ) )
+	{
+		f = filesystem->Open( cacheName, "wb", pathID );
+		if ( f )
+		{
+			filesystem->Write( buf.Base(), buf.TellPut(), f );
+			filesystem->Close( f );
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Turns the binary cache for LoadFromFile on or off
+//-----------------------------------------------------------------------------
+void KeyValues::SetBinaryCacheEnabled( bool bEnabled )
+{
+	s_bBinaryCacheChecked = true;
+	s_bBinaryCacheEnabled = bEnabled;
+}
+
+bool KeyValues::IsBinaryCacheEnabled()
+{
+	if ( !s_bBinaryCacheChecked )
+	{
+		s_bBinaryCacheChecked = true;
+		s_bBinaryCacheEnabled = ( CommandLine()->FindParm( "-kvcache" ) != 0 );
+	}
+
+	return s_bBinaryCacheEnabled;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Save the keyvalues to disk
 //			Creates the path to the file if it doesn't exist 
@@ -617,13 +827,121 @@ void KeyValues::RecursiveSaveToFile( IBaseFileSystem *filesystem, FileHandle_t f
 //-----------------------------------------------------------------------------
 KeyValues *KeyValues::FindKey(int keySymbol)
 {
-	for (KeyValues *dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
+	return FindSubKey( keySymbol );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the first subkey with the given name, using (and building,
+//			for wide sections) the subkey index
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::FindSubKey( int keySymbol )
+{
+	if ( m_pSubKeyIndex )
 	{
-		if (dat->m_iKeyName == keySymbol)
-			return dat;
+		if ( m_pSubKeyIndex->m_nGeneration == s_nKeyNameGeneration )
+		{
+			int mask = m_pSubKeyIndex->m_nMask;
+			for ( int i = keySymbol & mask; m_pSubKeyIndex->m_pSlots[i]; i = ( i + 1 ) & mask )
+			{
+				if ( m_pSubKeyIndex->m_pSlots[i]->m_iKeyName == keySymbol )
+					return m_pSubKeyIndex->m_pSlots[i];
+			}
+			return NULL;
+		}
+
+		// something got renamed since this was built
+		InvalidateSubKeyIndex();
+	}
+
+	int nVisited = 0;
+	KeyValues *dat;
+	for ( dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		if ( dat->m_iKeyName == keySymbol )
+			break;
+
+		++nVisited;
+	}
+
+	if ( nVisited >= KEYVALUES_INDEX_MIN_SUBKEYS )
+	{
+		BuildSubKeyIndex();
+	}
+
+	return dat;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the subkey index at half load, keeping the first key of each name
+//-----------------------------------------------------------------------------
+void KeyValues::BuildSubKeyIndex()
+{
+	InvalidateSubKeyIndex();
+
+	int nSubKeys = 0;
+	KeyValues *dat;
+	for ( dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		++nSubKeys;
+	}
+
+	int nSlots = 64;
+	while ( nSlots < nSubKeys * 2 )
+	{
+		nSlots <<= 1;
+	}
+
+	int nBytes = sizeof( CKeyValuesSubKeyIndex ) + ( nSlots - 1 ) * sizeof( KeyValues * );
+	m_pSubKeyIndex = (CKeyValuesSubKeyIndex *)new char[ nBytes ];
+	memset( m_pSubKeyIndex, 0, nBytes );
+	m_pSubKeyIndex->m_nGeneration = s_nKeyNameGeneration;
+	m_pSubKeyIndex->m_nMask = nSlots - 1;
+
+	for ( dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		AddToSubKeyIndex( dat );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a key appended to the subkey list, dropping the index if it gets too full
+//-----------------------------------------------------------------------------
+void KeyValues::AddToSubKeyIndex( KeyValues *pKey )
+{
+	if ( !m_pSubKeyIndex )
+		return;
+
+	// Set even if an earlier key of the same name takes the slot, renaming
+	// this one would still leave the index out of date
+	pKey->m_bInSubKeyIndex = true;
+
+	if ( ( m_pSubKeyIndex->m_nCount + 1 ) * 2 > m_pSubKeyIndex->m_nMask + 1 )
+	{
+		// it'll get rebuilt at the right size by the next lookup
+		InvalidateSubKeyIndex();
+		return;
 	}
 
-	return NULL;
+	int mask = m_pSubKeyIndex->m_nMask;
+	int i;
+	for ( i = pKey->m_iKeyName & mask; m_pSubKeyIndex->m_pSlots[i]; i = ( i + 1 ) & mask )
+	{
+		// earlier keys of the same name win, same as a list walk
+		if ( m_pSubKeyIndex->m_pSlots[i]->m_iKeyName == pKey->m_iKeyName )
+			return;
+	}
+
+	m_pSubKeyIndex->m_pSlots[i] = pKey;
+	m_pSubKeyIndex->m_nCount++;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void KeyValues::InvalidateSubKeyIndex()
+{
+	delete[] (char *)m_pSubKeyIndex;
+	m_pSubKeyIndex = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -654,19 +972,8 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 	// lookup the symbol for the search string
 	HKeySymbol iSearchStr = KeyValuesSystem()->GetSymbolForString(searchStr);
 
-	KeyValues *lastItem = NULL;
-	KeyValues *dat;
 	// find the searchStr in the current peer list
-	for (dat = m_pSub; dat != NULL; dat = dat->m_pPeer)
-	{
-		lastItem = dat;	// record the last item looked at (for if we need to append to the end of the list)
-
-		// symbol compare
-		if (dat->m_iKeyName == iSearchStr)
-		{
-			break;
-		}
-	}
+	KeyValues *dat = FindSubKey( iSearchStr );
 
 	if ( !dat && m_pChain )
 	{
@@ -682,6 +989,13 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 			dat = new KeyValues( searchStr );
 //			Assert(dat != NULL);
 
+			// find the end of the list
+			KeyValues *lastItem = m_pSub;
+			while ( lastItem && lastItem->m_pPeer )
+			{
+				lastItem = lastItem->m_pPeer;
+			}
+
 			// insert new key at end of list
 			if (lastItem)
 			{
@@ -692,6 +1006,7 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 				m_pSub = dat;
 			}
 			dat->m_pPeer = NULL;
+			AddToSubKeyIndex( dat );
 
 			// a key graduates to be a submsg as soon as it's m_pSub is set
 			// this should be the only place m_pSub is set
@@ -766,6 +1081,8 @@ KeyValues* KeyValues::CreateKey( const char *keyName )
 		pTempDat->SetNextKey( dat );
 	}
 
+	AddToSubKeyIndex( dat );
+
 	return dat;
 }
 
@@ -799,6 +1116,7 @@ void KeyValues::RemoveSubKey(KeyValues *subKey)
 	}
 
 	subKey->m_pPeer = NULL;
+	InvalidateSubKeyIndex();
 }
 
 
@@ -1078,10 +1396,8 @@ void KeyValues::SetString( const char *keyName, const char *value )
 	if ( dat )
 	{
 		// delete the old value
-		delete [] dat->m_sValue;
 		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		dat->FreeValueStrings();
 
 		if (!value)
 		{
@@ -1108,10 +1424,8 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 	if ( dat )
 	{
 		// delete the old value
-		delete[] dat->m_wsValue;
 		// make sure we're not storing the STRING  - as we're converting over to WSTRING
-		delete [] dat->m_sValue;
-		dat->m_sValue = NULL;
+		dat->FreeValueStrings();
 
 		if (!value)
 		{
@@ -1158,7 +1472,19 @@ void KeyValues::SetFloat( const char *keyName, float value )
 
 void KeyValues::SetName( const char * setName )
 {
-	m_iKeyName = KeyValuesSystem()->GetSymbolForString( setName );
+	SetNameSymbol( KeyValuesSystem()->GetSymbolForString( setName ) );
+}
+
+void KeyValues::SetNameSymbol( int iKeyName )
+{
+	if ( m_bInSubKeyIndex )
+	{
+		// our parent may have us in its subkey index under the old name
+		++s_nKeyNameGeneration;
+		m_bInSubKeyIndex = false;
+	}
+
+	m_iKeyName = iKeyName;
 }
 
 //-----------------------------------------------------------------------------
@@ -1179,7 +1505,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 {
 	// garymcthack - need to check this code for possible buffer overruns.
 	
-	m_iKeyName = src.GetNameSymbol();
+	SetNameSymbol( src.GetNameSymbol() );
 
 	if( !src.m_pSub )
 	{
@@ -1366,9 +1692,13 @@ bool KeyValues::IsEmpty(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::Clear( void )
 {
-	delete m_pSub;
+	if ( m_pSub )
+	{
+		m_pSub->FreeKey();
+	}
 	m_pSub = NULL;
 	m_iDataType = TYPE_NONE;
+	InvalidateSubKeyIndex();
 }
 
 //-----------------------------------------------------------------------------
@@ -1388,6 +1718,28 @@ KeyValues::types_t KeyValues::GetDataType(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::deleteThis()
 {
+	// arena keys belong to the tree they were read into, and go away with its root
+	if ( m_bAllocatedInArena )
+	{
+		AssertMsg( 0, "KeyValues::deleteThis called on a key allocated in its root's arena" );
+		return;
+	}
+
+	delete this;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees a key that's being dropped from its tree
+//-----------------------------------------------------------------------------
+void KeyValues::FreeKey()
+{
+	if ( m_bAllocatedInArena )
+	{
+		// the memory goes back with the arena, just let go of anything hanging off this key
+		RemoveEverything();
+		return;
+	}
+
 	delete this;
 }
 
@@ -1456,6 +1808,8 @@ void KeyValues::ParseIncludedKeys( char const *resourceName, const char *filetoi
 	// Append included file
 	Q_strcat( fullpath, filetoinclude );
 
+	++s_nIncludesParsed;
+
 	KeyValues *newKV = new KeyValues( fullpath );
 
 	// CUtlSymbol save = s_CurrentFileSymbol;	// did that had any use ???
@@ -1648,8 +2002,347 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, char **pfile
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Frees the string values, unless they live in the arena
+//-----------------------------------------------------------------------------
+void KeyValues::FreeValueStrings()
+{
+	if ( !m_bValueInArena )
+	{
+		delete[] m_sValue;
+		delete[] m_wsValue;
+	}
+
+	m_sValue = NULL;
+	m_wsValue = NULL;
+	m_bValueInArena = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Memory for a value read from a binary buffer
+//-----------------------------------------------------------------------------
+void *KeyValues::AllocValueMemory( int nBytes, CKeyValuesArena *pArena )
+{
+	Assert( pArena );
+	m_bValueInArena = true;
+	return pArena->Alloc( nBytes );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns a null terminated string in the buffer and skips past it
+//-----------------------------------------------------------------------------
+static const char *ReadBinaryString( CUtlBuffer &buffer, int &len )
+{
+	int nRemaining = buffer.Size() - buffer.TellGet();
+	if ( !buffer.IsValid() || nRemaining <= 0 )
+		return NULL;
+
+	const char *pString = (const char *)buffer.PeekGet();
+	const char *pEnd = (const char *)memchr( pString, 0, nRemaining );
+	if ( !pEnd )
+		return NULL;
+
+	len = pEnd - pString;
+	buffer.SeekGet( CUtlBuffer::SEEK_CURRENT, len + 1 );
+	return pString;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writes this key, its subkeys and its peers in binary.
+//			Layout:	int id, int version,
+//					int name count, names (null terminated),
+//					int key count, keys
+//			Key:	byte type, byte flags, int name index, [string], [typed value],
+//					int subkey count, subkeys
+//-----------------------------------------------------------------------------
+bool KeyValues::WriteAsBinary( CUtlBuffer &buffer )
+{
+	if ( buffer.IsText() )
+		return false;
+
+	// write the keys first, so the name table only holds names that are used
+	CUtlVector< int > symbolToIndex;
+	CUtlVector< int > symbols;
+	CUtlBuffer keys( 0, 4096 );
+
+	int nKeys = 0;
+	for ( KeyValues *dat = this; dat != NULL; dat = ( dat->m_pPeer != this ) ? dat->m_pPeer : NULL )
+	{
+		dat->RecursiveWriteAsBinary( keys, symbolToIndex, symbols );
+		++nKeys;
+	}
+
+	buffer.PutInt( KEYVALUES_BINARY_ID );
+	buffer.PutInt( KEYVALUES_BINARY_VERSION );
+
+	buffer.PutInt( symbols.Count() );
+	for ( int i = 0; i < symbols.Count(); i++ )
+	{
+		buffer.PutString( KeyValuesSystem()->GetStringForSymbol( symbols[i] ) );
+	}
+
+	buffer.PutInt( nKeys );
+	buffer.Put( keys.Base(), keys.TellPut() );
+
+	return buffer.IsValid() && keys.IsValid();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void KeyValues::RecursiveWriteAsBinary( CUtlBuffer &buffer, CUtlVector< int > &symbolToIndex, CUtlVector< int > &symbols )
+{
+	int nameIndex = -1;
+	if ( m_iKeyName >= 0 )
+	{
+		while ( symbolToIndex.Count() <= m_iKeyName )
+		{
+			symbolToIndex.AddToTail( -1 );
+		}
+
+		if ( symbolToIndex[m_iKeyName] == -1 )
+		{
+			symbolToIndex[m_iKeyName] = symbols.AddToTail( m_iKeyName );
+		}
+
+		nameIndex = symbolToIndex[m_iKeyName];
+	}
+
+	// pointers mean nothing outside this process
+	types_t type = ( m_iDataType == TYPE_PTR ) ? TYPE_NONE : m_iDataType;
+
+	// the parser keeps the original text of numbers around too
+	bool bHasString = m_sValue && ( type == TYPE_STRING || type == TYPE_INT || type == TYPE_FLOAT );
+
+	unsigned char flags = 0;
+	if ( bHasString )
+	{
+		flags |= KEYVALUES_BINARY_HAS_STRING;
+	}
+	if ( m_bHasEscapeSequences )
+	{
+		flags |= KEYVALUES_BINARY_ESCAPE;
+	}
+
+	buffer.PutUnsignedChar( (unsigned char)type );
+	buffer.PutUnsignedChar( flags );
+	buffer.PutInt( nameIndex );
+
+	if ( bHasString )
+	{
+		buffer.PutString( m_sValue );
+	}
+
+	switch ( type )
+	{
+	case TYPE_INT:
+		buffer.PutInt( m_iValue );
+		break;
+
+	case TYPE_FLOAT:
+		buffer.PutFloat( m_flValue );
+		break;
+
+	case TYPE_COLOR:
+		buffer.Put( m_Color, 4 );
+		break;
+
+	case TYPE_WSTRING:
+		{
+			// 16 bit characters, whatever size wchar_t is here
+			int len = m_wsValue ? wcslen( m_wsValue ) : 0;
+			buffer.PutInt( len );
+			for ( int i = 0; i < len; i++ )
+			{
+				buffer.PutUnsignedShort( (unsigned short)m_wsValue[i] );
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	int nSubKeys = 0;
+	KeyValues *dat;
+	for ( dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		++nSubKeys;
+	}
+
+	buffer.PutInt( nSubKeys );
+	for ( dat = m_pSub; dat != NULL; dat = dat->m_pPeer )
+	{
+		dat->RecursiveWriteAsBinary( buffer, symbolToIndex, symbols );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Replaces this key (and its peers) with the contents of a buffer
+//			written by WriteAsBinary
+//-----------------------------------------------------------------------------
+bool KeyValues::ReadAsBinary( CUtlBuffer &buffer, bool bUseArena )
+{
+	RemoveEverything();
+
+	if ( buffer.IsText() )
+		return false;
+
+	if ( buffer.GetInt() != KEYVALUES_BINARY_ID || buffer.GetInt() != KEYVALUES_BINARY_VERSION )
+		return false;
+
+	int nNames = buffer.GetInt();
+	if ( !buffer.IsValid() || nNames < 0 )
+		return false;
+
+	// resolve each name to a symbol once, keys just index into this
+	CUtlVector< int > symbols;
+	symbols.EnsureCapacity( nNames );
+	int i;
+	for ( i = 0; i < nNames; i++ )
+	{
+		int len;
+		const char *pName = ReadBinaryString( buffer, len );
+		if ( !pName )
+			return false;
+
+		symbols.AddToTail( KeyValuesSystem()->GetSymbolForString( pName ) );
+	}
+
+	int nKeys = buffer.GetInt();
+	if ( !buffer.IsValid() || nKeys <= 0 )
+		return false;
+
+	if ( bUseArena )
+	{
+		// keys take up a few times their encoded size, try to fit the whole tree in one block
+		m_pArena = new CKeyValuesArena( ( buffer.Size() - buffer.TellGet() ) * 4 );
+	}
+
+	KeyValues *pPrev = NULL;
+	for ( i = 0; i < nKeys; i++ )
+	{
+		KeyValues *dat = this;
+		if ( pPrev )
+		{
+			dat = AllocBinaryKey( m_pArena );
+			pPrev->m_pPeer = dat;
+		}
+		pPrev = dat;
+
+		if ( !dat->RecursiveReadAsBinary( buffer, symbols, m_pArena ) )
+		{
+			DevMsg( 1, "KeyValues::ReadAsBinary: bad binary data in key %s\n", GetName() );
+			RemoveEverything();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+bool KeyValues::RecursiveReadAsBinary( CUtlBuffer &buffer, const CUtlVector< int > &symbols, CKeyValuesArena *pArena )
+{
+	int type = buffer.GetUnsignedChar();
+	int flags = buffer.GetUnsignedChar();
+	int nameIndex = buffer.GetInt();
+
+	if ( !buffer.IsValid() || type > TYPE_COLOR || nameIndex < -1 || nameIndex >= symbols.Count() )
+		return false;
+
+	m_iKeyName = ( nameIndex >= 0 ) ? symbols[nameIndex] : INVALID_KEY_SYMBOL;
+	m_iDataType = (types_t)type;
+	m_bHasEscapeSequences = ( flags & KEYVALUES_BINARY_ESCAPE ) != 0;
+
+	if ( flags & KEYVALUES_BINARY_HAS_STRING )
+	{
+		int len;
+		const char *pString = ReadBinaryString( buffer, len );
+		if ( !pString )
+			return false;
+
+		m_sValue = pArena ? (char *)AllocValueMemory( len + 1, pArena ) : new char[len + 1];
+		Q_memcpy( m_sValue, pString, len + 1 );
+	}
+
+	switch ( m_iDataType )
+	{
+	case TYPE_INT:
+		m_iValue = buffer.GetInt();
+		break;
+
+	case TYPE_FLOAT:
+		m_flValue = buffer.GetFloat();
+		break;
+
+	case TYPE_COLOR:
+		buffer.Get( m_Color, 4 );
+		break;
+
+	case TYPE_WSTRING:
+		{
+			int len = buffer.GetInt();
+			if ( !buffer.IsValid() || len < 0 || len * 2 > buffer.Size() - buffer.TellGet() )
+				return false;
+
+			m_wsValue = pArena ? (wchar_t *)AllocValueMemory( ( len + 1 ) * sizeof( wchar_t ), pArena ) : new wchar_t[len + 1];
+			for ( int i = 0; i < len; i++ )
+			{
+				m_wsValue[i] = (wchar_t)buffer.GetUnsignedShort();
+			}
+			m_wsValue[len] = 0;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	int nSubKeys = buffer.GetInt();
+	if ( !buffer.IsValid() || nSubKeys < 0 )
+		return false;
+
+	KeyValues *pPrev = NULL;
+	for ( int i = 0; i < nSubKeys; i++ )
+	{
+		KeyValues *dat = AllocBinaryKey( pArena );
+
+		// link it in before reading, so a failure still cleans it up
+		if ( pPrev )
+		{
+			pPrev->m_pPeer = dat;
+		}
+		else
+		{
+			m_pSub = dat;
+		}
+		pPrev = dat;
+
+		if ( !dat->RecursiveReadAsBinary( buffer, symbols, pArena ) )
+			return false;
+	}
+
+	return buffer.IsValid();
+}
+
 #include "tier0/memdbgoff.h"
 
+//-----------------------------------------------------------------------------
+// Purpose: Allocates a blank key for the binary reader, in the arena if there is one
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::AllocBinaryKey( CKeyValuesArena *pArena )
+{
+	if ( !pArena )
+		return new KeyValues( (const char *)NULL );
+
+	KeyValues *dat = ::new ( pArena->Alloc( sizeof( KeyValues ) ) ) KeyValues( (const char *)NULL );
+	dat->m_bAllocatedInArena = true;
+	return dat;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: memory allocator
 //-----------------------------------------------------------------------------
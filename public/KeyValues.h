@@ -32,6 +32,8 @@
 class IBaseFileSystem;
 class CUtlBuffer;
 class Color;
+class CKeyValuesArena;
+class CKeyValuesSubKeyIndex;
 typedef void * FileHandle_t;
 
 //-----------------------------------------------------------------------------
@@ -82,6 +84,21 @@ public:
 	// Read from a buffer...  Note that the buffer must be null terminated
 	bool LoadFromBuffer( char const *resourceName, const char *pBuffer, IBaseFileSystem* pFileSystem = NULL, const char *pPathID = NULL );
 
+	// Binary form of this key, its subkeys and its peers. Reading replaces the current contents;
+	// with bUseArena every node read is carved out of a single arena owned by this key, which is
+	// released in one go when this key is deleted. Arena keys must not outlive this key.
+	bool WriteAsBinary( CUtlBuffer &buffer );
+	bool ReadAsBinary( CUtlBuffer &buffer, bool bUseArena = true );
+
+	// Same as LoadFromFile, but the parsed tree is saved in binary next to the source file
+	// (as <resourceName>.kvb) and read back from there while the source's size and time match.
+	// Files that #include others are never cached.
+	bool LoadFromFileCached( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID = NULL );
+
+	// Makes LoadFromFile go through LoadFromFileCached. Off unless -kvcache is on the command line.
+	static void SetBinaryCacheEnabled( bool bEnabled );
+	static bool IsBinaryCacheEnabled();
+
 	// Find a keyValue, create it if it is not found.
 	// Set bCreate to true to create the key if it doesn't already exist (which ensures a valid pointer will be returned)
 	KeyValues *FindKey(const char *keyName, bool bCreate = false);
@@ -92,7 +109,7 @@ public:
 	// Key iteration
 	KeyValues *GetFirstSubKey();	// returns the first subkey in the list
 	KeyValues *GetNextKey();		// returns the next subkey
-	void SetNextKey( KeyValues * pDat);
+	void SetNextKey( KeyValues * pDat);	// NOTE: doesn't update the parent's subkey index, only use on top level keys
 
 	//
 	// VXP: These functions can be used to treat it like a true key/values tree instead of 
@@ -158,7 +175,8 @@ public:
 	};
 	types_t GetDataType(const char *keyName = NULL);
 
-	// Virtual deletion function - ensures that KeyValues object is deleted from correct heap
+	// Virtual deletion function - ensures that KeyValues object is deleted from correct heap.
+	// Keys read into an arena (see ReadAsBinary) go away with their root, not on their own.
 	void deleteThis();
 
 private:
@@ -181,6 +199,26 @@ private:
 	void ParseIncludedKeys( char const *resourceName, const char *filetoinclude, 
 		IBaseFileSystem* pFileSystem, const char *pPathID, CUtlVector< KeyValues * >& includedKeys );
 
+	bool LoadFromTextFile( IBaseFileSystem *filesystem, const char *resourceName, const char *pathID );
+
+	void RecursiveWriteAsBinary( CUtlBuffer &buffer, CUtlVector< int > &symbolToIndex, CUtlVector< int > &symbols );
+	bool RecursiveReadAsBinary( CUtlBuffer &buffer, const CUtlVector< int > &symbols, CKeyValuesArena *pArena );
+	static KeyValues *AllocBinaryKey( CKeyValuesArena *pArena );
+	void *AllocValueMemory( int nBytes, CKeyValuesArena *pArena );
+	void FreeValueStrings();
+
+	// Wide sections keep a symbol -> subkey hash, built on demand by FindKey
+	KeyValues *FindSubKey( int keySymbol );
+	void BuildSubKeyIndex();
+	void AddToSubKeyIndex( KeyValues *pKey );
+	void InvalidateSubKeyIndex();
+
+	// Renames the key, invalidating any subkey index our parent has us in
+	void SetNameSymbol( int iKeyName );
+
+	// Frees a key dropped from its tree; arena keys only let go of what hangs off them
+	void FreeKey();
+
 	void Init();
 	const char * ReadToken( char **buffer, bool &wasQuoted );
 	void WriteIndents( IBaseFileSystem *filesystem, FileHandle_t f, int indentLevel );
@@ -207,6 +245,12 @@ private:
 	KeyValues *m_pSub;	// pointer to Start of a new sub key list
 	KeyValues *m_pChain;// Search here if it's not in our list
 	bool	   m_bHasEscapeSequences; // true, if while parsing this KeyValue, Escape Sequences are used (default false)
+	bool	   m_bAllocatedInArena;	// this key's memory belongs to its root's arena and is never freed on its own
+	bool	   m_bValueInArena;		// m_sValue/m_wsValue point into the arena
+	bool	   m_bInSubKeyIndex;	// our parent built a subkey index with us in it, renaming has to invalidate it
+
+	CKeyValuesArena *m_pArena;		// arena owned by this (root) key, see ReadAsBinary
+	CKeyValuesSubKeyIndex *m_pSubKeyIndex;
 };
 
 #endif // KEYVALUES_H
@@ -325,6 +325,9 @@ public:
 	// Gets at the shader parameters
 	virtual int				ShaderParamCount() const = 0;
 	virtual IMaterialVar	**GetShaderParams( void ) = 0;
+
+	// Name of the shader (or fallback) the material ended up using
+	virtual const char *	GetShaderName() const = 0;
 };
 
 #endif // IMATERIAL_H
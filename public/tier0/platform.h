@@ -128,7 +128,11 @@ typedef void * HINSTANCE;
 #endif
 
 // Used to step into the debugger
+#ifdef _WIN32
 #define  DebuggerBreak()  __asm { int 3 }
+#elif _LINUX
+#define  DebuggerBreak()  __asm__ __volatile__ ( "int $3" )
+#endif
 
 // C functions for external declarations that call the appropriate C++ methods
 #ifndef EXPORT
@@ -0,0 +1,131 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Portable threading primitives: threads, interlocked operations,
+//			mutexes, events, and a small pool that spreads independent work
+//			items over the logical processors.
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef THREADTOOLS_H
+#define THREADTOOLS_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+
+//-----------------------------------------------------------------------------
+// Threads
+//-----------------------------------------------------------------------------
+typedef void *ThreadHandle_t;
+typedef unsigned (*ThreadFunc_t)( void *pParam );
+
+// The new thread registers itself with Plat_RegisterThread before calling pfnThread.
+PLATFORM_INTERFACE ThreadHandle_t Plat_CreateThread( ThreadFunc_t pfnThread, void *pParam, const char *pName = "Source Thread" );
+
+// Waits for the thread to exit and frees the handle.
+PLATFORM_INTERFACE void Plat_JoinThread( ThreadHandle_t hThread );
+
+PLATFORM_INTERFACE void Plat_Sleep( unsigned nMilliseconds );
+
+//-----------------------------------------------------------------------------
+// Interlocked operations, all return the new value except Exchange,
+// CompareExchange and ExchangeAdd which return the old one
+//-----------------------------------------------------------------------------
+PLATFORM_INTERFACE long Plat_InterlockedIncrement( long volatile *pDest );
+PLATFORM_INTERFACE long Plat_InterlockedDecrement( long volatile *pDest );
+PLATFORM_INTERFACE long Plat_InterlockedExchange( long volatile *pDest, long value );
+PLATFORM_INTERFACE long Plat_InterlockedCompareExchange( long volatile *pDest, long value, long comperand );
+PLATFORM_INTERFACE long Plat_InterlockedExchangeAdd( long volatile *pDest, long value );
+
+//-----------------------------------------------------------------------------
+// Mutexes, recursive
+//-----------------------------------------------------------------------------
+typedef void *MutexHandle_t;
+
+PLATFORM_INTERFACE MutexHandle_t Plat_CreateMutex();
+PLATFORM_INTERFACE void Plat_DestroyMutex( MutexHandle_t hMutex );
+PLATFORM_INTERFACE void Plat_LockMutex( MutexHandle_t hMutex );
+PLATFORM_INTERFACE void Plat_UnlockMutex( MutexHandle_t hMutex );
+
+class CThreadMutex
+{
+public:
+	CThreadMutex()		{ m_hMutex = Plat_CreateMutex(); }
+	~CThreadMutex()		{ Plat_DestroyMutex( m_hMutex ); }
+
+	void Lock()			{ Plat_LockMutex( m_hMutex ); }
+	void Unlock()		{ Plat_UnlockMutex( m_hMutex ); }
+
+private:
+	CThreadMutex( const CThreadMutex & );
+	CThreadMutex &operator=( const CThreadMutex & );
+
+	MutexHandle_t m_hMutex;
+};
+
+// Holds the mutex for the rest of the scope
+class CAutoLock
+{
+public:
+	CAutoLock( CThreadMutex &mutex ) : m_Mutex( mutex )	{ m_Mutex.Lock(); }
+	~CAutoLock()										{ m_Mutex.Unlock(); }
+
+private:
+	CAutoLock &operator=( const CAutoLock & );
+
+	CThreadMutex &m_Mutex;
+};
+
+//-----------------------------------------------------------------------------
+// Events.  An auto reset event releases a single waiter and resets itself, a
+// manual reset event stays signaled until it is reset.
+//-----------------------------------------------------------------------------
+typedef void *EventHandle_t;
+
+#define PLAT_WAIT_INFINITE	0xFFFFFFFF
+
+PLATFORM_INTERFACE EventHandle_t Plat_CreateEvent( bool bManualReset );
+PLATFORM_INTERFACE void Plat_DestroyEvent( EventHandle_t hEvent );
+PLATFORM_INTERFACE void Plat_SetEvent( EventHandle_t hEvent );
+PLATFORM_INTERFACE void Plat_ResetEvent( EventHandle_t hEvent );
+
+// Returns false if the timeout expired before the event was signaled
+PLATFORM_INTERFACE bool Plat_WaitEvent( EventHandle_t hEvent, unsigned nTimeoutMs = PLAT_WAIT_INFINITE );
+
+class CThreadEvent
+{
+public:
+	CThreadEvent( bool bManualReset = false )	{ m_hEvent = Plat_CreateEvent( bManualReset ); }
+	~CThreadEvent()								{ Plat_DestroyEvent( m_hEvent ); }
+
+	void Set()									{ Plat_SetEvent( m_hEvent ); }
+	void Reset()								{ Plat_ResetEvent( m_hEvent ); }
+	bool Wait( unsigned nTimeoutMs = PLAT_WAIT_INFINITE )	{ return Plat_WaitEvent( m_hEvent, nTimeoutMs ); }
+
+private:
+	CThreadEvent( const CThreadEvent & );
+	CThreadEvent &operator=( const CThreadEvent & );
+
+	EventHandle_t m_hEvent;
+};
+
+//-----------------------------------------------------------------------------
+// Parallel processing.  Calls pfnProcess once for every item in [0, nItems)
+// and returns when all of them are done.  The items are handed out to a pool
+// of worker threads plus the calling thread, in no particular order, so they
+// must not depend on each other.  A call made while another one is running
+// (from a worker, or from a second thread) just processes its items serially.
+//-----------------------------------------------------------------------------
+typedef void (*ParallelProcessFunc_t)( void *pContext, int iItem );
+
+PLATFORM_INTERFACE void Plat_ParallelProcess( ParallelProcessFunc_t pfnProcess, void *pContext, int nItems );
+
+// Number of threads, counting the caller, that Plat_ParallelProcess spreads
+// items over.  Defaults to the number of logical processors.  1 is serial.
+PLATFORM_INTERFACE int Plat_GetParallelThreadCount();
+PLATFORM_INTERFACE void Plat_SetParallelThreadCount( int nThreads );
+
+#endif // THREADTOOLS_H
@@ -121,15 +121,23 @@ public:
 	// VTFBufferHeaderSize() method below to only read that much from the file
 	// NOTE: If you skip mip levels, the height + width of the texture will
 	// change to reflect the size of the largest read in mip level
-	virtual bool Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly = false, int nSkipMipLevels = 0 ) = 0;
+	// NOTE: With bQuiet, errors are only returned, not printed
+	virtual bool Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly = false, int nSkipMipLevels = 0, bool bQuiet = false ) = 0;
 	virtual bool Serialize( CUtlBuffer &buf ) = 0;
 
+	// Reads just the image data from mip level nSkipMipLevels down to the
+	// smallest one, for all frames + faces, without the low-res image.
+	// NOTE: Unserialize only the header first, then read the part of the
+	// file MipRangeFileInfo returns into the buffer
+	virtual bool UnserializeMipRange( CUtlBuffer &buf, int nSkipMipLevels, bool bQuiet = false ) = 0;
+
 	// These are methods to help with optimization:
 	// Once the header is read in, they indicate where to start reading
 	// other data (measured from file start), and how many bytes to read....
 	virtual void LowResFileInfo( int *pStartLocation, int *pSizeInBytes) const = 0;
 	virtual void ImageFileInfo( int nFrame, int nFace, int nMip, int *pStartLocation, int *pSizeInBytes) const = 0;
 	virtual int FileSize( int nMipSkipCount = 0 ) const = 0;
+	virtual void MipRangeFileInfo( int nSkipMipLevels, int *pStartLocation, int *pSizeInBytes ) const = 0;
 
 	// Attributes...
 	virtual int Width() const = 0;
@@ -6,6 +6,8 @@
 //=============================================================================
 
 #include "flexrenderdata.h"
+#include "mathlib.h"
+#include <xmmintrin.h>
 
 
 //-----------------------------------------------------------------------------
@@ -179,3 +181,169 @@ CachedVertex_t* CCachedRenderData::CreateWorldVertex( int vertex )
 	return GetWorldVertex( vertex );
 }
 
+
+//-----------------------------------------------------------------------------
+// Returns the flexed copy of a vertex, making one from the vertex if this is
+// the first flex to move it
+//-----------------------------------------------------------------------------
+static inline CachedVertex_t *R_GetFlexedVertex( CCachedRenderData &vertexCache, mstudiovertex_t *pVertices, 
+	Vector4D *pstudiotangentS, int n )
+{
+	if (vertexCache.IsVertexFlexed(n))
+		return vertexCache.GetFlexVertex(n);
+
+	// Add a new flexed vert to the flexed vertex list
+	CachedVertex_t *pFlexedVertex = vertexCache.CreateFlexVertex(n);
+
+	VectorCopy( pVertices[n].m_vecPosition, pFlexedVertex->m_Position );
+	VectorCopy( pVertices[n].m_vecNormal, pFlexedVertex->m_Normal );
+	Vector4DCopy( pstudiotangentS[n], pFlexedVertex->m_TangentS );
+	Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
+
+	return pFlexedVertex;
+}
+
+
+// flexed vertices looked up at a time by R_StudioFlexVertsSSE
+#define FLEX_BATCH_SIZE	64
+
+//-----------------------------------------------------------------------------
+// Adds one flex's weighted deltas to the flexed vertices.  The flexed vertices
+// for a batch of deltas are looked up (or made) first, then the deltas are
+// added with SSE, a whole position, normal or tangent per instruction, doing
+// the same multiplies and adds as the scalar loop.
+//-----------------------------------------------------------------------------
+static void R_StudioFlexVertsSSE( CCachedRenderData &vertexCache, mstudiovertex_t *pVertices, 
+	Vector4D *pstudiotangentS, mstudiovertanim_t *pvanim, int numverts, float w )
+{
+	CachedVertex_t *ppFlexedVertex[FLEX_BATCH_SIZE];
+
+	// The fourth lane of each load is the next field over, a zero weight leaves it as it was
+	__m128 weight = _mm_setr_ps( w, w, w, 0.0f );
+
+	for ( int j = 0; j < numverts; j += FLEX_BATCH_SIZE )
+	{
+		int count = min( FLEX_BATCH_SIZE, numverts - j );
+		mstudiovertanim_t *pBatch = pvanim + j;
+
+		int k;
+		for ( k = 0; k < count; k++ )
+		{
+			ppFlexedVertex[k] = R_GetFlexedVertex( vertexCache, pVertices, pstudiotangentS, pBatch[k].index );
+		}
+
+		for ( k = 0; k < count; k++ )
+		{
+			CachedVertex_t *pFlexedVertex = ppFlexedVertex[k];
+
+			// delta.x y z ndelta.x, and delta.z ndelta.x y z rotated so ndelta comes first
+			__m128 delta = _mm_loadu_ps( pBatch[k].delta.Base() );
+			__m128 nDelta = _mm_loadu_ps( &pBatch[k].delta.z );
+			nDelta = _mm_shuffle_ps( nDelta, nDelta, _MM_SHUFFLE( 0, 3, 2, 1 ) );
+
+			__m128 nDeltaScale = _mm_mul_ps( nDelta, weight );
+
+			// position, then normal, then tangent, each store overlaps the next field by one float
+			_mm_storeu_ps( pFlexedVertex->m_Position.Base(), 
+				_mm_add_ps( _mm_loadu_ps( pFlexedVertex->m_Position.Base() ), _mm_mul_ps( delta, weight ) ) );
+			_mm_storeu_ps( pFlexedVertex->m_Normal.Base(), 
+				_mm_add_ps( _mm_loadu_ps( pFlexedVertex->m_Normal.Base() ), nDeltaScale ) );
+			_mm_storeu_ps( pFlexedVertex->m_TangentS.Base(), 
+				_mm_add_ps( _mm_loadu_ps( pFlexedVertex->m_TangentS.Base() ), nDeltaScale ) );
+			Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// The same, a float at a time, for CPUs without SSE
+//-----------------------------------------------------------------------------
+static void R_StudioFlexVertsScalar( CCachedRenderData &vertexCache, mstudiovertex_t *pVertices, 
+	Vector4D *pstudiotangentS, mstudiovertanim_t *pvanim, int numverts, float w )
+{
+	for (int j = 0; j < numverts; j++)
+	{
+		int n = pvanim[j].index;
+
+		// only flex the indicies that are (still) part of this mesh
+		// if (n < (int)pmesh->numvertices)
+		if (1) // need LOD info here
+		{
+			CachedVertex_t* pFlexedVertex = R_GetFlexedVertex( vertexCache, pVertices, pstudiotangentS, n );
+
+			Vector nDeltaScale;
+			VectorMultiply( pvanim[j].ndelta, w, nDeltaScale );
+
+			VectorMA( pFlexedVertex->m_Position, w, pvanim[j].delta, pFlexedVertex->m_Position );
+			pFlexedVertex->m_Normal += nDeltaScale;
+			pFlexedVertex->m_TangentS.AsVector3D() += nDeltaScale;
+			Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds one flex's weighted deltas to the flexed vertices of the current mesh
+//-----------------------------------------------------------------------------
+void R_StudioFlexVertDeltas( CCachedRenderData &vertexCache, mstudiovertex_t *pVertices, 
+	Vector4D *pstudiotangentS, mstudiovertanim_t *pvanim, int numverts, float w, bool bSSE )
+{
+	if (bSSE)
+	{
+		R_StudioFlexVertsSSE( vertexCache, pVertices, pstudiotangentS, pvanim, numverts, w );
+	}
+	else
+	{
+		R_StudioFlexVertsScalar( vertexCache, pVertices, pstudiotangentS, pvanim, numverts, w );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Applies every flex of a mesh
+//-----------------------------------------------------------------------------
+void R_StudioFlexVerts( CCachedRenderData &vertexCache, mstudiomesh_t *pmesh, const float *pFlexWeights, bool bSSE )
+{
+	// get pointers to geometry
+	mstudiovertex_t *pVertices	= pmesh->Vertex(0);
+	Vector4D *pstudiotangentS	= pmesh->TangentS( 0 );
+
+	mstudioflex_t	*pflex = pmesh->pFlex( 0 );
+	
+	vertexCache.SetupComputation( pmesh, true );
+
+	// apply flex weights
+	for (int i = 0; i < pmesh->numflexes; i++)
+	{
+		float w = pFlexWeights[pflex[i].flexdesc];
+
+		if (w <= pflex[i].target0 || w >= pflex[i].target3)
+		{
+			// value outside of range
+			continue;
+		}
+		else if (w < pflex[i].target1)
+		{
+			// 0 to 1 ramp
+			w = (w - pflex[i].target0) / (pflex[i].target1 - pflex[i].target0);
+		}
+		else if (w > pflex[i].target2)
+		{
+			// 1 to 0 ramp
+			w = (pflex[i].target3 - w) / (pflex[i].target3 - pflex[i].target2);
+		}
+		else
+		{
+			// plat
+			w = 1.0;
+		}
+
+		if (w > -0.001 && w < 0.001)
+			continue;
+
+		mstudiovertanim_t *pvanim = pflex[i].pVertanim( 0 );
+		R_StudioFlexVertDeltas( vertexCache, pVertices, pstudiotangentS, pvanim, pflex[i].numverts, w, bSSE );
+	}
+}
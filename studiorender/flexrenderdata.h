@@ -203,4 +203,20 @@ inline void CCachedRenderData::SetBodyModelMesh( int body, int model, int mesh)
 }
 
 
+//-----------------------------------------------------------------------------
+// Adds one flex's vertex animation deltas, scaled by w, to the flexed vertices
+// of the mesh set up for a flex computation, making flexed copies of vertices
+// the first time they move
+//-----------------------------------------------------------------------------
+void R_StudioFlexVertDeltas( CCachedRenderData &vertexCache, mstudiovertex_t *pVertices, 
+	Vector4D *pstudiotangentS, mstudiovertanim_t *pvanim, int numverts, float w, bool bSSE );
+
+//-----------------------------------------------------------------------------
+// Sets up a flex computation for the mesh and adds the deltas of each of its
+// flexes, weighted by its controller in pFlexWeights ramped through its targets.
+// Flexes that end up with a weight within 0.001 of zero are skipped.
+//-----------------------------------------------------------------------------
+void R_StudioFlexVerts( CCachedRenderData &vertexCache, mstudiomesh_t *pmesh, const float *pFlexWeights, bool bSSE );
+
+
 #endif // FLEXRENDERDATA_H
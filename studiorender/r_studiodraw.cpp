@@ -20,6 +20,7 @@
 #include "mathlib.h"
 #include "vector.h"
 #include "studiostats.h"
+#include "r_studioskin.h"
 #include <malloc.h>
 #include <xmmintrin.h>
 
@@ -439,314 +440,6 @@ void CStudioRender::DrawShadows( int body, int flags )
 }
 
 
-static matrix3x4_t *ComputeSkinMatrix( mstudioboneweight_t &boneweights, matrix3x4_t *pPoseToWorld, matrix3x4_t &result )
-{
-	float flWeight0, flWeight1, flWeight2, flWeight3;
-
-	switch( boneweights.numbones )
-	{
-	default:
-	case 1:
-		return &pPoseToWorld[boneweights.bone[0]];
-
-	case 2:
-		{
-			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
-			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
-			flWeight0 = boneweights.weight[0];
-			flWeight1 = boneweights.weight[1];
-
-			// NOTE: Inlining here seems to make a fair amount of difference
-			result[0][0] = boneMat0[0][0] * flWeight0 + boneMat1[0][0] * flWeight1;
-			result[0][1] = boneMat0[0][1] * flWeight0 + boneMat1[0][1] * flWeight1;
-			result[0][2] = boneMat0[0][2] * flWeight0 + boneMat1[0][2] * flWeight1;
-			result[0][3] = boneMat0[0][3] * flWeight0 + boneMat1[0][3] * flWeight1;
-			result[1][0] = boneMat0[1][0] * flWeight0 + boneMat1[1][0] * flWeight1;
-			result[1][1] = boneMat0[1][1] * flWeight0 + boneMat1[1][1] * flWeight1;
-			result[1][2] = boneMat0[1][2] * flWeight0 + boneMat1[1][2] * flWeight1;
-			result[1][3] = boneMat0[1][3] * flWeight0 + boneMat1[1][3] * flWeight1;
-			result[2][0] = boneMat0[2][0] * flWeight0 + boneMat1[2][0] * flWeight1;
-			result[2][1] = boneMat0[2][1] * flWeight0 + boneMat1[2][1] * flWeight1;
-			result[2][2] = boneMat0[2][2] * flWeight0 + boneMat1[2][2] * flWeight1;
-			result[2][3] = boneMat0[2][3] * flWeight0 + boneMat1[2][3] * flWeight1;
-		}
-		return &result;
-
-	case 3:
-		{
-			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
-			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
-			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
-			flWeight0 = boneweights.weight[0];
-			flWeight1 = boneweights.weight[1];
-			flWeight2 = boneweights.weight[2];
-
-			result[0][0] = boneMat0[0][0] * flWeight0 + boneMat1[0][0] * flWeight1 + boneMat2[0][0] * flWeight2;
-			result[0][1] = boneMat0[0][1] * flWeight0 + boneMat1[0][1] * flWeight1 + boneMat2[0][1] * flWeight2;
-			result[0][2] = boneMat0[0][2] * flWeight0 + boneMat1[0][2] * flWeight1 + boneMat2[0][2] * flWeight2;
-			result[0][3] = boneMat0[0][3] * flWeight0 + boneMat1[0][3] * flWeight1 + boneMat2[0][3] * flWeight2;
-			result[1][0] = boneMat0[1][0] * flWeight0 + boneMat1[1][0] * flWeight1 + boneMat2[1][0] * flWeight2;
-			result[1][1] = boneMat0[1][1] * flWeight0 + boneMat1[1][1] * flWeight1 + boneMat2[1][1] * flWeight2;
-			result[1][2] = boneMat0[1][2] * flWeight0 + boneMat1[1][2] * flWeight1 + boneMat2[1][2] * flWeight2;
-			result[1][3] = boneMat0[1][3] * flWeight0 + boneMat1[1][3] * flWeight1 + boneMat2[1][3] * flWeight2;
-			result[2][0] = boneMat0[2][0] * flWeight0 + boneMat1[2][0] * flWeight1 + boneMat2[2][0] * flWeight2;
-			result[2][1] = boneMat0[2][1] * flWeight0 + boneMat1[2][1] * flWeight1 + boneMat2[2][1] * flWeight2;
-			result[2][2] = boneMat0[2][2] * flWeight0 + boneMat1[2][2] * flWeight1 + boneMat2[2][2] * flWeight2;
-			result[2][3] = boneMat0[2][3] * flWeight0 + boneMat1[2][3] * flWeight1 + boneMat2[2][3] * flWeight2;
-		}
-		return &result;
-
-	case 4:
-		{
-			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
-			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
-			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
-			matrix3x4_t &boneMat3 = pPoseToWorld[boneweights.bone[3]];
-			flWeight0 = boneweights.weight[0];
-			flWeight1 = boneweights.weight[1];
-			flWeight2 = boneweights.weight[2];
-			flWeight3 = boneweights.weight[3];
-
-			result[0][0] = boneMat0[0][0] * flWeight0 + boneMat1[0][0] * flWeight1 + boneMat2[0][0] * flWeight2 + boneMat3[0][0] * flWeight3;
-			result[0][1] = boneMat0[0][1] * flWeight0 + boneMat1[0][1] * flWeight1 + boneMat2[0][1] * flWeight2 + boneMat3[0][1] * flWeight3;
-			result[0][2] = boneMat0[0][2] * flWeight0 + boneMat1[0][2] * flWeight1 + boneMat2[0][2] * flWeight2 + boneMat3[0][2] * flWeight3;
-			result[0][3] = boneMat0[0][3] * flWeight0 + boneMat1[0][3] * flWeight1 + boneMat2[0][3] * flWeight2 + boneMat3[0][3] * flWeight3;
-			result[1][0] = boneMat0[1][0] * flWeight0 + boneMat1[1][0] * flWeight1 + boneMat2[1][0] * flWeight2 + boneMat3[1][0] * flWeight3;
-			result[1][1] = boneMat0[1][1] * flWeight0 + boneMat1[1][1] * flWeight1 + boneMat2[1][1] * flWeight2 + boneMat3[1][1] * flWeight3;
-			result[1][2] = boneMat0[1][2] * flWeight0 + boneMat1[1][2] * flWeight1 + boneMat2[1][2] * flWeight2 + boneMat3[1][2] * flWeight3;
-			result[1][3] = boneMat0[1][3] * flWeight0 + boneMat1[1][3] * flWeight1 + boneMat2[1][3] * flWeight2 + boneMat3[1][3] * flWeight3;
-			result[2][0] = boneMat0[2][0] * flWeight0 + boneMat1[2][0] * flWeight1 + boneMat2[2][0] * flWeight2 + boneMat3[2][0] * flWeight3;
-			result[2][1] = boneMat0[2][1] * flWeight0 + boneMat1[2][1] * flWeight1 + boneMat2[2][1] * flWeight2 + boneMat3[2][1] * flWeight3;
-			result[2][2] = boneMat0[2][2] * flWeight0 + boneMat1[2][2] * flWeight1 + boneMat2[2][2] * flWeight2 + boneMat3[2][2] * flWeight3;
-			result[2][3] = boneMat0[2][3] * flWeight0 + boneMat1[2][3] * flWeight1 + boneMat2[2][3] * flWeight2 + boneMat3[2][3] * flWeight3;
-		}
-		return &result;
-	}
-
-	Assert(0);
-	return NULL;
-}
-
-
-static matrix3x4_t *ComputeSkinMatrixSSE( mstudioboneweight_t &boneweights, matrix3x4_t *pPoseToWorld, matrix3x4_t &result )
-{
-	// NOTE: pPoseToWorld, being cache aligned, doesn't need explicit initialization
-#ifdef _WIN32
-	switch( boneweights.numbones )
-	{
-	default:
-	case 1:
-		return &pPoseToWorld[boneweights.bone[0]];
-
-	case 2:
-		{
-			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
-			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
-			float *pWeights = boneweights.weight;
-
-			_asm
-			{
-				mov		eax, DWORD PTR [pWeights]
-				movss	xmm6, dword ptr[eax]		; boneweights.weight[0]
-				movss	xmm7, dword ptr[eax + 4]	; boneweights.weight[1]
-
-				mov		eax, DWORD PTR [boneMat0]
-				mov		ecx, DWORD PTR [boneMat1]
-				mov		edi, DWORD PTR [result]
-
-				// Fill xmm6, and 7 with all the bone weights
-				shufps	xmm6, xmm6, 0
-				shufps	xmm7, xmm7, 0
-
-				// Load up all rows of the three matrices
-				movaps	xmm0, XMMWORD PTR [eax]
-				movaps	xmm1, XMMWORD PTR [ecx]
-				movaps	xmm2, XMMWORD PTR [eax + 16]
-				movaps	xmm3, XMMWORD PTR [ecx + 16]
-				movaps	xmm4, XMMWORD PTR [eax + 32]
-				movaps	xmm5, XMMWORD PTR [ecx + 32]
-
-				// Multiply the rows by the weights
-				mulps	xmm0, xmm6
-				mulps	xmm1, xmm7
-				mulps	xmm2, xmm6
-				mulps	xmm3, xmm7
-				mulps	xmm4, xmm6
-				mulps	xmm5, xmm7
-
-				addps	xmm0, xmm1
-				addps	xmm2, xmm3
-				addps	xmm4, xmm5
-
-				movaps	XMMWORD PTR [edi], xmm0
-				movaps	XMMWORD PTR [edi + 16], xmm2
-				movaps	XMMWORD PTR [edi + 32], xmm4
-			}
-		}
-		return &result;
-
-	case 3:
-		{
-			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
-			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
-			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
-			float *pWeights = boneweights.weight;
-
-			_asm
-			{
-				mov		eax, DWORD PTR [pWeights]
-				movss	xmm5, dword ptr[eax]		; boneweights.weight[0]
-				movss	xmm6, dword ptr[eax + 4]	; boneweights.weight[1]
-				movss	xmm7, dword ptr[eax + 8]	; boneweights.weight[2]
-
-				mov		eax, DWORD PTR [boneMat0]
-				mov		ecx, DWORD PTR [boneMat1]
-				mov		edx, DWORD PTR [boneMat2]
-				mov		edi, DWORD PTR [result]
-
-				// Fill xmm5, 6, and 7 with all the bone weights
-				shufps	xmm5, xmm5, 0
-				shufps	xmm6, xmm6, 0
-				shufps	xmm7, xmm7, 0
-
-				// Load up the first row of the three matrices
-				movaps	xmm0, XMMWORD PTR [eax]
-				movaps	xmm1, XMMWORD PTR [ecx]
-				movaps	xmm2, XMMWORD PTR [edx]
-
-				// Multiply the rows by the weights
-				mulps	xmm0, xmm5
-				mulps	xmm1, xmm6
-				mulps	xmm2, xmm7
-
-				addps	xmm0, xmm1
-				addps	xmm0, xmm2
-				movaps	XMMWORD PTR [edi], xmm0
-				
-				// Load up the second row of the three matrices
-				movaps	xmm0, XMMWORD PTR [eax + 16]
-				movaps	xmm1, XMMWORD PTR [ecx + 16]
-				movaps	xmm2, XMMWORD PTR [edx + 16]
-
-				// Multiply the rows by the weights
-				mulps	xmm0, xmm5
-				mulps	xmm1, xmm6
-				mulps	xmm2, xmm7
-
-				addps	xmm0, xmm1
-				addps	xmm0, xmm2
-				movaps	XMMWORD PTR [edi + 16], xmm0	
-
-				// Load up the third row of the three matrices
-				movaps	xmm0, XMMWORD PTR [eax + 32]
-				movaps	xmm1, XMMWORD PTR [ecx + 32]
-				movaps	xmm2, XMMWORD PTR [edx + 32]
-
-				// Multiply the rows by the weights
-				mulps	xmm0, xmm5
-				mulps	xmm1, xmm6
-				mulps	xmm2, xmm7
-
-				addps	xmm0, xmm1
-				addps	xmm0, xmm2
-				movaps	XMMWORD PTR [edi + 32], xmm0	
-			}
-		}
-		return &result;
-
-	case 4:
-		{
-			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
-			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
-			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
-			matrix3x4_t &boneMat3 = pPoseToWorld[boneweights.bone[3]];
-			float *pWeights = boneweights.weight;
-
-			_asm
-			{
-				mov		eax, DWORD PTR [pWeights]
-				movss	xmm4, dword ptr[eax]		; boneweights.weight[0]
-				movss	xmm5, dword ptr[eax + 4]	; boneweights.weight[1]
-				movss	xmm6, dword ptr[eax + 8]	; boneweights.weight[2]
-				movss	xmm7, dword ptr[eax + 12]	; boneweights.weight[3]
-
-				mov		eax, DWORD PTR [boneMat0]
-				mov		ecx, DWORD PTR [boneMat1]
-				mov		edx, DWORD PTR [boneMat2]
-				mov		esi, DWORD PTR [boneMat3]
-				mov		edi, DWORD PTR [result]
-
-				// Fill xmm5, 6, and 7 with all the bone weights
-				shufps	xmm4, xmm4, 0
-				shufps	xmm5, xmm5, 0
-				shufps	xmm6, xmm6, 0
-				shufps	xmm7, xmm7, 0
-
-				// Load up the first row of the four matrices
-				movaps	xmm0, XMMWORD PTR [eax]
-				movaps	xmm1, XMMWORD PTR [ecx]
-				movaps	xmm2, XMMWORD PTR [edx]
-				movaps	xmm3, XMMWORD PTR [esi]
-
-				// Multiply the rows by the weights
-				mulps	xmm0, xmm4
-				mulps	xmm1, xmm5
-				mulps	xmm2, xmm6
-				mulps	xmm3, xmm7
-
-				addps	xmm0, xmm1
-				addps	xmm2, xmm3
-				addps	xmm0, xmm2
-				movaps	XMMWORD PTR [edi], xmm0
-				
-				// Load up the second row of the three matrices
-				movaps	xmm0, XMMWORD PTR [eax + 16]
-				movaps	xmm1, XMMWORD PTR [ecx + 16]
-				movaps	xmm2, XMMWORD PTR [edx + 16]
-				movaps	xmm3, XMMWORD PTR [esi + 16]
-
-				// Multiply the rows by the weights
-				mulps	xmm0, xmm4
-				mulps	xmm1, xmm5
-				mulps	xmm2, xmm6
-				mulps	xmm3, xmm7
-
-				addps	xmm0, xmm1
-				addps	xmm2, xmm3
-				addps	xmm0, xmm2
-				movaps	XMMWORD PTR [edi + 16], xmm0	
-
-				// Load up the third row of the three matrices
-				movaps	xmm0, XMMWORD PTR [eax + 32]
-				movaps	xmm1, XMMWORD PTR [ecx + 32]
-				movaps	xmm2, XMMWORD PTR [edx + 32]
-				movaps	xmm3, XMMWORD PTR [esi + 32]
-
-				// Multiply the rows by the weights
-				mulps	xmm0, xmm4
-				mulps	xmm1, xmm5
-				mulps	xmm2, xmm6
-				mulps	xmm3, xmm7
-
-				addps	xmm0, xmm1
-				addps	xmm2, xmm3
-				addps	xmm0, xmm2
-				movaps	XMMWORD PTR [edi + 32], xmm0	
-			}
-		}
-		return &result;
-	}
-#elif _LINUX
-#warning "ComputeSkinMatrixSSE C implementation only"
-	return ComputeSkinMatrix( boneweights, pPoseToWorld, result );
-#else
-#error
-#endif
-	Assert(0);
-	return NULL;
-}
-
-
 //-----------------------------------------------------------------------------
 // Computes lighting
 //-----------------------------------------------------------------------------
@@ -829,57 +522,20 @@ public:
 		}
 	}
 
-	static void R_TransformVert( const Vector *pSrcPos, const Vector *pSrcNorm, const Vector4D *pSrcTangentS,
-		matrix3x4_t *pSkinMat, VectorAligned &pos, VectorAligned &norm, Vector4DAligned &tangentS )
-	{
-		// NOTE: Could add SSE stuff here, if we knew what SSE stuff could make it faster
-
-		pos.x =		pSrcPos->x * (*pSkinMat)[0][0]	+ pSrcPos->y * (*pSkinMat)[0][1]	+ pSrcPos->z * (*pSkinMat)[0][2] + (*pSkinMat)[0][3];
-		norm.x =	pSrcNorm->x * (*pSkinMat)[0][0] + pSrcNorm->y * (*pSkinMat)[0][1]	+ pSrcNorm->z * (*pSkinMat)[0][2];
-
-		pos.y =		pSrcPos->x * (*pSkinMat)[1][0]	+ pSrcPos->y * (*pSkinMat)[1][1]	+ pSrcPos->z * (*pSkinMat)[1][2] + (*pSkinMat)[1][3];
-		norm.y =	pSrcNorm->x * (*pSkinMat)[1][0] + pSrcNorm->y * (*pSkinMat)[1][1]	+ pSrcNorm->z * (*pSkinMat)[1][2];
-
-		pos.z =		pSrcPos->x * (*pSkinMat)[2][0]	+ pSrcPos->y * (*pSkinMat)[2][1]	+ pSrcPos->z * (*pSkinMat)[2][2] + (*pSkinMat)[2][3];
-		norm.z =	pSrcNorm->x * (*pSkinMat)[2][0] + pSrcNorm->y * (*pSkinMat)[2][1]	+ pSrcNorm->z * (*pSkinMat)[2][2];
-
-		if (nHasTangentSpace)
-		{
-			tangentS.x = pSrcTangentS->x * (*pSkinMat)[0][0] + pSrcTangentS->y * (*pSkinMat)[0][1]	+ pSrcTangentS->z * (*pSkinMat)[0][2];
-			tangentS.y = pSrcTangentS->x * (*pSkinMat)[1][0] + pSrcTangentS->y * (*pSkinMat)[1][1]	+ pSrcTangentS->z * (*pSkinMat)[1][2];
-			tangentS.z = pSrcTangentS->x * (*pSkinMat)[2][0] + pSrcTangentS->y * (*pSkinMat)[2][1]	+ pSrcTangentS->z * (*pSkinMat)[2][2];
-			tangentS.w = pSrcTangentS->w;
-		}
-	}
-
 	static void R_StudioSoftwareProcessMesh( mstudiomesh_t* pmesh, matrix3x4_t *pPoseToWorld,
 		CCachedRenderData &vertexCache, CMeshBuilder& meshBuilder, int numVertices, unsigned short* pGroupToMesh, float r_blend )
 	{
-		Vector color;
-		Vector4D *pStudioTangentS;
 		VectorAligned norm, pos;
 		Vector4DAligned tangentS;
-		Vector *pSrcPos;
-		Vector *pSrcNorm;
-		Vector4D *pSrcTangentS = NULL;
-#ifdef _WIN32		
-		__declspec(align(16)) matrix3x4_t temp;
-		__declspec(align(16)) matrix3x4_t *pSkinMat;
-#elif _LINUX
-		__attribute__((aligned(16))) matrix3x4_t temp;
-		__attribute__((aligned(16))) matrix3x4_t *pSkinMat;
-#endif
-		int ntemp[4];
 
 		Assert( numVertices > 0 );
 
 		// Gets at the vertex data
 		mstudiovertex_t *pVertices = pmesh->Vertex(0);
-		if (nHasTangentSpace)
-		{
-			pStudioTangentS = pmesh->TangentS( 0 );
-			Assert( pStudioTangentS->w == -1.0f || pStudioTangentS->w == 1.0f );
-		}
+
+		// Transform the verts into world space
+		skinnedvertex_t *pSkinned = R_SkinVertices( pmesh, pPoseToWorld, nDoFlex ? &vertexCache : NULL, 
+			nHasTangentSpace != 0, nHasSSE != 0, numVertices, pGroupToMesh );
 
 		// Mouth related stuff...
 		float fIllum = 1.0f;
@@ -904,73 +560,18 @@ public:
 			#endif
 		#endif
 
-		// Precaches the data
-		for ( int i = 0; i < 4; ++i )
-		{
-			ntemp[i] = pGroupToMesh[i];
-
-			if (nHasSSE)
-			{
-				char *pMem = (char*)&pVertices[ntemp[i]];
-				_mm_prefetch( pMem, _MM_HINT_T0 );
-				_mm_prefetch( pMem + 32, _MM_HINT_T0 );
-
-				if (nHasTangentSpace)
-				{
-					_mm_prefetch( (char*)&pStudioTangentS[ntemp[i]], _MM_HINT_T0 );
-				}
-			}
-		}
-
-		int n, idx;
 		for ( int j=0; j < numVertices; ++j )
 		{
-			idx = j & 0x3;
-			n = ntemp[idx];
+			mstudiovertex_t &vert = pVertices[pGroupToMesh[j]];
+			skinnedvertex_t &skinned = pSkinned[j];
 
-			mstudiovertex_t &vert = pVertices[n];
-
-			ntemp[idx] = pGroupToMesh[j+4];
-
-			// Compute the skinning matrix
-			if (nHasSSE)
-			{
-				pSkinMat = ComputeSkinMatrixSSE( vert.m_BoneWeights, pPoseToWorld, temp );
-			}
-			else
-			{
-				pSkinMat = ComputeSkinMatrix( vert.m_BoneWeights, pPoseToWorld, temp );
-			}
-			
-			// transform into world space
-			if (nDoFlex && vertexCache.IsVertexFlexed(n))
-			{
-				CachedVertex_t* pFlexedVertex = vertexCache.GetFlexVertex(n);
-				pSrcPos = &pFlexedVertex->m_Position;
-				pSrcNorm = &pFlexedVertex->m_Normal;
-				VectorNormalize( pFlexedVertex->m_Normal );
-
-				if (nHasTangentSpace)
-				{
-					pSrcTangentS = &pFlexedVertex->m_TangentS;
-					Assert( pSrcTangentS->w == -1.0f || pSrcTangentS->w == 1.0f );
-				}
-			}
-			else
+			pos.Init( skinned.m_Position[0], skinned.m_Position[1], skinned.m_Position[2] );
+			norm.Init( skinned.m_Normal[0], skinned.m_Normal[1], skinned.m_Normal[2] );
+			if (nHasTangentSpace)
 			{
-				pSrcPos = &vert.m_vecPosition;
-				pSrcNorm = &vert.m_vecNormal;
-
-				if (nHasTangentSpace)
-				{
-					pSrcTangentS = &pStudioTangentS[n];
-					Assert( pSrcTangentS->w == -1.0f || pSrcTangentS->w == 1.0f );
-				}
+				tangentS.Init( skinned.m_TangentS[0], skinned.m_TangentS[1], skinned.m_TangentS[2], skinned.m_TangentS[3] );
 			}
 
-			// Transform the vert into world space
-			R_TransformVert( pSrcPos, pSrcNorm, pSrcTangentS, pSkinMat, pos, norm, tangentS );
-
 			// Compute lighting
 			R_PerformLighting( forward, fIllum, pos, norm, r_blend, meshBuilder );
 
@@ -997,17 +598,6 @@ public:
 	#endif
 
 			meshBuilder.AdvanceVertex();
-
-			if (nHasSSE)
-			{
-				_mm_prefetch( (char*)&pVertices[ntemp[idx]], _MM_HINT_T0 );
-				_mm_prefetch( (char*)&pVertices[ntemp[idx]] + 32, _MM_HINT_T0 );
-
-				if (nHasTangentSpace)
-				{
-					_mm_prefetch( (char*)&pStudioTangentS[ntemp[idx]], _MM_HINT_T0 );
-				}
-			}
 		}
 	}
 };
@@ -1093,77 +683,20 @@ void CStudioRender::R_StudioSoftwareProcessMesh( mstudiomesh_t* pmesh, CMeshBuil
 	g_SoftwareProcessFunc[idx](pmesh, m_PoseToWorld, m_VertexCache, meshBuilder, numVertices, pGroupToMesh, r_blend ); 
 }
 
-static void R_SlowTransformVert( const Vector *pSrcPos, const Vector *pSrcNorm, const Vector4D *pSrcTangentS,
-	matrix3x4_t *pSkinMat, VectorAligned &pos, VectorAligned &norm, Vector4DAligned &tangentS )
-{
-	pos.x =		pSrcPos->x * (*pSkinMat)[0][0]	+ pSrcPos->y * (*pSkinMat)[0][1]	+ pSrcPos->z * (*pSkinMat)[0][2] + (*pSkinMat)[0][3];
-	norm.x =	pSrcNorm->x * (*pSkinMat)[0][0] + pSrcNorm->y * (*pSkinMat)[0][1]	+ pSrcNorm->z * (*pSkinMat)[0][2];
-
-	pos.y =		pSrcPos->x * (*pSkinMat)[1][0]	+ pSrcPos->y * (*pSkinMat)[1][1]	+ pSrcPos->z * (*pSkinMat)[1][2] + (*pSkinMat)[1][3];
-	norm.y =	pSrcNorm->x * (*pSkinMat)[1][0] + pSrcNorm->y * (*pSkinMat)[1][1]	+ pSrcNorm->z * (*pSkinMat)[1][2];
-
-	pos.z =		pSrcPos->x * (*pSkinMat)[2][0]	+ pSrcPos->y * (*pSkinMat)[2][1]	+ pSrcPos->z * (*pSkinMat)[2][2] + (*pSkinMat)[2][3];
-	norm.z =	pSrcNorm->x * (*pSkinMat)[2][0] + pSrcNorm->y * (*pSkinMat)[2][1]	+ pSrcNorm->z * (*pSkinMat)[2][2];
-
-	tangentS.x = pSrcTangentS->x * (*pSkinMat)[0][0] + pSrcTangentS->y * (*pSkinMat)[0][1]	+ pSrcTangentS->z * (*pSkinMat)[0][2];
-	tangentS.y = pSrcTangentS->x * (*pSkinMat)[1][0] + pSrcTangentS->y * (*pSkinMat)[1][1]	+ pSrcTangentS->z * (*pSkinMat)[1][2];
-	tangentS.z = pSrcTangentS->x * (*pSkinMat)[2][0] + pSrcTangentS->y * (*pSkinMat)[2][1]	+ pSrcTangentS->z * (*pSkinMat)[2][2];
-	tangentS.w = pSrcTangentS->w;
-}
-
 void CStudioRender::R_StudioSoftwareProcessMesh_Normals( mstudiomesh_t* pmesh, CMeshBuilder& meshBuilder, 
 		int numVertices, unsigned short* pGroupToMesh, StudioModelLighting_t lighting, bool doFlex, float r_blend,
 		bool bNeedsTangentSpace )
 {
-#ifdef _WIN32
-	__declspec(align(16)) matrix3x4_t temp;
-	__declspec(align(16)) matrix3x4_t *pSkinMat;
-#elif _LINUX
-	__attribute__((aligned(16))) matrix3x4_t temp;
-	__attribute__((aligned(16))) matrix3x4_t *pSkinMat;
-#endif
-	Vector *pSrcPos;
-	Vector *pSrcNorm;
-	Vector4D *pSrcTangentS = NULL;
-	Vector4D *pStudioTangentS;
 	VectorAligned norm, pos;
-	Vector4DAligned tangentS;
 
-	// Gets at the vertex data
-	mstudiovertex_t *pVertices = pmesh->Vertex(0);
-	pStudioTangentS = pmesh->TangentS( 0 );
-	Assert( pStudioTangentS->w == -1.0f || pStudioTangentS->w == 1.0f );
+	// Transform the verts into world space
+	skinnedvertex_t *pSkinned = R_SkinVertices( pmesh, m_PoseToWorld, &m_VertexCache, 
+		false, false, numVertices, pGroupToMesh );
 
 	for ( int j=0; j < numVertices; j++ )
 	{
-		int n = pGroupToMesh[j];
-
-		mstudiovertex_t &vert = pVertices[n];
-
-		pSkinMat = ComputeSkinMatrix( vert.m_BoneWeights, m_PoseToWorld, temp );
-
-		// transform into world space
-		if (m_VertexCache.IsVertexFlexed(n))
-		{
-			CachedVertex_t* pFlexedVertex = m_VertexCache.GetFlexVertex(n);
-			pSrcPos = &pFlexedVertex->m_Position;
-			pSrcNorm = &pFlexedVertex->m_Normal;
-			VectorNormalize( pFlexedVertex->m_Normal );
-
-			pSrcTangentS = &pFlexedVertex->m_TangentS;
-			Assert( pSrcTangentS->w == -1.0f || pSrcTangentS->w == 1.0f );
-		}
-		else
-		{
-			pSrcPos = &vert.m_vecPosition;
-			pSrcNorm = &vert.m_vecNormal;
-
-			pSrcTangentS = &pStudioTangentS[n];
-			Assert( pSrcTangentS->w == -1.0f || pSrcTangentS->w == 1.0f );
-		}
-
-		// Transform the vert into world space
-		R_SlowTransformVert( pSrcPos, pSrcNorm, pSrcTangentS, pSkinMat, pos, norm, tangentS );
+		pos.Init( pSkinned[j].m_Position[0], pSkinned[j].m_Position[1], pSkinned[j].m_Position[2] );
+		norm.Init( pSkinned[j].m_Normal[0], pSkinned[j].m_Normal[1], pSkinned[j].m_Normal[2] );
 
 		meshBuilder.Position3fv( pos.Base() );
 		meshBuilder.Normal3f( 1.0f, 0.0f, 0.0f );
@@ -191,82 +191,7 @@ void CStudioRender::R_StudioFlexVerts( mstudiomesh_t *pmesh )
 	if (m_VertexCache.IsFlexComputationDone())
 		return;
 
-	// get pointers to geometry
-	mstudiovertex_t *pVertices	= pmesh->Vertex(0);
-	Vector4D *pstudiotangentS	= pmesh->TangentS( 0 );
-
-	mstudioflex_t	*pflex = pmesh->pFlex( 0 );
-	
-	m_VertexCache.SetupComputation( pmesh, true );
-
-	// apply flex weights
-	int i, j, n;
-
-	for (i = 0; i < pmesh->numflexes; i++)
-	{
-		float w = m_FlexWeights[pflex[i].flexdesc];
-
-		if (w <= pflex[i].target0 || w >= pflex[i].target3)
-		{
-			// value outside of range
-			continue;
-		}
-		else if (w < pflex[i].target1)
-		{
-			// 0 to 1 ramp
-			w = (w - pflex[i].target0) / (pflex[i].target1 - pflex[i].target0);
-		}
-		else if (w > pflex[i].target2)
-		{
-			// 1 to 0 ramp
-			w = (pflex[i].target3 - w) / (pflex[i].target3 - pflex[i].target2);
-		}
-		else
-		{
-			// plat
-			w = 1.0;
-		}
-
-		if (w > -0.001 && w < 0.001)
-			continue;
-
-		mstudiovertanim_t *pvanim = pflex[i].pVertanim( 0 );
-
-		for (j = 0; j < pflex[i].numverts; j++)
-		{
-			n = pvanim[j].index;
-			mstudiovertex_t &vert = pVertices[n];
-
-			// only flex the indicies that are (still) part of this mesh
-			// if (n < (int)pmesh->numvertices)
-			if (1) // need LOD info here
-			{
-				CachedVertex_t* pFlexedVertex;
-				if (!m_VertexCache.IsVertexFlexed(n))
-				{
-					// Add a new flexed vert to the flexed vertex list
-					pFlexedVertex = m_VertexCache.CreateFlexVertex(n);
-
-					VectorCopy( vert.m_vecPosition, pFlexedVertex->m_Position );
-					VectorCopy( vert.m_vecNormal, pFlexedVertex->m_Normal );
-					Vector4DCopy( pstudiotangentS[n], pFlexedVertex->m_TangentS );
-					Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
-				}
-				else
-				{
-					pFlexedVertex = m_VertexCache.GetFlexVertex(n);
-				}
-
-				Vector nDeltaScale;
-				VectorMultiply( pvanim[j].ndelta, w, nDeltaScale );
-
-				VectorMA( pFlexedVertex->m_Position, w, pvanim[j].delta, pFlexedVertex->m_Position );
-				pFlexedVertex->m_Normal += nDeltaScale;
-				pFlexedVertex->m_TangentS.AsVector3D() += nDeltaScale;
-				Assert( pFlexedVertex->m_TangentS.w == -1.0f || pFlexedVertex->m_TangentS.w == 1.0f );
-			}
-		}
-	}
+	::R_StudioFlexVerts( m_VertexCache, pmesh, m_FlexWeights, MathLib_SSEEnabled() );
 }
 
 
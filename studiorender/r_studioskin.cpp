@@ -0,0 +1,548 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Software skinning for the software mesh paths
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "r_studioskin.h"
+#include "studio.h"
+#include "flexrenderdata.h"
+#include "mathlib.h"
+#include "utlvector.h"
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include <xmmintrin.h>
+
+
+matrix3x4_t *ComputeSkinMatrix( mstudioboneweight_t &boneweights, matrix3x4_t *pPoseToWorld, matrix3x4_t &result )
+{
+	float flWeight0, flWeight1, flWeight2, flWeight3;
+
+	switch( boneweights.numbones )
+	{
+	default:
+	case 1:
+		return &pPoseToWorld[boneweights.bone[0]];
+
+	case 2:
+		{
+			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
+			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
+			flWeight0 = boneweights.weight[0];
+			flWeight1 = boneweights.weight[1];
+
+			// NOTE: Inlining here seems to make a fair amount of difference
+			result[0][0] = boneMat0[0][0] * flWeight0 + boneMat1[0][0] * flWeight1;
+			result[0][1] = boneMat0[0][1] * flWeight0 + boneMat1[0][1] * flWeight1;
+			result[0][2] = boneMat0[0][2] * flWeight0 + boneMat1[0][2] * flWeight1;
+			result[0][3] = boneMat0[0][3] * flWeight0 + boneMat1[0][3] * flWeight1;
+			result[1][0] = boneMat0[1][0] * flWeight0 + boneMat1[1][0] * flWeight1;
+			result[1][1] = boneMat0[1][1] * flWeight0 + boneMat1[1][1] * flWeight1;
+			result[1][2] = boneMat0[1][2] * flWeight0 + boneMat1[1][2] * flWeight1;
+			result[1][3] = boneMat0[1][3] * flWeight0 + boneMat1[1][3] * flWeight1;
+			result[2][0] = boneMat0[2][0] * flWeight0 + boneMat1[2][0] * flWeight1;
+			result[2][1] = boneMat0[2][1] * flWeight0 + boneMat1[2][1] * flWeight1;
+			result[2][2] = boneMat0[2][2] * flWeight0 + boneMat1[2][2] * flWeight1;
+			result[2][3] = boneMat0[2][3] * flWeight0 + boneMat1[2][3] * flWeight1;
+		}
+		return &result;
+
+	case 3:
+		{
+			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
+			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
+			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
+			flWeight0 = boneweights.weight[0];
+			flWeight1 = boneweights.weight[1];
+			flWeight2 = boneweights.weight[2];
+
+			result[0][0] = boneMat0[0][0] * flWeight0 + boneMat1[0][0] * flWeight1 + boneMat2[0][0] * flWeight2;
+			result[0][1] = boneMat0[0][1] * flWeight0 + boneMat1[0][1] * flWeight1 + boneMat2[0][1] * flWeight2;
+			result[0][2] = boneMat0[0][2] * flWeight0 + boneMat1[0][2] * flWeight1 + boneMat2[0][2] * flWeight2;
+			result[0][3] = boneMat0[0][3] * flWeight0 + boneMat1[0][3] * flWeight1 + boneMat2[0][3] * flWeight2;
+			result[1][0] = boneMat0[1][0] * flWeight0 + boneMat1[1][0] * flWeight1 + boneMat2[1][0] * flWeight2;
+			result[1][1] = boneMat0[1][1] * flWeight0 + boneMat1[1][1] * flWeight1 + boneMat2[1][1] * flWeight2;
+			result[1][2] = boneMat0[1][2] * flWeight0 + boneMat1[1][2] * flWeight1 + boneMat2[1][2] * flWeight2;
+			result[1][3] = boneMat0[1][3] * flWeight0 + boneMat1[1][3] * flWeight1 + boneMat2[1][3] * flWeight2;
+			result[2][0] = boneMat0[2][0] * flWeight0 + boneMat1[2][0] * flWeight1 + boneMat2[2][0] * flWeight2;
+			result[2][1] = boneMat0[2][1] * flWeight0 + boneMat1[2][1] * flWeight1 + boneMat2[2][1] * flWeight2;
+			result[2][2] = boneMat0[2][2] * flWeight0 + boneMat1[2][2] * flWeight1 + boneMat2[2][2] * flWeight2;
+			result[2][3] = boneMat0[2][3] * flWeight0 + boneMat1[2][3] * flWeight1 + boneMat2[2][3] * flWeight2;
+		}
+		return &result;
+
+	case 4:
+		{
+			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
+			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
+			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
+			matrix3x4_t &boneMat3 = pPoseToWorld[boneweights.bone[3]];
+			flWeight0 = boneweights.weight[0];
+			flWeight1 = boneweights.weight[1];
+			flWeight2 = boneweights.weight[2];
+			flWeight3 = boneweights.weight[3];
+
+			result[0][0] = boneMat0[0][0] * flWeight0 + boneMat1[0][0] * flWeight1 + boneMat2[0][0] * flWeight2 + boneMat3[0][0] * flWeight3;
+			result[0][1] = boneMat0[0][1] * flWeight0 + boneMat1[0][1] * flWeight1 + boneMat2[0][1] * flWeight2 + boneMat3[0][1] * flWeight3;
+			result[0][2] = boneMat0[0][2] * flWeight0 + boneMat1[0][2] * flWeight1 + boneMat2[0][2] * flWeight2 + boneMat3[0][2] * flWeight3;
+			result[0][3] = boneMat0[0][3] * flWeight0 + boneMat1[0][3] * flWeight1 + boneMat2[0][3] * flWeight2 + boneMat3[0][3] * flWeight3;
+			result[1][0] = boneMat0[1][0] * flWeight0 + boneMat1[1][0] * flWeight1 + boneMat2[1][0] * flWeight2 + boneMat3[1][0] * flWeight3;
+			result[1][1] = boneMat0[1][1] * flWeight0 + boneMat1[1][1] * flWeight1 + boneMat2[1][1] * flWeight2 + boneMat3[1][1] * flWeight3;
+			result[1][2] = boneMat0[1][2] * flWeight0 + boneMat1[1][2] * flWeight1 + boneMat2[1][2] * flWeight2 + boneMat3[1][2] * flWeight3;
+			result[1][3] = boneMat0[1][3] * flWeight0 + boneMat1[1][3] * flWeight1 + boneMat2[1][3] * flWeight2 + boneMat3[1][3] * flWeight3;
+			result[2][0] = boneMat0[2][0] * flWeight0 + boneMat1[2][0] * flWeight1 + boneMat2[2][0] * flWeight2 + boneMat3[2][0] * flWeight3;
+			result[2][1] = boneMat0[2][1] * flWeight0 + boneMat1[2][1] * flWeight1 + boneMat2[2][1] * flWeight2 + boneMat3[2][1] * flWeight3;
+			result[2][2] = boneMat0[2][2] * flWeight0 + boneMat1[2][2] * flWeight1 + boneMat2[2][2] * flWeight2 + boneMat3[2][2] * flWeight3;
+			result[2][3] = boneMat0[2][3] * flWeight0 + boneMat1[2][3] * flWeight1 + boneMat2[2][3] * flWeight2 + boneMat3[2][3] * flWeight3;
+		}
+		return &result;
+	}
+
+	Assert(0);
+	return NULL;
+}
+
+
+static matrix3x4_t *ComputeSkinMatrixSSE( mstudioboneweight_t &boneweights, matrix3x4_t *pPoseToWorld, matrix3x4_t &result )
+{
+	// NOTE: pPoseToWorld, being cache aligned, doesn't need explicit initialization
+#ifdef _WIN32
+	switch( boneweights.numbones )
+	{
+	default:
+	case 1:
+		return &pPoseToWorld[boneweights.bone[0]];
+
+	case 2:
+		{
+			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
+			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
+			float *pWeights = boneweights.weight;
+
+			_asm
+			{
+				mov		eax, DWORD PTR [pWeights]
+				movss	xmm6, dword ptr[eax]		; boneweights.weight[0]
+				movss	xmm7, dword ptr[eax + 4]	; boneweights.weight[1]
+
+				mov		eax, DWORD PTR [boneMat0]
+				mov		ecx, DWORD PTR [boneMat1]
+				mov		edi, DWORD PTR [result]
+
+				// Fill xmm6, and 7 with all the bone weights
+				shufps	xmm6, xmm6, 0
+				shufps	xmm7, xmm7, 0
+
+				// Load up all rows of the three matrices
+				movaps	xmm0, XMMWORD PTR [eax]
+				movaps	xmm1, XMMWORD PTR [ecx]
+				movaps	xmm2, XMMWORD PTR [eax + 16]
+				movaps	xmm3, XMMWORD PTR [ecx + 16]
+				movaps	xmm4, XMMWORD PTR [eax + 32]
+				movaps	xmm5, XMMWORD PTR [ecx + 32]
+
+				// Multiply the rows by the weights
+				mulps	xmm0, xmm6
+				mulps	xmm1, xmm7
+				mulps	xmm2, xmm6
+				mulps	xmm3, xmm7
+				mulps	xmm4, xmm6
+				mulps	xmm5, xmm7
+
+				addps	xmm0, xmm1
+				addps	xmm2, xmm3
+				addps	xmm4, xmm5
+
+				movaps	XMMWORD PTR [edi], xmm0
+				movaps	XMMWORD PTR [edi + 16], xmm2
+				movaps	XMMWORD PTR [edi + 32], xmm4
+			}
+		}
+		return &result;
+
+	case 3:
+		{
+			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
+			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
+			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
+			float *pWeights = boneweights.weight;
+
+			_asm
+			{
+				mov		eax, DWORD PTR [pWeights]
+				movss	xmm5, dword ptr[eax]		; boneweights.weight[0]
+				movss	xmm6, dword ptr[eax + 4]	; boneweights.weight[1]
+				movss	xmm7, dword ptr[eax + 8]	; boneweights.weight[2]
+
+				mov		eax, DWORD PTR [boneMat0]
+				mov		ecx, DWORD PTR [boneMat1]
+				mov		edx, DWORD PTR [boneMat2]
+				mov		edi, DWORD PTR [result]
+
+				// Fill xmm5, 6, and 7 with all the bone weights
+				shufps	xmm5, xmm5, 0
+				shufps	xmm6, xmm6, 0
+				shufps	xmm7, xmm7, 0
+
+				// Load up the first row of the three matrices
+				movaps	xmm0, XMMWORD PTR [eax]
+				movaps	xmm1, XMMWORD PTR [ecx]
+				movaps	xmm2, XMMWORD PTR [edx]
+
+				// Multiply the rows by the weights
+				mulps	xmm0, xmm5
+				mulps	xmm1, xmm6
+				mulps	xmm2, xmm7
+
+				addps	xmm0, xmm1
+				addps	xmm0, xmm2
+				movaps	XMMWORD PTR [edi], xmm0
+				
+				// Load up the second row of the three matrices
+				movaps	xmm0, XMMWORD PTR [eax + 16]
+				movaps	xmm1, XMMWORD PTR [ecx + 16]
+				movaps	xmm2, XMMWORD PTR [edx + 16]
+
+				// Multiply the rows by the weights
+				mulps	xmm0, xmm5
+				mulps	xmm1, xmm6
+				mulps	xmm2, xmm7
+
+				addps	xmm0, xmm1
+				addps	xmm0, xmm2
+				movaps	XMMWORD PTR [edi + 16], xmm0	
+
+				// Load up the third row of the three matrices
+				movaps	xmm0, XMMWORD PTR [eax + 32]
+				movaps	xmm1, XMMWORD PTR [ecx + 32]
+				movaps	xmm2, XMMWORD PTR [edx + 32]
+
+				// Multiply the rows by the weights
+				mulps	xmm0, xmm5
+				mulps	xmm1, xmm6
+				mulps	xmm2, xmm7
+
+				addps	xmm0, xmm1
+				addps	xmm0, xmm2
+				movaps	XMMWORD PTR [edi + 32], xmm0	
+			}
+		}
+		return &result;
+
+	case 4:
+		{
+			matrix3x4_t &boneMat0 = pPoseToWorld[boneweights.bone[0]];
+			matrix3x4_t &boneMat1 = pPoseToWorld[boneweights.bone[1]];
+			matrix3x4_t &boneMat2 = pPoseToWorld[boneweights.bone[2]];
+			matrix3x4_t &boneMat3 = pPoseToWorld[boneweights.bone[3]];
+			float *pWeights = boneweights.weight;
+
+			_asm
+			{
+				mov		eax, DWORD PTR [pWeights]
+				movss	xmm4, dword ptr[eax]		; boneweights.weight[0]
+				movss	xmm5, dword ptr[eax + 4]	; boneweights.weight[1]
+				movss	xmm6, dword ptr[eax + 8]	; boneweights.weight[2]
+				movss	xmm7, dword ptr[eax + 12]	; boneweights.weight[3]
+
+				mov		eax, DWORD PTR [boneMat0]
+				mov		ecx, DWORD PTR [boneMat1]
+				mov		edx, DWORD PTR [boneMat2]
+				mov		esi, DWORD PTR [boneMat3]
+				mov		edi, DWORD PTR [result]
+
+				// Fill xmm5, 6, and 7 with all the bone weights
+				shufps	xmm4, xmm4, 0
+				shufps	xmm5, xmm5, 0
+				shufps	xmm6, xmm6, 0
+				shufps	xmm7, xmm7, 0
+
+				// Load up the first row of the four matrices
+				movaps	xmm0, XMMWORD PTR [eax]
+				movaps	xmm1, XMMWORD PTR [ecx]
+				movaps	xmm2, XMMWORD PTR [edx]
+				movaps	xmm3, XMMWORD PTR [esi]
+
+				// Multiply the rows by the weights
+				mulps	xmm0, xmm4
+				mulps	xmm1, xmm5
+				mulps	xmm2, xmm6
+				mulps	xmm3, xmm7
+
+				addps	xmm0, xmm1
+				addps	xmm2, xmm3
+				addps	xmm0, xmm2
+				movaps	XMMWORD PTR [edi], xmm0
+				
+				// Load up the second row of the three matrices
+				movaps	xmm0, XMMWORD PTR [eax + 16]
+				movaps	xmm1, XMMWORD PTR [ecx + 16]
+				movaps	xmm2, XMMWORD PTR [edx + 16]
+				movaps	xmm3, XMMWORD PTR [esi + 16]
+
+				// Multiply the rows by the weights
+				mulps	xmm0, xmm4
+				mulps	xmm1, xmm5
+				mulps	xmm2, xmm6
+				mulps	xmm3, xmm7
+
+				addps	xmm0, xmm1
+				addps	xmm2, xmm3
+				addps	xmm0, xmm2
+				movaps	XMMWORD PTR [edi + 16], xmm0	
+
+				// Load up the third row of the three matrices
+				movaps	xmm0, XMMWORD PTR [eax + 32]
+				movaps	xmm1, XMMWORD PTR [ecx + 32]
+				movaps	xmm2, XMMWORD PTR [edx + 32]
+				movaps	xmm3, XMMWORD PTR [esi + 32]
+
+				// Multiply the rows by the weights
+				mulps	xmm0, xmm4
+				mulps	xmm1, xmm5
+				mulps	xmm2, xmm6
+				mulps	xmm3, xmm7
+
+				addps	xmm0, xmm1
+				addps	xmm2, xmm3
+				addps	xmm0, xmm2
+				movaps	XMMWORD PTR [edi + 32], xmm0	
+			}
+		}
+		return &result;
+	}
+#elif _LINUX
+#warning "ComputeSkinMatrixSSE C implementation only"
+	return ComputeSkinMatrix( boneweights, pPoseToWorld, result );
+#else
+#error
+#endif
+	Assert(0);
+	return NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Batched software skinning.  The software paths skin every vertex of a strip
+// group into a scratch array first, and only then light it and hand it to the
+// mesh builder, since the lighting and the mesh builder can't be used from
+// more than one thread.  Consecutive vertices usually share their bone
+// weights, so a blended matrix is reused for as long as they do, and big
+// groups are split into batches skinned in parallel.
+//-----------------------------------------------------------------------------
+
+// vertices per batch handed to a worker thread
+#define SKIN_BATCH_SIZE				256
+
+// groups smaller than this aren't worth waking up the workers for
+#define SKIN_PARALLEL_MIN_VERTICES	1024
+
+struct skinbatch_t
+{
+	mstudiovertex_t		*m_pVertices;
+	Vector4D			*m_pTangentS;		// NULL if there's no tangent space
+	CCachedRenderData	*m_pVertexCache;	// NULL if the mesh isn't flexed
+	matrix3x4_t			*m_pPoseToWorld;
+	unsigned short		*m_pGroupToMesh;
+	skinnedvertex_t		*m_pSkinned;
+	int					m_nVertices;
+	bool				m_bSSE;
+};
+
+static CUtlVector< skinnedvertex_t > s_SkinnedVertices;
+
+static inline bool SameBoneWeights( const mstudioboneweight_t &a, const mstudioboneweight_t &b )
+{
+	if ( a.numbones != b.numbones )
+		return false;
+
+	// anything but 2-4 bones only uses the first one
+	int nBones = ( a.numbones >= 2 && a.numbones <= 4 ) ? a.numbones : 1;
+	for ( int i = 0; i < nBones; ++i )
+	{
+		if ( a.bone[i] != b.bone[i] || a.weight[i] != b.weight[i] )
+			return false;
+	}
+	return true;
+}
+
+static inline void R_SkinVert( const Vector *pSrcPos, const Vector *pSrcNorm, const Vector4D *pSrcTangentS,
+	const matrix3x4_t *pSkinMat, skinnedvertex_t &out )
+{
+	out.m_Position[0] =	pSrcPos->x * (*pSkinMat)[0][0]	+ pSrcPos->y * (*pSkinMat)[0][1]	+ pSrcPos->z * (*pSkinMat)[0][2] + (*pSkinMat)[0][3];
+	out.m_Normal[0] =	pSrcNorm->x * (*pSkinMat)[0][0] + pSrcNorm->y * (*pSkinMat)[0][1]	+ pSrcNorm->z * (*pSkinMat)[0][2];
+
+	out.m_Position[1] =	pSrcPos->x * (*pSkinMat)[1][0]	+ pSrcPos->y * (*pSkinMat)[1][1]	+ pSrcPos->z * (*pSkinMat)[1][2] + (*pSkinMat)[1][3];
+	out.m_Normal[1] =	pSrcNorm->x * (*pSkinMat)[1][0] + pSrcNorm->y * (*pSkinMat)[1][1]	+ pSrcNorm->z * (*pSkinMat)[1][2];
+
+	out.m_Position[2] =	pSrcPos->x * (*pSkinMat)[2][0]	+ pSrcPos->y * (*pSkinMat)[2][1]	+ pSrcPos->z * (*pSkinMat)[2][2] + (*pSkinMat)[2][3];
+	out.m_Normal[2] =	pSrcNorm->x * (*pSkinMat)[2][0] + pSrcNorm->y * (*pSkinMat)[2][1]	+ pSrcNorm->z * (*pSkinMat)[2][2];
+
+	if ( pSrcTangentS )
+	{
+		out.m_TangentS[0] = pSrcTangentS->x * (*pSkinMat)[0][0] + pSrcTangentS->y * (*pSkinMat)[0][1]	+ pSrcTangentS->z * (*pSkinMat)[0][2];
+		out.m_TangentS[1] = pSrcTangentS->x * (*pSkinMat)[1][0] + pSrcTangentS->y * (*pSkinMat)[1][1]	+ pSrcTangentS->z * (*pSkinMat)[1][2];
+		out.m_TangentS[2] = pSrcTangentS->x * (*pSkinMat)[2][0] + pSrcTangentS->y * (*pSkinMat)[2][1]	+ pSrcTangentS->z * (*pSkinMat)[2][2];
+		out.m_TangentS[3] = pSrcTangentS->w;
+	}
+}
+
+// The skin matrix transposed so each register holds one column, x y z in the low three floats
+static inline void R_LoadSkinColumnsSSE( const matrix3x4_t *pSkinMat, __m128 *pColumns )
+{
+	for ( int i = 0; i < 4; ++i )
+	{
+		pColumns[i] = _mm_setr_ps( (*pSkinMat)[0][i], (*pSkinMat)[1][i], (*pSkinMat)[2][i], 0.0f );
+	}
+}
+
+static inline __m128 R_RotateSSE( const __m128 *pColumns, const float *pSrc )
+{
+	__m128 result = _mm_mul_ps( pColumns[0], _mm_set1_ps( pSrc[0] ) );
+	result = _mm_add_ps( result, _mm_mul_ps( pColumns[1], _mm_set1_ps( pSrc[1] ) ) );
+	return _mm_add_ps( result, _mm_mul_ps( pColumns[2], _mm_set1_ps( pSrc[2] ) ) );
+}
+
+static inline void R_SkinVertSSE( const Vector *pSrcPos, const Vector *pSrcNorm, const Vector4D *pSrcTangentS,
+	const __m128 *pColumns, skinnedvertex_t &out )
+{
+	// Same multiplies and adds in the same order as R_SkinVert, four rows at a time
+	_mm_storeu_ps( out.m_Position, _mm_add_ps( R_RotateSSE( pColumns, pSrcPos->Base() ), pColumns[3] ) );
+	_mm_storeu_ps( out.m_Normal, R_RotateSSE( pColumns, pSrcNorm->Base() ) );
+
+	if ( pSrcTangentS )
+	{
+		_mm_storeu_ps( out.m_TangentS, R_RotateSSE( pColumns, pSrcTangentS->Base() ) );
+		out.m_TangentS[3] = pSrcTangentS->w;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Skins vertices [nFirst, nFirst + nCount) of the group
+//-----------------------------------------------------------------------------
+static void R_SkinVertexRange( const skinbatch_t &batch, int nFirst, int nCount )
+{
+#ifdef _WIN32
+	__declspec(align(16)) matrix3x4_t temp;
+#elif _LINUX
+	__attribute__((aligned(16))) matrix3x4_t temp;
+#endif
+	matrix3x4_t *pSkinMat = NULL;
+	const mstudioboneweight_t *pSkinWeights = NULL;
+	__m128 columns[4];
+
+	int nEnd = nFirst + nCount;
+	for ( int j = nFirst; j < nEnd; ++j )
+	{
+		int n = batch.m_pGroupToMesh[j];
+		mstudiovertex_t &vert = batch.m_pVertices[n];
+
+		if ( batch.m_bSSE && j + 4 < nEnd )
+		{
+			char *pMem = (char*)&batch.m_pVertices[batch.m_pGroupToMesh[j + 4]];
+			_mm_prefetch( pMem, _MM_HINT_T0 );
+			_mm_prefetch( pMem + 32, _MM_HINT_T0 );
+		}
+
+		// Only blend a new matrix when the weights change
+		if ( !pSkinWeights || !SameBoneWeights( *pSkinWeights, vert.m_BoneWeights ) )
+		{
+			if ( batch.m_bSSE )
+			{
+				pSkinMat = ComputeSkinMatrixSSE( vert.m_BoneWeights, batch.m_pPoseToWorld, temp );
+				R_LoadSkinColumnsSSE( pSkinMat, columns );
+			}
+			else
+			{
+				pSkinMat = ComputeSkinMatrix( vert.m_BoneWeights, batch.m_pPoseToWorld, temp );
+			}
+			pSkinWeights = &vert.m_BoneWeights;
+		}
+
+		const Vector *pSrcPos;
+		const Vector *pSrcNorm;
+		const Vector4D *pSrcTangentS = NULL;
+		if ( batch.m_pVertexCache && batch.m_pVertexCache->IsVertexFlexed( n ) )
+		{
+			CachedVertex_t* pFlexedVertex = batch.m_pVertexCache->GetFlexVertex( n );
+			pSrcPos = &pFlexedVertex->m_Position;
+			pSrcNorm = &pFlexedVertex->m_Normal;
+			if ( batch.m_pTangentS )
+			{
+				pSrcTangentS = &pFlexedVertex->m_TangentS;
+			}
+		}
+		else
+		{
+			pSrcPos = &vert.m_vecPosition;
+			pSrcNorm = &vert.m_vecNormal;
+			if ( batch.m_pTangentS )
+			{
+				pSrcTangentS = &batch.m_pTangentS[n];
+			}
+		}
+		Assert( !pSrcTangentS || pSrcTangentS->w == -1.0f || pSrcTangentS->w == 1.0f );
+
+		if ( batch.m_bSSE )
+		{
+			R_SkinVertSSE( pSrcPos, pSrcNorm, pSrcTangentS, columns, batch.m_pSkinned[j] );
+		}
+		else
+		{
+			R_SkinVert( pSrcPos, pSrcNorm, pSrcTangentS, pSkinMat, batch.m_pSkinned[j] );
+		}
+	}
+}
+
+static void R_SkinVertexBatch( void *pContext, int iItem )
+{
+	const skinbatch_t &batch = *(const skinbatch_t *)pContext;
+
+	int nFirst = iItem * SKIN_BATCH_SIZE;
+	R_SkinVertexRange( batch, nFirst, min( SKIN_BATCH_SIZE, batch.m_nVertices - nFirst ) );
+}
+
+//-----------------------------------------------------------------------------
+// Skins the vertices of a strip group into s_SkinnedVertices, in group order
+//-----------------------------------------------------------------------------
+skinnedvertex_t *R_SkinVertices( mstudiomesh_t* pmesh, matrix3x4_t *pPoseToWorld, CCachedRenderData *pVertexCache,
+	bool bTangentSpace, bool bSSE, int numVertices, unsigned short* pGroupToMesh )
+{
+	s_SkinnedVertices.EnsureCount( numVertices );
+
+	skinbatch_t batch;
+	batch.m_pVertices = pmesh->Vertex(0);
+	batch.m_pTangentS = bTangentSpace ? pmesh->TangentS(0) : NULL;
+	batch.m_pVertexCache = pVertexCache;
+	batch.m_pPoseToWorld = pPoseToWorld;
+	batch.m_pGroupToMesh = pGroupToMesh;
+	batch.m_pSkinned = s_SkinnedVertices.Base();
+	batch.m_nVertices = numVertices;
+	batch.m_bSSE = bSSE;
+
+	// Flexed normals are normalized in place, do that here in order since the
+	// same vertex may be in more than one batch
+	if ( pVertexCache )
+	{
+		for ( int j = 0; j < numVertices; ++j )
+		{
+			int n = pGroupToMesh[j];
+			if ( pVertexCache->IsVertexFlexed( n ) )
+			{
+				VectorNormalize( pVertexCache->GetFlexVertex( n )->m_Normal );
+			}
+		}
+	}
+
+	if ( numVertices >= SKIN_PARALLEL_MIN_VERTICES && Plat_GetParallelThreadCount() > 1 )
+	{
+		Plat_ParallelProcess( R_SkinVertexBatch, &batch, (numVertices + SKIN_BATCH_SIZE - 1) / SKIN_BATCH_SIZE );
+	}
+	else
+	{
+		R_SkinVertexRange( batch, 0, numVertices );
+	}
+
+	return batch.m_pSkinned;
+}
@@ -0,0 +1,51 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Software skinning for the software mesh paths
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifndef R_STUDIOSKIN_H
+#define R_STUDIOSKIN_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+//-----------------------------------------------------------------------------
+// forward declarations
+//-----------------------------------------------------------------------------
+struct matrix3x4_t;
+struct mstudioboneweight_t;
+struct mstudiomesh_t;
+class CCachedRenderData;
+
+
+//-----------------------------------------------------------------------------
+// A skinned vertex, padded so the SSE path can store whole registers
+//-----------------------------------------------------------------------------
+struct skinnedvertex_t
+{
+	float	m_Position[4];
+	float	m_Normal[4];
+	float	m_TangentS[4];
+};
+
+
+//-----------------------------------------------------------------------------
+// Blends the bone matrices a vertex is weighted to; returns either result or
+// the bone's own matrix when there's only one
+//-----------------------------------------------------------------------------
+matrix3x4_t *ComputeSkinMatrix( mstudioboneweight_t &boneweights, matrix3x4_t *pPoseToWorld, matrix3x4_t &result );
+
+//-----------------------------------------------------------------------------
+// Skins the vertices of a strip group into a scratch array, in group order.
+// The array is reused by the next call.  pVertexCache is NULL if the mesh
+// isn't flexed.
+//-----------------------------------------------------------------------------
+skinnedvertex_t *R_SkinVertices( mstudiomesh_t* pmesh, matrix3x4_t *pPoseToWorld, CCachedRenderData *pVertexCache,
+	bool bTangentSpace, bool bSSE, int numVertices, unsigned short* pGroupToMesh );
+
+
+#endif // R_STUDIOSKIN_H
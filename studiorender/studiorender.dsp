@@ -166,6 +166,10 @@ SOURCE=.\r_studiolight.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\r_studioskin.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\studiostats.cpp
 # End Source File
 # Begin Source File
@@ -250,6 +254,10 @@ SOURCE=..\Public\PixelWriter.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\r_studioskin.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\Public\s3_intrf.h
 # End Source File
 # Begin Source File
@@ -10,6 +10,7 @@
 #include <windows.h>
 #elif _LINUX
 #include <stdio.h>
+#include <unistd.h>
 #endif
 #include "tier0/platform.h"
 #include "tier0/vcrmode.h"
@@ -304,9 +305,24 @@ const CPUInformation& GetCPUInformation()
 		pi.m_nLogicalProcessors = 1;
 	}
 #elif _LINUX
-	// TODO: poll /dev/cpuinfo when we have some benefits from multithreading
-	pi.m_nPhysicalProcessors = 1;
-	pi.m_nLogicalProcessors = 1;
+	// Processors the kernel has online, this counts each logical processor
+	long nOnline = sysconf( _SC_NPROCESSORS_ONLN );
+	if ( nOnline < 1 )
+	{
+		nOnline = 1;
+	}
+	if ( nOnline > 255 )
+	{
+		nOnline = 255;
+	}
+
+	int nPerPackage = pi.m_nLogicalProcessors ? pi.m_nLogicalProcessors : 1;
+	pi.m_nPhysicalProcessors = (unsigned char)(nOnline / nPerPackage);
+	pi.m_nLogicalProcessors = (unsigned char)nOnline;
+	if( pi.m_nPhysicalProcessors == 0 )
+	{
+		pi.m_nPhysicalProcessors = 1;
+	}
 #endif
 
 	// Determine Processor Features:
@@ -12,6 +12,7 @@
 
 #include <sys/time.h>
 #include <unistd.h>
+#include <pthread.h>
 
 extern VCRMode g_VCRMode;
 
@@ -115,5 +116,29 @@ void Plat_SetThreadName( unsigned long dwThreadID, const char *pName )
 	Assert( "Plat_SetThreadName not implemented");
 }
 
+// Private Thread local ID:
+static __thread unsigned long Plat_CurrentThreadID = 0;
+
+unsigned long Plat_PrimaryThreadID = 0;
+
+unsigned long Plat_RegisterThread( const char *pName )
+{
+	// Initialize the current thread ID.
+	Plat_CurrentThreadID = (unsigned long)pthread_self();
+	return Plat_CurrentThreadID;
+}
+
+// Registers the primary thread.
+unsigned long Plat_RegisterPrimaryThread()
+{
+	Plat_PrimaryThreadID = Plat_RegisterThread( "Primary Thread" );
+	return Plat_PrimaryThreadID;
+}
+
+unsigned long Plat_GetCurrentThreadID()
+{
+	return Plat_CurrentThreadID;
+}
+
 
 
@@ -0,0 +1,560 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Portable threading primitives
+//
+// $NoKeywords: $
+//=============================================================================
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#endif
+
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier0/dbg.h"
+
+//-----------------------------------------------------------------------------
+// Threads
+//-----------------------------------------------------------------------------
+struct ThreadInit_t
+{
+	ThreadFunc_t	m_pfnThread;
+	void			*m_pParam;
+	const char		*m_pName;
+};
+
+#ifdef _WIN32
+
+static DWORD WINAPI ThreadProc( LPVOID pParam )
+{
+	ThreadInit_t init = *(ThreadInit_t *)pParam;
+	delete (ThreadInit_t *)pParam;
+
+	Plat_RegisterThread( init.m_pName );
+	return init.m_pfnThread( init.m_pParam );
+}
+
+ThreadHandle_t Plat_CreateThread( ThreadFunc_t pfnThread, void *pParam, const char *pName )
+{
+	ThreadInit_t *pInit = new ThreadInit_t;
+	pInit->m_pfnThread = pfnThread;
+	pInit->m_pParam = pParam;
+	pInit->m_pName = pName;
+
+	DWORD dwThreadID;
+	HANDLE hThread = CreateThread( NULL, 0, ThreadProc, pInit, 0, &dwThreadID );
+	if ( !hThread )
+	{
+		delete pInit;
+		return NULL;
+	}
+	return (ThreadHandle_t)hThread;
+}
+
+void Plat_JoinThread( ThreadHandle_t hThread )
+{
+	WaitForSingleObject( (HANDLE)hThread, INFINITE );
+	CloseHandle( (HANDLE)hThread );
+}
+
+void Plat_Sleep( unsigned nMilliseconds )
+{
+	Sleep( nMilliseconds );
+}
+
+#else
+
+static void *ThreadProc( void *pParam )
+{
+	ThreadInit_t init = *(ThreadInit_t *)pParam;
+	delete (ThreadInit_t *)pParam;
+
+	Plat_RegisterThread( init.m_pName );
+	init.m_pfnThread( init.m_pParam );
+	return NULL;
+}
+
+ThreadHandle_t Plat_CreateThread( ThreadFunc_t pfnThread, void *pParam, const char *pName )
+{
+	ThreadInit_t *pInit = new ThreadInit_t;
+	pInit->m_pfnThread = pfnThread;
+	pInit->m_pParam = pParam;
+	pInit->m_pName = pName;
+
+	pthread_t *pThread = new pthread_t;
+	if ( pthread_create( pThread, NULL, ThreadProc, pInit ) != 0 )
+	{
+		delete pInit;
+		delete pThread;
+		return NULL;
+	}
+	return (ThreadHandle_t)pThread;
+}
+
+void Plat_JoinThread( ThreadHandle_t hThread )
+{
+	pthread_t *pThread = (pthread_t *)hThread;
+	pthread_join( *pThread, NULL );
+	delete pThread;
+}
+
+void Plat_Sleep( unsigned nMilliseconds )
+{
+	usleep( nMilliseconds * 1000 );
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Interlocked operations
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+
+long Plat_InterlockedIncrement( long volatile *pDest )
+{
+	return InterlockedIncrement( (long *)pDest );
+}
+
+long Plat_InterlockedDecrement( long volatile *pDest )
+{
+	return InterlockedDecrement( (long *)pDest );
+}
+
+long Plat_InterlockedExchange( long volatile *pDest, long value )
+{
+	return InterlockedExchange( (long *)pDest, value );
+}
+
+// The compare exchange and exchange add prototypes changed between SDK
+// versions, so do them by hand
+long Plat_InterlockedCompareExchange( long volatile *pDest, long value, long comperand )
+{
+	long result;
+	__asm
+	{
+		mov		ecx, pDest
+		mov		edx, value
+		mov		eax, comperand
+		lock cmpxchg [ecx], edx
+		mov		result, eax
+	}
+	return result;
+}
+
+long Plat_InterlockedExchangeAdd( long volatile *pDest, long value )
+{
+	long result;
+	__asm
+	{
+		mov		ecx, pDest
+		mov		eax, value
+		lock xadd [ecx], eax
+		mov		result, eax
+	}
+	return result;
+}
+
+#else
+
+long Plat_InterlockedIncrement( long volatile *pDest )
+{
+	return __sync_add_and_fetch( pDest, 1 );
+}
+
+long Plat_InterlockedDecrement( long volatile *pDest )
+{
+	return __sync_sub_and_fetch( pDest, 1 );
+}
+
+long Plat_InterlockedExchange( long volatile *pDest, long value )
+{
+	__sync_synchronize();
+	return __sync_lock_test_and_set( pDest, value );
+}
+
+long Plat_InterlockedCompareExchange( long volatile *pDest, long value, long comperand )
+{
+	return __sync_val_compare_and_swap( pDest, comperand, value );
+}
+
+long Plat_InterlockedExchangeAdd( long volatile *pDest, long value )
+{
+	return __sync_fetch_and_add( pDest, value );
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Mutexes
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+
+MutexHandle_t Plat_CreateMutex()
+{
+	CRITICAL_SECTION *pCS = new CRITICAL_SECTION;
+	InitializeCriticalSection( pCS );
+	return (MutexHandle_t)pCS;
+}
+
+void Plat_DestroyMutex( MutexHandle_t hMutex )
+{
+	DeleteCriticalSection( (CRITICAL_SECTION *)hMutex );
+	delete (CRITICAL_SECTION *)hMutex;
+}
+
+void Plat_LockMutex( MutexHandle_t hMutex )
+{
+	EnterCriticalSection( (CRITICAL_SECTION *)hMutex );
+}
+
+void Plat_UnlockMutex( MutexHandle_t hMutex )
+{
+	LeaveCriticalSection( (CRITICAL_SECTION *)hMutex );
+}
+
+#else
+
+MutexHandle_t Plat_CreateMutex()
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init( &attr );
+	pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+
+	pthread_mutex_t *pMutex = new pthread_mutex_t;
+	pthread_mutex_init( pMutex, &attr );
+	pthread_mutexattr_destroy( &attr );
+	return (MutexHandle_t)pMutex;
+}
+
+void Plat_DestroyMutex( MutexHandle_t hMutex )
+{
+	pthread_mutex_destroy( (pthread_mutex_t *)hMutex );
+	delete (pthread_mutex_t *)hMutex;
+}
+
+void Plat_LockMutex( MutexHandle_t hMutex )
+{
+	pthread_mutex_lock( (pthread_mutex_t *)hMutex );
+}
+
+void Plat_UnlockMutex( MutexHandle_t hMutex )
+{
+	pthread_mutex_unlock( (pthread_mutex_t *)hMutex );
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Events
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+
+EventHandle_t Plat_CreateEvent( bool bManualReset )
+{
+	return (EventHandle_t)CreateEvent( NULL, bManualReset, FALSE, NULL );
+}
+
+void Plat_DestroyEvent( EventHandle_t hEvent )
+{
+	CloseHandle( (HANDLE)hEvent );
+}
+
+void Plat_SetEvent( EventHandle_t hEvent )
+{
+	SetEvent( (HANDLE)hEvent );
+}
+
+void Plat_ResetEvent( EventHandle_t hEvent )
+{
+	ResetEvent( (HANDLE)hEvent );
+}
+
+bool Plat_WaitEvent( EventHandle_t hEvent, unsigned nTimeoutMs )
+{
+	DWORD dwTimeout = ( nTimeoutMs == PLAT_WAIT_INFINITE ) ? INFINITE : nTimeoutMs;
+	return WaitForSingleObject( (HANDLE)hEvent, dwTimeout ) == WAIT_OBJECT_0;
+}
+
+#else
+
+struct PlatEvent_t
+{
+	pthread_mutex_t	m_Mutex;
+	pthread_cond_t	m_Cond;
+	bool			m_bManualReset;
+	bool			m_bSignaled;
+};
+
+EventHandle_t Plat_CreateEvent( bool bManualReset )
+{
+	PlatEvent_t *pEvent = new PlatEvent_t;
+	pthread_mutex_init( &pEvent->m_Mutex, NULL );
+	pthread_cond_init( &pEvent->m_Cond, NULL );
+	pEvent->m_bManualReset = bManualReset;
+	pEvent->m_bSignaled = false;
+	return (EventHandle_t)pEvent;
+}
+
+void Plat_DestroyEvent( EventHandle_t hEvent )
+{
+	PlatEvent_t *pEvent = (PlatEvent_t *)hEvent;
+	pthread_cond_destroy( &pEvent->m_Cond );
+	pthread_mutex_destroy( &pEvent->m_Mutex );
+	delete pEvent;
+}
+
+void Plat_SetEvent( EventHandle_t hEvent )
+{
+	PlatEvent_t *pEvent = (PlatEvent_t *)hEvent;
+	pthread_mutex_lock( &pEvent->m_Mutex );
+	pEvent->m_bSignaled = true;
+	if ( pEvent->m_bManualReset )
+	{
+		pthread_cond_broadcast( &pEvent->m_Cond );
+	}
+	else
+	{
+		pthread_cond_signal( &pEvent->m_Cond );
+	}
+	pthread_mutex_unlock( &pEvent->m_Mutex );
+}
+
+void Plat_ResetEvent( EventHandle_t hEvent )
+{
+	PlatEvent_t *pEvent = (PlatEvent_t *)hEvent;
+	pthread_mutex_lock( &pEvent->m_Mutex );
+	pEvent->m_bSignaled = false;
+	pthread_mutex_unlock( &pEvent->m_Mutex );
+}
+
+bool Plat_WaitEvent( EventHandle_t hEvent, unsigned nTimeoutMs )
+{
+	PlatEvent_t *pEvent = (PlatEvent_t *)hEvent;
+
+	struct timespec deadline;
+	if ( nTimeoutMs != PLAT_WAIT_INFINITE )
+	{
+		struct timeval now;
+		gettimeofday( &now, NULL );
+		deadline.tv_sec = now.tv_sec + nTimeoutMs / 1000;
+		deadline.tv_nsec = now.tv_usec * 1000 + ( nTimeoutMs % 1000 ) * 1000000;
+		if ( deadline.tv_nsec >= 1000000000 )
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock( &pEvent->m_Mutex );
+	while ( !pEvent->m_bSignaled )
+	{
+		if ( nTimeoutMs == PLAT_WAIT_INFINITE )
+		{
+			pthread_cond_wait( &pEvent->m_Cond, &pEvent->m_Mutex );
+		}
+		else if ( pthread_cond_timedwait( &pEvent->m_Cond, &pEvent->m_Mutex, &deadline ) == ETIMEDOUT )
+		{
+			break;
+		}
+	}
+
+	bool bSignaled = pEvent->m_bSignaled;
+	if ( bSignaled && !pEvent->m_bManualReset )
+	{
+		pEvent->m_bSignaled = false;
+	}
+	pthread_mutex_unlock( &pEvent->m_Mutex );
+	return bSignaled;
+}
+
+#endif
+
+//-----------------------------------------------------------------------------
+// Parallel processing.  The workers are started on the first call and sleep
+// on their own start event between calls.
+//-----------------------------------------------------------------------------
+#define MAX_PARALLEL_THREADS	8
+
+struct ParallelJob_t
+{
+	ParallelProcessFunc_t	m_pfnProcess;
+	void					*m_pContext;
+	long					m_nItems;
+	long volatile			m_iNextItem;
+};
+
+struct ParallelWorker_t
+{
+	ThreadHandle_t	m_hThread;
+	EventHandle_t	m_hStart;
+	EventHandle_t	m_hDone;
+};
+
+static ParallelJob_t s_ParallelJob;
+static ParallelWorker_t s_ParallelWorkers[MAX_PARALLEL_THREADS - 1];
+static int s_nParallelWorkers = 0;
+static int s_nParallelThreads = 0;			// 0 until the processor count is looked up
+static long volatile s_bParallelBusy = 0;
+static long volatile s_bParallelQuit = 0;
+
+static int ClampParallelThreadCount( int nThreads )
+{
+	if ( nThreads < 1 )
+		return 1;
+	if ( nThreads > MAX_PARALLEL_THREADS )
+		return MAX_PARALLEL_THREADS;
+	return nThreads;
+}
+
+static void ProcessParallelItems( ParallelJob_t *pJob )
+{
+	for (;;)
+	{
+		long iItem = Plat_InterlockedIncrement( &pJob->m_iNextItem ) - 1;
+		if ( iItem >= pJob->m_nItems )
+			break;
+
+		pJob->m_pfnProcess( pJob->m_pContext, iItem );
+	}
+}
+
+static unsigned ParallelWorkerThread( void *pParam )
+{
+	ParallelWorker_t *pWorker = (ParallelWorker_t *)pParam;
+	for (;;)
+	{
+		Plat_WaitEvent( pWorker->m_hStart );
+		if ( s_bParallelQuit )
+			break;
+
+		ProcessParallelItems( &s_ParallelJob );
+		Plat_SetEvent( pWorker->m_hDone );
+	}
+	return 0;
+}
+
+static void StartParallelWorkers()
+{
+	if ( s_nParallelThreads == 0 )
+	{
+		s_nParallelThreads = ClampParallelThreadCount( GetCPUInformation().m_nLogicalProcessors );
+	}
+
+	s_bParallelQuit = 0;
+	while ( s_nParallelWorkers < s_nParallelThreads - 1 )
+	{
+		ParallelWorker_t *pWorker = &s_ParallelWorkers[s_nParallelWorkers];
+		pWorker->m_hStart = Plat_CreateEvent( false );
+		pWorker->m_hDone = Plat_CreateEvent( false );
+		pWorker->m_hThread = Plat_CreateThread( ParallelWorkerThread, pWorker, "Parallel Worker" );
+		if ( !pWorker->m_hThread )
+		{
+			Plat_DestroyEvent( pWorker->m_hStart );
+			Plat_DestroyEvent( pWorker->m_hDone );
+			break;
+		}
+		s_nParallelWorkers++;
+	}
+}
+
+static void StopParallelWorkers()
+{
+	s_bParallelQuit = 1;
+	for ( int i = 0; i < s_nParallelWorkers; i++ )
+	{
+		ParallelWorker_t *pWorker = &s_ParallelWorkers[i];
+		Plat_SetEvent( pWorker->m_hStart );
+		Plat_JoinThread( pWorker->m_hThread );
+		Plat_DestroyEvent( pWorker->m_hStart );
+		Plat_DestroyEvent( pWorker->m_hDone );
+	}
+	s_nParallelWorkers = 0;
+}
+
+// Stops the workers when tier0 goes away
+class CParallelWorkerShutdown
+{
+public:
+	~CParallelWorkerShutdown()
+	{
+		StopParallelWorkers();
+	}
+};
+
+static CParallelWorkerShutdown s_ParallelWorkerShutdown;
+
+void Plat_ParallelProcess( ParallelProcessFunc_t pfnProcess, void *pContext, int nItems )
+{
+	if ( nItems <= 0 )
+		return;
+
+	// Nested or concurrent calls, and single items, don't use the workers
+	if ( nItems == 1 || Plat_InterlockedCompareExchange( &s_bParallelBusy, 1, 0 ) != 0 )
+	{
+		for ( int i = 0; i < nItems; i++ )
+		{
+			pfnProcess( pContext, i );
+		}
+		return;
+	}
+
+	StartParallelWorkers();
+
+	s_ParallelJob.m_pfnProcess = pfnProcess;
+	s_ParallelJob.m_pContext = pContext;
+	s_ParallelJob.m_nItems = nItems;
+	s_ParallelJob.m_iNextItem = 0;
+
+	// No point waking more workers than there are items for
+	int nWorkers = s_nParallelWorkers;
+	if ( nWorkers > nItems - 1 )
+	{
+		nWorkers = nItems - 1;
+	}
+	for ( int i = 0; i < nWorkers; i++ )
+	{
+		Plat_SetEvent( s_ParallelWorkers[i].m_hStart );
+	}
+
+	ProcessParallelItems( &s_ParallelJob );
+
+	for ( int i = 0; i < nWorkers; i++ )
+	{
+		Plat_WaitEvent( s_ParallelWorkers[i].m_hDone );
+	}
+
+	Plat_InterlockedExchange( &s_bParallelBusy, 0 );
+}
+
+int Plat_GetParallelThreadCount()
+{
+	if ( s_nParallelThreads == 0 )
+	{
+		s_nParallelThreads = ClampParallelThreadCount( GetCPUInformation().m_nLogicalProcessors );
+	}
+	return s_nParallelThreads;
+}
+
+void Plat_SetParallelThreadCount( int nThreads )
+{
+	nThreads = ClampParallelThreadCount( nThreads );
+	if ( nThreads == s_nParallelThreads )
+		return;
+
+	// Wait out any call in progress, the next call starts the new workers
+	while ( Plat_InterlockedCompareExchange( &s_bParallelBusy, 1, 0 ) != 0 )
+	{
+		Plat_Sleep( 0 );
+	}
+
+	StopParallelWorkers();
+	s_nParallelThreads = nThreads;
+
+	Plat_InterlockedExchange( &s_bParallelBusy, 0 );
+}
@@ -172,6 +172,10 @@ SOURCE=.\thread.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\threadtools.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\vcrmode.cpp
 # End Source File
 # Begin Source File
@@ -212,6 +216,10 @@ SOURCE=..\Public\tier0\platform.h
 # End Source File
 # Begin Source File
 
+SOURCE=..\Public\tier0\threadtools.h
+# End Source File
+# Begin Source File
+
 SOURCE=..\Public\tier0\vcr_shared.h
 # End Source File
 # Begin Source File
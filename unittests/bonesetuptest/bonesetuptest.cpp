@@ -0,0 +1,226 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Checks the SSE paths of SlerpBones and BlendBones against the
+//			scalar ones over every sequence of a sample model
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "unitlib/unitlib.h"
+#include "tier0/dbg.h"
+#include "mathlib.h"
+#include "studio.h"
+#include "bone_setup.h"
+#include "vstdlib/random.h"
+#include "engine/ISharedModelCache.h"
+#include "commonmacros.h"
+#include <string.h>
+#include <math.h>
+
+// bone_setup.cpp only uses this for demand loaded sequence groups
+ISharedModelCache *g_pSharedModelCache = NULL;
+
+
+DEFINE_TESTSUITE( BoneSetupTestSuite )
+
+
+//-----------------------------------------------------------------------------
+// The sample model: aligned, fixed alignment and unused bones, and a sequence
+// for each kind of blend. 13 bones, so the SSE paths have to pad.
+//-----------------------------------------------------------------------------
+#define SAMPLE_BONES		13
+#define SAMPLE_SEQUENCES	5
+
+struct samplemodel_t
+{
+	studiohdr_t			hdr;
+	mstudiobone_t		bones[SAMPLE_BONES];
+	mstudioseqdesc_t	seqs[SAMPLE_SEQUENCES];
+	float				weights[SAMPLE_SEQUENCES][SAMPLE_BONES];
+};
+
+static samplemodel_t s_SampleModel;
+
+static studiohdr_t *BuildSampleModel()
+{
+	samplemodel_t *pModel = &s_SampleModel;
+	memset( pModel, 0, sizeof( *pModel ) );
+
+	studiohdr_t *pHdr = &pModel->hdr;
+	pHdr->numbones = SAMPLE_BONES;
+	pHdr->boneindex = (byte *)pModel->bones - (byte *)pHdr;
+	pHdr->numseq = SAMPLE_SEQUENCES;
+	pHdr->seqindex = (byte *)pModel->seqs - (byte *)pHdr;
+
+	int i;
+	for ( i = 0; i < SAMPLE_BONES; i++ )
+	{
+		mstudiobone_t *pBone = &pModel->bones[i];
+		pBone->parent = i - 1;
+		pBone->qAlignment.Init( 0.0f, 0.0f, 0.0f, 1.0f );
+		pBone->flags = BONE_USED_BY_ANYTHING;
+		if ( ( i % 3 ) == 2 )
+		{
+			pBone->flags |= BONE_FIXED_ALIGNMENT;
+		}
+	}
+
+	// the blends have to leave bones outside the mask alone
+	pModel->bones[SAMPLE_BONES - 1].flags = 0;
+
+	// 0: whole body, 1: upper body layer, 2: ramped weights,
+	// 3: delta with some bones left out, 4: ramped post delta
+	static const int s_pSeqFlags[SAMPLE_SEQUENCES] = { 0, 0, 0, STUDIO_DELTA, STUDIO_DELTA | STUDIO_POST };
+	for ( i = 0; i < SAMPLE_SEQUENCES; i++ )
+	{
+		mstudioseqdesc_t *pSeq = &pModel->seqs[i];
+		pSeq->flags = s_pSeqFlags[i];
+		pSeq->weightlistindex = (byte *)pModel->weights[i] - (byte *)pSeq;
+
+		for ( int j = 0; j < SAMPLE_BONES; j++ )
+		{
+			float flRamp = (float)j / ( SAMPLE_BONES - 1 );
+			switch( i )
+			{
+			case 1:
+				pModel->weights[i][j] = ( j < SAMPLE_BONES / 2 ) ? 1.0f : 0.0f;
+				break;
+			case 2:
+			case 4:
+				pModel->weights[i][j] = flRamp;
+				break;
+			case 3:
+				pModel->weights[i][j] = ( ( j % 4 ) == 1 ) ? 0.0f : 1.0f;
+				break;
+			default:
+				pModel->weights[i][j] = 1.0f;
+				break;
+			}
+		}
+	}
+
+	return pHdr;
+}
+
+
+//-----------------------------------------------------------------------------
+// Random poses. q2 stays within ~100 degrees of q1, since rotations near 180
+// degrees lose precision to QuaternionScale() in either path; bones that get
+// aligned sometimes get -q2 to make them do it. Delta sequences scale q2 on
+// its own, so there q2 is the small rotation itself, like a real delta.
+//-----------------------------------------------------------------------------
+static void RandomPoses( const studiohdr_t *pHdr, bool bDelta, Quaternion *q1, Vector *pos1, Quaternion *q2, Vector *pos2 )
+{
+	for ( int i = 0; i < pHdr->numbones; i++ )
+	{
+		RadianEuler angles( RandomFloat( -M_PI, M_PI ), RandomFloat( -M_PI, M_PI ), RandomFloat( -M_PI, M_PI ) );
+		AngleQuaternion( angles, q1[i] );
+
+		RadianEuler delta( RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ) );
+		Quaternion qDelta;
+		AngleQuaternion( delta, qDelta );
+		if ( bDelta )
+		{
+			q2[i] = qDelta;
+		}
+		else
+		{
+			QuaternionMult( q1[i], qDelta, q2[i] );
+		}
+
+		if ( !( pHdr->pBone( i )->flags & BONE_FIXED_ALIGNMENT ) && ( RandomInt( 0, 1 ) != 0 ) )
+		{
+			q2[i].Init( -q2[i].x, -q2[i].y, -q2[i].z, -q2[i].w );
+		}
+
+		pos1[i].Init( RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ) );
+		pos2[i].Init( RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ) );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Runs one blend both ways and asserts the results match
+//-----------------------------------------------------------------------------
+#define BONE_BLEND_TOLERANCE	1e-5f
+
+static void CheckBoneBlend( const studiohdr_t *pHdr, bool bSlerp, int iSeq, float s )
+{
+	Quaternion q1[MAXSTUDIOBONES], q2[MAXSTUDIOBONES], qScalar[MAXSTUDIOBONES];
+	Vector pos1[MAXSTUDIOBONES], pos2[MAXSTUDIOBONES], posScalar[MAXSTUDIOBONES];
+
+	mstudioseqdesc_t *pSeq = pHdr->pSeqdesc( iSeq );
+
+	RandomPoses( pHdr, ( pSeq->flags & STUDIO_DELTA ) != 0, q1, pos1, q2, pos2 );
+	memcpy( qScalar, q1, pHdr->numbones * sizeof( Quaternion ) );
+	memcpy( posScalar, pos1, pHdr->numbones * sizeof( Vector ) );
+	for ( int k = 0; k < 2; k++ )
+	{
+		Studio_SetSSEBoneBlend( k != 0 );
+
+		Quaternion *q = k ? q1 : qScalar;
+		Vector *pos = k ? pos1 : posScalar;
+		if ( bSlerp )
+		{
+			SlerpBones( pHdr, q, pos, pSeq, q2, pos2, s, BONE_USED_BY_ANYTHING );
+		}
+		else
+		{
+			BlendBones( pHdr, q, pos, pSeq, q2, pos2, s, BONE_USED_BY_ANYTHING );
+		}
+	}
+	Studio_SetSSEBoneBlend( true );
+
+	for ( int i = 0; i < pHdr->numbones; i++ )
+	{
+		float flError = 0.0f;
+		int j;
+		for ( j = 0; j < 4; j++ )
+		{
+			// q and -q are the same rotation
+			flError = max( flError, min( fabs( q1[i][j] - qScalar[i][j] ), fabs( q1[i][j] + qScalar[i][j] ) ) );
+		}
+		for ( j = 0; j < 3; j++ )
+		{
+			flError = max( flError, fabs( pos1[i][j] - posScalar[i][j] ) / ( 1.0f + fabs( posScalar[i][j] ) ) );
+		}
+
+		_AssertMsg( flError <= BONE_BLEND_TOLERANCE, CDbgFmtMsg( "%s: sequence %d, s %.3f, bone %d is off by %f",
+			bSlerp ? "SlerpBones" : "BlendBones", iSeq, s, i, flError ) );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// The test
+//-----------------------------------------------------------------------------
+static const float s_pBlendAmounts[] = { 0.1f, 0.25f, 0.5f, 0.75f, 0.999f, 1.0f };
+
+#define BONE_BLEND_TRIALS	8
+
+DEFINE_TESTCASE( BoneBlendSSEMatchesScalar, BoneSetupTestSuite )
+{
+	Msg( "SSE bone blending vs scalar...\n" );
+
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f );
+	if ( !MathLib_SSEEnabled() )
+	{
+		Msg( "No SSE, skipping\n" );
+		return;
+	}
+
+	RandomSeed( 1 );
+
+	studiohdr_t *pHdr = BuildSampleModel();
+	for ( int iSeq = 0; iSeq < pHdr->numseq; iSeq++ )
+	{
+		for ( int i = 0; i < ARRAYSIZE( s_pBlendAmounts ); i++ )
+		{
+			for ( int j = 0; j < BONE_BLEND_TRIALS; j++ )
+			{
+				CheckBoneBlend( pHdr, true, iSeq, s_pBlendAmounts[i] );
+				CheckBoneBlend( pHdr, false, iSeq, s_pBlendAmounts[i] );
+			}
+		}
+	}
+}
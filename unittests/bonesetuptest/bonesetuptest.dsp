@@ -0,0 +1,149 @@
+# Microsoft Developer Studio Project File - Name="bonesetuptest" - Package Owner=<4>
+# Microsoft Developer Studio Generated Build File, Format Version 6.00
+# ** DO NOT EDIT **
+
+# TARGTYPE "Win32 (x86) Dynamic-Link Library" 0x0102
+
+CFG=bonesetuptest - Win32 Debug
+!MESSAGE This is not a valid makefile. To build this project using NMAKE,
+!MESSAGE use the Export Makefile command and run
+!MESSAGE 
+!MESSAGE NMAKE /f "bonesetuptest.mak".
+!MESSAGE 
+!MESSAGE You can specify a configuration when running NMAKE
+!MESSAGE by defining the macro CFG on the command line. For example:
+!MESSAGE 
+!MESSAGE NMAKE /f "bonesetuptest.mak" CFG="bonesetuptest - Win32 Debug"
+!MESSAGE 
+!MESSAGE Possible choices for configuration are:
+!MESSAGE 
+!MESSAGE "bonesetuptest - Win32 Release" (based on "Win32 (x86) Dynamic-Link Library")
+!MESSAGE "bonesetuptest - Win32 Debug" (based on "Win32 (x86) Dynamic-Link Library")
+!MESSAGE 
+
+# Begin Project
+# PROP AllowPerConfigDependencies 0
+# PROP Scc_ProjName ""
+# PROP Scc_LocalPath ""
+CPP=cl.exe
+MTL=midl.exe
+RSC=rc.exe
+
+!IF  "$(CFG)" == "bonesetuptest - Win32 Release"
+
+# PROP BASE Use_MFC 0
+# PROP BASE Use_Debug_Libraries 0
+# PROP BASE Output_Dir "Release"
+# PROP BASE Intermediate_Dir "Release"
+# PROP BASE Target_Dir ""
+# PROP Use_MFC 0
+# PROP Use_Debug_Libraries 0
+# PROP Output_Dir "Release"
+# PROP Intermediate_Dir "Release"
+# PROP Ignore_Export_Lib 1
+# PROP Target_Dir ""
+# ADD CPP /nologo /G6 /MT /W4 /Ox /Ot /Ow /Og /Oi /Op /Gf /Gy /I "..\..\common" /I "..\..\public" /I "..\..\game_shared" /D "NDEBUG" /D "_WIN32" /D "_WINDOWS" /D "_MBCS" /D "_USRDLL" /FD /c
+# ADD BASE MTL /nologo /D "NDEBUG" /mktyplib203 /win32
+# ADD MTL /nologo /D "NDEBUG" /mktyplib203 /win32
+# ADD BASE RSC /l 0x409 /d "NDEBUG"
+# ADD RSC /l 0x409 /d "NDEBUG"
+BSC32=bscmake.exe
+# ADD BASE BSC32 /nologo
+# ADD BSC32 /nologo
+LINK32=link.exe
+# ADD LINK32 unitlib.lib tier0.lib vstdlib.lib /nologo /subsystem:windows /dll /machine:I386 /libpath:"..\..\lib\common\\" /libpath:"..\..\lib\public\\"
+# Begin Custom Build - Publishing to target directory (..\..\..\bin)...
+TargetDir=.\Release
+TargetPath=.\Release\bonesetuptest.dll
+InputPath=.\Release\bonesetuptest.dll
+SOURCE="$(InputPath)"
+
+"..\..\..\bin\bonesetuptest.dll" : $(SOURCE) "$(INTDIR)" "$(OUTDIR)"
+	if exist ..\..\..\bin\bonesetuptest.dll attrib -r ..\..\..\bin\bonesetuptest.dll 
+	copy $(TargetPath) ..\..\..\bin\bonesetuptest.dll 
+	
+# End Custom Build
+
+!ELSEIF  "$(CFG)" == "bonesetuptest - Win32 Debug"
+
+# PROP BASE Use_MFC 0
+# PROP BASE Use_Debug_Libraries 1
+# PROP BASE Output_Dir "Debug"
+# PROP BASE Intermediate_Dir "Debug"
+# PROP BASE Target_Dir ""
+# PROP Use_MFC 0
+# PROP Use_Debug_Libraries 1
+# PROP Output_Dir "Debug"
+# PROP Intermediate_Dir "Debug"
+# PROP Ignore_Export_Lib 1
+# PROP Target_Dir ""
+# ADD CPP /nologo /G6 /MTd /W4 /Gm /ZI /Od /Op /I "..\..\common" /I "..\..\public" /I "..\..\game_shared" /D "_DEBUG" /D "_WIN32" /D "_WINDOWS" /D "_MBCS" /D "_USRDLL" /FR /FD /GZ /c
+# ADD BASE MTL /nologo /D "_DEBUG" /mktyplib203 /win32
+# ADD MTL /nologo /D "_DEBUG" /mktyplib203 /win32
+# ADD BASE RSC /l 0x409 /d "_DEBUG"
+# ADD RSC /l 0x409 /d "_DEBUG"
+BSC32=bscmake.exe
+# ADD BASE BSC32 /nologo
+# ADD BSC32 /nologo
+LINK32=link.exe
+# ADD LINK32 unitlib.lib tier0.lib vstdlib.lib /nologo /subsystem:windows /dll /debug /machine:I386 /pdbtype:sept /libpath:"..\..\lib\common\\" /libpath:"..\..\lib\public\\"
+# Begin Custom Build - Publishing to target directory (..\..\..\bin)...
+TargetDir=.\Debug
+TargetPath=.\Debug\bonesetuptest.dll
+InputPath=.\Debug\bonesetuptest.dll
+SOURCE="$(InputPath)"
+
+"..\..\..\bin\bonesetuptest.dll" : $(SOURCE) "$(INTDIR)" "$(OUTDIR)"
+	if exist ..\..\..\bin\bonesetuptest.dll attrib -r ..\..\..\bin\bonesetuptest.dll 
+	copy $(TargetPath) ..\..\..\bin\bonesetuptest.dll 
+	
+# End Custom Build
+
+!ENDIF 
+
+# Begin Target
+
+# Name "bonesetuptest - Win32 Release"
+# Name "bonesetuptest - Win32 Debug"
+# Begin Group "Source Files"
+
+# PROP Default_Filter "cpp;c;cxx;rc;def;r;odl;idl;hpj;bat"
+# Begin Source File
+
+SOURCE=.\bonesetuptest.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\game_shared\bone_setup.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\public\collisionutils.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\public\mathlib.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\public\tier0\memoverride.cpp
+# End Source File
+# End Group
+# Begin Group "Header Files"
+
+# PROP Default_Filter "h;hpp;hxx;hm;inl"
+# Begin Source File
+
+SOURCE=..\..\game_shared\bone_setup.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\public\studio.h
+# End Source File
+# Begin Source File
+
+SOURCE=..\..\public\unitlib\unitlib.h
+# End Source File
+# End Group
+# End Target
+# End Project
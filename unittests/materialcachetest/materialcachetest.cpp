@@ -0,0 +1,608 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Builds a compiled material cache against the stdio filesystem and
+//			shaderapiempty, then checks it survives a save + reload and that
+//			stale source files invalidate its entries. Also compiles a real
+//			material and checks the reload from the cache matches the text parse
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "unitlib/unitlib.h"
+#include "tier0/dbg.h"
+#include "interface.h"
+#include "filesystem.h"
+#include "utlbuffer.h"
+#include "vstdlib/strtools.h"
+#include "imageloader.h"
+#include "materialsystem/materialsystem_config.h"
+#include "shaderapi.h"
+#include "ishaderutil.h"
+#include "IHardwareConfigInternal.h"
+#include "materialcache.h"
+#include "materialsystem/imaterialsystem.h"
+#include "materialsystem/imaterial.h"
+#include "materialsystem/imaterialvar.h"
+#include "vstdlib/ICommandLine.h"
+#include "vmatrix.h"
+#include <string.h>
+
+
+// materialcache.cpp uses these; the material system normally owns them
+MaterialSystem_Config_t g_config;
+IShaderAPI *g_pShaderAPI = 0;
+IHardwareConfigInternal *g_pHWConfig = 0;
+IFileSystem *g_pFileSystem = 0;
+
+
+DEFINE_TESTSUITE( MaterialCacheTestSuite )
+
+
+//-----------------------------------------------------------------------------
+// The shader API reads the config through this; nothing else gets called
+// without a device
+//-----------------------------------------------------------------------------
+class CTestShaderUtil : public IShaderUtil
+{
+public:
+	MaterialSystem_Config_t& GetConfig() { return g_config; }
+	bool ConvertImageFormat( unsigned char *src, enum ImageFormat srcImageFormat,
+							 unsigned char *dst, enum ImageFormat dstImageFormat, 
+							 int width, int height, int srcStride, int dstStride ) { return false; }
+	int GetMemRequired( int width, int height, ImageFormat format, bool mipmap ) { return 0; }
+	ImageFormatInfo_t const& ImageFormatInfo( ImageFormat fmt ) const { return m_ImageFormatInfo; }
+	void SetDefaultShadowState() {}
+	void SetDefaultState() {}
+	void BindLightmap( TextureStage_t stage ) {}
+	void BindLightmapAlpha( TextureStage_t stage ) {}
+	void BindBumpLightmap( TextureStage_t stage ) {}
+	void BindWhite( TextureStage_t stage ) {}
+	void BindBlack( TextureStage_t stage ) {}
+	void BindGrey( TextureStage_t stage ) {}
+	void BindSyncTexture( TextureStage_t stage, int texture ) {}
+	void BindFBTexture( TextureStage_t stage, int textureIndex ) {}
+	void GetLightmapDimensions( int *w, int *h ) { *w = *h = 0; }
+	void BindFlatNormalMap( TextureStage_t stage ) {}
+	void BindNormalizationCubeMap( TextureStage_t stage ) {}
+	void ReleaseShaderObjects() {}
+	void RestoreShaderObjects() {}
+	bool IsInStubMode() { return true; }
+
+private:
+	ImageFormatInfo_t m_ImageFormatInfo;
+};
+
+static CTestShaderUtil s_ShaderUtil;
+
+
+//-----------------------------------------------------------------------------
+// Loads the filesystem + the empty shader API, and points the filesystem at
+// a scratch directory under the current one
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+#define FILESYSTEM_DLL_NAME			"filesystem_stdio.dll"
+#define SHADERAPIEMPTY_DLL_NAME		"shaderapiempty.dll"
+#elif _LINUX
+#define FILESYSTEM_DLL_NAME			"filesystem_i486.so"
+#define SHADERAPIEMPTY_DLL_NAME		"shaderapiempty_i486.so"
+#endif
+
+#define TEST_DIRECTORY				"matcachetest"
+#define TEST_CACHE_FILENAME			"materials/compiledmaterials.bin"
+
+static CSysModule *s_pFileSystemModule = NULL;
+static CSysModule *s_pShaderAPIModule = NULL;
+
+static bool LoadSystems()
+{
+	s_pFileSystemModule = Sys_LoadModule( FILESYSTEM_DLL_NAME );
+	s_pShaderAPIModule = Sys_LoadModule( SHADERAPIEMPTY_DLL_NAME );
+	if ( !s_pFileSystemModule || !s_pShaderAPIModule )
+		return false;
+
+	CreateInterfaceFn fileSystemFactory = Sys_GetFactory( s_pFileSystemModule );
+	CreateInterfaceFn shaderAPIFactory = Sys_GetFactory( s_pShaderAPIModule );
+	if ( !fileSystemFactory || !shaderAPIFactory )
+		return false;
+
+	g_pFileSystem = (IFileSystem *)fileSystemFactory( FILESYSTEM_INTERFACE_VERSION, NULL );
+	g_pShaderAPI = (IShaderAPI *)shaderAPIFactory( SHADERAPI_INTERFACE_VERSION, NULL );
+	g_pHWConfig = (IHardwareConfigInternal *)shaderAPIFactory( MATERIALSYSTEM_HARDWARECONFIG_INTERFACE_VERSION, NULL );
+	if ( !g_pFileSystem || !g_pShaderAPI || !g_pHWConfig )
+		return false;
+
+	if ( g_pFileSystem->Init() != INIT_OK )
+	{
+		g_pFileSystem = NULL;
+		return false;
+	}
+
+	if ( !g_pShaderAPI->Init( &s_ShaderUtil, g_pFileSystem, 0, 0 ) )
+	{
+		g_pShaderAPI = NULL;
+		return false;
+	}
+
+	char pPath[1024];
+	g_pFileSystem->GetCurrentDirectory( pPath, sizeof( pPath ) );
+	Q_strncat( pPath, "/" TEST_DIRECTORY, sizeof( pPath ) );
+
+	g_pFileSystem->RemoveAllSearchPaths();
+	g_pFileSystem->AddSearchPath( pPath, "GAME" );
+	g_pFileSystem->CreateDirHierarchy( "materials", "GAME" );
+	return true;
+}
+
+static void UnloadSystems()
+{
+	if ( g_pFileSystem )
+	{
+		g_pFileSystem->Shutdown();
+		g_pFileSystem = NULL;
+	}
+	if ( g_pShaderAPI )
+	{
+		g_pShaderAPI->Shutdown();
+		g_pShaderAPI = NULL;
+	}
+	g_pHWConfig = NULL;
+
+	if ( s_pShaderAPIModule )
+	{
+		Sys_UnloadModule( s_pShaderAPIModule );
+		s_pShaderAPIModule = NULL;
+	}
+	if ( s_pFileSystemModule )
+	{
+		Sys_UnloadModule( s_pFileSystemModule );
+		s_pFileSystemModule = NULL;
+	}
+}
+
+static void WriteTestFile( char const *pFileName, char const *pContents )
+{
+	FileHandle_t f = g_pFileSystem->Open( pFileName, "wb" );
+	_AssertMsg( f, CDbgFmtMsg( "Unable to write %s", pFileName ) );
+	if ( f )
+	{
+		g_pFileSystem->Write( pContents, strlen( pContents ), f );
+		g_pFileSystem->Close( f );
+	}
+}
+
+static void RemoveTestFile( char const *pFileName )
+{
+	if ( g_pFileSystem->FileExists( pFileName ) )
+	{
+		g_pFileSystem->RemoveFile( pFileName, "GAME" );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Sample materials: one up to date, and one each whose recorded file time or
+// size no longer matches its .vmt
+//-----------------------------------------------------------------------------
+enum
+{
+	TEST_MATERIAL_GOOD = 0,
+	TEST_MATERIAL_STALE_TIME,
+	TEST_MATERIAL_STALE_SIZE,
+
+	TEST_MATERIAL_COUNT
+};
+
+static char const *s_pTestMaterials[TEST_MATERIAL_COUNT] =
+{
+	"matcachetest_good",
+	"matcachetest_staletime",
+	"matcachetest_stalesize",
+};
+
+static void GetTestVMTName( int i, char *pFileName, int nMaxLen )
+{
+	Q_snprintf( pFileName, nMaxLen, "materials/%s.vmt", s_pTestMaterials[i] );
+}
+
+// Stands in for what CMaterial compiles; just has to come back unchanged
+static void BuildTestCompiledData( int i, CUtlBuffer &buf )
+{
+	buf.PutString( s_pTestMaterials[i] );
+	for ( int j = 0; j < 64; ++j )
+	{
+		buf.PutInt( i * 1000 + j );
+	}
+}
+
+static void StoreTestMaterial( int i )
+{
+	char pFileName[MATERIAL_MAX_PATH];
+	GetTestVMTName( i, pFileName, sizeof( pFileName ) );
+	WriteTestFile( pFileName, "\"UnlitGeneric\"\n{\n\t\"$basetexture\" \"dev/dev_blendmeasure\"\n}\n" );
+
+	MaterialCacheFiles_t files;
+	MaterialCache_AddSourceFile( files, pFileName );
+	_AssertMsg( files[0].m_nFileSize != 0, CDbgFmtMsg( "%s has no size", pFileName ) );
+
+	if ( i == TEST_MATERIAL_STALE_TIME )
+	{
+		--files[0].m_nFileTime;
+	}
+	else if ( i == TEST_MATERIAL_STALE_SIZE )
+	{
+		++files[0].m_nFileSize;
+	}
+
+	CUtlBuffer buf;
+	BuildTestCompiledData( i, buf );
+	MaterialCache_Store( s_pTestMaterials[i], files, buf );
+}
+
+static void CheckFind( char const *pMaterialName, int iCompiledData, bool bExpected, char const *pWhen )
+{
+	CUtlBuffer buf;
+	bool bFound = MaterialCache_Find( pMaterialName, buf );
+	_AssertMsg( bFound == bExpected, CDbgFmtMsg( "%s: %s was %s", pWhen, pMaterialName, bFound ? "found" : "not found" ) );
+	if ( !bFound || !bExpected )
+		return;
+
+	CUtlBuffer expected;
+	BuildTestCompiledData( iCompiledData, expected );
+	_AssertMsg( ( buf.Size() == expected.TellPut() ) && !memcmp( buf.Base(), expected.Base(), expected.TellPut() ),
+		CDbgFmtMsg( "%s: %s came back with different data", pWhen, pMaterialName ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// The test
+//-----------------------------------------------------------------------------
+DEFINE_TESTCASE( MaterialCacheSaveReloadInvalidate, MaterialCacheTestSuite )
+{
+	Msg( "Material cache save, reload and invalidation...\n" );
+
+	if ( !LoadSystems() )
+	{
+		_AssertMsg( false, "Unable to load " FILESYSTEM_DLL_NAME " and " SHADERAPIEMPTY_DLL_NAME );
+		UnloadSystems();
+		return;
+	}
+
+	memset( &g_config, 0, sizeof( g_config ) );
+	RemoveTestFile( TEST_CACHE_FILENAME );
+
+	int i;
+	for ( i = 0; i < TEST_MATERIAL_COUNT; ++i )
+	{
+		StoreTestMaterial( i );
+	}
+	CheckFind( s_pTestMaterials[TEST_MATERIAL_GOOD], TEST_MATERIAL_GOOD, true, "Before saving" );
+
+	// Writes the cache file + forgets it, so the finds below reload it
+	MaterialCache_Shutdown();
+	_AssertMsg( g_pFileSystem->FileExists( TEST_CACHE_FILENAME ), "The cache wasn't saved" );
+
+	CheckFind( s_pTestMaterials[TEST_MATERIAL_GOOD], TEST_MATERIAL_GOOD, true, "After reloading" );
+	CheckFind( s_pTestMaterials[TEST_MATERIAL_STALE_TIME], TEST_MATERIAL_STALE_TIME, false, "After reloading" );
+	CheckFind( s_pTestMaterials[TEST_MATERIAL_STALE_SIZE], TEST_MATERIAL_STALE_SIZE, false, "After reloading" );
+	CheckFind( "matcachetest_missing", 0, false, "After reloading" );
+
+	// Settings the shader fallbacks look at have to match too
+	g_config.bEditMode = !g_config.bEditMode;
+	CheckFind( s_pTestMaterials[TEST_MATERIAL_GOOD], TEST_MATERIAL_GOOD, false, "With a different config" );
+	g_config.bEditMode = !g_config.bEditMode;
+	CheckFind( s_pTestMaterials[TEST_MATERIAL_GOOD], TEST_MATERIAL_GOOD, true, "With the config restored" );
+
+	// Editing the .vmt makes its entry stale
+	char pFileName[MATERIAL_MAX_PATH];
+	GetTestVMTName( TEST_MATERIAL_GOOD, pFileName, sizeof( pFileName ) );
+	WriteTestFile( pFileName, "\"UnlitGeneric\"\n{\n\t\"$basetexture\" \"dev/dev_blendmeasure\"\n\t\"$translucent\" \"1\"\n}\n" );
+	CheckFind( s_pTestMaterials[TEST_MATERIAL_GOOD], TEST_MATERIAL_GOOD, false, "After editing the .vmt" );
+
+	MaterialCache_Shutdown();
+
+	RemoveTestFile( TEST_CACHE_FILENAME );
+	for ( i = 0; i < TEST_MATERIAL_COUNT; ++i )
+	{
+		GetTestVMTName( i, pFileName, sizeof( pFileName ) );
+		RemoveTestFile( pFileName );
+	}
+
+	UnloadSystems();
+}
+
+
+//-----------------------------------------------------------------------------
+// A real material, compiled by the material system: text parse on the first
+// load, then the cache on the next one. Wireframe is always around, since the
+// material system's own wireframe debug material uses it.
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+#define MATERIALSYSTEM_DLL_NAME		"materialsystem.dll"
+#elif _LINUX
+#define MATERIALSYSTEM_DLL_NAME		"materialsystem_i486.so"
+#endif
+
+#define TEST_REAL_MATERIAL			"matcachetest_real"
+#define TEST_REAL_VMT_FILENAME		"materials/" TEST_REAL_MATERIAL ".vmt"
+#define TEST_REAL_SHADER			"Wireframe"
+
+// Longer than any fixed size buffer the reader used to have
+#define TEST_LONG_STRING_LENGTH		1000
+
+static CSysModule *s_pMaterialSystemModule = NULL;
+static IMaterialSystem *s_pMaterialSystem = NULL;
+
+static bool InitMaterialSystem()
+{
+	if ( !s_pMaterialSystemModule )
+	{
+		s_pMaterialSystemModule = Sys_LoadModule( MATERIALSYSTEM_DLL_NAME );
+		if ( !s_pMaterialSystemModule )
+			return false;
+	}
+
+	CreateInterfaceFn materialSystemFactory = Sys_GetFactory( s_pMaterialSystemModule );
+	if ( !materialSystemFactory )
+		return false;
+
+	s_pMaterialSystem = (IMaterialSystem *)materialSystemFactory( MATERIAL_SYSTEM_INTERFACE_VERSION, NULL );
+	if ( !s_pMaterialSystem )
+		return false;
+
+	if ( !s_pMaterialSystem->Init( SHADERAPIEMPTY_DLL_NAME, NULL, Sys_GetFactory( s_pFileSystemModule ) ) )
+	{
+		s_pMaterialSystem = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Shutting down is what writes out the cache
+static void ShutdownMaterialSystem()
+{
+	if ( s_pMaterialSystem )
+	{
+		s_pMaterialSystem->Shutdown();
+		s_pMaterialSystem = NULL;
+	}
+}
+
+static void UnloadMaterialSystem()
+{
+	ShutdownMaterialSystem();
+	if ( s_pMaterialSystemModule )
+	{
+		Sys_UnloadModule( s_pMaterialSystemModule );
+		s_pMaterialSystemModule = NULL;
+	}
+}
+
+// One var of each type the compiled data stores, plus a var the shader
+// doesn't know about
+static void WriteRealTestMaterial()
+{
+	char pLongString[TEST_LONG_STRING_LENGTH + 1];
+	for ( int i = 0; i < TEST_LONG_STRING_LENGTH; ++i )
+	{
+		pLongString[i] = 'a' + ( i % 26 );
+	}
+	pLongString[TEST_LONG_STRING_LENGTH] = 0;
+
+	char pVMT[TEST_LONG_STRING_LENGTH + 512];
+	Q_snprintf( pVMT, sizeof( pVMT ),
+		"\"" TEST_REAL_SHADER "\"\n"
+		"{\n"
+		"\t\"$polyoffset\" \"1\"\n"
+		"\t\"$alpha\" \"0.3\"\n"
+		"\t\"$color\" \"[0.25 0.5 0.75]\"\n"
+		"\t\"$basetexturetransform\" \"center .5 .5 scale 2 3 rotate 30 translate .1 .2\"\n"
+		"\t\"$basetexture\" \"matcachetest/basetexture\"\n"
+		"\t\"$matcachetest_note\" \"%s\"\n"
+		"}\n", pLongString );
+	WriteTestFile( TEST_REAL_VMT_FILENAME, pVMT );
+}
+
+// Writes each var's name, type + value as a NUL-terminated string; floats
+// are printed with enough digits to catch any change in their bits
+static int DescribeMaterialVars( IMaterial *pMaterial, CUtlBuffer &buf )
+{
+	IMaterialVar **ppVars = pMaterial->GetShaderParams();
+	int nVarCount = pMaterial->ShaderParamCount();
+	char pTemp[256];
+
+	buf.SeekPut( CUtlBuffer::SEEK_HEAD, 0 );
+	for ( int i = 0; i < nVarCount; ++i )
+	{
+		IMaterialVar *pVar = ppVars[i];
+		Q_snprintf( pTemp, sizeof( pTemp ), "%s type %d:", pVar->GetName(), pVar->GetType() );
+		buf.Put( pTemp, strlen( pTemp ) );
+
+		int j;
+		switch( pVar->GetType() )
+		{
+		case MATERIAL_VAR_TYPE_INT:
+			Q_snprintf( pTemp, sizeof( pTemp ), " %d", pVar->GetIntValue() );
+			buf.Put( pTemp, strlen( pTemp ) );
+			break;
+
+		case MATERIAL_VAR_TYPE_FLOAT:
+			Q_snprintf( pTemp, sizeof( pTemp ), " %.9g", pVar->GetFloatValue() );
+			buf.Put( pTemp, strlen( pTemp ) );
+			break;
+
+		case MATERIAL_VAR_TYPE_STRING:
+			buf.PutChar( ' ' );
+			buf.Put( pVar->GetStringValue(), strlen( pVar->GetStringValue() ) );
+			break;
+
+		case MATERIAL_VAR_TYPE_VECTOR:
+			for ( j = 0; j < pVar->VectorSize(); ++j )
+			{
+				Q_snprintf( pTemp, sizeof( pTemp ), " %.9g", pVar->GetVecValue()[j] );
+				buf.Put( pTemp, strlen( pTemp ) );
+			}
+			break;
+
+		case MATERIAL_VAR_TYPE_MATRIX:
+			for ( j = 0; j < 16; ++j )
+			{
+				Q_snprintf( pTemp, sizeof( pTemp ), " %.9g", pVar->GetMatrixValue().m[j >> 2][j & 3] );
+				buf.Put( pTemp, strlen( pTemp ) );
+			}
+			break;
+		}
+		buf.PutChar( 0 );
+	}
+	return nVarCount;
+}
+
+static IMaterialVar *FindRealTestVar( IMaterial *pMaterial, char const *pVarName, MaterialVarType_t type )
+{
+	bool bFound;
+	IMaterialVar *pVar = pMaterial->FindVar( pVarName, &bFound, false );
+	_AssertMsg( bFound && ( pVar->GetType() == type ),
+		CDbgFmtMsg( "%s: %s didn't parse as type %d", TEST_REAL_MATERIAL, pVarName, type ) );
+	return bFound ? pVar : NULL;
+}
+
+// The shader the cache entry was compiled for is the last one in its chain
+static void GetCachedShaderName( char *pShaderName, int nMaxLen )
+{
+	*pShaderName = 0;
+
+	CUtlBuffer buf;
+	if ( !MaterialCache_Find( TEST_REAL_MATERIAL, buf ) )
+		return;
+
+	int nShaderCount = buf.GetInt();
+	for ( int i = 0; i < nShaderCount; ++i )
+	{
+		buf.GetString( pShaderName, nMaxLen );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// The test
+//-----------------------------------------------------------------------------
+DEFINE_TESTCASE( MaterialCacheCompileRealMaterial, MaterialCacheTestSuite )
+{
+	Msg( "Material cache compile and reload of a real material...\n" );
+
+	if ( !LoadSystems() )
+	{
+		_AssertMsg( false, "Unable to load " FILESYSTEM_DLL_NAME " and " SHADERAPIEMPTY_DLL_NAME );
+		UnloadSystems();
+		return;
+	}
+
+	bool bHadMatCache = ( CommandLine()->FindParm( "-matcache" ) != 0 );
+	if ( !bHadMatCache )
+	{
+		// The first parm is taken to be the exe name, so don't let ours be it
+		if ( CommandLine()->ParmCount() == 0 )
+		{
+			CommandLine()->CreateCmdLine( "unittest" );
+		}
+		CommandLine()->AppendParm( "-matcache", NULL );
+	}
+
+	RemoveTestFile( TEST_CACHE_FILENAME );
+	WriteRealTestMaterial();
+
+	// First load goes through the text parse, and compiles it into the cache
+	CUtlBuffer parsed;
+	int nParsedCount = 0;
+	char pParsedShaderName[256];
+	pParsedShaderName[0] = 0;
+	if ( !InitMaterialSystem() )
+	{
+		_AssertMsg( false, "Unable to init " MATERIALSYSTEM_DLL_NAME );
+	}
+	else
+	{
+		bool bFound;
+		IMaterial *pMaterial = s_pMaterialSystem->FindMaterial( TEST_REAL_MATERIAL, &bFound );
+		_AssertMsg( bFound, "Unable to find " TEST_REAL_VMT_FILENAME );
+		if ( bFound )
+		{
+			// Make sure every type the cache stores gets written
+			FindRealTestVar( pMaterial, "$polyoffset", MATERIAL_VAR_TYPE_INT );
+			FindRealTestVar( pMaterial, "$alpha", MATERIAL_VAR_TYPE_FLOAT );
+			FindRealTestVar( pMaterial, "$color", MATERIAL_VAR_TYPE_VECTOR );
+			FindRealTestVar( pMaterial, "$basetexturetransform", MATERIAL_VAR_TYPE_MATRIX );
+			FindRealTestVar( pMaterial, "$basetexture", MATERIAL_VAR_TYPE_STRING );
+			IMaterialVar *pNote = FindRealTestVar( pMaterial, "$matcachetest_note", MATERIAL_VAR_TYPE_STRING );
+			_AssertMsg( !pNote || ( strlen( pNote->GetStringValue() ) == TEST_LONG_STRING_LENGTH ),
+				"$matcachetest_note was truncated by the text parse" );
+
+			nParsedCount = DescribeMaterialVars( pMaterial, parsed );
+			Q_strncpy( pParsedShaderName, pMaterial->GetShaderName(), sizeof( pParsedShaderName ) );
+			_AssertMsg( !Q_stricmp( pParsedShaderName, TEST_REAL_SHADER ),
+				CDbgFmtMsg( "%s parsed with shader \"%s\"", TEST_REAL_MATERIAL, pParsedShaderName ) );
+		}
+	}
+	ShutdownMaterialSystem();
+	_AssertMsg( g_pFileSystem->FileExists( TEST_CACHE_FILENAME ), "The compiled material wasn't saved" );
+
+	// Second load comes back out of the cache
+	if ( InitMaterialSystem() )
+	{
+		// Init's default config, which the cache entry was keyed on
+		memset( &g_config, 0, sizeof( g_config ) );
+		g_config.bBumpmap = true;
+
+		char pCachedShaderName[256];
+		GetCachedShaderName( pCachedShaderName, sizeof( pCachedShaderName ) );
+		MaterialCache_Shutdown();
+		_AssertMsg( !Q_stricmp( pCachedShaderName, pParsedShaderName ),
+			CDbgFmtMsg( "The cache entry was compiled for shader \"%s\"", pCachedShaderName ) );
+
+		bool bFound;
+		IMaterial *pMaterial = s_pMaterialSystem->FindMaterial( TEST_REAL_MATERIAL, &bFound );
+		_AssertMsg( bFound, "Unable to find " TEST_REAL_MATERIAL " after reloading" );
+		if ( bFound )
+		{
+			CUtlBuffer loaded;
+			pMaterial->FindVar( "$polyoffset", NULL, false );
+			int nLoadedCount = DescribeMaterialVars( pMaterial, loaded );
+
+			_AssertMsg( !Q_stricmp( pMaterial->GetShaderName(), pParsedShaderName ),
+				CDbgFmtMsg( "Reloaded with shader \"%s\", parsed with \"%s\"", pMaterial->GetShaderName(), pParsedShaderName ) );
+			_AssertMsg( nLoadedCount == nParsedCount,
+				CDbgFmtMsg( "Reloaded with %d vars, parsed with %d", nLoadedCount, nParsedCount ) );
+
+			char const *pParsed = (char const *)parsed.Base();
+			char const *pLoaded = (char const *)loaded.Base();
+			for ( int i = 0; ( i < nParsedCount ) && ( i < nLoadedCount ); ++i )
+			{
+				_AssertMsg( !Q_strcmp( pParsed, pLoaded ),
+					CDbgFmtMsg( "Var %d parsed as \"%.128s\", reloaded as \"%.128s\"", i, pParsed, pLoaded ) );
+				pParsed += strlen( pParsed ) + 1;
+				pLoaded += strlen( pLoaded ) + 1;
+			}
+		}
+
+		// The cache only gets written back if something was compiled, which
+		// would mean the reload fell back to the text parse
+		RemoveTestFile( TEST_CACHE_FILENAME );
+		ShutdownMaterialSystem();
+		_AssertMsg( !g_pFileSystem->FileExists( TEST_CACHE_FILENAME ),
+			TEST_REAL_MATERIAL " was compiled again instead of loaded from the cache" );
+	}
+	else
+	{
+		_AssertMsg( false, "Unable to reinit " MATERIALSYSTEM_DLL_NAME );
+	}
+	UnloadMaterialSystem();
+
+	if ( !bHadMatCache )
+	{
+		CommandLine()->RemoveParm( "-matcache" );
+	}
+
+	RemoveTestFile( TEST_CACHE_FILENAME );
+	RemoveTestFile( TEST_REAL_VMT_FILENAME );
+
+	UnloadSystems();
+}
@@ -0,0 +1,348 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Checks the occlusion system's depth buffer test against its edge
+//			list test, using a synthetic world of occluders instead of a map
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "unitlib/unitlib.h"
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "gl_model_private.h"
+#include "IOcclusionSystem.h"
+#include "convar.h"
+#include "vmatrix.h"
+#include "vstdlib/random.h"
+#include <string.h>
+#include <math.h>
+
+
+class IMaterialSystem;
+class IMaterial;
+
+// OcclusionSystem.cpp uses these; the engine normally owns them. Nothing is
+// drawn unless r_visocclusion is set.
+CCommonHostState host_state;
+IMaterialSystem *materialSystemInterface = NULL;
+IMaterial *g_pMaterialWireframeVertexColorIgnoreZ = NULL;
+
+
+DEFINE_TESTSUITE( OcclusionTestSuite )
+
+
+//-----------------------------------------------------------------------------
+// The synthetic world: quads standing in front of a camera at the origin
+// that looks down +x, the way occluder brushes come out of vbsp
+//-----------------------------------------------------------------------------
+#define OCCLUDER_COUNT		5
+
+#define CAMERA_FOV			90.0f
+#define CAMERA_ASPECT		( 4.0f / 3.0f )
+#define CAMERA_ZNEAR		7.0f
+#define CAMERA_ZFAR			8192.0f
+
+static Vector s_pOccluderVerts[OCCLUDER_COUNT][4] =
+{
+	{ Vector(  512, -256, -128 ), Vector(  512,  256, -128 ), Vector(  512,  256,  128 ), Vector(  512, -256,  128 ) },
+	{ Vector( 1024,  200, -300 ), Vector( 1024,  900, -300 ), Vector( 1024,  900,  300 ), Vector( 1024,  200,  300 ) },
+	{ Vector(  768, -900, -200 ), Vector(  768, -300, -200 ), Vector(  768, -300,  400 ), Vector(  768, -900,  400 ) },
+	{ Vector( 1500, -600, -500 ), Vector( 1900,  100, -500 ), Vector( 1900,  100,  200 ), Vector( 1500, -600,  200 ) },
+	{ Vector(  300,  150,  -60 ), Vector(  300,  300,  -60 ), Vector(  360,  300,  -20 ), Vector(  360,  150,  -20 ) },
+};
+
+static model_t s_World;
+static mvertex_t s_pVertices[OCCLUDER_COUNT * 4];
+static int s_pVertexIndices[OCCLUDER_COUNT * 4];
+static cplane_t s_pPlanes[OCCLUDER_COUNT];
+static doccluderdata_t s_pOccluders[OCCLUDER_COUNT];
+static doccluderpolydata_t s_pOccluderPolys[OCCLUDER_COUNT];
+
+static void BuildWorld()
+{
+	memset( &s_World, 0, sizeof( s_World ) );
+	for ( int i = 0; i < OCCLUDER_COUNT; ++i )
+	{
+		for ( int j = 0; j < 4; ++j )
+		{
+			s_pVertices[i * 4 + j].position = s_pOccluderVerts[i][j];
+			s_pVertexIndices[i * 4 + j] = i * 4 + j;
+		}
+
+		// Face the camera, or the occlusion system treats it as a backface
+		Vector vecEdge1, vecEdge2;
+		VectorSubtract( s_pOccluderVerts[i][1], s_pOccluderVerts[i][0], vecEdge1 );
+		VectorSubtract( s_pOccluderVerts[i][2], s_pOccluderVerts[i][0], vecEdge2 );
+		CrossProduct( vecEdge1, vecEdge2, s_pPlanes[i].normal );
+		VectorNormalize( s_pPlanes[i].normal );
+		s_pPlanes[i].dist = DotProduct( s_pPlanes[i].normal, s_pOccluderVerts[i][0] );
+		if ( s_pPlanes[i].dist > 0.0f )
+		{
+			s_pPlanes[i].normal *= -1.0f;
+			s_pPlanes[i].dist = -s_pPlanes[i].dist;
+		}
+		s_pPlanes[i].type = 3;
+
+		s_pOccluderPolys[i].firstvertexindex = i * 4;
+		s_pOccluderPolys[i].vertexcount = 4;
+		s_pOccluderPolys[i].planenum = i;
+
+		s_pOccluders[i].flags = 0;
+		s_pOccluders[i].firstpoly = i;
+		s_pOccluders[i].polycount = 1;
+		ClearBounds( s_pOccluders[i].mins, s_pOccluders[i].maxs );
+		for ( int k = 0; k < 4; ++k )
+		{
+			AddPointToBounds( s_pOccluderVerts[i][k], s_pOccluders[i].mins, s_pOccluders[i].maxs );
+		}
+	}
+
+	s_World.brush.vertexes = s_pVertices;
+	s_World.brush.numoccludervertindices = OCCLUDER_COUNT * 4;
+	s_World.brush.occludervertindices = s_pVertexIndices;
+	s_World.brush.planes = s_pPlanes;
+	s_World.brush.numoccluders = OCCLUDER_COUNT;
+	s_World.brush.occluders = s_pOccluders;
+	s_World.brush.numoccluderpolys = OCCLUDER_COUNT;
+	s_World.brush.occluderpolys = s_pOccluderPolys;
+	host_state.worldmodel = &s_World;
+}
+
+
+//-----------------------------------------------------------------------------
+// Sets up the same matrices the renderer hands the occlusion system: a
+// right-handed camera space looking down -z, and a D3D style projection
+//-----------------------------------------------------------------------------
+static void SetView()
+{
+	VMatrix worldToCamera;
+	worldToCamera.Init(
+		 0.0f, -1.0f, 0.0f, 0.0f,
+		 0.0f,  0.0f, 1.0f, 0.0f,
+		-1.0f,  0.0f, 0.0f, 0.0f,
+		 0.0f,  0.0f, 0.0f, 1.0f );
+
+	float flWidth = 2.0f * CAMERA_ZNEAR * tan( CAMERA_FOV * M_PI / 360.0f );
+	float flHeight = flWidth / CAMERA_ASPECT;
+	float flDepth = CAMERA_ZFAR / ( CAMERA_ZNEAR - CAMERA_ZFAR );
+
+	VMatrix cameraToProjection;
+	cameraToProjection.Init(
+		2.0f * CAMERA_ZNEAR / flWidth, 0.0f, 0.0f, 0.0f,
+		0.0f, 2.0f * CAMERA_ZNEAR / flHeight, 0.0f, 0.0f,
+		0.0f, 0.0f, flDepth, CAMERA_ZNEAR * flDepth,
+		0.0f, 0.0f, -1.0f, 0.0f );
+
+	VPlane nearClipPlane( Vector( 1.0f, 0.0f, 0.0f ), CAMERA_ZNEAR );
+	OcclusionSystem()->SetView( vec3_origin, CAMERA_FOV, worldToCamera, cameraToProjection, nearClipPlane );
+}
+
+static void SetConVar( char const *pName, int nValue )
+{
+	ConVar *pVar = (ConVar *)ConCommandBase::FindCommand( pName );
+	_AssertMsg( pVar && !pVar->IsCommand(), CDbgFmtMsg( "No convar %s", pName ) );
+	if ( pVar && !pVar->IsCommand() )
+	{
+		pVar->SetValue( nValue );
+	}
+}
+
+// With r_occlusioncompare set both tests are built, and r_occlusiondepthbuffer
+// only picks which answer IsOccluded returns, so nothing is rebuilt in between
+static bool IsOccludedByEdgeList( const Vector &vecAbsMins, const Vector &vecAbsMaxs )
+{
+	SetConVar( "r_occlusiondepthbuffer", 0 );
+	return OcclusionSystem()->IsOccluded( vecAbsMins, vecAbsMaxs );
+}
+
+static bool IsOccludedByDepthBuffer( const Vector &vecAbsMins, const Vector &vecAbsMaxs )
+{
+	SetConVar( "r_occlusiondepthbuffer", 1 );
+	return OcclusionSystem()->IsOccluded( vecAbsMins, vecAbsMaxs );
+}
+
+static void CheckBox( char const *pName, const Vector &vecCenter, float flExtent, bool bExpectOccluded )
+{
+	Vector vecExtents( flExtent, flExtent, flExtent );
+	Vector vecAbsMins, vecAbsMaxs;
+	VectorSubtract( vecCenter, vecExtents, vecAbsMins );
+	VectorAdd( vecCenter, vecExtents, vecAbsMaxs );
+
+	bool bEdgeListOccluded = IsOccludedByEdgeList( vecAbsMins, vecAbsMaxs );
+	bool bDepthBufferOccluded = IsOccludedByDepthBuffer( vecAbsMins, vecAbsMaxs );
+	_AssertMsg( bEdgeListOccluded == bExpectOccluded, CDbgFmtMsg( "%s: edge list says %s", pName, bEdgeListOccluded ? "occluded" : "visible" ) );
+	_AssertMsg( bDepthBufferOccluded == bExpectOccluded, CDbgFmtMsg( "%s: depth buffer says %s", pName, bDepthBufferOccluded ? "occluded" : "visible" ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Boxes we know the answer for, including after an occluder is switched off
+//-----------------------------------------------------------------------------
+DEFINE_TESTCASE( OcclusionKnownBoxes, OcclusionTestSuite )
+{
+	BuildWorld();
+	SetConVar( "r_occlusion", 1 );
+	SetConVar( "r_occlusioncompare", 1 );
+	SetView();
+
+	CheckBox( "behind the first wall", Vector( 1024, 0, 0 ), 32.0f, true );
+	CheckBox( "in front of the first wall", Vector( 256, 0, 0 ), 16.0f, false );
+	CheckBox( "beside the first wall", Vector( 1024, -560, -280 ), 24.0f, false );
+	CheckBox( "behind the slanted wall", Vector( 2600, -500, -200 ), 48.0f, true );
+	CheckBox( "straddling the first wall's edge", Vector( 1024, 512, 0 ), 32.0f, false );
+
+	OcclusionSystem()->ActivateOccluder( 0, false );
+	CheckBox( "behind an inactive wall", Vector( 1024, 0, 0 ), 32.0f, false );
+	OcclusionSystem()->ActivateOccluder( 0, true );
+	CheckBox( "behind a reactivated wall", Vector( 1024, 0, 0 ), 32.0f, true );
+
+	SetConVar( "r_occlusioncompare", 0 );
+	SetConVar( "r_occlusiondepthbuffer", 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Brute force visibility: a box with any point on its surface that a ray from
+// the eye reaches without going through an occluder can't be occluded
+//-----------------------------------------------------------------------------
+#define BOX_SAMPLES_PER_SIDE	8
+
+static bool IsRayBlocked( const Vector &vecEnd )
+{
+	for ( int i = 0; i < OCCLUDER_COUNT; ++i )
+	{
+		if ( s_pOccluders[i].flags & OCCLUDER_FLAGS_INACTIVE )
+			continue;
+
+		// The eye is at the origin, on the front side of every occluder
+		const cplane_t &plane = s_pPlanes[i];
+		float flEndDist = DotProduct( plane.normal, vecEnd ) - plane.dist;
+		if ( flEndDist >= 0.0f )
+			continue;
+
+		float t = -plane.dist / ( -plane.dist - flEndDist );
+		Vector vecHit = vecEnd * t;
+
+		// The occluders are convex, so the hit must be inside all the edges
+		bool bInside = true;
+		for ( int j = 0; j < 4; ++j )
+		{
+			Vector vecEdge, vecToHit, vecCross;
+			VectorSubtract( s_pOccluderVerts[i][(j + 1) & 0x3], s_pOccluderVerts[i][j], vecEdge );
+			VectorSubtract( vecHit, s_pOccluderVerts[i][j], vecToHit );
+			CrossProduct( vecEdge, vecToHit, vecCross );
+			if ( DotProduct( vecCross, plane.normal ) > 0.0f )
+			{
+				bInside = false;
+				break;
+			}
+		}
+
+		if ( bInside )
+			return true;
+	}
+
+	return false;
+}
+
+static bool IsBoxSurfaceVisible( const Vector &vecAbsMins, const Vector &vecAbsMaxs )
+{
+	for ( int x = 0; x <= BOX_SAMPLES_PER_SIDE; ++x )
+	{
+		for ( int y = 0; y <= BOX_SAMPLES_PER_SIDE; ++y )
+		{
+			for ( int z = 0; z <= BOX_SAMPLES_PER_SIDE; ++z )
+			{
+				// Only points on the surface
+				if ( ( x % BOX_SAMPLES_PER_SIDE ) && ( y % BOX_SAMPLES_PER_SIDE ) && ( z % BOX_SAMPLES_PER_SIDE ) )
+					continue;
+
+				Vector vecSample;
+				vecSample.x = vecAbsMins.x + ( vecAbsMaxs.x - vecAbsMins.x ) * x / BOX_SAMPLES_PER_SIDE;
+				vecSample.y = vecAbsMins.y + ( vecAbsMaxs.y - vecAbsMins.y ) * y / BOX_SAMPLES_PER_SIDE;
+				vecSample.z = vecAbsMins.z + ( vecAbsMaxs.z - vecAbsMins.z ) * z / BOX_SAMPLES_PER_SIDE;
+				if ( !IsRayBlocked( vecSample ) )
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Seeded random boxes inside the view. Neither test may occlude a box we can
+// see part of, and the depth buffer only ever errs on the side of drawing, so
+// it may never occlude a box the edge list doesn't.
+//-----------------------------------------------------------------------------
+#define RANDOM_BOX_COUNT	10000
+
+DEFINE_TESTCASE( OcclusionCompareRandomBoxes, OcclusionTestSuite )
+{
+	BuildWorld();
+	SetConVar( "r_occlusion", 1 );
+	SetConVar( "r_occlusioncompare", 1 );
+	SetView();
+
+	CUniformRandomStream randomStream;
+	randomStream.SetSeed( 1 );
+
+	int nAgree = 0, nBothOccluded = 0, nDepthOnly = 0, nEdgeOnly = 0;
+	int nEdgeListWrong = 0, nDepthBufferWrong = 0;
+	double flEdgeListTime = 0.0, flDepthBufferTime = 0.0;
+	for ( int i = 0; i < RANDOM_BOX_COUNT; ++i )
+	{
+		Vector vecCenter, vecExtents;
+		vecCenter.x = randomStream.RandomFloat( 64.0f, 3072.0f );
+		vecCenter.y = vecCenter.x * randomStream.RandomFloat( -0.9f, 0.9f );
+		vecCenter.z = vecCenter.x * randomStream.RandomFloat( -0.65f, 0.65f );
+		vecExtents.x = randomStream.RandomFloat( 4.0f, 48.0f );
+		vecExtents.y = randomStream.RandomFloat( 4.0f, 48.0f );
+		vecExtents.z = randomStream.RandomFloat( 4.0f, 48.0f );
+
+		Vector vecAbsMins, vecAbsMaxs;
+		VectorSubtract( vecCenter, vecExtents, vecAbsMins );
+		VectorAdd( vecCenter, vecExtents, vecAbsMaxs );
+
+		double flStartTime = Plat_FloatTime();
+		bool bEdgeListOccluded = IsOccludedByEdgeList( vecAbsMins, vecAbsMaxs );
+		double flMidTime = Plat_FloatTime();
+		bool bDepthBufferOccluded = IsOccludedByDepthBuffer( vecAbsMins, vecAbsMaxs );
+		flEdgeListTime += flMidTime - flStartTime;
+		flDepthBufferTime += Plat_FloatTime() - flMidTime;
+
+		if ( ( bEdgeListOccluded || bDepthBufferOccluded ) && IsBoxSurfaceVisible( vecAbsMins, vecAbsMaxs ) )
+		{
+			nEdgeListWrong += bEdgeListOccluded;
+			nDepthBufferWrong += bDepthBufferOccluded;
+		}
+
+		if ( bEdgeListOccluded == bDepthBufferOccluded )
+		{
+			++nAgree;
+			nBothOccluded += bEdgeListOccluded;
+		}
+		else if ( bDepthBufferOccluded )
+		{
+			++nDepthOnly;
+		}
+		else
+		{
+			++nEdgeOnly;
+		}
+	}
+
+	Msg( "%d of %d boxes agree (%d occluded by both)\n", nAgree, RANDOM_BOX_COUNT, nBothOccluded );
+	Msg( "  only depth buffer occluded %d, only edge list occluded %d\n", nDepthOnly, nEdgeOnly );
+	Msg( "  edge list %.3f ms, depth buffer %.3f ms\n", flEdgeListTime * 1000.0, flDepthBufferTime * 1000.0 );
+
+	_AssertMsg( nBothOccluded > 0, "No random box was occluded; the scene doesn't test anything" );
+	_AssertMsg( nEdgeListWrong == 0, CDbgFmtMsg( "Edge list occluded %d boxes that can be seen", nEdgeListWrong ) );
+	_AssertMsg( nDepthBufferWrong == 0, CDbgFmtMsg( "Depth buffer occluded %d boxes that can be seen", nDepthBufferWrong ) );
+	_AssertMsg( nDepthOnly == 0, CDbgFmtMsg( "Depth buffer occluded %d boxes the edge list didn't", nDepthOnly ) );
+	_AssertMsg( nEdgeOnly * 10 <= nBothOccluded + nEdgeOnly, CDbgFmtMsg( "Depth buffer missed %d of %d boxes the edge list occluded", nEdgeOnly, nBothOccluded + nEdgeOnly ) );
+
+	SetConVar( "r_occlusioncompare", 0 );
+	SetConVar( "r_occlusiondepthbuffer", 0 );
+}
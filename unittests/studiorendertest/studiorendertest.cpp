@@ -0,0 +1,410 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Checks studiorender's batched and SSE software vertex paths
+//			against the plain scalar ones on a fixed mesh
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "unitlib/unitlib.h"
+#include "tier0/dbg.h"
+#include "mathlib.h"
+#include "studio.h"
+#include "flexrenderdata.h"
+#include "r_studioskin.h"
+#include "vstdlib/random.h"
+#include "commonmacros.h"
+#include <string.h>
+#include <math.h>
+
+
+DEFINE_TESTSUITE( StudioRenderTestSuite )
+
+
+//-----------------------------------------------------------------------------
+// The sample mesh.  Vertices come in runs sharing their bone weights, with
+// 1 to 4 bones each, and enough of them to be skinned in parallel.
+//-----------------------------------------------------------------------------
+#define SAMPLE_BONES		8
+#define SAMPLE_VERTICES		1500
+#define SAMPLE_FLEXES		8
+#define SAMPLE_VERTANIMS	1222
+
+struct samplemesh_t
+{
+	mstudiomodel_t		model;
+	mstudiomesh_t		mesh;
+	mstudiovertex_t		verts[SAMPLE_VERTICES];
+	Vector4D			tangentS[SAMPLE_VERTICES];
+	unsigned short		groupToMesh[SAMPLE_VERTICES];
+	mstudioflex_t		flexes[SAMPLE_FLEXES];
+	mstudiovertanim_t	vertanims[SAMPLE_VERTANIMS];
+};
+
+static samplemesh_t s_SampleMesh;
+
+static mstudiomesh_t *BuildSampleMesh()
+{
+	samplemesh_t *pSample = &s_SampleMesh;
+	memset( pSample, 0, sizeof( *pSample ) );
+
+	pSample->model.vertexindex = (byte *)pSample->verts - (byte *)&pSample->model;
+	pSample->model.tangentsindex = (byte *)pSample->tangentS - (byte *)&pSample->model;
+	pSample->model.numvertices = SAMPLE_VERTICES;
+	pSample->mesh.modelindex = (byte *)&pSample->model - (byte *)&pSample->mesh;
+	pSample->mesh.numvertices = SAMPLE_VERTICES;
+
+	mstudioboneweight_t weights;
+	int nRun = 0;
+	for ( int i = 0; i < SAMPLE_VERTICES; i++ )
+	{
+		if ( nRun == 0 )
+		{
+			weights.numbones = RandomInt( 1, 4 );
+			float flTotal = 0.0f;
+			int j;
+			for ( j = 0; j < 4; j++ )
+			{
+				weights.bone[j] = RandomInt( 0, SAMPLE_BONES - 1 );
+				weights.weight[j] = ( j < weights.numbones ) ? RandomFloat( 0.1f, 1.0f ) : 0.0f;
+				flTotal += weights.weight[j];
+			}
+			for ( j = 0; j < weights.numbones; j++ )
+			{
+				weights.weight[j] /= flTotal;
+			}
+			nRun = RandomInt( 1, 12 );
+		}
+		--nRun;
+
+		mstudiovertex_t *pVert = &pSample->verts[i];
+		pVert->m_BoneWeights = weights;
+		pVert->m_vecPosition.Init( RandomFloat( -50.0f, 50.0f ), RandomFloat( -50.0f, 50.0f ), RandomFloat( 0.0f, 72.0f ) );
+		pVert->m_vecNormal.Init( RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ) );
+		VectorNormalize( pVert->m_vecNormal );
+
+		pSample->tangentS[i].Init( RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ), RandomFloat( -1.0f, 1.0f ),
+			RandomInt( 0, 1 ) ? 1.0f : -1.0f );
+
+		// strip groups visit the mesh out of order, and share vertices
+		pSample->groupToMesh[i] = ( i * 7 ) % SAMPLE_VERTICES;
+		if ( ( i % 16 ) == 15 )
+		{
+			pSample->groupToMesh[i] = pSample->groupToMesh[i - 3];
+		}
+	}
+
+	return &pSample->mesh;
+}
+
+static void RandomPoseToWorld( matrix3x4_t *pPoseToWorld )
+{
+	for ( int i = 0; i < SAMPLE_BONES; i++ )
+	{
+		QAngle angles( RandomFloat( -180.0f, 180.0f ), RandomFloat( -180.0f, 180.0f ), RandomFloat( -180.0f, 180.0f ) );
+		Vector origin( RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ), RandomFloat( -100.0f, 100.0f ) );
+		AngleMatrix( angles, origin, pPoseToWorld[i] );
+	}
+}
+
+// Flexes every third vertex of the mesh; like the flex code, leaves normals unnormalized
+static void FlexSampleMesh( CCachedRenderData *pCache, mstudiomesh_t *pMesh )
+{
+	pCache->StartModel();
+	pCache->SetBodyPart( 0 );
+	pCache->SetModel( 0 );
+	pCache->SetMesh( 0 );
+	pCache->SetupComputation( pMesh, true );
+
+	for ( int i = 0; i < pMesh->numvertices; i += 3 )
+	{
+		mstudiovertex_t *pVert = pMesh->Vertex( i );
+		CachedVertex_t *pFlexed = pCache->CreateFlexVertex( i );
+		pFlexed->m_Position = pVert->m_vecPosition + Vector( RandomFloat( -2.0f, 2.0f ), RandomFloat( -2.0f, 2.0f ), RandomFloat( -2.0f, 2.0f ) );
+		pFlexed->m_Normal = pVert->m_vecNormal * RandomFloat( 0.5f, 2.0f ) + Vector( RandomFloat( -0.1f, 0.1f ), 0.0f, 0.0f );
+		Vector4DCopy( *pMesh->TangentS( i ), pFlexed->m_TangentS );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Skins one vertex the way the software mesh paths did before batching
+//-----------------------------------------------------------------------------
+static void SkinVertexReference( mstudiomesh_t *pMesh, int n, matrix3x4_t *pPoseToWorld, CCachedRenderData *pCache,
+	bool bTangentSpace, Vector &pos, Vector &norm, Vector4D &tangentS )
+{
+	mstudiovertex_t &vert = *pMesh->Vertex( n );
+
+	matrix3x4_t temp;
+	matrix3x4_t *pSkinMat = ComputeSkinMatrix( vert.m_BoneWeights, pPoseToWorld, temp );
+
+	Vector srcPos, srcNorm;
+	const Vector4D *pSrcTangentS;
+	if ( pCache && pCache->IsVertexFlexed( n ) )
+	{
+		CachedVertex_t *pFlexed = pCache->GetFlexVertex( n );
+		srcPos = pFlexed->m_Position;
+		srcNorm = pFlexed->m_Normal;
+		VectorNormalize( srcNorm );
+		pSrcTangentS = &pFlexed->m_TangentS;
+	}
+	else
+	{
+		srcPos = vert.m_vecPosition;
+		srcNorm = vert.m_vecNormal;
+		pSrcTangentS = pMesh->TangentS( n );
+	}
+
+	VectorTransform( srcPos, *pSkinMat, pos );
+	VectorRotate( srcNorm, *pSkinMat, norm );
+	if ( bTangentSpace )
+	{
+		VectorRotate( pSrcTangentS->AsVector3D(), *pSkinMat, tangentS.AsVector3D() );
+		tangentS.w = pSrcTangentS->w;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Skins a strip group in one batch and asserts every vertex matches
+//-----------------------------------------------------------------------------
+#define SKIN_POSITION_TOLERANCE		1e-3f
+#define SKIN_DIRECTION_TOLERANCE	1e-4f
+
+static float MaxError( const float *pA, const float *pB, int nCount, float flScale )
+{
+	float flError = 0.0f;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		flError = max( flError, fabs( pA[i] - pB[i] ) / ( flScale + fabs( pB[i] ) ) );
+	}
+	return flError;
+}
+
+static void CheckSkinVertices( mstudiomesh_t *pMesh, matrix3x4_t *pPoseToWorld, CCachedRenderData *pCache,
+	bool bTangentSpace, bool bSSE, int nVertices )
+{
+	unsigned short *pGroupToMesh = s_SampleMesh.groupToMesh;
+	skinnedvertex_t *pSkinned = R_SkinVertices( pMesh, pPoseToWorld, pCache, bTangentSpace, bSSE, nVertices, pGroupToMesh );
+
+	for ( int j = 0; j < nVertices; j++ )
+	{
+		Vector pos, norm;
+		Vector4D tangentS;
+		SkinVertexReference( pMesh, pGroupToMesh[j], pPoseToWorld, pCache, bTangentSpace, pos, norm, tangentS );
+
+		float flPosError = MaxError( pSkinned[j].m_Position, pos.Base(), 3, 1.0f );
+		float flDirError = MaxError( pSkinned[j].m_Normal, norm.Base(), 3, 1.0f );
+		if ( bTangentSpace )
+		{
+			flDirError = max( flDirError, MaxError( pSkinned[j].m_TangentS, tangentS.Base(), 4, 1.0f ) );
+		}
+
+		_AssertMsg( flPosError <= SKIN_POSITION_TOLERANCE && flDirError <= SKIN_DIRECTION_TOLERANCE,
+			CDbgFmtMsg( "%s skinning%s%s of %d vertices: vertex %d is off by %f (position), %f (direction)",
+				bSSE ? "SSE" : "Scalar", pCache ? ", flexed" : "", bTangentSpace ? ", tangent space" : "",
+				nVertices, j, flPosError, flDirError ) );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// The test
+//-----------------------------------------------------------------------------
+
+// one group small enough to skin serially, one big enough to split up
+static const int s_pGroupSizes[] = { 100, SAMPLE_VERTICES };
+
+DEFINE_TESTCASE( SkinVerticesMatchesPerVertex, StudioRenderTestSuite )
+{
+	Msg( "Batched software skinning vs per vertex...\n" );
+
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f );
+	RandomSeed( 1 );
+
+	mstudiomesh_t *pMesh = BuildSampleMesh();
+
+	// The SSE skin matrix code expects these to be aligned
+#ifdef _WIN32
+	__declspec(align(16)) matrix3x4_t pPoseToWorld[SAMPLE_BONES];
+#elif _LINUX
+	__attribute__((aligned(16))) matrix3x4_t pPoseToWorld[SAMPLE_BONES];
+#endif
+	RandomPoseToWorld( pPoseToWorld );
+
+	// Too big for the stack
+	CCachedRenderData *pCache = new CCachedRenderData;
+	FlexSampleMesh( pCache, pMesh );
+
+	for ( int nSSE = 0; nSSE < 2; nSSE++ )
+	{
+		if ( nSSE && !MathLib_SSEEnabled() )
+		{
+			Msg( "No SSE, skipping the SSE path\n" );
+			break;
+		}
+
+		for ( int i = 0; i < ARRAYSIZE( s_pGroupSizes ); i++ )
+		{
+			for ( int nFlags = 0; nFlags < 4; nFlags++ )
+			{
+				CheckSkinVertices( pMesh, pPoseToWorld, ( nFlags & 1 ) ? pCache : NULL, ( nFlags & 2 ) != 0,
+					nSSE != 0, s_pGroupSizes[i] );
+			}
+		}
+	}
+
+	delete pCache;
+}
+
+
+//-----------------------------------------------------------------------------
+// Sample flexes.  Each moves a different run of vertices, overlapping the
+// others, and the counts straddle the SSE path's batches of 64.  Their
+// controllers hit each part of the target ramp; the last two ramp to a
+// weight R_StudioFlexVerts skips.
+//-----------------------------------------------------------------------------
+static const int s_pFlexVertCounts[SAMPLE_FLEXES] = { 1, 63, 64, 65, 200, 700, 64, 65 };
+static const float s_pFlexTargets[SAMPLE_FLEXES][4] = 
+{
+	{ 0.0f, 0.25f, 0.75f, 1.0f },	// plat
+	{ 0.0f, 1.0f, 1.0f, 2.0f },		// 0 to 1 ramp
+	{ 0.0f, 1.0f, 1.0f, 2.0f },
+	{ -1.0f, 0.0f, 0.0f, 1.0f },	// 1 to 0 ramp
+	{ 0.0f, 0.0f, 1.0f, 1.0f },
+	{ 0.0f, 1.0f, 1.0f, 2.0f },
+	{ 0.0f, 1.0f, 1.0f, 2.0f },
+	{ -1.0f, 0.0f, 0.0f, 1.0f },
+};
+static const float s_pFlexControllers[SAMPLE_FLEXES] = { 0.5f, 0.5f, 0.002f, 0.25f, 0.5f, 0.33f, 0.0005f, 0.9995f };
+
+// what the controllers ramp to, 0 for the flexes that get skipped
+static const float s_pFlexWeights[SAMPLE_FLEXES] = { 1.0f, 0.5f, 0.002f, 0.75f, 1.0f, 0.33f, 0.0f, 0.0f };
+
+static void BuildSampleFlexes( mstudiomesh_t *pMesh )
+{
+	samplemesh_t *pSample = &s_SampleMesh;
+	pSample->mesh.flexindex = (byte *)pSample->flexes - (byte *)&pSample->mesh;
+	pSample->mesh.numflexes = SAMPLE_FLEXES;
+
+	mstudiovertanim_t *pvanim = pSample->vertanims;
+	for ( int i = 0; i < SAMPLE_FLEXES; i++ )
+	{
+		mstudioflex_t *pFlex = pMesh->pFlex( i );
+		pFlex->flexdesc = i;
+		pFlex->target0 = s_pFlexTargets[i][0];
+		pFlex->target1 = s_pFlexTargets[i][1];
+		pFlex->target2 = s_pFlexTargets[i][2];
+		pFlex->target3 = s_pFlexTargets[i][3];
+		pFlex->numverts = s_pFlexVertCounts[i];
+		pFlex->vertindex = (byte *)pvanim - (byte *)pFlex;
+
+		// 7 and SAMPLE_VERTICES share no factors, so a flex never moves a vertex twice
+		int nFirst = RandomInt( 0, SAMPLE_VERTICES - 1 );
+		for ( int j = 0; j < s_pFlexVertCounts[i]; j++ )
+		{
+			pvanim[j].index = ( nFirst + j * 7 ) % SAMPLE_VERTICES;
+			pvanim[j].delta.Init( RandomFloat( -2.0f, 2.0f ), RandomFloat( -2.0f, 2.0f ), RandomFloat( -2.0f, 2.0f ) );
+			pvanim[j].ndelta.Init( RandomFloat( -0.2f, 0.2f ), RandomFloat( -0.2f, 0.2f ), RandomFloat( -0.2f, 0.2f ) );
+		}
+		pvanim += s_pFlexVertCounts[i];
+	}
+	Assert( pvanim == pSample->vertanims + SAMPLE_VERTANIMS );
+}
+
+static void StartSampleFlexes( CCachedRenderData *pCache )
+{
+	pCache->StartModel();
+	pCache->SetBodyPart( 0 );
+	pCache->SetModel( 0 );
+	pCache->SetMesh( 0 );
+}
+
+// Adds the deltas of the flexes that should be applied, at their expected weights
+static void ApplyExpectedFlexes( CCachedRenderData *pCache, mstudiomesh_t *pMesh )
+{
+	StartSampleFlexes( pCache );
+	pCache->SetupComputation( pMesh, true );
+
+	for ( int i = 0; i < SAMPLE_FLEXES; i++ )
+	{
+		if ( s_pFlexWeights[i] == 0.0f )
+			continue;
+
+		mstudioflex_t *pFlex = pMesh->pFlex( i );
+		R_StudioFlexVertDeltas( *pCache, pMesh->Vertex( 0 ), pMesh->TangentS( 0 ), pFlex->pVertanim( 0 ), pFlex->numverts,
+			s_pFlexWeights[i], false );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// The SSE path does the same multiplies and adds as the scalar one, but the
+// scalar one may keep more precision on x87, so allow a little slop
+//-----------------------------------------------------------------------------
+#define FLEX_TOLERANCE	1e-5f
+
+static void CheckFlexVerts( mstudiomesh_t *pMesh, CCachedRenderData *pExpected, bool bSSE )
+{
+	float pFlexWeights[MAXSTUDIOFLEXDESC];
+	memset( pFlexWeights, 0, sizeof( pFlexWeights ) );
+	memcpy( pFlexWeights, s_pFlexControllers, sizeof( s_pFlexControllers ) );
+
+	// Too big for the stack
+	CCachedRenderData *pCache = new CCachedRenderData;
+	StartSampleFlexes( pCache );
+	R_StudioFlexVerts( *pCache, pMesh, pFlexWeights, bSSE );
+
+	int nFlexed = 0;
+	for ( int n = 0; n < pMesh->numvertices; n++ )
+	{
+		bool bFlexed = pExpected->IsVertexFlexed( n );
+		_AssertMsg( bFlexed == pCache->IsVertexFlexed( n ), CDbgFmtMsg( "%s: vertex %d is %sflexed", 
+			bSSE ? "SSE" : "Scalar", n, bFlexed ? "not " : "" ) );
+		if ( !bFlexed || !pCache->IsVertexFlexed( n ) )
+			continue;
+
+		++nFlexed;
+		CachedVertex_t *pExpectedVert = pExpected->GetFlexVertex( n );
+		CachedVertex_t *pActual = pCache->GetFlexVertex( n );
+
+		float flError = MaxError( pActual->m_Position.Base(), pExpectedVert->m_Position.Base(), 3, 1.0f );
+		flError = max( flError, MaxError( pActual->m_Normal.Base(), pExpectedVert->m_Normal.Base(), 3, 1.0f ) );
+		flError = max( flError, MaxError( pActual->m_TangentS.Base(), pExpectedVert->m_TangentS.Base(), 3, 1.0f ) );
+
+		_AssertMsg( flError <= FLEX_TOLERANCE && pActual->m_TangentS.w == pExpectedVert->m_TangentS.w,
+			CDbgFmtMsg( "%s: flexed vertex %d is off by %f, tangent w %f vs %f", bSSE ? "SSE" : "Scalar", n, flError,
+				pActual->m_TangentS.w, pExpectedVert->m_TangentS.w ) );
+	}
+
+	// the sample flexes overlap, so fewer vertices than deltas
+	_AssertMsg( nFlexed > 0 && nFlexed <= SAMPLE_VERTANIMS, CDbgFmtMsg( "%d vertices flexed", nFlexed ) );
+
+	delete pCache;
+}
+
+DEFINE_TESTCASE( FlexVertsMatchExpected, StudioRenderTestSuite )
+{
+	Msg( "Flex verts vs expected weights...\n" );
+
+	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f );
+	RandomSeed( 1 );
+
+	mstudiomesh_t *pMesh = BuildSampleMesh();
+	BuildSampleFlexes( pMesh );
+
+	CCachedRenderData *pExpected = new CCachedRenderData;
+	ApplyExpectedFlexes( pExpected, pMesh );
+
+	CheckFlexVerts( pMesh, pExpected, false );
+	if ( MathLib_SSEEnabled() )
+	{
+		CheckFlexVerts( pMesh, pExpected, true );
+	}
+	else
+	{
+		Msg( "No SSE, skipping the SSE path\n" );
+	}
+
+	delete pExpected;
+}
@@ -0,0 +1,433 @@
+//========= Copyright  1996-2003, Valve LLC, All rights reserved. ============
+//
+// Purpose: Runs texture streaming's once-a-frame update over test textures
+//			that read real .vtf files on the streaming thread, and checks the
+//			budget, which textures get streamed out to make room, the cap on
+//			reads per frame, and that streaming a texture the other way
+//			cancels its pending read
+//
+// $NoKeywords: $
+//=============================================================================
+
+#include "unitlib/unitlib.h"
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include "interface.h"
+#include "filesystem.h"
+#include "utlbuffer.h"
+#include "convar.h"
+#include "vstdlib/strtools.h"
+#include "imageloader.h"
+#include "vtf/vtf.h"
+#include "texturestreaming.h"
+#include <string.h>
+
+
+// texturestreaming.cpp uses this; the material system normally owns it
+IFileSystem *g_pFileSystem = 0;
+
+
+DEFINE_TESTSUITE( TextureStreamingTestSuite )
+
+
+//-----------------------------------------------------------------------------
+// Test textures are 1024x1024 I8, so each one takes 1 MB at full res and 4 KB
+// at 64x64, which is what they load at
+//-----------------------------------------------------------------------------
+#define TEST_TEXTURE_SIZE			1024
+#define TEST_TEXTURE_LOWRES_SKIP	4
+#define TEST_TEXTURE_COUNT			4
+
+#define TEST_DIRECTORY				"texstreamtest"
+
+
+//-----------------------------------------------------------------------------
+// Loads the filesystem + points it at a scratch directory under the current one
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
+#define FILESYSTEM_DLL_NAME			"filesystem_stdio.dll"
+#elif _LINUX
+#define FILESYSTEM_DLL_NAME			"filesystem_i486.so"
+#endif
+
+static CSysModule *s_pFileSystemModule = NULL;
+
+static bool LoadFileSystem()
+{
+	s_pFileSystemModule = Sys_LoadModule( FILESYSTEM_DLL_NAME );
+	if ( !s_pFileSystemModule )
+		return false;
+
+	CreateInterfaceFn fileSystemFactory = Sys_GetFactory( s_pFileSystemModule );
+	if ( !fileSystemFactory )
+		return false;
+
+	g_pFileSystem = (IFileSystem *)fileSystemFactory( FILESYSTEM_INTERFACE_VERSION, NULL );
+	if ( !g_pFileSystem )
+		return false;
+
+	if ( g_pFileSystem->Init() != INIT_OK )
+	{
+		g_pFileSystem = NULL;
+		return false;
+	}
+
+	char pPath[1024];
+	g_pFileSystem->GetCurrentDirectory( pPath, sizeof( pPath ) );
+	Q_strncat( pPath, "/" TEST_DIRECTORY, sizeof( pPath ) );
+
+	g_pFileSystem->RemoveAllSearchPaths();
+	g_pFileSystem->AddSearchPath( pPath, "GAME" );
+	g_pFileSystem->CreateDirHierarchy( "materials", "GAME" );
+	return true;
+}
+
+static void UnloadFileSystem()
+{
+	if ( g_pFileSystem )
+	{
+		g_pFileSystem->Shutdown();
+		g_pFileSystem = NULL;
+	}
+
+	if ( s_pFileSystemModule )
+	{
+		Sys_UnloadModule( s_pFileSystemModule );
+		s_pFileSystemModule = NULL;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Writes a test .vtf; every mip is filled with its mip level, so a read of
+// the wrong mip range shows up
+//-----------------------------------------------------------------------------
+static void GetTestTextureFileName( int i, char *pFileName, int nMaxLen )
+{
+	Q_snprintf( pFileName, nMaxLen, "materials/texstreamtest%d.vtf", i );
+}
+
+static bool WriteTestTexture( char const *pFileName )
+{
+	IVTFTexture *pVTFTexture = CreateVTFTexture();
+	if ( !pVTFTexture->Init( TEST_TEXTURE_SIZE, TEST_TEXTURE_SIZE, IMAGE_FORMAT_I8, 0, 1 ) )
+	{
+		DestroyVTFTexture( pVTFTexture );
+		return false;
+	}
+
+	for ( int iMip = 0; iMip < pVTFTexture->MipCount(); ++iMip )
+	{
+		memset( pVTFTexture->ImageData( 0, 0, iMip ), iMip, pVTFTexture->ComputeMipSize( iMip ) );
+	}
+
+	CUtlBuffer buf;
+	bool bOk = pVTFTexture->Serialize( buf );
+	DestroyVTFTexture( pVTFTexture );
+	if ( !bOk )
+		return false;
+
+	FileHandle_t f = g_pFileSystem->Open( pFileName, "wb" );
+	if ( !f )
+		return false;
+
+	bOk = ( g_pFileSystem->Write( buf.Base(), buf.TellPut(), f ) == buf.TellPut() );
+	g_pFileSystem->Close( f );
+	return bOk;
+}
+
+
+//-----------------------------------------------------------------------------
+// Streams the same way CTexture does, minus the uploads
+//-----------------------------------------------------------------------------
+class CTestStreamedTexture : public IStreamedTexture
+{
+public:
+	CTestStreamedTexture();
+	~CTestStreamedTexture();
+
+	void Init( int i );
+
+	// IStreamedTexture
+	virtual bool IsStreamed() const { return true; }
+	virtual int GetLastBindFrame() const { return m_nLastBindFrame; }
+	virtual int GetStreamedMemory( bool bFullRes ) const;
+	virtual bool IsStreamedFullRes() const;
+	virtual void QueueStream( bool bFullRes );
+	virtual bool UpdateStream();
+
+	void FreeStream();
+
+	char m_pFileName[256];
+	int m_nLastBindFrame;
+	int m_nMipSkipCount;
+	TextureStreamHandle_t m_hStreamJob;
+
+	// Reads that came back with the wrong mips or not at all
+	int m_nBadReads;
+};
+
+CTestStreamedTexture::CTestStreamedTexture()
+{
+	m_pFileName[0] = 0;
+	m_nLastBindFrame = -1;
+	m_nMipSkipCount = TEST_TEXTURE_LOWRES_SKIP;
+	m_hStreamJob = TEXTURE_STREAM_INVALID_HANDLE;
+	m_nBadReads = 0;
+}
+
+CTestStreamedTexture::~CTestStreamedTexture()
+{
+	FreeStream();
+}
+
+void CTestStreamedTexture::Init( int i )
+{
+	GetTestTextureFileName( i, m_pFileName, sizeof( m_pFileName ) );
+}
+
+int CTestStreamedTexture::GetStreamedMemory( bool bFullRes ) const
+{
+	int nSize = TEST_TEXTURE_SIZE >> ( bFullRes ? 0 : TEST_TEXTURE_LOWRES_SKIP );
+	return nSize * nSize;
+}
+
+bool CTestStreamedTexture::IsStreamedFullRes() const
+{
+	if ( m_hStreamJob != TEXTURE_STREAM_INVALID_HANDLE )
+		return TextureStreaming_GetMipSkipCount( m_hStreamJob ) == 0;
+
+	return m_nMipSkipCount == 0;
+}
+
+void CTestStreamedTexture::QueueStream( bool bFullRes )
+{
+	FreeStream();
+
+	int nMipSkipCount = bFullRes ? 0 : TEST_TEXTURE_LOWRES_SKIP;
+	if ( nMipSkipCount == m_nMipSkipCount )
+		return;
+
+	m_hStreamJob = TextureStreaming_Read( m_pFileName, nMipSkipCount, m_nLastBindFrame );
+}
+
+bool CTestStreamedTexture::UpdateStream()
+{
+	if ( m_hStreamJob == TEXTURE_STREAM_INVALID_HANDLE )
+		return false;
+
+	if ( !TextureStreaming_IsDone( m_hStreamJob ) )
+	{
+		TextureStreaming_SetPriority( m_hStreamJob, m_nLastBindFrame );
+		return false;
+	}
+
+	IVTFTexture *pVTFTexture = TextureStreaming_GetTexture( m_hStreamJob );
+	int nMipSkipCount = TextureStreaming_GetMipSkipCount( m_hStreamJob );
+	if ( pVTFTexture && ( pVTFTexture->Width() == ( TEST_TEXTURE_SIZE >> nMipSkipCount ) ) &&
+		 ( pVTFTexture->ImageData( 0, 0, 0 )[0] == nMipSkipCount ) )
+	{
+		m_nMipSkipCount = nMipSkipCount;
+	}
+	else
+	{
+		++m_nBadReads;
+	}
+
+	FreeStream();
+	return true;
+}
+
+void CTestStreamedTexture::FreeStream()
+{
+	if ( m_hStreamJob != TEXTURE_STREAM_INVALID_HANDLE )
+	{
+		TextureStreaming_Free( m_hStreamJob );
+		m_hStreamJob = TEXTURE_STREAM_INVALID_HANDLE;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+static CTestStreamedTexture s_Textures[TEST_TEXTURE_COUNT];
+static IStreamedTexture *s_pTextures[TEST_TEXTURE_COUNT];
+
+static void SetConVar( char const *pName, int nValue )
+{
+	ConVar *pVar = (ConVar *)ConCommandBase::FindCommand( pName );
+	_AssertMsg( pVar && !pVar->IsCommand(), CDbgFmtMsg( "No convar %s", pName ) );
+	if ( pVar && !pVar->IsCommand() )
+	{
+		pVar->SetValue( nValue );
+	}
+}
+
+static int CountPendingReads()
+{
+	int nPending = 0;
+	for ( int i = 0; i < TEST_TEXTURE_COUNT; ++i )
+	{
+		if ( s_Textures[i].m_hStreamJob != TEXTURE_STREAM_INVALID_HANDLE )
+		{
+			++nPending;
+		}
+	}
+	return nPending;
+}
+
+// Runs frames until nothing is pending after an update
+static void RunUntilIdle( char const *pWhen )
+{
+	for ( int nFrame = 0; nFrame < 2000; ++nFrame )
+	{
+		TextureStreaming_Update( s_pTextures, TEST_TEXTURE_COUNT );
+		if ( CountPendingReads() == 0 )
+			return;
+
+		Plat_Sleep( 1 );
+	}
+
+	_AssertMsg( false, CDbgFmtMsg( "%s: streaming never finished", pWhen ) );
+}
+
+// Waits for every pending read to finish without running a frame
+static void WaitForReads( char const *pWhen )
+{
+	for ( int nWait = 0; nWait < 2000; ++nWait )
+	{
+		bool bDone = true;
+		for ( int i = 0; i < TEST_TEXTURE_COUNT; ++i )
+		{
+			TextureStreamHandle_t hJob = s_Textures[i].m_hStreamJob;
+			if ( ( hJob != TEXTURE_STREAM_INVALID_HANDLE ) && !TextureStreaming_IsDone( hJob ) )
+			{
+				bDone = false;
+			}
+		}
+		if ( bDone )
+			return;
+
+		Plat_Sleep( 1 );
+	}
+
+	_AssertMsg( false, CDbgFmtMsg( "%s: reads never finished", pWhen ) );
+}
+
+// Checks which textures are at full res; pFullRes has a 1 for each one that should be
+static void CheckFullRes( char const *pWhen, int const *pFullRes )
+{
+	int nMemory = 0;
+	for ( int i = 0; i < TEST_TEXTURE_COUNT; ++i )
+	{
+		CTestStreamedTexture &texture = s_Textures[i];
+		int nExpectedSkip = pFullRes[i] ? 0 : TEST_TEXTURE_LOWRES_SKIP;
+		_AssertMsg( texture.m_nMipSkipCount == nExpectedSkip,
+			CDbgFmtMsg( "%s: texture %d has mip skip %d, expected %d", pWhen, i, texture.m_nMipSkipCount, nExpectedSkip ) );
+		_AssertMsg( texture.m_nBadReads == 0, CDbgFmtMsg( "%s: texture %d had %d bad reads", pWhen, i, texture.m_nBadReads ) );
+		nMemory += texture.GetStreamedMemory( texture.m_nMipSkipCount == 0 );
+	}
+
+	_AssertMsg( nMemory <= TextureStreaming_Budget(),
+		CDbgFmtMsg( "%s: %d bytes is over the %d byte budget", pWhen, nMemory, TextureStreaming_Budget() ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// The test
+//-----------------------------------------------------------------------------
+DEFINE_TESTCASE( TextureStreamingBudgetEvictCancel, TextureStreamingTestSuite )
+{
+	Msg( "Texture streaming budget, eviction and cancelling...\n" );
+
+	if ( !LoadFileSystem() )
+	{
+		_AssertMsg( false, "Unable to load " FILESYSTEM_DLL_NAME );
+		UnloadFileSystem();
+		return;
+	}
+
+	int i;
+	for ( i = 0; i < TEST_TEXTURE_COUNT; ++i )
+	{
+		char pFileName[256];
+		GetTestTextureFileName( i, pFileName, sizeof( pFileName ) );
+		_AssertMsg( WriteTestTexture( pFileName ), CDbgFmtMsg( "Unable to write %s", pFileName ) );
+
+		s_Textures[i].Init( i );
+		s_Textures[i].m_nLastBindFrame = TEST_TEXTURE_COUNT - i;
+		s_pTextures[i] = &s_Textures[i];
+	}
+
+	// Room for two textures at full res + the rest at low res
+	SetConVar( "mat_texturestream_budget", 3 );
+	SetConVar( "mat_texturestream_uploads", 8 );
+
+	// Only one read gets queued per frame, and it's the most recently used texture
+	SetConVar( "mat_texturestream_reads", 1 );
+	TextureStreaming_Update( s_pTextures, TEST_TEXTURE_COUNT );
+	_AssertMsg( ( CountPendingReads() == 1 ) && ( s_Textures[0].m_hStreamJob != TEXTURE_STREAM_INVALID_HANDLE ),
+		CDbgFmtMsg( "With one read a frame: %d reads were queued", CountPendingReads() ) );
+	SetConVar( "mat_texturestream_reads", 4 );
+
+	// The two most recently used textures fit
+	RunUntilIdle( "Budget" );
+	static int s_pBudgetFullRes[TEST_TEXTURE_COUNT] = { 1, 1, 0, 0 };
+	CheckFullRes( "Budget", s_pBudgetFullRes );
+
+	// Using the other two streams out the ones that are older now
+	s_Textures[2].m_nLastBindFrame = 10;
+	s_Textures[3].m_nLastBindFrame = 9;
+	RunUntilIdle( "Eviction" );
+	static int s_pEvictFullRes[TEST_TEXTURE_COUNT] = { 0, 0, 1, 1 };
+	CheckFullRes( "Eviction", s_pEvictFullRes );
+
+	// Using 0 + 1 again queues them in and 2 + 3 out. Let all four reads
+	// finish, but only upload one a frame, so 0 gets uploaded + 1 doesn't.
+	s_Textures[0].m_nLastBindFrame = 20;
+	s_Textures[1].m_nLastBindFrame = 19;
+	TextureStreaming_Update( s_pTextures, TEST_TEXTURE_COUNT );
+	_AssertMsg( CountPendingReads() == 4, CDbgFmtMsg( "Swapping: %d reads were queued, expected 4", CountPendingReads() ) );
+	WaitForReads( "Swapping" );
+
+	// Now 2 + 3 are the most recently used again. Streaming 1 back out and
+	// 2 + 3 back in has to drop the reads they have pending, not upload them.
+	SetConVar( "mat_texturestream_uploads", 1 );
+	s_Textures[1].m_nLastBindFrame = 1;
+	s_Textures[2].m_nLastBindFrame = 30;
+	s_Textures[3].m_nLastBindFrame = 29;
+	TextureStreaming_Update( s_pTextures, TEST_TEXTURE_COUNT );
+	_AssertMsg( s_Textures[0].m_nMipSkipCount == 0, "Cancelling: texture 0 wasn't uploaded" );
+	for ( i = 1; i < TEST_TEXTURE_COUNT; ++i )
+	{
+		CTestStreamedTexture &texture = s_Textures[i];
+		int nExpectedSkip = ( i == 1 ) ? TEST_TEXTURE_LOWRES_SKIP : 0;
+		_AssertMsg( ( texture.m_hStreamJob == TEXTURE_STREAM_INVALID_HANDLE ) && ( texture.m_nMipSkipCount == nExpectedSkip ),
+			CDbgFmtMsg( "Cancelling: texture %d has mip skip %d and %s read pending", i,
+			texture.m_nMipSkipCount, ( texture.m_hStreamJob != TEXTURE_STREAM_INVALID_HANDLE ) ? "a" : "no" ) );
+	}
+	SetConVar( "mat_texturestream_uploads", 8 );
+
+	// And texture 0 goes back out to make room
+	RunUntilIdle( "Cancelling" );
+	CheckFullRes( "Cancelling", s_pEvictFullRes );
+
+	// Lowering the budget streams textures out
+	SetConVar( "mat_texturestream_budget", 1 );
+	RunUntilIdle( "Lowered budget" );
+	static int s_pLoweredFullRes[TEST_TEXTURE_COUNT] = { 0, 0, 0, 0 };
+	CheckFullRes( "Lowered budget", s_pLoweredFullRes );
+
+	for ( i = 0; i < TEST_TEXTURE_COUNT; ++i )
+	{
+		s_Textures[i].FreeStream();
+
+		char pFileName[256];
+		GetTestTextureFileName( i, pFileName, sizeof( pFileName ) );
+		g_pFileSystem->RemoveFile( pFileName, "GAME" );
+	}
+
+	TextureStreaming_Shutdown();
+	UnloadFileSystem();
+}
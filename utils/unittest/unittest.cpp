@@ -8,39 +8,44 @@
 #include "unitlib/unitlib.h"
 #include "tier0/dbg.h"
 #include <stdio.h>
+#ifdef _WIN32
 #include <windows.h>
+#elif _LINUX
+#include <dlfcn.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#endif
 
 #pragma warning (disable:4100)
 
+// Failed asserts so far; a test fails if it adds to this
+static int s_nAssertCount = 0;
+
 SpewRetval_t UnitTestSpew( SpewType_t type, char const *pMsg )
 {
 	printf( "%s", pMsg );
+#ifdef _WIN32
 	OutputDebugString( pMsg );
+#endif
+
+	if ( type == SPEW_ASSERT )
+	{
+		// the assert macros don't end their messages with a newline
+		printf( "\n" );
+		++s_nAssertCount;
+	}
 	return SPEW_CONTINUE;
 }
 
 
-/*
-============
-main
-============
-*/
-int main (int argc, char **argv)
-{
-	printf( "Valve Software - unittest.exe (%s)\n", __DATE__ );
-
-	// Install a special Spew handler that ignores all assertions and lets us
-	// run for as long as possible
-	SpewOutputFunc( UnitTestSpew );
-
-	// Very simple... just iterate over all .DLLs in the current directory and call
-	// LoadLibrary on them; check to see if they added any test cases. If
-	// they didn't then unload them just as quick.
-
-	// We may want to make this more sophisticated, giving it a search path,
-	// or giving test DLLs special extensions, or statically linking the test DLLs
-	// to this program.
+//-----------------------------------------------------------------------------
+// Loads the test DLLs in the current directory; check to see if they added
+// any test cases. If they didn't then unload them just as quick.
+//-----------------------------------------------------------------------------
+#ifdef _WIN32
 
+static int LoadTestDLLs()
+{
 	WIN32_FIND_DATA findFileData;
 	HANDLE hFind= FindFirstFile("*.dll", &findFileData);
 
@@ -59,13 +64,96 @@ int main (int argc, char **argv)
 			break;
 	}
 
+	return testCount;
+}
+
+#elif _LINUX
+
+// Only the test .so's, loading the engine ones would start them up
+static int LoadTestDLLs()
+{
+	DIR *pDir = opendir( "." );
+
+	int testCount = 0;
+	while ( pDir )
+	{
+		struct dirent *pEntry = readdir( pDir );
+		if ( !pEntry )
+			break;
+
+		if ( fnmatch( "*test_*.so", pEntry->d_name, 0 ) != 0 )
+			continue;
+
+		char pPath[1024];
+		_snprintf( pPath, sizeof( pPath ), "./%s", pEntry->d_name );
+		void *hLib = dlopen( pPath, RTLD_NOW );
+		if ( !hLib )
+		{
+			printf( "Unable to load %s: %s\n", pEntry->d_name, dlerror() );
+			++s_nAssertCount;
+			continue;
+		}
+
+		int newTestCount = UnitTestCount();
+		if (newTestCount == testCount)
+		{
+			dlclose( hLib );
+		}
+		testCount = newTestCount;
+	}
+
+	if ( pDir )
+	{
+		closedir( pDir );
+	}
+
+	return testCount;
+}
+
+#endif
+
+
+/*
+============
+main
+============
+*/
+int main (int argc, char **argv)
+{
+	printf( "Valve Software - unittest.exe (%s)\n", __DATE__ );
+
+	// Install a special Spew handler that ignores all assertions and lets us
+	// run for as long as possible
+	SpewOutputFunc( UnitTestSpew );
+
+	// Very simple... just iterate over all .DLLs in the current directory and
+	// load them.
+
+	// We may want to make this more sophisticated, giving it a search path,
+	// or giving test DLLs special extensions, or statically linking the test DLLs
+	// to this program.
+	int nLoadFailures = s_nAssertCount;
+	int testCount = LoadTestDLLs();
+	nLoadFailures = s_nAssertCount - nLoadFailures;
+
+	int nFailedTests = 0;
 	for ( int i = 0; i < testCount; ++i )
 	{
 		ITestCase* pTestCase = GetUnitTest(i);
 		printf("Starting test %s....\n", pTestCase->GetName() );
+
+		int nAssertCount = s_nAssertCount;
 		pTestCase->RunTest();
+		if ( s_nAssertCount != nAssertCount )
+		{
+			printf( "Test %s FAILED\n", pTestCase->GetName() );
+			++nFailedTests;
+		}
 	}
 
-	return 0;
+	printf( "%d of %d tests failed\n", nFailedTests, testCount );
+
+	// Non-zero if anything failed, so build scripts can check it
+	return nFailedTests + nLoadFailures;
 }
 
@@ -131,9 +131,11 @@ static const char *FindDependentMaterial( const char *pMaterialName, const char
 	return NULL;
 }
 
-static bool LoadSrcVTFFiles( IVTFTexture *pSrcVTFTextures[6], const char *pSkyboxBaseName )
+// Only the mips down from nMinSize get read in
+static bool LoadSrcVTFFiles( IVTFTexture *pSrcVTFTextures[6], const char *pSkyboxBaseName, int nMinSize )
 {
 	const char *facingName[6] = { "rt", "lf", "bk", "ft", "up", "dn" };
+	int nSkipMipLevels = 0;
 	int i;
 	for( i = 0; i < 6; i++ )
 	{
@@ -152,17 +154,43 @@ static bool LoadSrcVTFFiles( IVTFTexture *pSrcVTFTextures[6], const char *pSkybo
 				return false;
 			}
 		}
-		fseek( fp, 0, SEEK_END );
-		int srcVTFLength = ftell( fp );
-		fseek( fp, 0, SEEK_SET );
 
+		// Read the header first so we know which mips we need
+		int nHeaderSize = VTFFileHeaderSize();
 		CUtlBuffer buf;
-		buf.EnsureCapacity( srcVTFLength );
-		fread( buf.Base(), 1, srcVTFLength, fp );
-		fclose( fp );
+		buf.EnsureCapacity( nHeaderSize );
+		fread( buf.Base(), 1, nHeaderSize, fp );
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nHeaderSize );
 
 		pSrcVTFTextures[i] = CreateVTFTexture();
-		if (!pSrcVTFTextures[i]->Unserialize(buf))
+		if (!pSrcVTFTextures[i]->Unserialize( buf, true ))
+		{
+			fclose( fp );
+			Warning("*** Error unserializing skybox texture: %s\n", pSkyboxBaseName );
+			return false;
+		}
+
+		// Every face skips as many mips as the first one, so faces of
+		// different sizes still fail the size check below
+		if( i == 0 )
+		{
+			while( ( pSrcVTFTextures[0]->Width() >> ( nSkipMipLevels + 1 ) ) >= nMinSize )
+			{
+				++nSkipMipLevels;
+			}
+		}
+
+		int nImageOffset, nImageSize;
+		pSrcVTFTextures[i]->MipRangeFileInfo( nSkipMipLevels, &nImageOffset, &nImageSize );
+
+		buf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+		buf.EnsureCapacity( nImageSize );
+		fseek( fp, nImageOffset, SEEK_SET );
+		fread( buf.Base(), 1, nImageSize, fp );
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nImageSize );
+		fclose( fp );
+
+		if (!pSrcVTFTextures[i]->UnserializeMipRange( buf, nSkipMipLevels ))
 		{
 			Warning("*** Error unserializing skybox texture: %s\n", pSkyboxBaseName );
 			return false;
@@ -198,7 +226,7 @@ void Cubemap_CreateDefaultCubemaps( void )
 		return;
 	}
 
-	if( !LoadSrcVTFFiles( pSrcVTFTextures, pSkyboxBaseName ) )
+	if( !LoadSrcVTFFiles( pSrcVTFTextures, pSkyboxBaseName, DEFAULT_CUBEMAP_SIZE ) )
 	{
 		Warning( "Can't load skybox file %s to build the default cubemap!\n", pSkyboxBaseName );
 		return;
@@ -23,7 +23,7 @@ SpewRetval_t VTF2TGAOutputFunc( SpewType_t spewType, char const *pMsg )
 
 static void Usage( void )
 {
-	Error( "Usage: vtf2tga blah.vtf blah.tga\n" );
+	Error( "Usage: vtf2tga blah.vtf blah.tga [mip level]\n" );
 	exit( -1 );
 }
 
@@ -31,12 +31,17 @@ int main( int argc, char **argv )
 {
 	SpewOutputFunc( VTF2TGAOutputFunc );
 	MathLib_Init( 2.2f, 2.2f, 0.0f, 1.0f, false, false, false, false );
-	if( argc != 3 )
+	if( argc != 3 && argc != 4 )
 	{
 		Usage();
 	}
 	const char *pVTFFileName = argv[1];
 	const char *pTGAFileName = argv[2];
+	int nSkipMipLevels = ( argc == 4 ) ? atoi( argv[3] ) : 0;
+	if( nSkipMipLevels < 0 )
+	{
+		Usage();
+	}
 
 	FILE *vtfFp = fopen( pVTFFileName, "rb" );
 	if( !vtfFp )
@@ -50,15 +55,55 @@ int main( int argc, char **argv )
 	fseek( vtfFp, 0, SEEK_SET );
 
 	CUtlBuffer buf;
-	buf.EnsureCapacity( srcVTFLength );
-	fread( buf.Base(), 1, srcVTFLength, vtfFp );
-	fclose( vtfFp );
-
 	IVTFTexture *pTex = CreateVTFTexture();
-	if (!pTex->Unserialize( buf ))
+	if( nSkipMipLevels == 0 )
 	{
-		Error( "*** Error reading in .VTF file %s\n", pVTFFileName );
-		exit(-1);
+		buf.EnsureCapacity( srcVTFLength );
+		fread( buf.Base(), 1, srcVTFLength, vtfFp );
+		fclose( vtfFp );
+
+		if (!pTex->Unserialize( buf ))
+		{
+			Error( "*** Error reading in .VTF file %s\n", pVTFFileName );
+			exit(-1);
+		}
+	}
+	else
+	{
+		// Read just the header + the mip levels we're writing out
+		int nHeaderSize = VTFFileHeaderSize();
+		buf.EnsureCapacity( nHeaderSize );
+		fread( buf.Base(), 1, nHeaderSize, vtfFp );
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nHeaderSize );
+
+		if (!pTex->Unserialize( buf, true ))
+		{
+			Error( "*** Error reading in .VTF file %s\n", pVTFFileName );
+			exit(-1);
+		}
+
+		int nImageOffset, nImageSize;
+		pTex->MipRangeFileInfo( nSkipMipLevels, &nImageOffset, &nImageSize );
+		if( nImageOffset + nImageSize > srcVTFLength )
+		{
+			Error( "*** .VTF file %s is truncated\n", pVTFFileName );
+			exit(-1);
+		}
+
+		buf.SeekGet( CUtlBuffer::SEEK_HEAD, 0 );
+		buf.EnsureCapacity( nImageSize );
+		fseek( vtfFp, nImageOffset, SEEK_SET );
+		fread( buf.Base(), 1, nImageSize, vtfFp );
+		buf.SeekPut( CUtlBuffer::SEEK_HEAD, nImageSize );
+		fclose( vtfFp );
+
+		if (!pTex->UnserializeMipRange( buf, nSkipMipLevels ))
+		{
+			Error( "*** Error reading in .VTF file %s\n", pVTFFileName );
+			exit(-1);
+		}
+
+		Msg( "read %d of %d bytes for mip level %d\n", nHeaderSize + nImageSize, srcVTFLength, nSkipMipLevels );
 	}
 	
 	Msg( "vtf width: %d\n", pTex->Width() );
@@ -92,10 +92,12 @@ public:
 	virtual void LowResFileInfo( int *pStartLocation, int *pSizeInBytes ) const;
 	virtual void ImageFileInfo( int nFrame, int nFace, int nMip, int *pStartLocation, int *pSizeInBytes) const;
 	virtual int FileSize( int nMipSkipCount = 0 ) const;
+	virtual void MipRangeFileInfo( int nSkipMipLevels, int *pStartLocation, int *pSizeInBytes ) const;
 
 	// When unserializing, we can skip a certain number of mip levels,
 	// and we also can just load everything but the image data
-	virtual bool Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly = false, int nSkipMipLevels = 0 );
+	virtual bool Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly = false, int nSkipMipLevels = 0, bool bQuiet = false );
+	virtual bool UnserializeMipRange( CUtlBuffer &buf, int nSkipMipLevels, bool bQuiet = false );
 	virtual bool Serialize( CUtlBuffer &buf );
 
 	// Attributes...
@@ -186,11 +188,15 @@ private:
 	// Compute the mip count based on the size + flags
 	int ComputeMipCount( ) const;
 
+	// Number of faces + mip levels stored in the file; older files have fewer
+	int FileFaceCount( ) const;
+	int FileMipCount( ) const;
+
 	// Unserialization of low-res data
 	bool LoadLowResData( CUtlBuffer &buf );
 
 	// Unserialization of image data
-	bool LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header, int nSkipMipLevels );
+	bool LoadImageData( CUtlBuffer &buf, int nSkipMipLevels, bool bQuiet );
 
 	// Shutdown
 	void Shutdown();
@@ -243,6 +249,7 @@ private:
 	// FIXME: Remove
 	// This is to make sure old-format .vtf files are read properly
 	int	m_pVersion[2];
+	int m_nFileMipCount;
 };
 
 
@@ -299,6 +306,10 @@ CVTFTexture::CVTFTexture()
 	m_nLowResImageHeight = 0;
 	m_pLowResImageData = NULL;
 	m_nLowResImageAllocSize = 0;
+
+	m_pVersion[0] = VTF_MAJOR_VERSION;
+	m_pVersion[1] = VTF_MINOR_VERSION;
+	m_nFileMipCount = 0;
 }
 
 CVTFTexture::~CVTFTexture()
@@ -317,6 +328,26 @@ int CVTFTexture::ComputeMipCount( ) const
 }
 
 
+//-----------------------------------------------------------------------------
+// Number of faces + mip levels stored in the file
+//-----------------------------------------------------------------------------
+int CVTFTexture::FileFaceCount( ) const
+{
+	// For backwards compatibility, we don't read in the spheremap fallback on
+	// older format .VTF files...
+	if (IsCubeMap() && (m_pVersion[0] == 7) && (m_pVersion[1] < 1))
+		return 6;
+
+	return m_nFaceCount;
+}
+
+int CVTFTexture::FileMipCount( ) const
+{
+	// NOTE: Older format .VTF files may be missing the smallest mip levels
+	return min( m_nFileMipCount, m_nMipCount );
+}
+
+
 //-----------------------------------------------------------------------------
 // Returns true if it's a power of two
 //-----------------------------------------------------------------------------
@@ -391,6 +422,11 @@ bool CVTFTexture::Init( int nWidth, int nHeight, ImageFormat fmt, int iFlags, in
 	m_nMipCount = ComputeMipCount();
 	m_nFrameCount = iFrameCount;
 	m_nFaceCount = (iFlags & TEXTUREFLAGS_ENVMAP) ? CUBEMAP_FACE_COUNT : 1;
+
+	// This is what we'd write out
+	m_pVersion[0] = VTF_MAJOR_VERSION;
+	m_pVersion[1] = VTF_MINOR_VERSION;
+	m_nFileMipCount = m_nMipCount;
 	
 	// Need to do this because Shutdown deallocated the low-res image
 	m_nLowResImageWidth = m_nLowResImageHeight = 0;
@@ -484,11 +520,11 @@ void CVTFTexture::ImageFileInfo( int nFrame, int nFace, int nMipLevel, int *pSta
 	nOffset += iLowResSize;
 
 	// get to the right miplevel
-	for( i = m_nMipCount - 1; i > nMipLevel; --i )
+	for( i = FileMipCount() - 1; i > nMipLevel; --i )
 	{
 		ComputeMipLevelDimensions( i, &iMipWidth, &iMipHeight );
 		int iMipLevelSize = ImageLoader::GetMemRequired( iMipWidth, iMipHeight, m_Format, false );
-		nOffset += iMipLevelSize * m_nFrameCount * m_nFaceCount;
+		nOffset += iMipLevelSize * m_nFrameCount * FileFaceCount();
 	}
 
 	// get to the right frame
@@ -519,16 +555,31 @@ void CVTFTexture::ImageFileInfo( int nFrame, int nFace, int nMipLevel, int *pSta
 }
 
 int CVTFTexture::FileSize( int nMipSkipCount ) const
+{
+	int nOffset, nImageSize;
+	MipRangeFileInfo( nMipSkipCount, &nOffset, &nImageSize );
+	return nOffset + nImageSize;
+}
+
+//-----------------------------------------------------------------------------
+// Where the image data for all mip levels from nSkipMipLevels down is.
+// The smallest mips are stored first, so it's one block right after the
+// low-res image.
+//-----------------------------------------------------------------------------
+void CVTFTexture::MipRangeFileInfo( int nSkipMipLevels, int *pStartLocation, int *pSizeInBytes ) const
 {
 	// The image data starts after the low-res image
 	int nLowResSize;
-	int nOffset;
-	LowResFileInfo( &nOffset, &nLowResSize );
-	nOffset += nLowResSize;
+	LowResFileInfo( pStartLocation, &nLowResSize );
+	*pStartLocation += nLowResSize;
 
-	int nFaceSize = ComputeFaceSize( nMipSkipCount );
-	int nImageSize = nFaceSize * m_nFaceCount * m_nFrameCount;
-	return nOffset + nImageSize;
+	int nFileMipCount = FileMipCount();
+	int nFaceSize = 0;
+	for ( int iMip = nSkipMipLevels; iMip < nFileMipCount; ++iMip )
+	{
+		nFaceSize += ComputeMipSize( iMip );
+	}
+	*pSizeInBytes = nFaceSize * FileFaceCount() * m_nFrameCount;
 }
 
 
@@ -550,21 +601,25 @@ bool CVTFTexture::LoadLowResData( CUtlBuffer &buf )
 //-----------------------------------------------------------------------------
 // Unserialization of image data
 //-----------------------------------------------------------------------------
-bool CVTFTexture::LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header, int nSkipMipLevels )
+bool CVTFTexture::LoadImageData( CUtlBuffer &buf, int nSkipMipLevels, bool bQuiet )
 {
 	// Fix up the mip count + size based on how many mip levels we skip...
 	if (nSkipMipLevels > 0)
 	{
 		Assert( m_nMipCount > nSkipMipLevels );
-		if (header.numMipLevels < nSkipMipLevels)
+		if (m_nFileMipCount < nSkipMipLevels)
 		{
 			// NOTE: This can only happen with older format .vtf files
-			Warning("Warning! Encountered old format VTF file; please rebuild it!\n");
+			if (!bQuiet)
+			{
+				Warning("Warning! Encountered old format VTF file; please rebuild it!\n");
+			}
 			return false;
 		}
 
 		ComputeMipLevelDimensions( nSkipMipLevels, &m_nWidth, &m_nHeight );
 		m_nMipCount -= nSkipMipLevels;
+		m_nFileMipCount -= nSkipMipLevels;
 	}
 
 	// read the texture image (including mipmaps if they are there and needed.)
@@ -573,12 +628,7 @@ bool CVTFTexture::LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header,
 
 	// For backwards compatibility, we don't read in the spheremap fallback on
 	// older format .VTF files...
-	int nFacesToRead = m_nFaceCount;
-	if (IsCubeMap())
-	{
-		if ((header.version[0] == 7) && (header.version[1] < 1))
-			nFacesToRead = 6;
-	}
+	int nFacesToRead = FileFaceCount();
 
 	// NOTE: We load the bits this way because we store the bits in memory
 	// differently that the way they are stored on disk; we store on disk
@@ -588,7 +638,7 @@ bool CVTFTexture::LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header,
 	for (int iMip = m_nMipCount; --iMip >= 0; )
 	{
 		// NOTE: This is for older versions...
-		if (header.numMipLevels - nSkipMipLevels <= iMip)
+		if (m_nFileMipCount <= iMip)
 			continue;
 
 		int iMipSize = ComputeMipSize( iMip );
@@ -610,10 +660,12 @@ bool CVTFTexture::LoadImageData( CUtlBuffer &buf, const VTFFileHeader_t &header,
 //-----------------------------------------------------------------------------
 // Unserialization
 //-----------------------------------------------------------------------------
-bool CVTFTexture::Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly, int nSkipMipLevels )
+bool CVTFTexture::Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly, int nSkipMipLevels, bool bQuiet )
 {
 	// When unserializing, we can skip a certain number of mip levels,
 	// and we also can just load everything but the image data
+	// NOTE: bQuiet leaves reporting errors to the caller, since Warning
+	// can't be called off the main thread
 
 	VTFFileHeader_t header;
 	memset( &header, 0, sizeof(VTFFileHeader_t) );
@@ -621,30 +673,45 @@ bool CVTFTexture::Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly, int nSki
 	buf.Get( &header, sizeof(VTFFileHeader_t) );
 	if (!buf.IsValid())
 	{
-		Warning("*** Error unserializing VTF file... is the file empty?\n");
+		if (!bQuiet)
+		{
+			Warning("*** Error unserializing VTF file... is the file empty?\n");
+		}
 		return false;
 	}
 
 	// Validity check
 	if ( Q_strncmp( header.fileTypeString, "VTF", 4 ) )
 	{
-		Warning("*** Tried to load a non-VTF file as a VTF file!\n");
+		if (!bQuiet)
+		{
+			Warning("*** Tried to load a non-VTF file as a VTF file!\n");
+		}
 		return false;
 	}
 
 	if( header.version[0] != VTF_MAJOR_VERSION )
 	{
-		Warning("*** Encountered VTF file with an invalid version!\n");
+		if (!bQuiet)
+		{
+			Warning("*** Encountered VTF file with an invalid version!\n");
+		}
 		return false;
 	}
 	if( (header.flags & TEXTUREFLAGS_ENVMAP) && (header.width != header.height) )
 	{
-		Warning("*** Encountered VTF non-square cubemap!\n");
+		if (!bQuiet)
+		{
+			Warning("*** Encountered VTF non-square cubemap!\n");
+		}
 		return false;
 	}
 	if( header.width <= 0 || header.height <= 0 )
 	{
-		Warning( "*** Encountered VTF invalid texture size!\n" );
+		if (!bQuiet)
+		{
+			Warning( "*** Encountered VTF invalid texture size!\n" );
+		}
 		return false;
 	}
 
@@ -671,6 +738,7 @@ bool CVTFTexture::Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly, int nSki
 	// This is to make sure old-format .vtf files are read properly
 	m_pVersion[0] = header.version[0];
 	m_pVersion[1] = header.version[1];
+	m_nFileMipCount = header.numMipLevels;
 
 	if( header.lowResImageWidth == 0 || header.lowResImageHeight == 0 )
 	{
@@ -691,13 +759,36 @@ bool CVTFTexture::Unserialize( CUtlBuffer &buf, bool bBufferHeaderOnly, int nSki
 	if (!LoadLowResData( buf ))
 		return false;
 
-	if (!LoadImageData( buf, header, nSkipMipLevels ))
+	if (!LoadImageData( buf, nSkipMipLevels, bQuiet ))
 		return false;
 
 	return true;
 }
 
 
+//-----------------------------------------------------------------------------
+// Unserializes just the image data, skipping the largest mip levels and the
+// low-res image. Call Unserialize with bBufferHeaderOnly first, then put the
+// part of the file MipRangeFileInfo points at into buf.
+//-----------------------------------------------------------------------------
+bool CVTFTexture::UnserializeMipRange( CUtlBuffer &buf, int nSkipMipLevels, bool bQuiet )
+{
+	if ( nSkipMipLevels >= m_nMipCount )
+	{
+		if ( !bQuiet )
+		{
+			Warning("*** Tried to skip all the mip levels of a VTF file!\n");
+		}
+		return false;
+	}
+
+	// We're not reading the low-res image
+	m_nLowResImageWidth = m_nLowResImageHeight = 0;
+
+	return LoadImageData( buf, nSkipMipLevels, bQuiet );
+}
+
+
 //-----------------------------------------------------------------------------
 // Serialization of image data
 //-----------------------------------------------------------------------------